@@ -61,6 +61,20 @@ namespace
 		}
 	}
 
+	size_t get_sqlite_stmt_cache_size()
+	{
+		std::string stmt_cache_size_str = Server->getServerParameter("sqlite_stmt_cache_size");
+
+		if(!stmt_cache_size_str.empty())
+		{
+			return atoi(stmt_cache_size_str.c_str());
+		}
+		else
+		{
+			return 64;
+		}
+	}
+
 	void errorLogCallback(void *pArg, int iErrCode, const char *zMsg)
 	{
 		switch (iErrCode)
@@ -98,6 +112,11 @@ static void unlock_notify_cb(void **apArg, int nArg)
 	}
 }
 
+CDatabase::CDatabase()
+	: stmt_cache_hits(0), stmt_cache_misses(0)
+{
+}
+
 CDatabase::~CDatabase()
 {
 	destroyAllQueries();
@@ -108,6 +127,9 @@ CDatabase::~CDatabase()
 	}
 	prepared_queries.clear();
 
+	logStmtCacheStats();
+	clearStmtCache();
+
 	sqlite3_close(db);
 }
 
@@ -212,7 +234,7 @@ db_results CDatabase::Read(std::string pQuery)
 	if(q!=NULL)
 	{
 		db_results ret=q->Read();
-		delete ((CQuery*)q);
+		releaseQuery(static_cast<CQuery*>(q));
 		return ret;
 	}
 	return db_results();
@@ -225,7 +247,7 @@ bool CDatabase::Write(std::string pQuery)
 	if(q!=NULL)
 	{
 		bool b=q->Write();
-		delete ((CQuery*)q);
+		releaseQuery(static_cast<CQuery*>(q));
 		return b;
 	}
 	else
@@ -314,6 +336,23 @@ bool CDatabase::RollbackTransaction()
 
 IQuery* CDatabase::Prepare(std::string pQuery, bool autodestroy)
 {
+	CQuery** cached = stmt_cache.get(pQuery, false);
+	if(cached!=NULL)
+	{
+		CQuery *q=*cached;
+		stmt_cache.del(pQuery);
+		++stmt_cache_hits;
+
+		if( autodestroy )
+		{
+			queries.push_back(q);
+		}
+
+		return q;
+	}
+
+	++stmt_cache_misses;
+
 	IScopedReadLock lock(NULL);
 
 	if (!in_transaction && write_lock.get()==NULL)
@@ -438,13 +477,13 @@ void CDatabase::destroyQuery(IQuery *q)
 		if( queries[i]==q )
 		{
 			CQuery *cq=(CQuery*)q;
-			delete cq;
+			releaseQuery(cq);
 			queries.erase( queries.begin()+i);
 			return;
 		}
 	}
 	CQuery *cq=(CQuery*)q;
-	delete cq;
+	releaseQuery(cq);
 }
 
 void CDatabase::destroyAllQueries(void)
@@ -452,11 +491,51 @@ void CDatabase::destroyAllQueries(void)
 	for(size_t i=0;i<queries.size();++i)
 	{
 		CQuery *cq=(CQuery*)queries[i];
-		delete cq;
+		releaseQuery(cq);
 	}
 	queries.clear();
 }
 
+void CDatabase::releaseQuery(CQuery* q)
+{
+	static size_t stmt_cache_size = get_sqlite_stmt_cache_size();
+
+	std::string stmt_str = q->getStatement();
+
+	if(stmt_cache_size==0
+		|| stmt_cache.has_key(stmt_str)
+		|| !q->resetForReuse())
+	{
+		delete q;
+		return;
+	}
+
+	stmt_cache.put(stmt_str, q);
+
+	while(stmt_cache.size()>stmt_cache_size)
+	{
+		delete stmt_cache.evict_one().second;
+	}
+}
+
+void CDatabase::clearStmtCache()
+{
+	while(!stmt_cache.empty())
+	{
+		delete stmt_cache.evict_one().second;
+	}
+}
+
+void CDatabase::logStmtCacheStats()
+{
+	int64 total = stmt_cache_hits + stmt_cache_misses;
+	if(total>0)
+	{
+		Server->Log("Prepared statement cache: "+convert(stmt_cache_hits)+" hits, "+convert(stmt_cache_misses)+" misses ("
+			+convert(stmt_cache_hits*100/total)+"% hit rate)", LL_DEBUG);
+	}
+}
+
 _i64 CDatabase::getLastInsertID(void)
 {
 	return sqlite3_last_insert_rowid(db);
@@ -587,6 +666,8 @@ std::string CDatabase::getEngineName(void)
 
 void CDatabase::AttachDBs(void)
 {
+	clearStmtCache();
+
 	for(size_t i=0;i<attached_dbs.size();++i)
 	{
 		Write("ATTACH DATABASE '"+attached_dbs[i].first+"' AS "+attached_dbs[i].second);
@@ -595,6 +676,8 @@ void CDatabase::AttachDBs(void)
 
 void CDatabase::DetachDBs(void)
 {
+	clearStmtCache();
+
 	for(size_t i=0;i<attached_dbs.size();++i)
 	{
 		Write("DETACH DATABASE "+attached_dbs[i].second);
@@ -678,6 +761,9 @@ bool CDatabase::Backup(const std::string &pFile, IBackupProgress* progress)
 
 void CDatabase::freeMemory()
 {
+	logStmtCacheStats();
+	clearStmtCache();
+
 	sqlite3_db_release_memory(db);
 }
 
@@ -7,6 +7,7 @@
 #include "Interface/Mutex.h"
 #include "Interface/Condition.h"
 #include "Interface/SharedMutex.h"
+#include "common/lrucache.h"
 
 struct sqlite3;
 class CQuery;
@@ -16,6 +17,8 @@ const int c_sqlite_busy_timeout_default=10000; //10 seconds
 class CDatabase : public IDatabaseInt
 {
 public:
+	CDatabase();
+
 	bool Open(std::string pFile, const std::vector<std::pair<std::string,std::string> > &attach,
 		size_t allocation_chunk_size, ISharedMutex* single_user_mutex, IMutex* lock_mutex,
 		int* lock_count, ICondition *unlock_cond, const str_map& params);
@@ -75,12 +78,21 @@ private:
 	
 	bool backup_db(const std::string &pFile, const std::string &pDB, IBackupProgress* progress);
 
+	void releaseQuery(CQuery* q);
+	void clearStmtCache();
+	void logStmtCacheStats();
+
 	sqlite3 *db;
 	bool in_transaction;
 
 	std::vector<CQuery*> queries;
 	std::map<int, IQuery*> prepared_queries;
 
+	//Statements of destroyed queries by SQL text. Reused by Prepare
+	common::lrucache<std::string, CQuery*> stmt_cache;
+	int64 stmt_cache_hits;
+	int64 stmt_cache_misses;
+
 	IMutex* lock_mutex;
 	int* lock_count;
 	ICondition *unlock_cond;
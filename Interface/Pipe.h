@@ -7,6 +7,7 @@
 #include "Types.h"
 
 class IPipeThrottler;
+class IFsFile;
 
 class IPipe : public IObject
 {
@@ -44,6 +45,13 @@ public:
 	virtual void resetTransferedBytes(void)=0;
 
 	virtual _i64 getRealTransferredBytes() { return 0; }
+
+	/**
+	* Returns true if sendFile() can send file data directly from the
+	* page cache (e.g. via sendfile on a socket without throttling)
+	*/
+	virtual bool canSendFile() { return false; }
+	virtual bool sendFile(IFsFile* file, int64 offset, int64 size, int timeoutms=-1) { return false; }
 };
 
 #endif //IPIPE_H
@@ -97,6 +97,12 @@ public:
 	virtual void createThread(IThread *thread, const std::string& name=std::string())=0;
 	virtual void setCurrentThreadName(const std::string& name) = 0;
 	virtual IPipe *createMemoryPipe(void)=0;
+	/**
+	* Memory pipe with a ring of reusable message buffers with initial
+	* size ring_capacity. Cheaper than the default memory pipe for pipes
+	* with many small messages (e.g. read with Read(std::string*) in a loop)
+	*/
+	virtual IPipe *createMemoryPipe(size_t ring_capacity)=0;
 	virtual IThreadPool *getThreadPool(void)=0;
 	virtual ISettingsReader* createFileSettingsReader(const std::string& pFile)=0;
 	virtual ISettingsReader* createDBSettingsReader(THREAD_ID tid, DATABASE_ID pIdentifier, const std::string &pTable, const std::string &pSQL="")=0;
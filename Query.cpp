@@ -137,6 +137,20 @@ void CQuery::Reset(void)
 	curr_idx=1;
 }
 
+bool CQuery::resetForReuse()
+{
+	if(cursor!=NULL)
+	{
+		return false;
+	}
+
+	sqlite3_reset(ps);
+	sqlite3_clear_bindings(ps);
+	curr_idx=1;
+
+	return sqlite3_stmt_busy(ps)==0;
+}
+
 bool CQuery::Write(int timeoutms)
 {
 	IScopedReadLock lock(db->getSingleUseMutex());
@@ -41,6 +41,8 @@ public:
 
 	virtual void Reset(void);
 
+	bool resetForReuse();
+
 	virtual bool Write(int timeoutms=-1);
 	db_results Read(int *timeoutms=NULL);
 
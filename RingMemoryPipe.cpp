@@ -0,0 +1,224 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "RingMemoryPipe.h"
+#include "Server.h"
+#ifndef _WIN32
+#include <memory.h>
+#endif
+
+CRingMemoryPipe::CRingMemoryPipe(size_t capacity)
+	: ring(capacity>0 ? capacity : 1), head(0), count(0), waiting_readers(0), has_error(false)
+{
+	mutex=Server->createMutex();
+	cond=Server->createCondition();
+}
+
+CRingMemoryPipe::~CRingMemoryPipe(void)
+{
+	Server->destroy(mutex);
+	Server->destroy(cond);
+}
+
+std::string& CRingMemoryPipe::nextWriteSlot(void)
+{
+	if(count==ring.size())
+	{
+		std::vector<std::string> new_ring(ring.size()*2);
+		for(size_t i=0;i<count;++i)
+		{
+			new_ring[i].swap(ring[(head+i)%ring.size()]);
+		}
+		ring.swap(new_ring);
+		head=0;
+	}
+
+	return ring[(head+count)%ring.size()];
+}
+
+void CRingMemoryPipe::written(void)
+{
+	++count;
+
+	if(waiting_readers>0)
+	{
+		cond->notify_all();
+	}
+}
+
+bool CRingMemoryPipe::waitReadable(IScopedLock& lock, int timeoutms, bool fail_on_error)
+{
+	if(count==0 && timeoutms!=0)
+	{
+		++waiting_readers;
+
+		if(timeoutms>0)
+		{
+			int64 starttime=Server->getTimeMS();
+			int64 currtime=starttime;
+			while(count==0 && starttime+timeoutms>currtime && !has_error)
+			{
+				cond->wait(&lock, timeoutms-static_cast<int>(currtime-starttime));
+				if(count==0)
+				{
+					currtime=Server->getTimeMS();
+				}
+			}
+		}
+		else
+		{
+			while(count==0 && !has_error)
+			{
+				cond->wait(&lock);
+			}
+		}
+
+		--waiting_readers;
+	}
+
+	if(fail_on_error && timeoutms<0 && has_error)
+	{
+		return false;
+	}
+
+	return count>0;
+}
+
+size_t CRingMemoryPipe::Read(char *buffer, size_t bsize, int timeoutms)
+{
+	IScopedLock lock(mutex);
+
+	if(!waitReadable(lock, timeoutms, true))
+	{
+		return 0;
+	}
+
+	std::string& msg=ring[head];
+
+	size_t psize=msg.size();
+
+	if( psize<=bsize )
+	{
+		memcpy(buffer, msg.data(), psize);
+		head=(head+1)%ring.size();
+		--count;
+		return psize;
+	}
+	else
+	{
+		memcpy(buffer, msg.data(), bsize);
+		msg.erase(0, bsize);
+		return bsize;
+	}
+}
+
+bool CRingMemoryPipe::Write(const char *buffer, size_t bsize, int timeoutms, bool flush)
+{
+	IScopedLock lock(mutex);
+
+	nextWriteSlot().assign(buffer, bsize);
+	written();
+
+	return true;
+}
+
+size_t CRingMemoryPipe::Read(std::string *str, int timeoutms)
+{
+	IScopedLock lock(mutex);
+
+	if(!waitReadable(lock, timeoutms, true))
+	{
+		return 0;
+	}
+
+	//The slot keeps the previous buffer of the reader for the next message
+	str->swap(ring[head]);
+	head=(head+1)%ring.size();
+	--count;
+
+	return str->size();
+}
+
+bool CRingMemoryPipe::Write(const std::string &str, int timeoutms, bool flush)
+{
+	IScopedLock lock(mutex);
+
+	nextWriteSlot().assign(str);
+	written();
+
+	return true;
+}
+
+bool CRingMemoryPipe::isWritable(int timeoutms)
+{
+	return true;
+}
+
+bool CRingMemoryPipe::isReadable(int timeoutms)
+{
+	IScopedLock lock(mutex);
+	return waitReadable(lock, timeoutms, false);
+}
+
+bool CRingMemoryPipe::hasError(void)
+{
+	IScopedLock lock(mutex);
+	return has_error;
+}
+
+size_t CRingMemoryPipe::getNumElements(void)
+{
+	IScopedLock lock(mutex);
+	return count;
+}
+
+void CRingMemoryPipe::shutdown(void)
+{
+	IScopedLock lock(mutex);
+	has_error=true;
+	cond->notify_all();
+}
+
+void CRingMemoryPipe::addThrottler(IPipeThrottler *throttler)
+{
+
+}
+
+void CRingMemoryPipe::addOutgoingThrottler(IPipeThrottler *throttler)
+{
+
+}
+
+void CRingMemoryPipe::addIncomingThrottler(IPipeThrottler *throttler)
+{
+
+}
+
+_i64 CRingMemoryPipe::getTransferedBytes(void)
+{
+	return 0;
+}
+
+void CRingMemoryPipe::resetTransferedBytes(void)
+{
+}
+
+bool CRingMemoryPipe::Flush( int timeoutms/*=-1 */ )
+{
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef RINGMEMPIPE_H_
+#define RINGMEMPIPE_H_
+
+#include "Interface/Pipe.h"
+#include <vector>
+#include <string>
+#include "Interface/Mutex.h"
+#include "Interface/Condition.h"
+
+/**
+* Memory pipe which keeps the messages in a ring of message buffers.
+* The buffers are reused: Read(std::string*) swaps the message with the
+* caller's string, so the next message written into the slot reuses the
+* reader's previous buffer. The reader is only woken up if it waits for
+* a message. The ring grows if it is full, so writes never block.
+*/
+class CRingMemoryPipe : public IPipe
+{
+public:
+	CRingMemoryPipe(size_t capacity);
+	~CRingMemoryPipe(void);
+
+	virtual size_t Read(char *buffer, size_t bsize, int timeoutms);
+	virtual bool Write(const char *buffer, size_t bsize, int timeoutms, bool flush);
+	virtual size_t Read(std::string *ret, int timeoutms);
+	virtual bool Write(const std::string &str, int timeoutms, bool flush);
+
+	virtual bool isWritable(int timeoutms);
+	virtual bool isReadable(int timeoutms);
+
+	virtual bool hasError(void);
+
+	virtual void shutdown(void);
+
+	virtual size_t getNumElements(void);
+
+	virtual void addThrottler(IPipeThrottler *throttler);
+	virtual void addOutgoingThrottler(IPipeThrottler *throttler);
+	virtual void addIncomingThrottler(IPipeThrottler *throttler);
+
+	virtual _i64 getTransferedBytes(void);
+	virtual void resetTransferedBytes(void);
+
+	virtual bool Flush( int timeoutms=-1 );
+
+private:
+	std::string& nextWriteSlot(void);
+	void written(void);
+	bool waitReadable(IScopedLock& lock, int timeoutms, bool fail_on_error);
+
+	std::vector<std::string> ring;
+	size_t head;
+	size_t count;
+
+	IMutex *mutex;
+	ICondition *cond;
+	size_t waiting_readers;
+
+	bool has_error;
+};
+
+#endif /*RINGMEMPIPE_H_*/
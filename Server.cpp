@@ -51,6 +51,7 @@
 #include "file.h"
 #include "utf8/utf8.h"
 #include "MemoryPipe.h"
+#include "RingMemoryPipe.h"
 #include "MemorySettingsReader.h"
 #include "Database.h"
 #include "SQLiteFactory.h"
@@ -1299,6 +1300,11 @@ IPipe *CServer::createMemoryPipe(void)
 	return new CMemoryPipe;
 }
 
+IPipe *CServer::createMemoryPipe(size_t ring_capacity)
+{
+	return new CRingMemoryPipe(ring_capacity);
+}
+
 #ifdef _WIN32
 void thread_helper_f(IThread *t, const std::string& name)
 {
@@ -102,6 +102,7 @@ public:
 	virtual ISharedMutex* createSharedMutex();
 	virtual ICondition* createCondition(void);
 	virtual IPipe *createMemoryPipe(void);
+	virtual IPipe *createMemoryPipe(size_t ring_capacity);
 	virtual void createThread(IThread *thread, const std::string& name = std::string());
 	virtual void setCurrentThreadName(const std::string& name);
 	virtual IThreadPool *getThreadPool(void);
@@ -24,9 +24,14 @@
 #include <memory.h>
 #include <errno.h>
 #endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include "Server.h"
 #include "Interface/PipeThrottler.h"
+#include "Interface/File.h"
 #include "stringtools.h"
+#include <algorithm>
 
 CStreamPipe::CStreamPipe( SOCKET pSocket)
 	: transfered_bytes(0)
@@ -337,3 +342,57 @@ bool CStreamPipe::Flush( int timeoutms/*=-1 */ )
 {
 	return true;
 }
+
+bool CStreamPipe::canSendFile()
+{
+#ifdef __linux__
+	return outgoing_throttlers.empty();
+#else
+	return false;
+#endif
+}
+
+bool CStreamPipe::sendFile(IFsFile* file, int64 offset, int64 size, int timeoutms)
+{
+#ifdef __linux__
+	int fd = file->getOsHandle();
+	off_t off = static_cast<off_t>(offset);
+	int64 remaining = size;
+
+	while(remaining>0)
+	{
+		int rc = selectSocketWrite(s, timeoutms);
+		if(rc<=0)
+		{
+			if(rc<0)
+			{
+				has_error=true;
+			}
+			return false;
+		}
+
+		ssize_t sent = ::sendfile(s, fd, &off, static_cast<size_t>((std::min)(remaining, static_cast<int64>(1024*1024))));
+		if(sent<0)
+		{
+			if(errno==EINTR || errno==EAGAIN || errno==EWOULDBLOCK)
+			{
+				continue;
+			}
+
+			has_error=true;
+			return false;
+		}
+		else if(sent==0)
+		{
+			return false;
+		}
+
+		transfered_bytes+=sent;
+		remaining-=sent;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
@@ -33,6 +33,9 @@ public:
 
 	virtual bool Flush( int timeoutms=-1 );
 
+	virtual bool canSendFile();
+	virtual bool sendFile(IFsFile* file, int64 offset, int64 size, int timeoutms);
+
 private:
 	SOCKET s;
 	bool doThrottle(size_t new_bytes, bool outgoing, bool wait);
@@ -46,7 +46,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "HashReadPipeline.h"
 #endif
+#include "ChunkHashCache.h"
 #include <assert.h>
 
 #if defined(__APPLE__) || defined(__FreeBSD__)
@@ -192,6 +194,7 @@ void CClientThread::operator()(void)
 						Server->destroy(next_chunks.front().update_file);
 					}
 					delete next_chunks.front().pipe_file_user;
+					delete next_chunks.front().chunk_hash_cache;
 				}
 
 				next_chunks.pop();
@@ -1058,6 +1061,21 @@ bool CClientThread::ProcessPacket(CRData *data)
 					break;
 				}
 				
+				//Starting the reader and hasher threads does not pay off for files
+				//with only one checkpoint
+				if( with_hashes
+					&& filesize - start_offset > c_checkpoint_dist )
+				{
+					bool b = sendFileHashed(start_offset, filesize, file_extents, o_filename, filename);
+					CloseHandle(hFile);
+					hFile=INVALID_HANDLE_VALUE;
+					if(!b)
+					{
+						return false;
+					}
+					break;
+				}
+
 				off64_t foffset=start_offset;
 
 				unsigned int s_bsize=8192;
@@ -1278,6 +1296,13 @@ bool CClientThread::ProcessPacket(CRData *data)
 					return false;
 				}
 			} break;
+		case ID_GET_FILE_BATCH:
+			{
+				if(!GetFileBatch(data))
+				{
+					return false;
+				}
+			} break;
 		case ID_SCRIPT_FINISH:
 			{
 				if(!FinishScript(data))
@@ -1766,6 +1791,7 @@ bool CClientThread::GetFileBlockdiff(CRData *data, bool with_metadata)
 	std::auto_ptr<ScopedPipeFileUser> pipe_file_user;
 	IFile* srv_file = NULL;
 	IFileServ::CbtHashFileInfo cbt_hash_file_info;
+	std::auto_ptr<ChunkHashCache> chunk_hash_cache;
 	IFileServ::IMetadataCallback* metadata_callback = NULL;
 	if(is_script)
 	{
@@ -1898,6 +1924,13 @@ bool CClientThread::GetFileBlockdiff(CRData *data, bool with_metadata)
 					cbt_hash_file_info.metadata_size = length;
 				}
 			}
+
+#ifndef _WIN32
+			if (cbt_hash_file_info.cbt_hash_file == NULL)
+			{
+				chunk_hash_cache.reset(ChunkHashCache::create(hFile, o_filename, curr_filesize));
+			}
+#endif
 		}
 	}
 	else
@@ -1937,6 +1970,7 @@ bool CClientThread::GetFileBlockdiff(CRData *data, bool with_metadata)
 	chunk.with_sparse = is_script ? false : with_sparse;
 	chunk.s_filename = s_filename;
 	chunk.cbt_hash_file_info = cbt_hash_file_info;
+	chunk.chunk_hash_cache = chunk_hash_cache.release();
 	pipe_file_user.release();
 
 	hFile=INVALID_HANDLE_VALUE;
@@ -2324,6 +2358,61 @@ bool CClientThread::sendFullFile(IFile* file, _i64 start_offset, bool with_hashe
 	return curr_filesize!=-1;
 }
 
+#ifndef _WIN32
+bool CClientThread::sendFileHashed(_i64 start_offset, _i64 filesize, const std::vector<SExtent>& file_extents, const std::string& o_filename, const std::string& filename)
+{
+	HashReadPipeline pipeline(hFile, start_offset, filesize, file_extents);
+	pipeline.start();
+
+	while(true)
+	{
+		HashReadPipeline::SBlock* block = pipeline.getBlock();
+
+		if(block==NULL)
+		{
+			return false;
+		}
+
+		if(block->last && pipeline.getReadErrno()!=0)
+		{
+			int err = pipeline.getReadErrno();
+			Log("Error: Reading from file failed. Errno: " + convert(err), LL_DEBUG);
+			FileServ::callErrorCallback(o_filename, filename, pipeline.getReadErrorOffset(), "code: " + convert(err));
+			return false;
+		}
+
+		if(block->size>0)
+		{
+			int rc = SendInt(block->buf.data(), block->size);
+			if (rc == SOCKET_ERROR)
+			{
+				Log("Error: Sending data failed");
+				return false;
+			}
+		}
+
+		if(block->checkpoint)
+		{
+			SendInt(block->digest, 16);
+		}
+
+		bool last = block->last;
+
+		pipeline.releaseBlock();
+
+		if(last)
+		{
+			return true;
+		}
+
+		if(FileServ::isPause() )
+		{
+			Sleep(500);
+		}
+	}
+}
+#endif
+
 bool CClientThread::InformMetadataStreamEnd( CRData * data )
 {
 #ifdef CHECK_IDENT
@@ -2357,6 +2446,80 @@ bool CClientThread::InformMetadataStreamEnd( CRData * data )
 	return true;
 }
 
+bool CClientThread::GetFileBatch( CRData * data )
+{
+	std::string ident;
+	if(!data->getStr(&ident))
+	{
+		return false;
+	}
+
+#ifdef CHECK_IDENT
+	if(!FileServ::checkIdentity(ident))
+	{
+		Log("Identity check failed -batch", LL_DEBUG);
+		return false;
+	}
+#endif
+
+	char c_version;
+	if(!data->getChar(&c_version)
+		|| c_version!=0)
+	{
+		return false;
+	}
+
+	char c_with_hash;
+	char c_with_sparse;
+	int64 n_files;
+	if(!data->getChar(&c_with_hash)
+		|| !data->getChar(&c_with_sparse)
+		|| !data->getVarInt(&n_files) )
+	{
+		return false;
+	}
+
+	Log("Sending batch of "+convert(n_files)+" files", LL_DEBUG);
+
+	//Every entry is answered exactly like a single ID_GET_FILE_WITH_METADATA request,
+	//the file names are prefix compressed against the previous entry
+	std::string s_filename;
+	for(int64 i=0;i<n_files && !stopped;++i)
+	{
+		int64 prefix_len;
+		std::string suffix;
+		int64 metadata_id;
+		if(!data->getVarInt(&prefix_len)
+			|| !data->getStr(&suffix)
+			|| !data->getVarInt(&metadata_id)
+			|| prefix_len<0
+			|| static_cast<size_t>(prefix_len)>s_filename.size() )
+		{
+			Log("Error parsing file batch", LL_ERROR);
+			return false;
+		}
+
+		s_filename = s_filename.substr(0, static_cast<size_t>(prefix_len)) + suffix;
+
+		CWData file_req;
+		file_req.addUChar(ID_GET_FILE_WITH_METADATA);
+		file_req.addString(s_filename);
+		file_req.addString(ident);
+		file_req.addChar(0);
+		file_req.addChar(c_with_hash);
+		file_req.addVarInt(metadata_id);
+		file_req.addChar(c_with_sparse);
+
+		CRData file_req_data(file_req.getDataPtr(), file_req.getDataSize());
+		if(!ProcessPacket(&file_req_data))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 bool CClientThread::FinishScript( CRData * data )
 {
 #ifdef CHECK_IDENT
@@ -1,3 +1,5 @@
+#pragma once
+
 #pragma warning ( disable:4005 )
 #pragma warning ( disable:4996 )
 
@@ -31,6 +33,7 @@ class IFsFile;
 class IMutex;
 class ICondition;
 class ScopedPipeFileUser;
+class ChunkHashCache;
 
 #include "chunk_settings.h"
 #include "packet_ids.h"
@@ -50,13 +53,13 @@ struct SSendData
 struct SChunk
 {
 	SChunk()
-		: msg(ID_ILLEGAL), update_file(NULL), pipe_file_user(NULL), cbt_hash_file_info()
+		: msg(ID_ILLEGAL), update_file(NULL), pipe_file_user(NULL), cbt_hash_file_info(), chunk_hash_cache(NULL)
 	{
 
 	}
 
 	explicit SChunk(char msg)
-		: msg(msg), update_file(NULL), pipe_file_user(NULL), cbt_hash_file_info()
+		: msg(msg), update_file(NULL), pipe_file_user(NULL), cbt_hash_file_info(), chunk_hash_cache(NULL)
 	{
 
 	}
@@ -73,6 +76,7 @@ struct SChunk
 	bool with_sparse;
 	std::string s_filename;
 	IFileServ::CbtHashFileInfo cbt_hash_file_info;
+	ChunkHashCache* chunk_hash_cache;
 };
 
 struct SLPData
@@ -117,25 +121,6 @@ public:
 	bool getNextChunk(SChunk *chunk, bool has_error);
 
 	static std::string getDummyMetadata(std::string output_fn, int64 folder_items, int64 metadata_id, bool is_dir);
-private:
-
-	bool sendFullFile(IFile* file, _i64 start_offset, bool with_hashes);
-
-	bool RecvMessage();
-	bool ProcessPacket(CRData *data);
-	bool ReadFilePart(HANDLE hFile, _i64 offset, bool last, _u32 toread);
-	int SendData();
-	void ReleaseMemory(void);
-	void CloseThread(HANDLE hFile);
-
-	bool GetFileBlockdiff(CRData *data, bool with_metadata);
-	bool Handle_ID_BLOCK_REQUEST(CRData *data);
-
-	bool GetFileHashAndMetadata(CRData* data);
-
-	void queueChunk(const SChunk& chunk);
-	bool InformMetadataStreamEnd( CRData * data );
-	bool FinishScript( CRData * data );
 
 	struct SExtent
 	{
@@ -158,6 +143,29 @@ private:
 		int64 size;
 	};
 
+private:
+
+	bool sendFullFile(IFile* file, _i64 start_offset, bool with_hashes);
+	bool sendFileHashed(_i64 start_offset, _i64 filesize, const std::vector<SExtent>& file_extents, const std::string& o_filename, const std::string& filename);
+
+	bool RecvMessage();
+	bool ProcessPacket(CRData *data);
+	bool ReadFilePart(HANDLE hFile, _i64 offset, bool last, _u32 toread);
+	int SendData();
+	void ReleaseMemory(void);
+	void CloseThread(HANDLE hFile);
+
+	bool GetFileBlockdiff(CRData *data, bool with_metadata);
+	bool Handle_ID_BLOCK_REQUEST(CRData *data);
+
+	bool GetFileHashAndMetadata(CRData* data);
+
+	void queueChunk(const SChunk& chunk);
+	bool InformMetadataStreamEnd( CRData * data );
+
+	bool GetFileBatch( CRData * data );
+	bool FinishScript( CRData * data );
+
 	int64 getFileExtents(int64 fsize, int64& n_sparse_extents, std::vector<SExtent>& file_extents, bool& has_file_extents, int64& start_offset);
 
 	bool sendExtents(const std::vector<SExtent>& file_extents, int64 fsize, int64 n_sparse_extents);
@@ -0,0 +1,452 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ChunkHashCache.h"
+#include "chunk_settings.h"
+#include "log.h"
+#include "../Interface/Server.h"
+#include "../Interface/File.h"
+#include "../Interface/Mutex.h"
+#include "../stringtools.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../md5.h"
+#include <algorithm>
+#include <memory.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/vfs.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/fs.h>
+
+#define BTRFS_IOCTL_MAGIC 0x94
+#define BTRFS_SUPER_MAGIC 0x9123683E
+#define BTRFS_EXTENT_DATA_KEY 108
+#define BTRFS_FILE_EXTENT_INLINE 0
+#define BTRFS_FILE_EXTENT_PREALLOC 2
+
+#ifndef FS_NOCOW_FL
+#define FS_NOCOW_FL 0x00800000
+#endif
+
+namespace
+{
+	struct btrfs_ioctl_search_key
+	{
+		uint64 tree_id;
+		uint64 min_objectid;
+		uint64 max_objectid;
+		uint64 min_offset;
+		uint64 max_offset;
+		uint64 min_transid;
+		uint64 max_transid;
+		_u32 min_type;
+		_u32 max_type;
+		_u32 nr_items;
+		_u32 unused;
+		uint64 unused1;
+		uint64 unused2;
+		uint64 unused3;
+		uint64 unused4;
+	};
+
+	struct btrfs_ioctl_search_header
+	{
+		uint64 transid;
+		uint64 objectid;
+		uint64 offset;
+		_u32 type;
+		_u32 len;
+	};
+
+	struct btrfs_ioctl_search_args
+	{
+		btrfs_ioctl_search_key key;
+		char buf[4096 - sizeof(btrfs_ioctl_search_key)];
+	};
+
+	struct btrfs_ioctl_fs_info_args
+	{
+		uint64 max_id;
+		uint64 num_devices;
+		unsigned char fsid[16];
+		unsigned char reserved[1024 - 32];
+	};
+
+#define BTRFS_IOC_TREE_SEARCH _IOWR(BTRFS_IOCTL_MAGIC, 17, btrfs_ioctl_search_args)
+#define BTRFS_IOC_FS_INFO _IOR(BTRFS_IOCTL_MAGIC, 31, btrfs_ioctl_fs_info_args)
+
+	//Offsets in struct btrfs_file_extent_item
+	const size_t extent_item_type_off = 20;
+	const size_t extent_item_inline_size = 21;
+	const size_t extent_item_size = 53;
+	const size_t extent_item_num_bytes_off = 45;
+	const size_t extent_item_ram_bytes_off = 8;
+}
+#endif //__linux__
+
+namespace
+{
+	const char cache_magic[] = "URBCHC01";
+	const int64 cache_header_size = sizeof(cache_magic) - 1;
+	const int64 cache_entry_size = big_hash_size + chunkhash_single_size;
+	const int64 min_cache_file_size = 64 * 1024 * 1024;
+	const int64 cache_max_age_s = 30 * 24 * 60 * 60;
+	const int64 cache_prune_interval_s = 24 * 60 * 60;
+
+	uint64 read_le64(const char* ptr)
+	{
+		uint64 ret;
+		memcpy(&ret, ptr, sizeof(ret));
+		return little_endian(ret);
+	}
+}
+
+IMutex* ChunkHashCache::mutex = NULL;
+int64 ChunkHashCache::last_prune = 0;
+
+void ChunkHashCache::init()
+{
+	mutex = Server->createMutex();
+}
+
+ChunkHashCache* ChunkHashCache::create(int fd, const std::string& key_fn, int64 filesize)
+{
+#ifdef __linux__
+	if (filesize < min_cache_file_size
+		|| Server->getServerParameter("chunk_hash_cache") == "false")
+	{
+		return NULL;
+	}
+
+	struct statfs fs_stat;
+	if (fstatfs(fd, &fs_stat) != 0
+		|| fs_stat.f_type != BTRFS_SUPER_MAGIC)
+	{
+		return NULL;
+	}
+
+	int attr_flags = 0;
+	if (ioctl(fd, FS_IOC_GETFLAGS, &attr_flags) != 0
+		|| (attr_flags & FS_NOCOW_FL) != 0)
+	{
+		//Data of nocow files is overwritten without new extents
+		return NULL;
+	}
+
+	btrfs_ioctl_fs_info_args fs_info = {};
+	if (ioctl(fd, BTRFS_IOC_FS_INFO, &fs_info) != 0)
+	{
+		return NULL;
+	}
+
+	struct stat64 stat_buf;
+	if (fstat64(fd, &stat_buf) != 0)
+	{
+		return NULL;
+	}
+
+	//Extent items only show written data
+	fdatasync(fd);
+
+	std::vector<SExtentItem> extent_items;
+
+	btrfs_ioctl_search_args search_args = {};
+	search_args.key.tree_id = 0;
+	search_args.key.min_objectid = stat_buf.st_ino;
+	search_args.key.max_objectid = stat_buf.st_ino;
+	search_args.key.min_type = BTRFS_EXTENT_DATA_KEY;
+	search_args.key.max_type = BTRFS_EXTENT_DATA_KEY;
+	search_args.key.min_offset = 0;
+	search_args.key.max_offset = static_cast<uint64>(-1);
+	search_args.key.min_transid = 0;
+	search_args.key.max_transid = static_cast<uint64>(-1);
+
+	while (true)
+	{
+		search_args.key.nr_items = 4096;
+
+		if (ioctl(fd, BTRFS_IOC_TREE_SEARCH, &search_args) != 0)
+		{
+			Log("Searching btrfs extent items failed. Errno: " + convert(errno), LL_DEBUG);
+			return NULL;
+		}
+
+		if (search_args.key.nr_items == 0)
+		{
+			break;
+		}
+
+		size_t buf_pos = 0;
+		uint64 last_offset = 0;
+		for (_u32 i = 0; i < search_args.key.nr_items; ++i)
+		{
+			btrfs_ioctl_search_header sh;
+			memcpy(&sh, search_args.buf + buf_pos, sizeof(sh));
+			buf_pos += sizeof(sh);
+
+			const char* item = search_args.buf + buf_pos;
+			buf_pos += sh.len;
+			last_offset = sh.offset;
+
+			if (sh.objectid != static_cast<uint64>(stat_buf.st_ino)
+				|| sh.type != BTRFS_EXTENT_DATA_KEY
+				|| sh.len < extent_item_inline_size)
+			{
+				continue;
+			}
+
+			SExtentItem extent_item;
+			extent_item.offset = static_cast<int64>(sh.offset);
+			extent_item.prealloc = item[extent_item_type_off] == BTRFS_FILE_EXTENT_PREALLOC;
+
+			if (item[extent_item_type_off] == BTRFS_FILE_EXTENT_INLINE)
+			{
+				extent_item.end = extent_item.offset + static_cast<int64>(read_le64(item + extent_item_ram_bytes_off));
+				extent_item.data.assign(item, extent_item_inline_size);
+			}
+			else if (sh.len >= extent_item_size)
+			{
+				extent_item.end = extent_item.offset + static_cast<int64>(read_le64(item + extent_item_num_bytes_off));
+				extent_item.data.assign(item, extent_item_size);
+			}
+			else
+			{
+				continue;
+			}
+
+			uint64 le_offset = little_endian(sh.offset);
+			extent_item.data.insert(0, reinterpret_cast<char*>(&le_offset), sizeof(le_offset));
+
+			extent_items.push_back(extent_item);
+		}
+
+		if (last_offset == static_cast<uint64>(-1))
+		{
+			break;
+		}
+
+		search_args.key.min_offset = last_offset + 1;
+	}
+
+	std::sort(extent_items.begin(), extent_items.end());
+
+	std::string cache_root = Server->getServerWorkingDir() + os_file_sep() + "urbackup" + os_file_sep() + "chunk_hash_cache";
+
+	prune(cache_root);
+
+	std::string cache_dir = cache_root + os_file_sep() + bytesToHex(fs_info.fsid, sizeof(fs_info.fsid));
+
+	if (!os_directory_exists(cache_dir)
+		&& !os_create_dir_recursive(cache_dir))
+	{
+		Log("Error creating chunk hash cache directory \"" + cache_dir + "\". " + os_last_error_str(), LL_WARNING);
+		return NULL;
+	}
+
+	//Inode numbers are per subvolume
+	std::string cache_fn = cache_dir + os_file_sep() + convert(static_cast<int64>(stat_buf.st_ino)) + "_" + Server->GenerateHexMD5(key_fn);
+
+	IFsFile* cache_file = Server->openFile(cache_fn, MODE_RW_CREATE);
+	if (cache_file == NULL)
+	{
+		Log("Error opening chunk hash cache file \"" + cache_fn + "\". " + os_last_error_str(), LL_WARNING);
+		return NULL;
+	}
+
+	std::string magic = cache_file->Read(static_cast<int64>(0), static_cast<_u32>(cache_header_size));
+	if (magic != std::string(cache_magic, cache_header_size)
+		&& !cache_file->Resize(0))
+	{
+		Server->destroy(cache_file);
+		return NULL;
+	}
+
+	//Also updates the modification time used by prune()
+	if (cache_file->Write(0, cache_magic, static_cast<_u32>(cache_header_size)) != cache_header_size)
+	{
+		Server->destroy(cache_file);
+		return NULL;
+	}
+
+	return new ChunkHashCache(cache_file, extent_items);
+#else
+	return NULL;
+#endif
+}
+
+void ChunkHashCache::prune(const std::string& cache_root)
+{
+	int64 ctime = Server->getTimeSeconds();
+	{
+		IScopedLock lock(mutex);
+		if (last_prune != 0
+			&& ctime - last_prune < cache_prune_interval_s)
+		{
+			return;
+		}
+		last_prune = ctime;
+	}
+
+	//Removes caches of deleted or replaced files, which are not used anymore
+	std::vector<SFile> fs_dirs = getFiles(cache_root);
+	for (size_t i = 0; i < fs_dirs.size(); ++i)
+	{
+		if (!fs_dirs[i].isdir)
+		{
+			continue;
+		}
+
+		std::string fs_dir = cache_root + os_file_sep() + fs_dirs[i].name;
+		std::vector<SFile> cache_files = getFiles(fs_dir);
+		size_t n_removed = 0;
+		for (size_t j = 0; j < cache_files.size(); ++j)
+		{
+			if (!cache_files[j].isdir
+				&& ctime - cache_files[j].last_modified > cache_max_age_s)
+			{
+				if (Server->deleteFile(fs_dir + os_file_sep() + cache_files[j].name))
+				{
+					++n_removed;
+				}
+				else
+				{
+					Log("Error deleting old chunk hash cache file \"" + fs_dir + os_file_sep() + cache_files[j].name + "\". " + os_last_error_str(), LL_WARNING);
+				}
+			}
+		}
+
+		if (n_removed > 0)
+		{
+			Log("Removed " + convert(n_removed) + " unused chunk hash cache files from \"" + fs_dir + "\"", LL_DEBUG);
+
+			if (n_removed == cache_files.size())
+			{
+				os_remove_dir(fs_dir);
+			}
+		}
+	}
+}
+
+ChunkHashCache::ChunkHashCache(IFile* cache_file, std::vector<SExtentItem>& p_extent_items)
+	: cache_file(cache_file)
+{
+	extent_items.swap(p_extent_items);
+}
+
+ChunkHashCache::~ChunkHashCache()
+{
+	Server->destroy(cache_file);
+}
+
+bool ChunkHashCache::getChunkHash(int64 pos, char* chunkhash)
+{
+	if (pos % c_checkpoint_dist != 0)
+	{
+		return false;
+	}
+
+	std::string sig;
+	if (!extentSignature(pos, sig))
+	{
+		return false;
+	}
+
+	char entry[cache_entry_size];
+	{
+		IScopedLock lock(mutex);
+		if (cache_file->Read(cache_header_size + (pos / c_checkpoint_dist)*cache_entry_size, entry, cache_entry_size) != cache_entry_size)
+		{
+			return false;
+		}
+	}
+
+	//Also detects partially written entries
+	if (entryCheck(sig, entry + big_hash_size) != std::string(entry, big_hash_size))
+	{
+		return false;
+	}
+
+	memcpy(chunkhash, entry + big_hash_size, chunkhash_single_size);
+	return true;
+}
+
+void ChunkHashCache::putChunkHash(int64 pos, const char* chunkhash)
+{
+	if (pos % c_checkpoint_dist != 0)
+	{
+		return;
+	}
+
+	std::string sig;
+	if (!extentSignature(pos, sig))
+	{
+		return;
+	}
+
+	char entry[cache_entry_size];
+	memcpy(entry, entryCheck(sig, chunkhash).data(), big_hash_size);
+	memcpy(entry + big_hash_size, chunkhash, chunkhash_single_size);
+
+	IScopedLock lock(mutex);
+	cache_file->Write(cache_header_size + (pos / c_checkpoint_dist)*cache_entry_size, entry, cache_entry_size);
+}
+
+bool ChunkHashCache::extentSignature(int64 pos, std::string& sig)
+{
+	int64 end = pos + c_checkpoint_dist;
+
+	SExtentItem key;
+	key.offset = pos;
+	std::vector<SExtentItem>::iterator it = std::upper_bound(extent_items.begin(), extent_items.end(), key);
+	if (it != extent_items.begin())
+	{
+		--it;
+	}
+
+	for (; it != extent_items.end() && it->offset < end; ++it)
+	{
+		if (it->end <= pos)
+		{
+			continue;
+		}
+
+		if (it->prealloc)
+		{
+			//Writing to preallocated extents does not relocate them
+			return false;
+		}
+
+		sig += it->data;
+	}
+
+	sig += std::string(reinterpret_cast<char*>(&pos), sizeof(pos));
+
+	return true;
+}
+
+std::string ChunkHashCache::entryCheck(const std::string& sig, const char* chunkhash)
+{
+	MD5 md5;
+	md5.update(reinterpret_cast<unsigned char*>(const_cast<char*>(sig.data())), static_cast<unsigned int>(sig.size()));
+	md5.update(reinterpret_cast<unsigned char*>(const_cast<char*>(chunkhash)), chunkhash_single_size);
+	md5.finalize();
+	return std::string(reinterpret_cast<char*>(md5.raw_digest_int()), big_hash_size);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include <string>
+#include <vector>
+
+class IFile;
+class IMutex;
+
+/**
+* Persisted chunk hashes of large files for clients without change block
+* tracking driver (Linux). The hashes of a chunk are only returned if the
+* file extents of the chunk (physical location and btrfs generation) are
+* the same as when the hashes were stored, so only changed chunks have to
+* be read and hashed again. Only available on btrfs, because on other
+* file systems data can be overwritten in place without changing the
+* extent mapping. Cache files not used for 30 days are removed.
+*/
+class ChunkHashCache
+{
+public:
+	static void init();
+
+	//Returns NULL if the file system does not support it
+	static ChunkHashCache* create(int fd, const std::string& key_fn, int64 filesize);
+
+	~ChunkHashCache();
+
+	bool getChunkHash(int64 pos, char* chunkhash);
+	void putChunkHash(int64 pos, const char* chunkhash);
+
+private:
+	struct SExtentItem
+	{
+		int64 offset;
+		int64 end;
+		bool prealloc;
+		std::string data;
+
+		bool operator<(const SExtentItem& other) const
+		{
+			return offset < other.offset;
+		}
+	};
+
+	ChunkHashCache(IFile* cache_file, std::vector<SExtentItem>& extent_items);
+
+	static void prune(const std::string& cache_root);
+
+	bool extentSignature(int64 pos, std::string& sig);
+	std::string entryCheck(const std::string& sig, const char* chunkhash);
+
+	IFile* cache_file;
+	std::vector<SExtentItem> extent_items;
+
+	static IMutex* mutex;
+	static int64 last_prune;
+};
@@ -33,6 +33,7 @@
 #include <errno.h>
 #endif
 #include "PipeSessions.h"
+#include "ChunkHashCache.h"
 
 namespace
 {
@@ -106,6 +107,8 @@ void ChunkSendThread::operator()(void)
 				cbt_hash_file_info.cbt_hash_file = NULL;
 			}
 
+			chunk_hash_cache.reset();
+
 			file_extents.clear();
 		}
 		else if (chunk.msg == ID_FLUSH_SOCKET)
@@ -137,6 +140,7 @@ void ChunkSendThread::operator()(void)
 			curr_hash_size=chunk.hashsize;
 			curr_file_size=chunk.startpos;
 			cbt_hash_file_info = chunk.cbt_hash_file_info;
+			chunk_hash_cache.reset(chunk.chunk_hash_cache);
 			pipe_file_user.reset(chunk.pipe_file_user);
 			file_extents.clear();
 			has_more_extents = true;
@@ -230,6 +234,8 @@ void ChunkSendThread::operator()(void)
 		cbt_hash_file_info.cbt_hash_file = NULL;
 	}
 
+	chunk_hash_cache.reset();
+
 	delete this;
 }
 
@@ -392,7 +398,17 @@ bool ChunkSendThread::sendChunk(SChunk *chunk)
 	int64 index_chunkhash_pos = -1;
 	_u16 index_chunkhash_pos_offset;
 
-	if (cbt_hash_file_info.cbt_hash_file!=NULL
+	if (chunk_hash_cache.get() != NULL
+		&& curr_pos + c_checkpoint_dist <= curr_file_size)
+	{
+		char chunkhash[chunkhash_single_size];
+		if (chunk_hash_cache->getChunkHash(spos, chunkhash)
+			&& memcmp(chunkhash, chunk->big_hash, chunkhash_single_size) == 0)
+		{
+			cbt_unchanged = true;
+		}
+	}
+	else if (cbt_hash_file_info.cbt_hash_file!=NULL
 		&&  curr_pos+c_checkpoint_dist<=curr_file_size
 		&& (cbt_hash_file_info.metadata_offset!=-1
 			|| !file_extents.empty()
@@ -486,7 +502,8 @@ bool ChunkSendThread::sendChunk(SChunk *chunk)
 	}
 
 	std::vector<char> new_chunkhashes;
-	if (index_chunkhash_pos != -1)
+	if (index_chunkhash_pos != -1
+		|| (chunk_hash_cache.get() != NULL && !cbt_unchanged) )
 	{
 		new_chunkhashes.resize(sizeof(_u16) + chunkhash_single_size);
 	}
@@ -609,13 +626,20 @@ bool ChunkSendThread::sendChunk(SChunk *chunk)
 
 	md5_hash.finalize();
 
-	if (!new_chunkhashes.empty()
+	if (index_chunkhash_pos != -1
 		&& *cbt_hash_file_info.snapshot_sequence_id == cbt_hash_file_info.snapshot_sequence_id_reference)
 	{
 		memcpy(new_chunkhashes.data(), &index_chunkhash_pos_offset, sizeof(index_chunkhash_pos_offset));
 		memcpy(new_chunkhashes.data()+sizeof(_u16), md5_hash.raw_digest_int(), big_hash_size);
 		cbt_hash_file_info.cbt_hash_file->Write(index_chunkhash_pos, new_chunkhashes.data(), static_cast<_u32>(new_chunkhashes.size()));
 	}
+	else if (!new_chunkhashes.empty()
+		&& chunk_hash_cache.get() != NULL
+		&& read_total == c_checkpoint_dist)
+	{
+		memcpy(new_chunkhashes.data() + sizeof(_u16), md5_hash.raw_digest_int(), big_hash_size);
+		chunk_hash_cache->putChunkHash(chunk->startpos, new_chunkhashes.data() + sizeof(_u16));
+	}
 
 	if(!sent_update && !cbt_unchanged && memcmp(md5_hash.raw_digest_int(), chunk->big_hash, big_hash_size)!=0 )
 	{
@@ -8,6 +8,7 @@
 #include <memory>
 
 class ScopedPipeFileUser;
+class ChunkHashCache;
 class CClientThread;
 struct SChunk;
 
@@ -32,6 +33,7 @@ private:
 	_i64 curr_hash_size;
 	_i64 curr_file_size;
 	IFileServ::CbtHashFileInfo cbt_hash_file_info;
+	std::auto_ptr<ChunkHashCache> chunk_hash_cache;
 	std::vector<IFsFile::SFileExtent> file_extents;
 	bool has_more_extents;
 
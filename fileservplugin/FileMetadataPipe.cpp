@@ -59,7 +59,16 @@
 #endif
 
 const size_t metadata_id_size = 4+4+8+4;
+const size_t metadata_buffer_init_size = 4096;
+const size_t metadata_prefetch_threads = 4;
+const size_t metadata_prefetch_lookahead = 64;
 
+#ifndef _WIN32
+namespace
+{
+	bool collect_os_metadata(const std::string& local_fn, size_t max_stat_size, std::string& os_data);
+}
+#endif
 
 FileMetadataPipe::FileMetadataPipe( IPipe* pipe, const std::string& cmd )
 	: PipeFileBase(cmd), pipe(pipe),
@@ -68,18 +77,35 @@ FileMetadataPipe::FileMetadataPipe( IPipe* pipe, const std::string& cmd )
 	backup_read_state(-1),
 #else
 	backup_state(BackupState_StatInit),
+	prefetched_off(0),
 #endif
 	metadata_state(MetadataState_Wait),
 		errpipe(Server->createMemoryPipe()),
-	metadata_file(NULL)
+	metadata_file(NULL),
+	prefetch_mutex(Server->createMutex()),
+	prefetch_cond(Server->createCondition()),
+	prefetch_stop(false),
+	curr_prefetch(NULL)
 {
-	metadata_buffer.resize(4096);
+	metadata_buffer.resize(metadata_buffer_init_size);
 	init();
 }
 
 FileMetadataPipe::~FileMetadataPipe()
 {
 	assert(token_callback.get() == NULL);
+
+	stopPrefetch();
+
+	if (curr_prefetch != NULL)
+	{
+		freePrefetchItem(curr_prefetch);
+	}
+
+	for (size_t i = 0; i < prefetch_queue.size(); ++i)
+	{
+		freePrefetchItem(prefetch_queue[i]);
+	}
 }
 
 
@@ -175,7 +201,16 @@ bool FileMetadataPipe::readStdoutIntoBuffer( char* buf, size_t buf_avail, size_t
 	{
 		if(metadata_buffer_size==0)
 		{
-			SFile file_meta = getFileMetadata(os_file_prefix(local_fn));
+			SFile file_meta;
+			if(curr_prefetch!=NULL && curr_prefetch->prefetch)
+			{
+				file_meta = curr_prefetch->file_meta;
+			}
+			else
+			{
+				file_meta = getFileMetadata(os_file_prefix(local_fn));
+			}
+
 			if(file_meta.name.empty())
 			{
 				Server->Log("Error getting metadata (created and last modified time) of "+local_fn, LL_ERROR);
@@ -456,7 +491,7 @@ bool FileMetadataPipe::readStdoutIntoBuffer( char* buf, size_t buf_avail, size_t
 	while(true)
 	{
 		std::string msg;
-		size_t r = pipe->Read(&msg, 60000);
+		size_t r = readPipeMsg(msg);
 
 		if(r==0)
 		{
@@ -503,7 +538,15 @@ bool FileMetadataPipe::readStdoutIntoBuffer( char* buf, size_t buf_avail, size_t
 						last_public_fns.pop_front();
 					}
 
-					int file_type_flags = os_get_file_type(os_file_prefix(local_fn));
+					int file_type_flags;
+					if (curr_prefetch != NULL && curr_prefetch->prefetch)
+					{
+						file_type_flags = curr_prefetch->file_type_flags;
+					}
+					else
+					{
+						file_type_flags = os_get_file_type(os_file_prefix(local_fn));
+					}
 
 					if (file_type_flags == 0)
 					{
@@ -627,6 +670,7 @@ bool FileMetadataPipe::readStdoutIntoBuffer( char* buf, size_t buf_avail, size_t
 void FileMetadataPipe::finishStdout()
 {
 	token_callback.reset();
+	stopPrefetch();
 }
 
 bool FileMetadataPipe::readStderrIntoBuffer( char* buf, size_t buf_avail, size_t& read_bytes )
@@ -674,12 +718,18 @@ void FileMetadataPipe::cleanupOnForceShutdown()
 	}
 #endif
 
+	prefetch_jobs.clear();
+
 	while (true)
 	{
 		std::string msg;
-		size_t r = pipe->Read(&msg, 0);
-
-		if (r == 0)
+		if (!prefetch_queue.empty())
+		{
+			msg = prefetch_queue.front()->msg;
+			freePrefetchItem(prefetch_queue.front());
+			prefetch_queue.pop_front();
+		}
+		else if (pipe->Read(&msg, 0) == 0)
 		{
 			break;
 		}
@@ -729,6 +779,186 @@ void FileMetadataPipe::forceExitWait()
 	waitForExit();
 }
 
+size_t FileMetadataPipe::readPipeMsg(std::string& msg)
+{
+	if (curr_prefetch != NULL)
+	{
+		freePrefetchItem(curr_prefetch);
+		curr_prefetch = NULL;
+	}
+
+	if (prefetch_queue.empty())
+	{
+		size_t r = pipe->Read(&msg, 60000);
+		if (r == 0)
+		{
+			return 0;
+		}
+
+		queuePrefetch(msg);
+	}
+
+	while (prefetch_queue.size() < metadata_prefetch_lookahead)
+	{
+		std::string next_msg;
+		if (pipe->Read(&next_msg, 0) == 0)
+		{
+			break;
+		}
+
+		queuePrefetch(next_msg);
+	}
+
+	IScopedLock lock(prefetch_mutex.get());
+
+	curr_prefetch = prefetch_queue.front();
+	prefetch_queue.pop_front();
+
+	while (!curr_prefetch->done)
+	{
+		prefetch_cond->wait(&lock);
+	}
+
+	msg = curr_prefetch->msg;
+	return msg.size();
+}
+
+void FileMetadataPipe::queuePrefetch(const std::string& msg)
+{
+	SPrefetchItem* item = new SPrefetchItem;
+	item->msg = msg;
+	item->prefetch = false;
+	item->done = true;
+	item->file_type_flags = 0;
+#ifdef _WIN32
+	item->hFile = INVALID_HANDLE_VALUE;
+	item->open_err = 0;
+#endif
+
+	CRData msg_data(&msg);
+
+	char id;
+	std::string msg_public_fn;
+	int64 msg_folder_items;
+	int64 msg_metadata_id;
+	std::string msg_server_token;
+	void* msg_callback;
+	if (msg_data.getChar(&id)
+		&& id == METADATA_PIPE_SEND_FILE
+		&& msg_data.getStr(&msg_public_fn)
+		&& msg_data.getStr(&item->local_fn)
+		&& msg_data.getInt64(&msg_folder_items)
+		&& msg_data.getInt64(&msg_metadata_id)
+		&& msg_data.getStr(&msg_server_token)
+		&& (!msg_data.getVoidPtr(&msg_callback) || msg_callback == NULL) )
+	{
+		//Metadata is read from the local file system
+		item->prefetch = true;
+		item->done = false;
+	}
+
+	IScopedLock lock(prefetch_mutex.get());
+
+	prefetch_queue.push_back(item);
+
+	if (item->prefetch)
+	{
+		prefetch_jobs.push_back(item);
+
+		if (prefetch_tickets.empty()
+			&& !prefetch_stop)
+		{
+			for (size_t i = 0; i < metadata_prefetch_threads; ++i)
+			{
+				prefetch_tickets.push_back(Server->getThreadPool()->execute(new PrefetchWorker(this), "metadata prefetch"));
+			}
+		}
+
+		prefetch_cond->notify_all();
+	}
+}
+
+void FileMetadataPipe::prefetchWorker()
+{
+	IScopedLock lock(prefetch_mutex.get());
+
+	while (true)
+	{
+		while (prefetch_jobs.empty()
+			&& !prefetch_stop)
+		{
+			prefetch_cond->wait(&lock);
+		}
+
+		if (prefetch_stop)
+		{
+			return;
+		}
+
+		SPrefetchItem* item = prefetch_jobs.front();
+		prefetch_jobs.pop_front();
+
+		lock.relock(NULL);
+
+		prefetchMetadata(item);
+
+		lock.relock(prefetch_mutex.get());
+
+		item->done = true;
+		prefetch_cond->notify_all();
+	}
+}
+
+void FileMetadataPipe::stopPrefetch()
+{
+	{
+		IScopedLock lock(prefetch_mutex.get());
+		prefetch_stop = true;
+		prefetch_cond->notify_all();
+	}
+
+	if (!prefetch_tickets.empty())
+	{
+		Server->getThreadPool()->waitFor(prefetch_tickets);
+		prefetch_tickets.clear();
+	}
+}
+
+void FileMetadataPipe::prefetchMetadata(SPrefetchItem* item)
+{
+	item->file_type_flags = os_get_file_type(os_file_prefix(item->local_fn));
+
+	if (item->file_type_flags == 0)
+	{
+		return;
+	}
+
+	item->file_meta = getFileMetadata(os_file_prefix(item->local_fn));
+
+#ifdef _WIN32
+	item->hFile = CreateFileW(Server->ConvertToWchar(os_file_prefix(item->local_fn)).c_str(), GENERIC_READ | ACCESS_SYSTEM_SECURITY | READ_CONTROL, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OPEN_REPARSE_POINT, NULL);
+
+	if (item->hFile == INVALID_HANDLE_VALUE)
+	{
+		item->open_err = GetLastError();
+	}
+#else
+	collect_os_metadata(item->local_fn, metadata_buffer_init_size, item->os_data);
+#endif
+}
+
+void FileMetadataPipe::freePrefetchItem(SPrefetchItem* item)
+{
+#ifdef _WIN32
+	if (item->hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(item->hFile);
+	}
+#endif
+	delete item;
+}
+
 #ifdef _WIN32
 bool FileMetadataPipe::transmitCurrMetadata( char* buf, size_t buf_avail, size_t& read_bytes )
 {
@@ -923,6 +1153,22 @@ bool FileMetadataPipe::transmitCurrMetadata( char* buf, size_t buf_avail, size_t
 bool FileMetadataPipe::openFileHandle()
 {
 	backup_read_context = NULL;
+
+	if (curr_prefetch != NULL && curr_prefetch->prefetch)
+	{
+		hFile = curr_prefetch->hFile;
+		curr_prefetch->hFile = INVALID_HANDLE_VALUE;
+		backup_read_state = -1;
+
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			SetLastError(curr_prefetch->open_err);
+			return false;
+		}
+
+		return true;
+	}
+
 	hFile = CreateFileW(Server->ConvertToWchar(os_file_prefix(local_fn)).c_str(), GENERIC_READ | ACCESS_SYSTEM_SECURITY | READ_CONTROL, FILE_SHARE_READ, NULL,
 		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OPEN_REPARSE_POINT, NULL);
 
@@ -1062,11 +1308,96 @@ namespace
 			return true;
 		}
 	}
+
+	bool collect_os_metadata(const std::string& local_fn, size_t max_stat_size, std::string& os_data)
+	{
+		CWData data;
+		struct stat64 statbuf;
+		int rc = lstat64(local_fn.c_str(), &statbuf);
+
+		if(rc!=0)
+		{
+			Server->Log("Error with lstat of "+local_fn+" errorcode: "+convert(errno), LL_ERROR);
+			return false;
+		}
+
+		std::string symlink_target;
+		if (S_ISLNK(statbuf.st_mode))
+		{
+			if (!os_get_symlink_target(local_fn, symlink_target))
+			{
+				Server->Log("Error getting symlink target of " + local_fn + " errorcode: " + convert(errno), LL_ERROR);
+				return false;
+			}
+		}
+
+		serialize_stat_buf(statbuf, symlink_target, data);
+
+		if(data.getDataSize()+sizeof(_u32)>max_stat_size)
+		{
+			Server->Log("File metadata of "+local_fn+" too large ("+convert((size_t)data.getDataSize()+sizeof(_u32))+")", LL_ERROR);
+			return false;
+		}
+
+		_u32 metadata_size = little_endian(static_cast<_u32>(data.getDataSize()));
+		os_data.assign(reinterpret_cast<char*>(&metadata_size), sizeof(_u32));
+		os_data.append(data.getDataPtr(), data.getDataSize());
+
+		std::vector<std::string> eattr_keys;
+		if(!get_xattr_keys(local_fn, eattr_keys))
+		{
+			return false;
+		}
+
+		CWData eattr_data;
+		eattr_data.addInt64(eattr_keys.size());
+		os_data.append(eattr_data.getDataPtr(), eattr_data.getDataSize());
+
+		for(size_t i=0;i<eattr_keys.size();++i)
+		{
+			os_data.append(eattr_keys[i]);
+
+			std::string eattr_val;
+			if(!get_xattr(local_fn, eattr_keys[i], eattr_val))
+			{
+				eattr_val.resize(sizeof(_u32));
+				unsigned int umax = UINT_MAX;
+				memcpy(&eattr_val[0], &umax, sizeof(umax));
+			}
+
+			os_data.append(eattr_val);
+		}
+
+		return true;
+	}
 }
 
 bool FileMetadataPipe::transmitCurrMetadata(char* buf, size_t buf_avail, size_t& read_bytes)
 {
-	if(backup_state==BackupState_StatInit)
+	if(backup_state==BackupState_StatInit
+		&& curr_prefetch!=NULL && curr_prefetch->prefetch)
+	{
+		if(curr_prefetch->os_data.empty())
+		{
+			return false;
+		}
+
+		prefetched_off=0;
+		backup_state=BackupState_Prefetched;
+	}
+
+	if(backup_state==BackupState_Prefetched)
+	{
+		const std::string& os_data = curr_prefetch->os_data;
+		if(os_data.size()-prefetched_off>0)
+		{
+			read_bytes = (std::min)(os_data.size()-prefetched_off, buf_avail);
+			memcpy(buf, os_data.data()+prefetched_off, read_bytes);
+			prefetched_off+=read_bytes;
+		}
+		return os_data.size()-prefetched_off>0;
+	}
+	else if(backup_state==BackupState_StatInit)
 	{
 		CWData data;
         struct stat64 statbuf;
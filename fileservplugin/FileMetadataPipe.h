@@ -5,8 +5,10 @@
 #include <memory>
 #include <deque>
 #include "../Interface/Condition.h"
+#include "../Interface/ThreadPool.h"
 #include "IFileServ.h"
 #include "../urbackupcommon/sha2/sha2.h"
+#include "../urbackupcommon/os_functions.h"
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -46,10 +48,48 @@ protected:
 
 private:
 
+	struct SPrefetchItem
+	{
+		std::string msg;
+		std::string local_fn;
+		bool prefetch;
+		bool done;
+		int file_type_flags;
+		SFile file_meta;
+#ifdef _WIN32
+		HANDLE hFile;
+		DWORD open_err;
+#else
+		std::string os_data;
+#endif
+	};
+
+	class PrefetchWorker : public IThread
+	{
+	public:
+		PrefetchWorker(FileMetadataPipe* pipe)
+			: pipe(pipe) {}
+
+		void operator()() {
+			pipe->prefetchWorker();
+			delete this;
+		}
+
+	private:
+		FileMetadataPipe* pipe;
+	};
+
 	bool transmitCurrMetadata(char* buf, size_t buf_avail, size_t& read_bytes);
 
 	bool openFileHandle();
 
+	size_t readPipeMsg(std::string& msg);
+	void queuePrefetch(const std::string& msg);
+	void prefetchWorker();
+	void stopPrefetch();
+	static void prefetchMetadata(SPrefetchItem* item);
+	static void freePrefetchItem(SPrefetchItem* item);
+
 #ifdef _WIN32
 	HANDLE hFile;
 	int backup_read_state;
@@ -61,6 +101,7 @@ private:
 	enum BackupState
 	{
         BackupState_StatInit,
+		BackupState_Prefetched,
 		BackupState_Stat,
 		BackupState_EAttrInit,
 		BackupState_EAttr,
@@ -69,6 +110,7 @@ private:
 	};
 
 	BackupState backup_state;
+	size_t prefetched_off;
 	size_t eattr_idx;
 	std::vector<std::string> eattr_keys;
 	size_t eattr_key_off;
@@ -127,6 +169,14 @@ private:
 	sha512_ctx transmit_file_ctx;
 
 	std::auto_ptr<IFileServ::ITokenCallback> token_callback;
+
+	std::auto_ptr<IMutex> prefetch_mutex;
+	std::auto_ptr<ICondition> prefetch_cond;
+	std::deque<SPrefetchItem*> prefetch_queue;
+	std::deque<SPrefetchItem*> prefetch_jobs;
+	std::vector<THREADPOOL_TICKET> prefetch_tickets;
+	bool prefetch_stop;
+	SPrefetchItem* curr_prefetch;
 };
 
 #ifndef _WIN32
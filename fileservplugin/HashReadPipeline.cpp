@@ -0,0 +1,337 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "HashReadPipeline.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "chunk_settings.h"
+#include "settings.h"
+#include <algorithm>
+#include <memory.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#define pread64 pread
+#endif
+
+namespace
+{
+	const int stage_free = 0;
+	const int stage_read = 1;
+	const int stage_hashed = 2;
+
+	const _i64 c_readahead_window = 4 * 1024 * 1024;
+
+	class PipelineReadThread : public IThread
+	{
+	public:
+		PipelineReadThread(HashReadPipeline* pipeline)
+			: pipeline(pipeline)
+		{}
+
+		void operator()()
+		{
+			pipeline->runRead();
+			delete this;
+		}
+
+	private:
+		HashReadPipeline* pipeline;
+	};
+
+	class PipelineHashThread : public IThread
+	{
+	public:
+		PipelineHashThread(HashReadPipeline* pipeline)
+			: pipeline(pipeline)
+		{}
+
+		void operator()()
+		{
+			pipeline->runHash();
+			delete this;
+		}
+
+	private:
+		HashReadPipeline* pipeline;
+	};
+}
+
+HashReadPipeline::HashReadPipeline(HANDLE hFile, _i64 start_offset, _i64 filesize, const std::vector<CClientThread::SExtent>& file_extents)
+	: hFile(hFile), start_offset(start_offset), filesize(filesize), file_extents(file_extents),
+	blocks(HASHPIPELINE_NBUFFERS), read_pos(0), hash_pos(0), send_pos(0), stopped(false),
+	read_errno(0), read_error_offset(0), readahead_offset(start_offset)
+{
+	mutex = Server->createMutex();
+	cond = Server->createCondition();
+
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		blocks[i].buf.resize(READSIZE);
+		blocks[i].size = 0;
+		blocks[i].checkpoint = false;
+		blocks[i].last = false;
+		blocks[i].stage = stage_free;
+	}
+}
+
+HashReadPipeline::~HashReadPipeline()
+{
+	stop();
+	Server->getThreadPool()->waitFor(tickets);
+
+	Server->destroy(mutex);
+	Server->destroy(cond);
+}
+
+void HashReadPipeline::start()
+{
+	hash_func.init();
+
+#ifdef __linux__
+	posix_fadvise64(hFile, start_offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	tickets.push_back(Server->getThreadPool()->execute(new PipelineReadThread(this), "filesrv: hash read"));
+	tickets.push_back(Server->getThreadPool()->execute(new PipelineHashThread(this), "filesrv: hash"));
+}
+
+HashReadPipeline::SBlock* HashReadPipeline::getBlock()
+{
+	return waitBlock(send_pos, stage_hashed);
+}
+
+void HashReadPipeline::releaseBlock()
+{
+	blockDone(send_pos, stage_free);
+}
+
+void HashReadPipeline::stop()
+{
+	IScopedLock lock(mutex);
+	stopped = true;
+	cond->notify_all();
+}
+
+int HashReadPipeline::getReadErrno()
+{
+	IScopedLock lock(mutex);
+	return read_errno;
+}
+
+_i64 HashReadPipeline::getReadErrorOffset()
+{
+	IScopedLock lock(mutex);
+	return read_error_offset;
+}
+
+void HashReadPipeline::runRead()
+{
+	_i64 foffset = start_offset;
+	_i64 next_checkpoint = (std::min)(start_offset + c_checkpoint_dist, filesize);
+
+	size_t extent_pos = 0;
+	while (extent_pos < file_extents.size()
+		&& foffset >= file_extents[extent_pos].offset + file_extents[extent_pos].size)
+	{
+		++extent_pos;
+	}
+
+	bool last_hash = false;
+
+	while (foffset < filesize)
+	{
+		bool is_finished = false;
+		while (extent_pos < file_extents.size()
+			&& foffset >= file_extents[extent_pos].offset)
+		{
+			foffset += file_extents[extent_pos].size;
+			next_checkpoint += file_extents[extent_pos].size;
+
+			if (next_checkpoint > filesize)
+				next_checkpoint = filesize;
+
+			if (foffset >= filesize
+				&& last_hash)
+			{
+				is_finished = true;
+			}
+
+			++extent_pos;
+		}
+
+		if (is_finished)
+		{
+			break;
+		}
+
+		size_t count = static_cast<size_t>((std::min)(static_cast<_i64>(READSIZE), next_checkpoint - foffset));
+
+		if (extent_pos < file_extents.size())
+		{
+			count = static_cast<size_t>((std::min)(file_extents[extent_pos].offset - foffset, static_cast<_i64>(count)));
+		}
+
+		SBlock* block = waitBlock(read_pos, stage_free);
+		if (block == NULL)
+		{
+			return;
+		}
+
+		block->size = 0;
+		block->checkpoint = false;
+		block->last = false;
+
+		if (count > 0)
+		{
+			if (!readBlock(block, foffset, count))
+			{
+				block->last = true;
+				blockDone(read_pos, stage_read);
+				return;
+			}
+
+			last_hash = false;
+		}
+
+		if (foffset == next_checkpoint)
+		{
+			block->checkpoint = true;
+			next_checkpoint += c_checkpoint_dist;
+			if (next_checkpoint > filesize)
+				next_checkpoint = filesize;
+
+			last_hash = true;
+		}
+
+		blockDone(read_pos, stage_read);
+	}
+
+	SBlock* block = waitBlock(read_pos, stage_free);
+	if (block != NULL)
+	{
+		block->size = 0;
+		block->checkpoint = false;
+		block->last = true;
+		blockDone(read_pos, stage_read);
+	}
+}
+
+void HashReadPipeline::runHash()
+{
+	while (true)
+	{
+		SBlock* block = waitBlock(hash_pos, stage_read);
+		if (block == NULL)
+		{
+			return;
+		}
+
+		if (block->size > 0)
+		{
+			hash_func.update(reinterpret_cast<unsigned char*>(block->buf.data()), static_cast<unsigned int>(block->size));
+		}
+
+		if (block->checkpoint)
+		{
+			hash_func.finalize();
+			memcpy(block->digest, hash_func.raw_digest_int(), sizeof(block->digest));
+			hash_func.init();
+		}
+
+		bool last = block->last;
+
+		blockDone(hash_pos, stage_hashed);
+
+		if (last)
+		{
+			return;
+		}
+	}
+}
+
+HashReadPipeline::SBlock* HashReadPipeline::waitBlock(size_t pos, int stage)
+{
+	IScopedLock lock(mutex);
+	while (!stopped && blocks[pos].stage != stage)
+	{
+		cond->wait(&lock);
+	}
+
+	if (stopped)
+	{
+		return NULL;
+	}
+
+	return &blocks[pos];
+}
+
+void HashReadPipeline::blockDone(size_t& pos, int next_stage)
+{
+	IScopedLock lock(mutex);
+	blocks[pos].stage = next_stage;
+	pos = (pos + 1) % blocks.size();
+	cond->notify_all();
+}
+
+bool HashReadPipeline::readBlock(SBlock* block, _i64& foffset, size_t count)
+{
+	ssize_t rc = pread64(hFile, block->buf.data(), count, foffset);
+
+	if (rc == 0) //other process made the file smaller
+	{
+		memset(block->buf.data(), 0, count);
+		rc = count;
+	}
+	else if (rc < 0)
+	{
+		int err = errno;
+		IScopedLock lock(mutex);
+		read_errno = err;
+		read_error_offset = foffset;
+		return false;
+	}
+
+	block->size = rc;
+	foffset += rc;
+
+	readahead(foffset);
+
+	return true;
+}
+
+void HashReadPipeline::readahead(_i64 foffset)
+{
+#ifdef __linux__
+	if (readahead_offset < foffset)
+	{
+		//Skipped a sparse extent
+		readahead_offset = foffset;
+	}
+
+	if (readahead_offset - foffset < c_readahead_window / 2
+		&& readahead_offset < filesize)
+	{
+		posix_fadvise64(hFile, readahead_offset, c_readahead_window / 2, POSIX_FADV_WILLNEED);
+		readahead_offset += c_readahead_window / 2;
+	}
+#endif
+}
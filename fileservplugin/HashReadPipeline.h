@@ -0,0 +1,77 @@
+#pragma once
+
+#include "../Interface/Thread.h"
+#include "../Interface/ThreadPool.h"
+#include "../Interface/Types.h"
+#include "../md5.h"
+#include "CClientThread.h"
+#include <vector>
+
+class IMutex;
+class ICondition;
+
+/**
+* Reads a file and hashes it in checkpoint distances for sending it
+* with hashes. Reading, hashing and sending overlap: A reader thread
+* reads blocks into a ring of buffers (with kernel readahead), a
+* hasher thread hashes them in order and the client thread sends
+* them (getBlock/releaseBlock).
+*/
+class HashReadPipeline
+{
+public:
+	struct SBlock
+	{
+		std::vector<char> buf;
+		size_t size;
+		bool checkpoint;
+		char digest[16];
+		bool last;
+		int stage;
+	};
+
+	HashReadPipeline(HANDLE hFile, _i64 start_offset, _i64 filesize, const std::vector<CClientThread::SExtent>& file_extents);
+	~HashReadPipeline();
+
+	void start();
+
+	//Returns the next hashed block or NULL on read error/stop
+	SBlock* getBlock();
+	void releaseBlock();
+
+	void stop();
+
+	int getReadErrno();
+	_i64 getReadErrorOffset();
+
+	void runRead();
+	void runHash();
+
+private:
+	SBlock* waitBlock(size_t pos, int stage);
+	void blockDone(size_t& pos, int next_stage);
+	bool readBlock(SBlock* block, _i64& foffset, size_t count);
+	void readahead(_i64 foffset);
+
+	HANDLE hFile;
+	_i64 start_offset;
+	_i64 filesize;
+	const std::vector<CClientThread::SExtent>& file_extents;
+
+	std::vector<SBlock> blocks;
+	size_t read_pos;
+	size_t hash_pos;
+	size_t send_pos;
+
+	IMutex* mutex;
+	ICondition* cond;
+	bool stopped;
+
+	int read_errno;
+	_i64 read_error_offset;
+	_i64 readahead_offset;
+
+	MD5 hash_func;
+
+	std::vector<THREADPOOL_TICKET> tickets;
+};
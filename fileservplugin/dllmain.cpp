@@ -44,6 +44,7 @@ extern IServer* Server;
 #include "IFileServFactory.h"
 #include "IFileServ.h"
 #include "PipeSessions.h"
+#include "ChunkHashCache.h"
 #include "../stringtools.h"
 #include <stdlib.h>
 
@@ -55,6 +56,7 @@ DLLEXPORT void LoadActions(IServer* pServer)
 
 	FileServ::init_mutex();
 	PipeSessions::init();
+	ChunkHashCache::init();
 
 	fileservpluginmgr=new CFileServPluginMgr;
 
@@ -0,0 +1,975 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ChunkStoreFile.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+#include "../stringtools.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../urbackupcommon/sha2/sha2.h"
+#include "FileWrapper.h"
+#include "ClientBitmap.h"
+#include "fs/ntfs.h"
+#include <memory.h>
+#include <algorithm>
+
+namespace
+{
+	const char chunkstore_magic[] = "URBCAS01";
+	const size_t chunkstore_magic_size = 8;
+	const int64 chunkstore_header_size = 4096;
+	const size_t chunk_hash_size = 32;
+	const int64 chunk_header_size = sizeof(int64);
+	const size_t table_copy_entries = 4096;
+	const size_t max_pending_unrefs = 4096;
+}
+
+IMutex* ChunkStoreFile::mutex = NULL;
+char ChunkStoreFile::zero_hash[32];
+
+ChunkStoreFile::ChunkStoreFile(const std::string &fn, const std::string& store_path, bool pRead_only, uint64 pDstsize, unsigned int pBlocksize)
+	: filename(fn), store_path(store_path), read_only(pRead_only), is_open(false), dstsize(pDstsize),
+	blocksize(pBlocksize), curr_offset(0), cur_block(-1), cur_dirty(false), cur_written_start(0), cur_written_end(0),
+	cached_entry_block(-1), used_blocks(-1), header_dirty(false)
+{
+	if (!openFile(fn, !read_only))
+	{
+		return;
+	}
+
+	if (file->Size() >= chunkstore_header_size)
+	{
+		is_open = readHeader();
+	}
+	else if (!read_only)
+	{
+		is_open = writeHeader();
+	}
+}
+
+ChunkStoreFile::ChunkStoreFile(const std::string &fn, const std::string &parent_fn, const std::string& store_path, bool pRead_only, uint64 pDstsize)
+	: filename(fn), store_path(store_path), read_only(pRead_only), is_open(false), dstsize(pDstsize),
+	blocksize(0), curr_offset(0), cur_block(-1), cur_dirty(false), cur_written_start(0), cur_written_end(0),
+	cached_entry_block(-1), used_blocks(-1), header_dirty(false)
+{
+	if (!openFile(fn, !read_only))
+	{
+		return;
+	}
+
+	if (file->Size() >= chunkstore_header_size)
+	{
+		is_open = readHeader();
+		return;
+	}
+
+	if (read_only)
+	{
+		return;
+	}
+
+	is_open = copyParentTable(parent_fn);
+}
+
+ChunkStoreFile::~ChunkStoreFile()
+{
+	if (is_open && !read_only)
+	{
+		finish();
+	}
+}
+
+void ChunkStoreFile::init_mutex()
+{
+	mutex = Server->createMutex();
+
+	sha256_ctx ctx;
+	sha256_init(&ctx);
+	std::vector<char> zero_buf(512*1024);
+	sha256_update(&ctx, reinterpret_cast<unsigned char*>(zero_buf.data()), static_cast<unsigned int>(zero_buf.size()));
+	sha256_final(&ctx, reinterpret_cast<unsigned char*>(zero_hash));
+}
+
+bool ChunkStoreFile::openFile(const std::string & fn, bool create)
+{
+	file.reset(Server->openFile(fn, read_only ? MODE_READ : MODE_RW));
+
+	if (file.get() == NULL && create)
+	{
+		file.reset(Server->openFile(fn, MODE_RW_CREATE));
+	}
+
+	if (file.get() == NULL)
+	{
+		Server->Log("Error opening chunk store image file \"" + fn + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::readHeader()
+{
+	std::string header = file->Read(static_cast<int64>(0), static_cast<_u32>(chunkstore_header_size));
+	if (header.size() != chunkstore_header_size
+		|| memcmp(header.data(), chunkstore_magic, chunkstore_magic_size) != 0)
+	{
+		Server->Log("Chunk store image file \"" + filename + "\" has an invalid header", LL_ERROR);
+		return false;
+	}
+
+	size_t pos = chunkstore_magic_size;
+	memcpy(&dstsize, header.data() + pos, sizeof(dstsize));
+	dstsize = little_endian(dstsize);
+	pos += sizeof(dstsize);
+	memcpy(&blocksize, header.data() + pos, sizeof(blocksize));
+	blocksize = little_endian(blocksize);
+	pos += sizeof(blocksize);
+	unsigned int store_path_size;
+	memcpy(&store_path_size, header.data() + pos, sizeof(store_path_size));
+	store_path_size = little_endian(store_path_size);
+	pos += sizeof(store_path_size);
+
+	if (blocksize == 0
+		|| pos + store_path_size > header.size())
+	{
+		Server->Log("Chunk store image file \"" + filename + "\" has an invalid header (blocksize or store path)", LL_ERROR);
+		return false;
+	}
+
+	if (store_path.empty())
+	{
+		store_path = header.substr(pos, store_path_size);
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::writeHeader()
+{
+	std::string header(chunkstore_header_size, 0);
+
+	if (chunkstore_magic_size + sizeof(dstsize) + sizeof(blocksize) + sizeof(unsigned int)
+		+ store_path.size() > header.size())
+	{
+		Server->Log("Chunk store path \"" + store_path + "\" is too long", LL_ERROR);
+		return false;
+	}
+
+	size_t pos = 0;
+	memcpy(&header[pos], chunkstore_magic, chunkstore_magic_size);
+	pos += chunkstore_magic_size;
+	uint64 dstsize_le = little_endian(dstsize);
+	memcpy(&header[pos], &dstsize_le, sizeof(dstsize_le));
+	pos += sizeof(dstsize_le);
+	unsigned int blocksize_le = little_endian(blocksize);
+	memcpy(&header[pos], &blocksize_le, sizeof(blocksize_le));
+	pos += sizeof(blocksize_le);
+	unsigned int store_path_size = little_endian(static_cast<unsigned int>(store_path.size()));
+	memcpy(&header[pos], &store_path_size, sizeof(store_path_size));
+	pos += sizeof(store_path_size);
+	memcpy(&header[pos], store_path.data(), store_path.size());
+
+	if (file->Write(static_cast<int64>(0), header) != header.size())
+	{
+		Server->Log("Error writing header of chunk store image file \"" + filename + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	int64 n_blocks = numBlocks();
+	char empty_hash[chunk_hash_size] = {};
+	if (n_blocks > 0
+		&& file->Size() < chunkstore_header_size + n_blocks*static_cast<int64>(chunk_hash_size)
+		&& file->Write(chunkstore_header_size + (n_blocks - 1)*chunk_hash_size, empty_hash, static_cast<_u32>(chunk_hash_size)) != chunk_hash_size)
+	{
+		Server->Log("Error writing block table of chunk store image file \"" + filename + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::copyParentTable(const std::string & parent_fn)
+{
+	std::auto_ptr<ChunkStoreFile> parent(new ChunkStoreFile(parent_fn, store_path, true, 0, 0));
+	if (!parent->isOpen())
+	{
+		Server->Log("Error opening parent chunk store image file \"" + parent_fn + "\"", LL_ERROR);
+		return false;
+	}
+
+	blocksize = parent->blocksize;
+	if (store_path.empty())
+	{
+		store_path = parent->store_path;
+	}
+	if (dstsize < parent->dstsize)
+	{
+		dstsize = parent->dstsize;
+	}
+
+	if (!writeHeader())
+	{
+		return false;
+	}
+
+	int64 parent_blocks = parent->numBlocks();
+	std::vector<char> entries(table_copy_entries*chunk_hash_size);
+	std::map<std::string, int64> refs;
+	for (int64 block = 0; block < parent_blocks; block += table_copy_entries)
+	{
+		_u32 toread = static_cast<_u32>((std::min)(static_cast<int64>(table_copy_entries), parent_blocks - block)*chunk_hash_size);
+		if (parent->file->Read(chunkstore_header_size + block*chunk_hash_size, entries.data(), toread) != toread)
+		{
+			Server->Log("Error reading block table of parent chunk store image file \"" + parent_fn + "\"", LL_ERROR);
+			return false;
+		}
+
+		for (_u32 i = 0; i < toread; i += chunk_hash_size)
+		{
+			const char* hash = entries.data() + i;
+			if (!isEmptyEntry(hash)
+				&& !isZeroEntry(hash))
+			{
+				++refs[std::string(hash, chunk_hash_size)];
+			}
+		}
+	}
+
+	//Reference each chunk once with the number of blocks using it
+	//before the table exists. A crash in between only leaks references.
+	for (std::map<std::string, int64>::iterator it = refs.begin(); it != refs.end(); ++it)
+	{
+		IScopedLock lock(mutex);
+		if (!changeChunkRef(chunkPath(it->first.data()), it->second))
+		{
+			return false;
+		}
+	}
+
+	for (int64 block = 0; block < parent_blocks; block += table_copy_entries)
+	{
+		_u32 toread = static_cast<_u32>((std::min)(static_cast<int64>(table_copy_entries), parent_blocks - block)*chunk_hash_size);
+		if (parent->file->Read(chunkstore_header_size + block*chunk_hash_size, entries.data(), toread) != toread)
+		{
+			Server->Log("Error reading block table of parent chunk store image file \"" + parent_fn + "\"", LL_ERROR);
+			return false;
+		}
+
+		if (file->Write(chunkstore_header_size + block*chunk_hash_size, entries.data(), toread) != toread)
+		{
+			Server->Log("Error writing block table of chunk store image file \"" + filename + "\". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::Seek(_i64 offset)
+{
+	if (static_cast<uint64>(offset) > dstsize)
+	{
+		return false;
+	}
+	curr_offset = offset;
+	return true;
+}
+
+bool ChunkStoreFile::Read(char* buffer, size_t bsize, size_t &read_bytes)
+{
+	read_bytes = 0;
+
+	if (curr_offset + static_cast<_i64>(bsize) > static_cast<_i64>(dstsize))
+	{
+		bsize = static_cast<size_t>(dstsize - curr_offset);
+	}
+
+	while (read_bytes < bsize)
+	{
+		int64 block = curr_offset / blocksize;
+		_u32 block_off = static_cast<_u32>(curr_offset % blocksize);
+		_u32 toread = static_cast<_u32>((std::min)(static_cast<size_t>(blocksize - block_off), bsize - read_bytes));
+
+		if (block == cur_block)
+		{
+			if (!materializeBlock())
+			{
+				return false;
+			}
+			memcpy(buffer + read_bytes, cur_buf.data() + block_off, toread);
+		}
+		else
+		{
+			char hash[chunk_hash_size];
+			if (!getEntry(block, hash))
+			{
+				return false;
+			}
+
+			if (isEmptyEntry(hash) || isZeroEntry(hash))
+			{
+				memset(buffer + read_bytes, 0, toread);
+			}
+			else if (!readChunk(hash, block_off, buffer + read_bytes, toread))
+			{
+				return false;
+			}
+		}
+
+		read_bytes += toread;
+		curr_offset += toread;
+	}
+
+	return true;
+}
+
+_u32 ChunkStoreFile::Write(const char *buffer, _u32 bsize, bool *has_error)
+{
+	if (read_only)
+	{
+		if (has_error) *has_error = true;
+		return 0;
+	}
+
+	_u32 written = 0;
+	while (written < bsize)
+	{
+		int64 block = curr_offset / blocksize;
+		_u32 block_off = static_cast<_u32>(curr_offset % blocksize);
+		_u32 towrite = (std::min)(blocksize - block_off, bsize - written);
+
+		if (block != cur_block)
+		{
+			if (!flushBlock())
+			{
+				if (has_error) *has_error = true;
+				return 0;
+			}
+			cur_block = block;
+			cur_buf.resize(blocksize);
+			cur_written_start = block_off;
+			cur_written_end = block_off;
+		}
+		else if (cur_written_start != cur_written_end
+			&& (block_off > cur_written_end || block_off + towrite < cur_written_start))
+		{
+			if (!materializeBlock())
+			{
+				if (has_error) *has_error = true;
+				return 0;
+			}
+		}
+
+		memcpy(cur_buf.data() + block_off, buffer + written, towrite);
+		cur_dirty = true;
+		cur_written_start = (std::min)(cur_written_start, block_off);
+		cur_written_end = (std::max)(cur_written_end, block_off + towrite);
+
+		written += towrite;
+		curr_offset += towrite;
+	}
+
+	if (static_cast<uint64>(curr_offset) > dstsize)
+	{
+		dstsize = curr_offset;
+		header_dirty = true;
+	}
+
+	return written;
+}
+
+bool ChunkStoreFile::materializeBlock()
+{
+	if (cur_block < 0
+		|| (cur_written_start == 0 && cur_written_end == blocksize))
+	{
+		return true;
+	}
+
+	std::vector<char> old_data(blocksize);
+	char hash[chunk_hash_size];
+	if (!getEntry(cur_block, hash))
+	{
+		return false;
+	}
+
+	if (!isEmptyEntry(hash) && !isZeroEntry(hash)
+		&& !readChunk(hash, 0, old_data.data(), blocksize))
+	{
+		return false;
+	}
+
+	memcpy(old_data.data() + cur_written_start, cur_buf.data() + cur_written_start, cur_written_end - cur_written_start);
+	cur_buf.swap(old_data);
+	cur_written_start = 0;
+	cur_written_end = blocksize;
+	return true;
+}
+
+bool ChunkStoreFile::flushBlock()
+{
+	if (cur_block < 0 || !cur_dirty)
+	{
+		cur_block = -1;
+		return true;
+	}
+
+	if (!materializeBlock())
+	{
+		return false;
+	}
+
+	char hash[chunk_hash_size];
+	sha256_ctx ctx;
+	sha256_init(&ctx);
+	sha256_update(&ctx, reinterpret_cast<unsigned char*>(cur_buf.data()), blocksize);
+	sha256_final(&ctx, reinterpret_cast<unsigned char*>(hash));
+
+	char old_hash[chunk_hash_size];
+	if (!getEntry(cur_block, old_hash))
+	{
+		return false;
+	}
+
+	if (memcmp(old_hash, hash, chunk_hash_size) != 0)
+	{
+		if (!isZeroEntry(hash)
+			&& !addChunk(hash, cur_buf.data()))
+		{
+			return false;
+		}
+
+		if (!setEntry(cur_block, hash))
+		{
+			return false;
+		}
+
+		if (!isEmptyEntry(old_hash)
+			&& !isZeroEntry(old_hash))
+		{
+			pending_unrefs.push_back(std::string(old_hash, chunk_hash_size));
+		}
+	}
+
+	cur_block = -1;
+	cur_dirty = false;
+
+	if (pending_unrefs.size() >= max_pending_unrefs)
+	{
+		return releasePendingRefs();
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::releasePendingRefs()
+{
+	if (!file->Sync())
+	{
+		Server->Log("Error syncing block table of chunk store image file \"" + filename + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	for (size_t i = 0; i < pending_unrefs.size(); ++i)
+	{
+		removeChunkRef(pending_unrefs[i].data());
+	}
+	pending_unrefs.clear();
+
+	return true;
+}
+
+bool ChunkStoreFile::isOpen(void)
+{
+	return is_open;
+}
+
+uint64 ChunkStoreFile::getSize(void)
+{
+	return dstsize;
+}
+
+uint64 ChunkStoreFile::usedSize(void)
+{
+	if (used_blocks < 0)
+	{
+		used_blocks = 0;
+		int64 n_blocks = numBlocks();
+		std::vector<char> entries(table_copy_entries*chunk_hash_size);
+		for (int64 block = 0; block < n_blocks; block += table_copy_entries)
+		{
+			_u32 toread = static_cast<_u32>((std::min)(static_cast<int64>(table_copy_entries), n_blocks - block)*chunk_hash_size);
+			if (file->Read(chunkstore_header_size + block*chunk_hash_size, entries.data(), toread) != toread)
+			{
+				break;
+			}
+
+			for (_u32 i = 0; i < toread; i += chunk_hash_size)
+			{
+				if (!isEmptyEntry(entries.data() + i))
+				{
+					++used_blocks;
+				}
+			}
+		}
+	}
+
+	return used_blocks*blocksize;
+}
+
+std::string ChunkStoreFile::getFilename(void)
+{
+	return filename;
+}
+
+bool ChunkStoreFile::has_sector(_i64 sector_size)
+{
+	if (sector_size < 0)
+	{
+		sector_size = 1;
+	}
+
+	for (int64 block = curr_offset / blocksize; block*blocksize < curr_offset + sector_size; ++block)
+	{
+		if (block == cur_block)
+		{
+			return true;
+		}
+
+		char hash[chunk_hash_size];
+		if (getEntry(block, hash)
+			&& !isEmptyEntry(hash))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ChunkStoreFile::this_has_sector(_i64 sector_size)
+{
+	return has_sector(sector_size);
+}
+
+unsigned int ChunkStoreFile::getBlocksize()
+{
+	return blocksize;
+}
+
+bool ChunkStoreFile::finish()
+{
+	if (read_only)
+	{
+		return true;
+	}
+
+	if (!flushBlock())
+	{
+		return false;
+	}
+
+	if (header_dirty)
+	{
+		if (!writeHeader())
+		{
+			return false;
+		}
+		header_dirty = false;
+	}
+
+	return releasePendingRefs();
+}
+
+bool ChunkStoreFile::trimUnused(_i64 fs_offset, _i64 trim_blocksize, ITrimCallback* trim_callback)
+{
+	FileWrapper devfile(this, fs_offset);
+	std::auto_ptr<IReadOnlyBitmap> bitmap_source;
+
+	bitmap_source.reset(new ClientBitmap(filename + ".cbitmap"));
+
+	if (bitmap_source->hasError())
+	{
+		Server->Log("Error reading client bitmap. Falling back to reading bitmap from NTFS", LL_WARNING);
+
+		bitmap_source.reset(new FSNTFS(&devfile, IFSImageFactory::EReadaheadMode_None, false, NULL));
+	}
+
+	if (bitmap_source->hasError())
+	{
+		Server->Log("Error opening NTFS bitmap. Cannot trim.", LL_WARNING);
+		return false;
+	}
+
+	int64 bitmap_blocksize = bitmap_source->getBlocksize();
+
+	if (trim_blocksize < blocksize)
+	{
+		trim_blocksize = blocksize;
+	}
+
+	if (trim_blocksize%bitmap_blocksize != 0)
+	{
+		Server->Log("Trim block size (" + convert(trim_blocksize) + ") is not a multiple of the bitmap block size (" + convert(bitmap_blocksize) + ")", LL_WARNING);
+		return false;
+	}
+
+	trim_blocksize = trim_blocksize / bitmap_blocksize;
+
+	int64 n_fs_blocks = devfile.Size() / bitmap_blocksize;
+	int64 unused_start_block = -1;
+
+	for (int64 fs_block = 0; fs_block < n_fs_blocks + trim_blocksize; fs_block += trim_blocksize)
+	{
+		bool has_block = fs_block >= n_fs_blocks;
+		for (int64 i = fs_block; i < fs_block + trim_blocksize && i < n_fs_blocks; ++i)
+		{
+			if (bitmap_source->hasBlock(i))
+			{
+				has_block = true;
+				break;
+			}
+		}
+
+		if (!has_block)
+		{
+			if (unused_start_block == -1)
+			{
+				unused_start_block = fs_block;
+			}
+		}
+		else if (unused_start_block != -1)
+		{
+			int64 unused_start = fs_offset + unused_start_block*bitmap_blocksize;
+			int64 unused_end = (std::min)(fs_offset + (std::min)(fs_block, n_fs_blocks)*bitmap_blocksize, static_cast<int64>(dstsize));
+
+			if (unused_start >= static_cast<int64>(dstsize))
+			{
+				break;
+			}
+
+			if (!setUnused(unused_start, unused_end))
+			{
+				Server->Log("Trimming chunk store image failed. Stopping trimming.", LL_WARNING);
+				return false;
+			}
+			if (trim_callback != NULL)
+			{
+				trim_callback->trimmed(unused_start - fs_offset, unused_end - fs_offset);
+			}
+
+			unused_start_block = -1;
+		}
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::syncBitmap(_i64 fs_offset)
+{
+	//The block table is the only record of used blocks. Blocks the
+	//file system uses but which were never written read as zeros.
+	return true;
+}
+
+bool ChunkStoreFile::makeFull(_i64 fs_offset, IVHDWriteCallback* write_callback)
+{
+	//Incremental images get a complete copy of the parent's block
+	//table on creation and never read from the parent afterwards
+	return true;
+}
+
+bool ChunkStoreFile::setUnused(_i64 unused_start, _i64 unused_end)
+{
+	int64 block_start = (unused_start + blocksize - 1) / blocksize;
+	int64 block_end = unused_end / blocksize;
+
+	if (static_cast<uint64>(unused_end) >= dstsize)
+	{
+		block_end = numBlocks();
+	}
+
+	for (int64 block = block_start; block < block_end; ++block)
+	{
+		if (block == cur_block)
+		{
+			cur_block = -1;
+			cur_dirty = false;
+		}
+
+		char hash[chunk_hash_size];
+		if (!getEntry(block, hash))
+		{
+			return false;
+		}
+
+		if (isEmptyEntry(hash))
+		{
+			continue;
+		}
+
+		char empty_hash[chunk_hash_size] = {};
+		if (!setEntry(block, empty_hash))
+		{
+			return false;
+		}
+
+		if (!isZeroEntry(hash))
+		{
+			pending_unrefs.push_back(std::string(hash, chunk_hash_size));
+		}
+	}
+
+	if (pending_unrefs.size() >= max_pending_unrefs)
+	{
+		return releasePendingRefs();
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::releaseChunks()
+{
+	int64 n_blocks = numBlocks();
+	std::vector<char> entries(table_copy_entries*chunk_hash_size);
+	bool ret = true;
+	for (int64 block = 0; block < n_blocks; block += table_copy_entries)
+	{
+		_u32 toread = static_cast<_u32>((std::min)(static_cast<int64>(table_copy_entries), n_blocks - block)*chunk_hash_size);
+		if (file->Read(chunkstore_header_size + block*chunk_hash_size, entries.data(), toread) != toread)
+		{
+			Server->Log("Error reading block table of chunk store image file \"" + filename + "\"", LL_ERROR);
+			return false;
+		}
+
+		for (_u32 i = 0; i < toread; i += chunk_hash_size)
+		{
+			const char* hash = entries.data() + i;
+			if (!isEmptyEntry(hash)
+				&& !isZeroEntry(hash)
+				&& !removeChunkRef(hash))
+			{
+				ret = false;
+			}
+		}
+	}
+
+	return ret;
+}
+
+int64 ChunkStoreFile::numBlocks()
+{
+	if (blocksize == 0)
+	{
+		return 0;
+	}
+	return static_cast<int64>(dstsize / blocksize + (dstsize%blocksize != 0 ? 1 : 0));
+}
+
+bool ChunkStoreFile::getEntry(int64 block, char* hash)
+{
+	if (block == cached_entry_block)
+	{
+		memcpy(hash, cached_entry, chunk_hash_size);
+		return true;
+	}
+
+	if (block >= numBlocks())
+	{
+		memset(hash, 0, chunk_hash_size);
+		return true;
+	}
+
+	_u32 read = file->Read(chunkstore_header_size + block*chunk_hash_size, hash, static_cast<_u32>(chunk_hash_size));
+	if (read != chunk_hash_size)
+	{
+		memset(hash + read, 0, chunk_hash_size - read);
+	}
+
+	cached_entry_block = block;
+	memcpy(cached_entry, hash, chunk_hash_size);
+	return true;
+}
+
+bool ChunkStoreFile::setEntry(int64 block, const char* hash)
+{
+	if (file->Write(chunkstore_header_size + block*chunk_hash_size, hash, static_cast<_u32>(chunk_hash_size)) != chunk_hash_size)
+	{
+		Server->Log("Error writing block table entry of chunk store image file \"" + filename + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	cached_entry_block = block;
+	memcpy(cached_entry, hash, chunk_hash_size);
+	used_blocks = -1;
+	return true;
+}
+
+std::string ChunkStoreFile::chunkPath(const char* hash)
+{
+	std::string hex = bytesToHex(reinterpret_cast<const unsigned char*>(hash), chunk_hash_size);
+	return store_path + os_file_sep() + hex.substr(0, 2) + os_file_sep() + hex.substr(2, 2) + os_file_sep() + hex;
+}
+
+bool ChunkStoreFile::addChunk(const char* hash, const char* data)
+{
+	std::string path = chunkPath(hash);
+
+	{
+		IScopedLock lock(mutex);
+		if (Server->fileExists(path))
+		{
+			return changeChunkRef(path, 1);
+		}
+	}
+
+	std::string dir = ExtractFilePath(path, os_file_sep());
+	if (!os_directory_exists(dir)
+		&& !os_create_dir_recursive(dir)
+		&& !os_directory_exists(dir))
+	{
+		Server->Log("Error creating chunk store directory \"" + dir + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	std::string tmp_path = path + ".new" + convert(Server->getRandomNumber());
+	{
+		std::auto_ptr<IFile> tmp_file(Server->openFile(tmp_path, MODE_WRITE));
+		if (tmp_file.get() == NULL)
+		{
+			Server->Log("Error creating chunk file \"" + tmp_path + "\". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		int64 refcount = little_endian(static_cast<int64>(1));
+		if (tmp_file->Write(static_cast<int64>(0), reinterpret_cast<char*>(&refcount), sizeof(refcount)) != sizeof(refcount)
+			|| tmp_file->Write(chunk_header_size, data, blocksize) != blocksize)
+		{
+			Server->Log("Error writing chunk file \"" + tmp_path + "\". " + os_last_error_str(), LL_ERROR);
+			tmp_file.reset();
+			Server->deleteFile(tmp_path);
+			return false;
+		}
+	}
+
+	IScopedLock lock(mutex);
+	if (Server->fileExists(path))
+	{
+		Server->deleteFile(tmp_path);
+		return changeChunkRef(path, 1);
+	}
+
+	if (!os_rename_file(tmp_path, path))
+	{
+		Server->Log("Error renaming chunk file \"" + tmp_path + "\" to \"" + path + "\". " + os_last_error_str(), LL_ERROR);
+		Server->deleteFile(tmp_path);
+		return false;
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::removeChunkRef(const char* hash)
+{
+	if (read_chunk_hash == std::string(hash, chunk_hash_size))
+	{
+		read_chunk.reset();
+		read_chunk_hash.clear();
+	}
+
+	IScopedLock lock(mutex);
+	return changeChunkRef(chunkPath(hash), -1);
+}
+
+bool ChunkStoreFile::changeChunkRef(const std::string& path, int64 diff)
+{
+	std::auto_ptr<IFile> chunk_file(Server->openFile(path, MODE_RW));
+	if (chunk_file.get() == NULL)
+	{
+		Server->Log("Error opening chunk file \"" + path + "\" to change reference count. " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	int64 refcount;
+	if (chunk_file->Read(static_cast<int64>(0), reinterpret_cast<char*>(&refcount), sizeof(refcount)) != sizeof(refcount))
+	{
+		Server->Log("Error reading reference count of chunk file \"" + path + "\"", LL_ERROR);
+		return false;
+	}
+
+	refcount = little_endian(refcount) + diff;
+
+	if (refcount <= 0)
+	{
+		chunk_file.reset();
+		return Server->deleteFile(path);
+	}
+
+	refcount = little_endian(refcount);
+
+	if (chunk_file->Write(static_cast<int64>(0), reinterpret_cast<char*>(&refcount), sizeof(refcount)) != sizeof(refcount))
+	{
+		Server->Log("Error writing reference count of chunk file \"" + path + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::readChunk(const char* hash, int64 offset, char* buffer, _u32 bsize)
+{
+	std::string hash_str(hash, chunk_hash_size);
+	if (read_chunk.get() == NULL
+		|| read_chunk_hash != hash_str)
+	{
+		read_chunk_hash.clear();
+		read_chunk.reset(Server->openFile(chunkPath(hash), MODE_READ));
+		if (read_chunk.get() == NULL)
+		{
+			Server->Log("Error opening chunk file \"" + chunkPath(hash) + "\" of image \"" + filename + "\". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+		read_chunk_hash = hash_str;
+	}
+
+	if (read_chunk->Read(chunk_header_size + offset, buffer, bsize) != bsize)
+	{
+		Server->Log("Error reading from chunk file \"" + read_chunk->getFilename() + "\". " + os_last_error_str(), LL_ERROR);
+		return false;
+	}
+
+	return true;
+}
+
+bool ChunkStoreFile::isEmptyEntry(const char* hash)
+{
+	for (size_t i = 0; i < chunk_hash_size; ++i)
+	{
+		if (hash[i] != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ChunkStoreFile::isZeroEntry(const char* hash)
+{
+	return memcmp(hash, zero_hash, chunk_hash_size) == 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "IVHDFile.h"
+#include "../Interface/File.h"
+#include <memory>
+#include <vector>
+#include <map>
+
+class IMutex;
+
+/**
+* Image file which only stores a table of SHA-256 block hashes.
+* The block data itself is stored once per hash in a shared,
+* reference counted chunk store, so identical blocks of images
+* from different clients only use disk space once.
+*/
+class ChunkStoreFile : public IVHDFile
+{
+public:
+	ChunkStoreFile(const std::string &fn, const std::string& store_path, bool pRead_only, uint64 pDstsize, unsigned int pBlocksize);
+	ChunkStoreFile(const std::string &fn, const std::string &parent_fn, const std::string& store_path, bool pRead_only, uint64 pDstsize);
+	~ChunkStoreFile();
+
+	virtual bool Seek(_i64 offset);
+	virtual bool Read(char* buffer, size_t bsize, size_t &read_bytes);
+	virtual _u32 Write(const char *buffer, _u32 bsize, bool *has_error);
+	virtual bool isOpen(void);
+	virtual uint64 getSize(void);
+	virtual uint64 usedSize(void);
+	virtual std::string getFilename(void);
+	virtual bool has_sector(_i64 sector_size=-1);
+	virtual bool this_has_sector(_i64 sector_size=-1);
+	virtual unsigned int getBlocksize();
+	virtual bool finish();
+	virtual bool trimUnused(_i64 fs_offset, _i64 trim_blocksize, ITrimCallback* trim_callback);
+	virtual bool syncBitmap(_i64 fs_offset);
+	virtual bool makeFull(_i64 fs_offset, IVHDWriteCallback* write_callback);
+	virtual bool setUnused(_i64 unused_start, _i64 unused_end);
+	virtual bool setBackingFileSize(_i64 fsize) { return true; }
+
+	bool releaseChunks();
+
+	static void init_mutex();
+
+private:
+	bool openFile(const std::string &fn, bool create);
+	bool readHeader();
+	bool writeHeader();
+	bool copyParentTable(const std::string &parent_fn);
+
+	int64 numBlocks();
+	bool getEntry(int64 block, char* hash);
+	bool setEntry(int64 block, const char* hash);
+
+	bool flushBlock();
+	bool materializeBlock();
+	bool releasePendingRefs();
+
+	std::string chunkPath(const char* hash);
+	bool addChunk(const char* hash, const char* data);
+	bool removeChunkRef(const char* hash);
+	bool changeChunkRef(const std::string& path, int64 diff);
+	bool readChunk(const char* hash, int64 offset, char* buffer, _u32 bsize);
+
+	static bool isEmptyEntry(const char* hash);
+	static bool isZeroEntry(const char* hash);
+
+	std::auto_ptr<IFile> file;
+	std::string filename;
+	std::string store_path;
+	bool read_only;
+	bool is_open;
+	uint64 dstsize;
+	unsigned int blocksize;
+	_i64 curr_offset;
+
+	int64 cur_block;
+	std::vector<char> cur_buf;
+	bool cur_dirty;
+	_u32 cur_written_start;
+	_u32 cur_written_end;
+
+	int64 cached_entry_block;
+	char cached_entry[32];
+
+	std::string read_chunk_hash;
+	std::auto_ptr<IFile> read_chunk;
+
+	int64 used_blocks;
+	bool header_dirty;
+
+	//Chunk references of replaced table entries. Only released
+	//after the table has been synced, so a crash cannot leave
+	//table entries pointing to deleted chunks
+	std::vector<std::string> pending_unrefs;
+
+	static IMutex* mutex;
+	static char zero_hash[32];
+};
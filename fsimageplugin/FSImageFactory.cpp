@@ -36,6 +36,7 @@
 #include "cowfile.h"
 #endif
 #include "ClientBitmap.h"
+#include "ChunkStoreFile.h"
 #include <stdlib.h>
 
 #ifdef _WIN32
@@ -249,6 +250,11 @@ bool FSImageFactory::isNTFS(char *buffer)
 IVHDFile *FSImageFactory::createVHDFile(const std::string &fn, bool pRead_only, uint64 pDstsize,
 	unsigned int pBlocksize, bool fast_mode, ImageFormat format)
 {
+	if(format==ImageFormat_VHD && strlower(findextension(fn))=="cas")
+	{
+		format=ImageFormat_ChunkStore;
+	}
+
 	switch(format)
 	{
 	case ImageFormat_VHD:
@@ -260,6 +266,8 @@ IVHDFile *FSImageFactory::createVHDFile(const std::string &fn, bool pRead_only,
 #else
 		return NULL;
 #endif
+	case ImageFormat_ChunkStore:
+		return new ChunkStoreFile(fn, std::string(), pRead_only, pDstsize, pBlocksize);
 	}
 	return NULL;
 }
@@ -278,11 +286,36 @@ IVHDFile *FSImageFactory::createVHDFile(const std::string &fn, const std::string
 #else
 		return NULL;
 #endif
+	case ImageFormat_ChunkStore:
+		return new ChunkStoreFile(fn, parent_fn, std::string(), pRead_only, pDstsize);
 	}
 
 	return NULL;
 }
 
+IVHDFile *FSImageFactory::createChunkStoreFile(const std::string &fn, const std::string &parent_fn, const std::string &store_path,
+	bool pRead_only, uint64 pDstsize, unsigned int pBlocksize)
+{
+	if(parent_fn.empty())
+	{
+		return new ChunkStoreFile(fn, store_path, pRead_only, pDstsize, pBlocksize);
+	}
+	else
+	{
+		return new ChunkStoreFile(fn, parent_fn, store_path, pRead_only, pDstsize);
+	}
+}
+
+bool FSImageFactory::releaseChunkStoreFile(const std::string &fn)
+{
+	ChunkStoreFile chunkstore_file(fn, std::string(), true, 0, 0);
+	if(!chunkstore_file.isOpen())
+	{
+		return false;
+	}
+	return chunkstore_file.releaseChunks();
+}
+
 void FSImageFactory::destroyVHDFile(IVHDFile *vhd)
 {
 	delete vhd;
@@ -14,6 +14,11 @@ public:
 	virtual IVHDFile *createVHDFile(const std::string &fn, const std::string &parent_fn,
 		bool pRead_only, bool fast_mode=false, IFSImageFactory::ImageFormat format=IFSImageFactory::ImageFormat_VHD, uint64 pDstsize=0);
 
+	virtual IVHDFile *createChunkStoreFile(const std::string &fn, const std::string &parent_fn, const std::string &store_path,
+		bool pRead_only, uint64 pDstsize, unsigned int pBlocksize=512*1024);
+
+	virtual bool releaseChunkStoreFile(const std::string &fn);
+
 	virtual void destroyVHDFile(IVHDFile *vhd);
 
 	virtual IReadOnlyBitmap* createClientBitmap(const std::string& fn);
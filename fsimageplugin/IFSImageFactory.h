@@ -27,7 +27,8 @@ public:
 	{
 		ImageFormat_VHD=0,
 		ImageFormat_CompressedVHD=1,
-		ImageFormat_RawCowFile=2
+		ImageFormat_RawCowFile=2,
+		ImageFormat_ChunkStore=3
 	};
 
 	virtual IVHDFile *createVHDFile(const std::string &fn, bool pRead_only, uint64 pDstsize,
@@ -36,6 +37,11 @@ public:
 	virtual IVHDFile *createVHDFile(const std::string &fn, const std::string &parent_fn,
 		bool pRead_only, bool fast_mode=false, ImageFormat compress=ImageFormat_VHD, uint64 pDstsize=0)=0;
 
+	virtual IVHDFile *createChunkStoreFile(const std::string &fn, const std::string &parent_fn, const std::string &store_path,
+		bool pRead_only, uint64 pDstsize, unsigned int pBlocksize=512*1024)=0;
+
+	virtual bool releaseChunkStoreFile(const std::string &fn)=0;
+
 	virtual void destroyVHDFile(IVHDFile *vhd)=0;
 
 	virtual IReadOnlyBitmap* createClientBitmap(const std::string& fn)=0;
@@ -67,6 +67,7 @@ extern IServer* Server;
 #include "win_dialog.h"
 #endif
 #include "FileWrapper.h"
+#include "ChunkStoreFile.h"
 
 #ifdef __linux__
 #include <linux/fs.h>
@@ -1327,6 +1328,8 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	}
 #endif
 
+	ChunkStoreFile::init_mutex();
+
 	imagepluginmgr=new CImagePluginMgr;
 
 	Server->RegisterPluginThreadsafeModel( imagepluginmgr, "fsimageplugin");
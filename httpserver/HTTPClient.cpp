@@ -29,6 +29,7 @@
 #include "HTTPFile.h"
 #include "HTTPAction.h"
 #include "HTTPProxy.h"
+#include <algorithm>
 
 extern CHTTPService* http_service;
 
@@ -41,6 +42,7 @@ const int HTTP_STATE_KEEPALIVE=5;
 const int HTTP_STATE_DONE=6;
 
 const int HTTP_MAX_KEEPALIVE=15000;
+const size_t HTTP_MAX_LINE_SIZE=64*1024;
 
 IMutex *CHTTPClient::share_mutex=NULL;
 std::map<std::string, SShareProxy> CHTTPClient::shared_connections;
@@ -51,7 +53,6 @@ void CHTTPClient::Init(THREAD_ID pTID, IPipe *pPipe, const std::string& pEndpoin
 	pipe=pPipe;
 	do_quit=false;
 	http_g_state=HTTP_STATE_COMMAND;
-	http_state=0;
 	request_num=0;
 	request_ticket=ILLEGAL_THREADPOOL_TICKET;
 	fileupload=false;
@@ -74,23 +75,55 @@ void CHTTPClient::ReceivePackets(IRunOtherCallback* run_other)
 	size_t rc=pipe->Read(&data);
 	if( rc>0 )
 	{
-		for(size_t i=0;i<rc;++i)
+		size_t pos=0;
+		while(pos<rc)
 		{
-			char ch=data[i];
-			switch(http_g_state)
+			if(http_g_state==HTTP_STATE_KEEPALIVE)
 			{
-			case HTTP_STATE_KEEPALIVE:
 				reset();
 				http_g_state=HTTP_STATE_COMMAND;
-				//fallthrough
-			case HTTP_STATE_COMMAND:
-				processCommand(ch);
-				break;
-			case HTTP_STATE_HEADER:
-				processHeader(ch);
-				break;
-			case HTTP_STATE_CONTENT:
-				processContent(ch);
+			}
+
+			if(http_g_state==HTTP_STATE_COMMAND || http_g_state==HTTP_STATE_HEADER)
+			{
+				size_t line_end=data.find('\n', pos);
+				if(line_end==std::string::npos)
+				{
+					tmp.append(data, pos, rc-pos);
+					pos=rc;
+
+					if(tmp.size()>HTTP_MAX_LINE_SIZE)
+					{
+						do_quit=true;
+					}
+					break;
+				}
+
+				tmp.append(data, pos, line_end-pos);
+				pos=line_end+1;
+
+				if(!tmp.empty() && tmp[tmp.size()-1]=='\r')
+				{
+					tmp.erase(tmp.size()-1);
+				}
+
+				if(http_g_state==HTTP_STATE_COMMAND)
+				{
+					processCommand(tmp);
+				}
+				else
+				{
+					processHeader(tmp);
+				}
+
+				tmp.clear();
+			}
+			else if(http_g_state==HTTP_STATE_CONTENT)
+			{
+				pos+=processContent(data.data()+pos, rc-pos);
+			}
+			else
+			{
 				break;
 			}
 
@@ -105,7 +138,6 @@ void CHTTPClient::ReceivePackets(IRunOtherCallback* run_other)
 
 				break;
 			}
-
 		}
 	}
 	else
@@ -235,80 +267,49 @@ bool CHTTPClient::Run(IRunOtherCallback* run_other)
 	return true;
 }
 
-void CHTTPClient::processCommand(char ch)
+void CHTTPClient::processCommand(const std::string& line)
 {
-	switch(http_state)
+	if(line.empty())
 	{
-	case 0:
-		if( ch!=' ' )
-			http_state=1;
-		else
-			break;
-	case 1:
-		if( ch==' ' && !http_method.empty() )
-			http_state=2;
-		else if( ch!=' ' )
-			http_method+=(char)toupper(ch);
-		break;
-	case 2:
-		if( ch!=' ' && ch!='\r' && ch!='\n' )
+		return;
+	}
+
+	std::vector<std::string> toks;
+	Tokenize(line, toks, " ");
+
+	for(size_t i=0;i<toks.size();++i)
+	{
+		if(toks[i].empty())
 		{
-			tmp+=ch;
-			break;
+			continue;
 		}
-		else if( (ch==' ' || ch=='\r' || ch=='\n' ) && !tmp.empty() )
-		{
-			if( tmp=="HTTP/1.0" )
-				http_version=10;
-			else if( tmp=="HTTP/1.1" )
-				http_version=11;
-			else
-			{
-				if( tmp.size()>http_query.size() )
-					http_query=tmp;
-			}
-			tmp.clear();
 
-			if( ch=='\r' || ch=='\n'  )
-				http_state=4;
-			else
-				break;
+		if(http_method.empty())
+		{
+			http_method=toks[i];
+			strupper(&http_method);
+		}
+		else if( toks[i]=="HTTP/1.0" )
+		{
+			http_version=10;
+		}
+		else if( toks[i]=="HTTP/1.1" )
+		{
+			http_version=11;
+		}
+		else if( toks[i].size()>http_query.size() )
+		{
+			http_query=toks[i];
 		}
-	case 3:
-		if( ch=='\n' )
-			http_state=4;
-		else if( ch=='\r' )
-			break;
-	case 4:
-		http_g_state=HTTP_STATE_HEADER;
-		http_state=0;
-		tmp.clear();
 	}
+
+	http_g_state=HTTP_STATE_HEADER;
 }
 
-void CHTTPClient::processHeader(char ch)
+void CHTTPClient::processHeader(const std::string& line)
 {
-	switch(http_state)
+	if(line.empty())
 	{
-	case 0:
-		if( ch=='\r' || ch=='\n' )
-			http_state=1;
-		else 
-		{
-			if( ch!=':' )
-				http_header_key+=(char)toupper(ch);
-			else
-			{
-				http_state=3;
-			}
-			break;
-		}
-	case 1:
-		if( ch=='\n' )
-			http_state=2;
-		else
-			break;
-	case 2:
 		if( http_method=="POST")
 		{
 			str_map::iterator iter=http_params.find("CONTENT-LENGTH");
@@ -318,46 +319,35 @@ void CHTTPClient::processHeader(char ch)
 				if( http_remaining_content>0 )
 				{
 					http_g_state=HTTP_STATE_CONTENT;
-					break;
+					return;
 				}
 			}
 		}
 		http_g_state=HTTP_STATE_READY;
-		break;
+		return;
+	}
 
-	case 3:
-		if( ch!=' ')
-			http_state=4;
-		else
-			break;
-	case 4:
-		if( ch!='\r' && ch!='\n' )
-		{
-			tmp+=ch;
-			break;
-		}
-		else
-		{
-			http_params.insert(std::pair<std::string, std::string>(http_header_key, tmp) );
-			tmp.clear();
-			http_header_key.clear();
-			http_state=5;
-		}
-	case 5:
-		if( ch=='\n' )
-			http_state=0;
-		else
-			break;
+	size_t colon=line.find(':');
+	if(colon==std::string::npos)
+	{
+		return;
 	}
+
+	size_t value_start=line.find_first_not_of(' ', colon+1);
+	std::string value = value_start==std::string::npos ? std::string() : line.substr(value_start);
+
+	std::string key=line.substr(0, colon);
+	strupper(&key);
+
+	http_params.insert(std::pair<std::string, std::string>(key, value) );
 }
 
-void CHTTPClient::processContent(char ch)
+size_t CHTTPClient::processContent(const char* buf, size_t bsize)
 {
-	if( http_remaining_content>0 )
-	{
-		http_content+=ch;
-		--http_remaining_content;
-	}
+	size_t toadd=(std::min)(bsize, http_remaining_content);
+	http_content.append(buf, toadd);
+	http_remaining_content-=toadd;
+
 	if( http_remaining_content<=0 )
 	{
 		http_g_state=HTTP_STATE_READY;
@@ -374,6 +364,8 @@ void CHTTPClient::processContent(char ch)
 			}
 		}
 	}
+
+	return toadd;
 }
 
 std::vector<std::string> CHTTPClient::parseHTTPPath(std::string pPath)
@@ -537,7 +529,7 @@ bool CHTTPClient::processRequest(void)
 #ifdef _WIN32
 			rp = greplace("\\", "_", rp);
 #endif
-			CHTTPFile *file_handler=new CHTTPFile(http_service->getRoot()+rp, pipe);
+			CHTTPFile *file_handler=new CHTTPFile(http_service->getRoot()+rp, pipe, http_params);
 			request_ticket=Server->getThreadPool()->execute(file_handler);
 			request_handler=file_handler;
 			return true;
@@ -562,9 +554,7 @@ void CHTTPClient::reset(void)
 	http_method.clear();
 	http_query.clear();
 	http_content.clear();
-	http_state=0;
 	tmp.clear();
-	http_header_key.clear();
 	request_ticket=ILLEGAL_THREADPOOL_TICKET;
 	fileupload=false;
 }
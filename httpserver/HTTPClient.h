@@ -30,9 +30,9 @@ public:
 
 private:
 
-	inline void processCommand(char ch);
-	inline void processHeader(char ch);
-	inline void processContent(char ch);
+	inline void processCommand(const std::string& line);
+	inline void processHeader(const std::string& line);
+	inline size_t processContent(const char* buf, size_t bsize);
 	inline bool processRequest(void);
 	inline void reset(void);
 
@@ -48,12 +48,10 @@ private:
 	std::string http_content;
 	int http_version;
 	int http_g_state;
-	int http_state;
 	unsigned int http_keepalive_start;
 	unsigned int http_keepalive_count;
 	size_t http_remaining_content;
 	std::string tmp;
-	std::string http_header_key;
 	bool fileupload;
 	std::string endpoint;
 
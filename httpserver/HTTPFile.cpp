@@ -19,6 +19,7 @@
 #include "HTTPFile.h"
 #include "MIMEType.h"
 #include "IndexFiles.h"
+#include "HTTPFileCache.h"
 
 #include "../Interface/Server.h"
 #include "../Interface/File.h"
@@ -26,9 +27,12 @@
 
 #include "../stringtools.h"
 
-#define FP_READ_SIZE 8192
+#include <vector>
 
-CHTTPFile::CHTTPFile(std::string pFilename, IPipe *pOutput)
+#define FP_READ_SIZE 65536
+
+CHTTPFile::CHTTPFile(std::string pFilename, IPipe *pOutput, const str_map& pParams)
+	: params(pParams)
 {
 	filename=pFilename;
 	output=pOutput;
@@ -40,35 +44,69 @@ std::string CHTTPFile::getContentType(void)
 	return MIMEType::getMIMEType(ext);
 }
 
+bool CHTTPFile::isCompressible(const std::string& ct)
+{
+	return next(ct, 0, "text/")
+		|| ct.find("javascript")!=std::string::npos
+		|| ct.find("json")!=std::string::npos
+		|| ct.find("xml")!=std::string::npos;
+}
+
+bool CHTTPFile::acceptsGzip(void)
+{
+	str_map::iterator it=params.find("ACCEPT-ENCODING");
+	if(it==params.end())
+	{
+		return false;
+	}
+
+	std::string accept_encoding=strlower(it->second);
+	return accept_encoding.find("gzip")!=std::string::npos;
+}
+
+bool CHTTPFile::etagMatches(const std::string& etag)
+{
+	str_map::iterator it=params.find("IF-NONE-MATCH");
+	if(it==params.end())
+	{
+		return false;
+	}
+
+	return trim(it->second)=="*"
+		|| it->second.find(etag)!=std::string::npos;
+}
+
 void CHTTPFile::operator ()(void)
 {
 	Server->Log("Sending file \""+filename+"\"", LL_DEBUG);
-	IFile *fp=Server->openFile(filename);
 
-	if( fp==NULL )
+	std::string etag;
+	int64 fsize;
+	bool exists;
+	CHTTPFileCache::SEntry* entry=CHTTPFileCache::get(filename, isCompressible(getContentType()), etag, fsize, exists);
+
+	if( !exists )
 	{
+		std::string orig_filename=filename;
 		const std::vector<std::string> idxf=IndexFiles::getIndexFiles();
 		for(size_t i=0;i<idxf.size();++i)
 		{
-			std::string fn=filename+"/"+idxf[i];
-			fp=Server->openFile(fn);
-			if( fp!=NULL )
+			filename=orig_filename+"/"+idxf[i];
+			entry=CHTTPFileCache::get(filename, isCompressible(getContentType()), etag, fsize, exists);
+			if( exists )
 			{
-				filename=fn;
 				break;
 			}
 		}
 	}
 
-	std::string ct=getContentType();
-
-	if( fp==NULL )
+	if( !exists )
 	{
 		output->Write("HTTP/1.1 404 Not Found\r\nContent-Type: text/html\r\nContent-Length: 22\r\n\r\nSorry. File not found.");
 		return;
 	}
 
-	std::string status="HTTP/1.1 200 ok\r\n";
+	std::string ct=getContentType();
 
 	std::string cache_header = "Cache-Control: no-cache";
 	if (ExtractFileName(filename).find(".chash-")!=std::string::npos)
@@ -76,17 +114,79 @@ void CHTTPFile::operator ()(void)
 		cache_header = "Cache-Control: max-age=365000000, immutable";
 	}
 
-	std::string header="Server: CS\r\nContent-Type: "+ct+"\r\n"+cache_header+"\r\nConnection: Keep-Alive\r\nKeep-Alive: timeout=15, max=95\r\nContent-Length: "+convert(fp->Size())+"\r\n\r\n";
+	bool send_gzip = entry!=NULL && !entry->gzip_data.empty() && acceptsGzip();
+	if(send_gzip)
+	{
+		etag.insert(etag.size()-1, "-gz");
+	}
+
+	std::string encoding_header;
+	if(entry!=NULL && !entry->gzip_data.empty())
+	{
+		encoding_header="Vary: Accept-Encoding\r\n";
+		if(send_gzip)
+		{
+			encoding_header+="Content-Encoding: gzip\r\n";
+		}
+	}
+
+	if(etagMatches(etag))
+	{
+		if(entry!=NULL)
+		{
+			CHTTPFileCache::release(entry);
+		}
+
+		output->Write("HTTP/1.1 304 Not Modified\r\nServer: CS\r\n"+cache_header+"\r\nETag: "+etag+"\r\n"+encoding_header+"Connection: Keep-Alive\r\nKeep-Alive: timeout=15, max=95\r\n\r\n");
+		return;
+	}
+
+	std::string status="HTTP/1.1 200 ok\r\n";
+
+	std::string header="Server: CS\r\nContent-Type: "+ct+"\r\n"+cache_header+"\r\nETag: "+etag+"\r\n"+encoding_header+"Connection: Keep-Alive\r\nKeep-Alive: timeout=15, max=95\r\n";
+
+	if(entry!=NULL)
+	{
+		const std::string& body = send_gzip ? entry->gzip_data : entry->data;
+
+		output->Write(status+header+"Content-Length: "+convert(body.size())+"\r\n\r\n", -1, false);
+		output->Write(body);
+
+		CHTTPFileCache::release(entry);
+		return;
+	}
+
+	IFsFile *fp=Server->openFile(filename);
+
+	if( fp==NULL )
+	{
+		output->Write("HTTP/1.1 404 Not Found\r\nContent-Type: text/html\r\nContent-Length: 22\r\n\r\nSorry. File not found.");
+		return;
+	}
+
+	int64 size=fp->Size();
 
 	Server->Log("Sending file: "+filename, LL_DEBUG);
-	output->Write(status+header);
-	
-	size_t bytes=0;
-	std::string buf;
-	while( (buf=fp->Read(FP_READ_SIZE)).size()>0 )
+	output->Write(status+header+"Content-Length: "+convert(size)+"\r\n\r\n");
+
+	if(output->canSendFile())
+	{
+		if(!output->sendFile(fp, 0, size))
+		{
+			Server->Log("Error sending file \""+filename+"\"", LL_DEBUG);
+		}
+	}
+	else
 	{
-		bytes+=buf.size();
-		output->Write(buf);
+		std::vector<char> buf(FP_READ_SIZE);
+		_u32 read;
+		while( (read=fp->Read(&buf[0], FP_READ_SIZE))>0 )
+		{
+			if(!output->Write(&buf[0], read))
+			{
+				break;
+			}
+		}
 	}
 
 	Server->Log("Sending file: "+filename+" done", LL_DEBUG);
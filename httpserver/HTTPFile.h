@@ -1,5 +1,6 @@
 #include "../Interface/Thread.h"
 #include "../Interface/Object.h"
+#include "../Interface/Types.h"
 
 #include <string>
 
@@ -8,12 +9,17 @@ class IPipe;
 class CHTTPFile : public IThread, public IObject
 {
 public:
-	CHTTPFile(std::string pFilename, IPipe *pOutput);
+	CHTTPFile(std::string pFilename, IPipe *pOutput, const str_map& pParams);
 	std::string getContentType(void);
 	std::string getIndexFiles(void);
 	void operator()(void);
 
 private:
+	bool isCompressible(const std::string& ct);
+	bool acceptsGzip(void);
+	bool etagMatches(const std::string& etag);
+
 	std::string filename;
 	IPipe *output;
+	str_map params;
 };
@@ -0,0 +1,300 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "HTTPFileCache.h"
+
+#include "../Interface/Server.h"
+#include "../Interface/File.h"
+#include "../Interface/Mutex.h"
+
+#include "../stringtools.h"
+#include "../common/miniz.h"
+
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define FC_READ_SIZE 32768
+#define FC_REVALIDATE_MS 1000
+
+IMutex* CHTTPFileCache::mutex=NULL;
+std::map<std::string, CHTTPFileCache::SEntry*> CHTTPFileCache::entries;
+std::list<CHTTPFileCache::SEntry*> CHTTPFileCache::lru;
+size_t CHTTPFileCache::cache_size=0;
+size_t CHTTPFileCache::max_cache_size=32*1024*1024;
+int64 CHTTPFileCache::max_file_size=1024*1024;
+
+void CHTTPFileCache::init(void)
+{
+	mutex=Server->createMutex();
+
+	std::string s_cache_size=Server->getServerParameter("http_file_cache_size");
+	if(!s_cache_size.empty())
+	{
+		max_cache_size=static_cast<size_t>(watoi64(s_cache_size));
+	}
+
+	std::string s_max_file_size=Server->getServerParameter("http_file_cache_max_file_size");
+	if(!s_max_file_size.empty())
+	{
+		max_file_size=watoi64(s_max_file_size);
+	}
+}
+
+void CHTTPFileCache::destroy(void)
+{
+	for(std::map<std::string, SEntry*>::iterator it=entries.begin();it!=entries.end();++it)
+	{
+		delete it->second;
+	}
+	entries.clear();
+	lru.clear();
+	cache_size=0;
+
+	Server->destroy(mutex);
+}
+
+bool CHTTPFileCache::getFileStat(const std::string& fn, int64& size, int64& last_modified, bool& isdir)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if(_stat64(fn.c_str(), &st)!=0)
+	{
+		return false;
+	}
+#else
+	struct stat st;
+	if(stat(fn.c_str(), &st)!=0)
+	{
+		return false;
+	}
+#endif
+
+	size=st.st_size;
+	last_modified=st.st_mtime;
+	isdir=(st.st_mode & S_IFMT)==S_IFDIR;
+	return true;
+}
+
+CHTTPFileCache::SEntry* CHTTPFileCache::get(const std::string& fn, bool compress, std::string& etag, int64& size, bool& exists)
+{
+	int64 ctime=Server->getTimeMS();
+	exists=false;
+
+	{
+		IScopedLock lock(mutex);
+		std::map<std::string, SEntry*>::iterator it=entries.find(fn);
+		if(it!=entries.end()
+			&& ctime-it->second->last_check<FC_REVALIDATE_MS)
+		{
+			SEntry* entry=it->second;
+			++entry->refcount;
+			lru.splice(lru.begin(), lru, entry->lru_it);
+			etag=entry->etag;
+			size=entry->size;
+			exists=true;
+			return entry;
+		}
+	}
+
+	int64 last_modified;
+	bool isdir;
+	if(!getFileStat(fn, size, last_modified, isdir)
+		|| isdir)
+	{
+		IScopedLock lock(mutex);
+		std::map<std::string, SEntry*>::iterator it=entries.find(fn);
+		if(it!=entries.end())
+		{
+			evict(it->second);
+		}
+		return NULL;
+	}
+
+	exists=true;
+	etag="\""+convert(size)+"-"+convert(last_modified)+"\"";
+
+	{
+		IScopedLock lock(mutex);
+		std::map<std::string, SEntry*>::iterator it=entries.find(fn);
+		if(it!=entries.end())
+		{
+			SEntry* entry=it->second;
+			if(entry->size==size
+				&& entry->last_modified==last_modified)
+			{
+				entry->last_check=ctime;
+				++entry->refcount;
+				lru.splice(lru.begin(), lru, entry->lru_it);
+				return entry;
+			}
+
+			evict(entry);
+		}
+	}
+
+	if(size>max_file_size
+		|| static_cast<size_t>(size)>max_cache_size)
+	{
+		return NULL;
+	}
+
+	SEntry* new_entry=load(fn, compress, size, last_modified);
+	if(new_entry==NULL)
+	{
+		return NULL;
+	}
+
+	new_entry->etag=etag;
+	new_entry->last_check=ctime;
+
+	IScopedLock lock(mutex);
+
+	std::map<std::string, SEntry*>::iterator it=entries.find(fn);
+	if(it!=entries.end())
+	{
+		//Loaded concurrently by another request
+		delete new_entry;
+		++it->second->refcount;
+		return it->second;
+	}
+
+	new_entry->refcount=1;
+	entries[fn]=new_entry;
+	lru.push_front(new_entry);
+	new_entry->lru_it=lru.begin();
+	cache_size+=new_entry->data.size()+new_entry->gzip_data.size();
+
+	while(cache_size>max_cache_size
+		&& lru.back()!=new_entry)
+	{
+		evict(lru.back());
+	}
+
+	return new_entry;
+}
+
+void CHTTPFileCache::release(SEntry* entry)
+{
+	IScopedLock lock(mutex);
+
+	--entry->refcount;
+	if(entry->refcount==0 && entry->evicted)
+	{
+		delete entry;
+	}
+}
+
+void CHTTPFileCache::evict(SEntry* entry)
+{
+	entries.erase(entry->filename);
+	lru.erase(entry->lru_it);
+	cache_size-=entry->data.size()+entry->gzip_data.size();
+	entry->evicted=true;
+
+	if(entry->refcount==0)
+	{
+		delete entry;
+	}
+}
+
+CHTTPFileCache::SEntry* CHTTPFileCache::load(const std::string& fn, bool compress, int64 size, int64 last_modified)
+{
+	std::auto_ptr<IFile> fp(Server->openFile(fn));
+	if(fp.get()==NULL)
+	{
+		return NULL;
+	}
+
+	std::auto_ptr<SEntry> entry(new SEntry);
+	entry->filename=fn;
+	entry->size=size;
+	entry->last_modified=last_modified;
+	entry->refcount=0;
+	entry->evicted=false;
+	entry->data.resize(static_cast<size_t>(size));
+
+	size_t pos=0;
+	while(pos<entry->data.size())
+	{
+		_u32 toread=static_cast<_u32>((std::min)(entry->data.size()-pos, static_cast<size_t>(FC_READ_SIZE)));
+		if(fp->Read(&entry->data[pos], toread)!=toread)
+		{
+			Server->Log("Error reading file \""+fn+"\" into HTTP file cache", LL_WARNING);
+			return NULL;
+		}
+		pos+=toread;
+	}
+
+	if(compress && !entry->data.empty())
+	{
+		if(!gzipData(entry->data, entry->gzip_data)
+			|| entry->gzip_data.size()>=entry->data.size())
+		{
+			entry->gzip_data.clear();
+		}
+	}
+
+	return entry.release();
+}
+
+bool CHTTPFileCache::gzipData(const std::string& data, std::string& gzip_data)
+{
+	const char gzip_header[]={ '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 2, '\xff' };
+
+	mz_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if(mz_deflateInit2(&stream, MZ_BEST_COMPRESSION, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 9, MZ_DEFAULT_STRATEGY)!=MZ_OK)
+	{
+		return false;
+	}
+
+	size_t header_size=sizeof(gzip_header);
+	gzip_data.resize(header_size+mz_deflateBound(&stream, static_cast<mz_ulong>(data.size()))+8);
+	memcpy(&gzip_data[0], gzip_header, header_size);
+
+	stream.next_in=reinterpret_cast<const unsigned char*>(data.data());
+	stream.avail_in=static_cast<unsigned int>(data.size());
+	stream.next_out=reinterpret_cast<unsigned char*>(&gzip_data[header_size]);
+	stream.avail_out=static_cast<unsigned int>(gzip_data.size()-header_size-8);
+
+	int rc=mz_deflate(&stream, MZ_FINISH);
+	size_t comp_size=stream.total_out;
+	mz_deflateEnd(&stream);
+
+	if(rc!=MZ_STREAM_END)
+	{
+		return false;
+	}
+
+	unsigned int crc=static_cast<unsigned int>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const unsigned char*>(data.data()), data.size()));
+	unsigned int isize=static_cast<unsigned int>(data.size());
+
+	size_t trailer_pos=header_size+comp_size;
+	for(size_t i=0;i<4;++i)
+	{
+		gzip_data[trailer_pos+i]=static_cast<char>((crc>>(i*8)) & 0xFF);
+		gzip_data[trailer_pos+4+i]=static_cast<char>((isize>>(i*8)) & 0xFF);
+	}
+
+	gzip_data.resize(trailer_pos+8);
+
+	return true;
+}
@@ -0,0 +1,55 @@
+#include "../Interface/Types.h"
+
+#include <string>
+#include <map>
+#include <list>
+
+class IMutex;
+
+/**
+* Keeps small static files of the web root in memory, together with
+* a gzip compressed variant and an ETag. Entries are revalidated via
+* the file size and modification time at most once per second.
+*/
+class CHTTPFileCache
+{
+public:
+	struct SEntry
+	{
+		std::string filename;
+		std::string data;
+		std::string gzip_data;
+		std::string etag;
+		int64 size;
+		int64 last_modified;
+		int64 last_check;
+		size_t refcount;
+		bool evicted;
+		std::list<SEntry*>::iterator lru_it;
+	};
+
+	static void init(void);
+	static void destroy(void);
+
+	/**
+	* Returns the cached entry for the file (which has to be released
+	* with release()) or NULL if the file is not cached. etag and
+	* size are then set from the file attributes if the file exists.
+	*/
+	static SEntry* get(const std::string& fn, bool compress, std::string& etag, int64& size, bool& exists);
+	static void release(SEntry* entry);
+
+	static bool getFileStat(const std::string& fn, int64& size, int64& last_modified, bool& isdir);
+
+private:
+	static SEntry* load(const std::string& fn, bool compress, int64 size, int64 last_modified);
+	static bool gzipData(const std::string& data, std::string& gzip_data);
+	static void evict(SEntry* entry);
+
+	static IMutex* mutex;
+	static std::map<std::string, SEntry*> entries;
+	static std::list<SEntry*> lru;
+	static size_t cache_size;
+	static size_t max_cache_size;
+	static int64 max_file_size;
+};
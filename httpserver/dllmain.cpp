@@ -39,6 +39,7 @@
 #include "MIMEType.h"
 #include "IndexFiles.h"
 #include "HTTPClient.h"
+#include "HTTPFileCache.h"
 
 #ifndef STATIC_PLUGIN
 IServer *Server;
@@ -64,6 +65,7 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	}
 
 	CHTTPClient::init_mutex();
+	CHTTPFileCache::init();
 
 	add_default_mimetypes();
 	add_default_indexfiles();
@@ -118,6 +120,7 @@ DLLEXPORT void UnloadActions(void)
 	if(Server->getServerParameter("leak_check")=="true")
 	{
 		CHTTPClient::destroy_mutex();
+		CHTTPFileCache::destroy();
 	}
 }
 
@@ -0,0 +1,574 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ClientDirRecord.h"
+#include "../Interface/Server.h"
+#include <string.h>
+#include <algorithm>
+
+namespace
+{
+	/*
+	* Header: marker (0, the previous format starts with the
+	* non-zero size of the first name), version, hash width,
+	* number of entries, size of the name heap and size of the
+	* symlink target heap
+	*/
+	const _u16 record_version = 1;
+	const size_t record_header_size = sizeof(_u16) * 2 + sizeof(_u32) * 4;
+	const size_t record_off_hash_width = sizeof(_u16) * 2;
+	const size_t record_off_count = record_off_hash_width + sizeof(_u32);
+	const size_t record_off_names_size = record_off_count + sizeof(_u32);
+	const size_t record_off_symlinks_size = record_off_names_size + sizeof(_u32);
+
+	const char record_flag_dir = 1;
+	const char record_flag_sym = 2;
+	const char record_flag_specialf = 4;
+
+	template<typename T>
+	T read_val(const std::string& data, size_t off)
+	{
+		T ret;
+		memcpy(&ret, data.data() + off, sizeof(T));
+		return ret;
+	}
+
+	template<typename T>
+	void write_val(std::string& data, size_t off, T val)
+	{
+		memcpy(&data[off], &val, sizeof(T));
+	}
+
+	char file_flags(const SFileAndHash& file)
+	{
+		char ret = 0;
+		if (file.isdir) ret |= record_flag_dir;
+		if (file.issym) ret |= record_flag_sym;
+		if (file.isspecialf) ret |= record_flag_specialf;
+		return ret;
+	}
+
+	int compare_name(const char* name, size_t name_size, const std::string& other)
+	{
+		int rc = memcmp(name, other.data(), (std::min)(name_size, other.size()));
+		if (rc != 0)
+		{
+			return rc;
+		}
+		if (name_size < other.size())
+		{
+			return -1;
+		}
+		if (name_size > other.size())
+		{
+			return 1;
+		}
+		return 0;
+	}
+}
+
+ClientDirRecord::ClientDirRecord()
+	: count(0), hash_width(0)
+{
+	setLayout(0, 0);
+}
+
+bool ClientDirRecord::set(std::string& n_data)
+{
+	data.swap(n_data);
+	n_data.clear();
+
+	if (!parse())
+	{
+		Server->Log("Directory record is corrupt", LL_ERROR);
+		data.clear();
+		parse();
+		return false;
+	}
+
+	return true;
+}
+
+bool ClientDirRecord::parse()
+{
+	if (data.empty())
+	{
+		setLayout(0, 0);
+		return true;
+	}
+
+	if (data.size() < record_header_size
+		|| read_val<_u16>(data, sizeof(_u16)) != record_version)
+	{
+		setLayout(0, 0);
+		return false;
+	}
+
+	_u32 n_count = read_val<_u32>(data, record_off_count);
+	_u32 n_hash_width = read_val<_u32>(data, record_off_hash_width);
+	uint64 names_size = read_val<_u32>(data, record_off_names_size);
+	uint64 symlinks_size = read_val<_u32>(data, record_off_symlinks_size);
+
+	uint64 total = record_header_size + static_cast<uint64>(n_count)*(sizeof(int64) + sizeof(uint64)
+		+ sizeof(_u32) * 2 + sizeof(char) + sizeof(_u16) + n_hash_width) + names_size + symlinks_size;
+
+	if (total != data.size())
+	{
+		setLayout(0, 0);
+		return false;
+	}
+
+	setLayout(n_count, n_hash_width);
+
+	_u32 last_name_end = 0;
+	_u32 last_symlink_end = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		_u32 name_end = read_val<_u32>(data, off_name_ends + i*sizeof(_u32));
+		_u32 symlink_end = read_val<_u32>(data, off_symlink_ends + i*sizeof(_u32));
+		if (name_end < last_name_end
+			|| symlink_end < last_symlink_end
+			|| read_val<_u16>(data, off_hash_sizes + i*sizeof(_u16)) > hash_width)
+		{
+			setLayout(0, 0);
+			return false;
+		}
+		last_name_end = name_end;
+		last_symlink_end = symlink_end;
+	}
+
+	if (last_name_end != names_size
+		|| last_symlink_end != symlinks_size)
+	{
+		setLayout(0, 0);
+		return false;
+	}
+
+	return true;
+}
+
+void ClientDirRecord::setLayout(_u32 n_count, _u32 n_hash_width)
+{
+	count = n_count;
+	hash_width = n_hash_width;
+
+	off_sizes = record_header_size;
+	off_change_indicators = off_sizes + count*sizeof(int64);
+	off_name_ends = off_change_indicators + count*sizeof(uint64);
+	off_symlink_ends = off_name_ends + count*sizeof(_u32);
+	off_flags = off_symlink_ends + count*sizeof(_u32);
+	off_hash_sizes = off_flags + count*sizeof(char);
+	off_hashes = off_hash_sizes + count*sizeof(_u16);
+	off_names = off_hashes + static_cast<size_t>(count)*hash_width;
+
+	if (data.size() >= record_header_size)
+	{
+		off_symlinks = off_names + read_val<_u32>(data, record_off_names_size);
+	}
+	else
+	{
+		off_symlinks = off_names;
+	}
+}
+
+const char* ClientDirRecord::name(size_t idx, size_t& name_size) const
+{
+	_u32 start = idx == 0 ? 0 : read_val<_u32>(data, off_name_ends + (idx - 1)*sizeof(_u32));
+	_u32 end = read_val<_u32>(data, off_name_ends + idx*sizeof(_u32));
+	name_size = end - start;
+	return data.data() + off_names + start;
+}
+
+bool ClientDirRecord::nameEquals(size_t idx, const std::string& other) const
+{
+	size_t name_size;
+	const char* name_ptr = name(idx, name_size);
+	return name_size == other.size()
+		&& memcmp(name_ptr, other.data(), name_size) == 0;
+}
+
+int64 ClientDirRecord::filesize(size_t idx) const
+{
+	return read_val<int64>(data, off_sizes + idx*sizeof(int64));
+}
+
+uint64 ClientDirRecord::changeIndicator(size_t idx) const
+{
+	return read_val<uint64>(data, off_change_indicators + idx*sizeof(uint64));
+}
+
+bool ClientDirRecord::isdir(size_t idx) const
+{
+	return (data[off_flags + idx] & record_flag_dir) != 0;
+}
+
+bool ClientDirRecord::issym(size_t idx) const
+{
+	return (data[off_flags + idx] & record_flag_sym) != 0;
+}
+
+bool ClientDirRecord::isspecialf(size_t idx) const
+{
+	return (data[off_flags + idx] & record_flag_specialf) != 0;
+}
+
+const char* ClientDirRecord::hash(size_t idx, size_t& hash_size) const
+{
+	hash_size = read_val<_u16>(data, off_hash_sizes + idx*sizeof(_u16));
+	return data.data() + off_hashes + idx*hash_width;
+}
+
+const char* ClientDirRecord::symlinkTarget(size_t idx, size_t& target_size) const
+{
+	_u32 start = idx == 0 ? 0 : read_val<_u32>(data, off_symlink_ends + (idx - 1)*sizeof(_u32));
+	_u32 end = read_val<_u32>(data, off_symlink_ends + idx*sizeof(_u32));
+	target_size = end - start;
+	return data.data() + off_symlinks + start;
+}
+
+void ClientDirRecord::get(size_t idx, SFileAndHash& file) const
+{
+	size_t ssize;
+	const char* ptr = name(idx, ssize);
+	file.name.assign(ptr, ssize);
+	file.size = filesize(idx);
+	file.change_indicator = changeIndicator(idx);
+	file.isdir = isdir(idx);
+	ptr = hash(idx, ssize);
+	file.hash.assign(ptr, ssize);
+	file.issym = issym(idx);
+	file.isspecialf = isspecialf(idx);
+	ptr = symlinkTarget(idx, ssize);
+	file.symlink_target.assign(ptr, ssize);
+}
+
+void ClientDirRecord::getAll(std::vector<SFileAndHash>& files) const
+{
+	files.reserve(files.size() + count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		SFileAndHash f;
+		get(i, f);
+		files.push_back(f);
+	}
+}
+
+size_t ClientDirRecord::find(const std::string& fn) const
+{
+	size_t lo = 0;
+	size_t hi = count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		size_t name_size;
+		const char* name_ptr = name(mid, name_size);
+		int rc = compare_name(name_ptr, name_size, fn);
+		if (rc == 0)
+		{
+			return mid;
+		}
+		else if (rc < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return count;
+}
+
+bool ClientDirRecord::equals(size_t idx, const SFileAndHash& file) const
+{
+	if (!nameEquals(idx, file.name)
+		|| filesize(idx) != file.size
+		|| changeIndicator(idx) != file.change_indicator
+		|| data[off_flags + idx] != file_flags(file))
+	{
+		return false;
+	}
+
+	size_t ssize;
+	const char* ptr = hash(idx, ssize);
+	if (ssize != file.hash.size()
+		|| memcmp(ptr, file.hash.data(), ssize) != 0)
+	{
+		return false;
+	}
+
+	ptr = symlinkTarget(idx, ssize);
+	return ssize == file.symlink_target.size()
+		&& memcmp(ptr, file.symlink_target.data(), ssize) == 0;
+}
+
+bool ClientDirRecord::equals(const std::vector<SFileAndHash>& files) const
+{
+	if (files.size() != count)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!equals(i, files[i]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ClientDirRecord::update(size_t idx, const SFileAndHash& file)
+{
+	size_t target_size;
+	const char* target = symlinkTarget(idx, target_size);
+	if (!nameEquals(idx, file.name)
+		|| target_size != file.symlink_target.size()
+		|| memcmp(target, file.symlink_target.data(), target_size) != 0)
+	{
+		return false;
+	}
+
+	write_val<int64>(data, off_sizes + idx*sizeof(int64), file.size);
+	write_val<uint64>(data, off_change_indicators + idx*sizeof(uint64), file.change_indicator);
+	data[off_flags + idx] = file_flags(file);
+	setHash(idx, file.hash);
+
+	return true;
+}
+
+void ClientDirRecord::setHash(size_t idx, const std::string& new_hash)
+{
+	if (new_hash.size() > hash_width)
+	{
+		widenHashes(static_cast<_u32>(new_hash.size()));
+	}
+
+	write_val<_u16>(data, off_hash_sizes + idx*sizeof(_u16), static_cast<_u16>(new_hash.size()));
+	char* ptr = &data[off_hashes + idx*hash_width];
+	if (!new_hash.empty())
+	{
+		memcpy(ptr, new_hash.data(), new_hash.size());
+	}
+	memset(ptr + new_hash.size(), 0, hash_width - new_hash.size());
+}
+
+void ClientDirRecord::widenHashes(_u32 n_hash_width)
+{
+	std::string n_data;
+	n_data.resize(data.size() + static_cast<size_t>(count)*(n_hash_width - hash_width));
+
+	memcpy(&n_data[0], data.data(), off_hashes);
+	write_val<_u32>(n_data, record_off_hash_width, n_hash_width);
+
+	char* ptr = &n_data[off_hashes];
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (hash_width > 0)
+		{
+			memcpy(ptr, data.data() + off_hashes + i*hash_width, hash_width);
+		}
+		memset(ptr + hash_width, 0, n_hash_width - hash_width);
+		ptr += n_hash_width;
+	}
+
+	if (data.size() > off_names)
+	{
+		memcpy(ptr, data.data() + off_names, data.size() - off_names);
+	}
+
+	data.swap(n_data);
+	setLayout(count, n_hash_width);
+}
+
+void ClientDirRecord::assign(const std::vector<SFileAndHash>& files)
+{
+	if (files.size() != count
+		|| data.empty())
+	{
+		encode(files, data);
+		parse();
+		return;
+	}
+
+	size_t max_hash_size = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t target_size;
+		const char* target = symlinkTarget(i, target_size);
+		if (!nameEquals(i, files[i].name)
+			|| target_size != files[i].symlink_target.size()
+			|| memcmp(target, files[i].symlink_target.data(), target_size) != 0)
+		{
+			encode(files, data);
+			parse();
+			return;
+		}
+
+		max_hash_size = (std::max)(max_hash_size, files[i].hash.size());
+	}
+
+	if (max_hash_size > hash_width)
+	{
+		widenHashes(static_cast<_u32>(max_hash_size));
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!equals(i, files[i]))
+		{
+			update(i, files[i]);
+		}
+	}
+}
+
+void ClientDirRecord::encode(const std::vector<SFileAndHash>& files, std::string& out)
+{
+	size_t n_hash_width = 0;
+	size_t names_size = 0;
+	size_t symlinks_size = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		n_hash_width = (std::max)(n_hash_width, files[i].hash.size());
+		names_size += files[i].name.size();
+		symlinks_size += files[i].symlink_target.size();
+	}
+
+	size_t n_count = files.size();
+	out.clear();
+	out.resize(record_header_size + n_count*(sizeof(int64) + sizeof(uint64)
+		+ sizeof(_u32) * 2 + sizeof(char) + sizeof(_u16) + n_hash_width) + names_size + symlinks_size);
+
+	write_val<_u16>(out, 0, 0);
+	write_val<_u16>(out, sizeof(_u16), record_version);
+	write_val<_u32>(out, record_off_hash_width, static_cast<_u32>(n_hash_width));
+	write_val<_u32>(out, record_off_count, static_cast<_u32>(n_count));
+	write_val<_u32>(out, record_off_names_size, static_cast<_u32>(names_size));
+	write_val<_u32>(out, record_off_symlinks_size, static_cast<_u32>(symlinks_size));
+
+	size_t pos_sizes = record_header_size;
+	size_t pos_change_indicators = pos_sizes + n_count*sizeof(int64);
+	size_t pos_name_ends = pos_change_indicators + n_count*sizeof(uint64);
+	size_t pos_symlink_ends = pos_name_ends + n_count*sizeof(_u32);
+	size_t pos_flags = pos_symlink_ends + n_count*sizeof(_u32);
+	size_t pos_hash_sizes = pos_flags + n_count*sizeof(char);
+	size_t pos_hashes = pos_hash_sizes + n_count*sizeof(_u16);
+	size_t pos_names = pos_hashes + n_count*n_hash_width;
+	size_t pos_symlinks = pos_names + names_size;
+
+	_u32 name_end = 0;
+	_u32 symlink_end = 0;
+	for (size_t i = 0; i < n_count; ++i)
+	{
+		const SFileAndHash& file = files[i];
+
+		write_val<int64>(out, pos_sizes + i*sizeof(int64), file.size);
+		write_val<uint64>(out, pos_change_indicators + i*sizeof(uint64), file.change_indicator);
+		out[pos_flags + i] = file_flags(file);
+		write_val<_u16>(out, pos_hash_sizes + i*sizeof(_u16), static_cast<_u16>(file.hash.size()));
+
+		if (!file.hash.empty())
+		{
+			memcpy(&out[pos_hashes + i*n_hash_width], file.hash.data(), file.hash.size());
+		}
+
+		if (!file.name.empty())
+		{
+			memcpy(&out[pos_names + name_end], file.name.data(), file.name.size());
+		}
+		name_end += static_cast<_u32>(file.name.size());
+		write_val<_u32>(out, pos_name_ends + i*sizeof(_u32), name_end);
+
+		if (!file.symlink_target.empty())
+		{
+			memcpy(&out[pos_symlinks + symlink_end], file.symlink_target.data(), file.symlink_target.size());
+		}
+		symlink_end += static_cast<_u32>(file.symlink_target.size());
+		write_val<_u32>(out, pos_symlink_ends + i*sizeof(_u32), symlink_end);
+	}
+}
+
+bool ClientDirRecord::convertLegacy(std::string& data)
+{
+	if (data.empty()
+		|| (data.size() >= sizeof(_u16) && read_val<_u16>(data, 0) == 0))
+	{
+		return true;
+	}
+
+	std::vector<SFileAndHash> files;
+	if (!decodeLegacy(data, files))
+	{
+		return false;
+	}
+
+	encode(files, data);
+	return true;
+}
+
+bool ClientDirRecord::decodeLegacy(const std::string& data, std::vector<SFileAndHash>& files)
+{
+	size_t pos = 0;
+	while (pos < data.size())
+	{
+		SFileAndHash f;
+		unsigned short ss;
+		if (pos + sizeof(unsigned short) > data.size()) return false;
+		memcpy(&ss, &data[pos], sizeof(unsigned short));
+		pos += sizeof(unsigned short);
+
+		if (pos + ss + sizeof(int64) * 2 + 1 + sizeof(unsigned short) > data.size()) return false;
+		f.name.assign(&data[pos], ss);
+		pos += ss;
+		memcpy(&f.size, &data[pos], sizeof(int64));
+		pos += sizeof(int64);
+		memcpy(&f.change_indicator, &data[pos], sizeof(uint64));
+		pos += sizeof(uint64);
+		f.isdir = data[pos] != 0;
+		++pos;
+
+		unsigned short hashsize;
+		memcpy(&hashsize, &data[pos], sizeof(unsigned short));
+		pos += sizeof(unsigned short);
+
+		if (pos + hashsize + 2 > data.size()) return false;
+		f.hash.assign(&data[pos], hashsize);
+		pos += hashsize;
+
+		f.issym = data[pos] != 0;
+		++pos;
+		f.isspecialf = data[pos] != 0;
+		++pos;
+
+		if (f.issym)
+		{
+			if (pos + sizeof(unsigned short) > data.size()) return false;
+			memcpy(&ss, &data[pos], sizeof(unsigned short));
+			pos += sizeof(unsigned short);
+			if (pos + ss > data.size()) return false;
+			f.symlink_target.assign(&data[pos], ss);
+			pos += ss;
+		}
+
+		files.push_back(f);
+	}
+
+	return true;
+}
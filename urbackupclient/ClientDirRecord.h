@@ -0,0 +1,99 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "clientdao.h"
+#include <string>
+#include <vector>
+
+/**
+* Directory record of the client file index (data column of the files table).
+* Entries are stored column-wise (fixed width columns for size, change
+* indicator, flags and hash, name and symlink target heaps), so they can be
+* accessed in place without decoding every entry into a SFileAndHash.
+* Changed entries can be updated in place as long as the name and symlink
+* target stay the same. Records in the previous row-wise format are
+* converted by the client database upgrade to version 28.
+*/
+class ClientDirRecord
+{
+public:
+	ClientDirRecord();
+
+	/**
+	* Takes the content of data
+	*/
+	bool set(std::string& data);
+
+	const std::string& getData() const {
+		return data;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	const char* name(size_t idx, size_t& name_size) const;
+	bool nameEquals(size_t idx, const std::string& other) const;
+	int64 filesize(size_t idx) const;
+	uint64 changeIndicator(size_t idx) const;
+	bool isdir(size_t idx) const;
+	bool issym(size_t idx) const;
+	bool isspecialf(size_t idx) const;
+	const char* hash(size_t idx, size_t& hash_size) const;
+	const char* symlinkTarget(size_t idx, size_t& target_size) const;
+
+	void get(size_t idx, SFileAndHash& file) const;
+	void getAll(std::vector<SFileAndHash>& files) const;
+
+	/**
+	* Returns size() if there is no entry with this name.
+	* Entries are sorted by name.
+	*/
+	size_t find(const std::string& name) const;
+
+	bool equals(size_t idx, const SFileAndHash& file) const;
+	bool equals(const std::vector<SFileAndHash>& files) const;
+
+	/**
+	* Updates size, change indicator, flags and hash of entry idx.
+	* Returns false if the name or the symlink target differs.
+	*/
+	bool update(size_t idx, const SFileAndHash& file);
+	void setHash(size_t idx, const std::string& new_hash);
+
+	/**
+	* Changes this record to files. Only changed entries are
+	* written if the names and symlink targets are unchanged,
+	* otherwise the whole record is encoded.
+	*/
+	void assign(const std::vector<SFileAndHash>& files);
+
+	static void encode(const std::vector<SFileAndHash>& files, std::string& out);
+
+	/**
+	* Converts a record in the previous row-wise format in place.
+	* Records in the current format are left unchanged.
+	*/
+	static bool convertLegacy(std::string& data);
+
+private:
+	bool parse();
+	void setLayout(_u32 n_count, _u32 n_hash_width);
+	void widenHashes(_u32 n_hash_width);
+
+	static bool decodeLegacy(const std::string& data, std::vector<SFileAndHash>& files);
+
+	std::string data;
+	_u32 count;
+	_u32 hash_width;
+
+	size_t off_sizes;
+	size_t off_change_indicators;
+	size_t off_name_ends;
+	size_t off_symlink_ends;
+	size_t off_flags;
+	size_t off_hash_sizes;
+	size_t off_hashes;
+	size_t off_names;
+	size_t off_symlinks;
+};
@@ -37,6 +37,7 @@
 #include "InternetClient.h"
 #include "../urbackupcommon/settingslist.h"
 #include "../urbackupcommon/capa_bits.h"
+#include "../urbackupcommon/image_restore_frame.h"
 
 #include <memory.h>
 #include <stdlib.h>
@@ -2436,6 +2437,24 @@ std::string ClientConnector::receivePacket(const SChannel& channel, int64 timeou
 	return "";
 }
 
+namespace
+{
+	bool readPipeFull(IPipe* pipe, char* buf, size_t bsize, int timeoutms)
+	{
+		size_t read = 0;
+		while (read < bsize)
+		{
+			size_t r = pipe->Read(&buf[read], bsize - read, timeoutms);
+			if (r == 0)
+			{
+				return false;
+			}
+			read += r;
+		}
+		return true;
+	}
+}
+
 void ClientConnector::removeChannelpipe(IPipe *cp)
 {
 	for (size_t i = 0; i < channel_pipes.size(); ++i)
@@ -2483,8 +2502,22 @@ void ClientConnector::downloadImage(str_map params)
 		{
 			offset="&offset="+params["offset"];
 		}
+
+		bool extents = params["extents"] == "1"
+			&& params["mbr"] != "true"
+			&& channel_pipes[i].restore_version >= 2;
+		std::string extent_params;
+		if (extents)
+		{
+			extent_params = "&extents=1";
+			if (channel_pipes[i].internet_connection)
+			{
+				extent_params += "&compress=1";
+			}
+		}
+
 		sendChannelPacket(channel_pipes[i], "DOWNLOAD IMAGE with_used_bytes=1&img_id=" 
-			+ params["img_id"] + "&time=" + params["time"] + "&mbr=" + params["mbr"] + offset);
+			+ params["img_id"] + "&time=" + params["time"] + "&mbr=" + params["mbr"] + offset + extent_params);
 		
 		Server->Log("Downloading from channel "+convert((int)i), LL_DEBUG);
 
@@ -2561,6 +2594,87 @@ void ClientConnector::downloadImage(str_map params)
 			Server->Log("Used bytes " + convert(used_bytes), LL_DEBUG);
 		}
 
+		if (params["extents"] == "1")
+		{
+			_i64 stream_version = extents ? c_image_restore_stream_extents : c_image_restore_stream_blocks;
+			if (!pipe->Write((char*)&stream_version, sizeof(_i64), (int)receive_timeouttime))
+			{
+				Server->Log("Could not write to pipe! downloadImage-6", LL_ERROR);
+				return;
+			}
+		}
+
+		if (extents)
+		{
+			_i64 received_bytes = 0;
+			while (true)
+			{
+				SImageRestoreFrame frame;
+				if (!readPipeFull(c, (char*)&frame, sizeof(frame), 180000))
+				{
+					Server->Log("Read Timeout -3 CS", LL_ERROR);
+					removeChannelpipe(c);
+					return;
+				}
+				if (!pipe->Write((char*)&frame, sizeof(frame), (int)receive_timeouttime * 5))
+				{
+					Server->Log("Could not write to pipe! downloadImage-7", LL_ERROR);
+					removeChannelpipe(c);
+					return;
+				}
+
+				if (little_endian(frame.pos) == c_image_restore_end)
+				{
+					break;
+				}
+
+				_u32 data_size = little_endian(frame.comp_size);
+				if (data_size == 0)
+				{
+					data_size = little_endian(frame.size);
+				}
+
+				if (data_size > c_image_restore_max_frame_size)
+				{
+					Server->Log("Invalid image frame size: " + convert(data_size), LL_ERROR);
+					removeChannelpipe(c);
+					return;
+				}
+
+				while (data_size > 0)
+				{
+					size_t r = c->Read(buf, (std::min)(c_buffer_size, static_cast<size_t>(data_size)), 180000);
+					if (r == 0)
+					{
+						Server->Log("Read Timeout -4 CS", LL_ERROR);
+						removeChannelpipe(c);
+						return;
+					}
+					if (!pipe->Write(buf, r, (int)receive_timeouttime * 5))
+					{
+						Server->Log("Could not write to pipe! downloadImage-8", LL_ERROR);
+						removeChannelpipe(c);
+						return;
+					}
+					data_size -= static_cast<_u32>(r);
+				}
+
+				received_bytes += little_endian(frame.size);
+
+				int t_pcdone = (std::min)((int)100, (int)(((float)received_bytes / (float)used_bytes)*100.f + 0.5f));
+				if (t_pcdone != l_pcdone)
+				{
+					l_pcdone = t_pcdone;
+					updateRunningPc(local_backup_running_id, l_pcdone);
+				}
+
+				lasttime = Server->getTimeMS();
+			}
+			remove_running_backup.setSuccess(true);
+			Server->Log("Downloading image done", LL_DEBUG);
+			return;
+		}
+
 		unsigned int blockleft=0;
 		unsigned int off=0;
 		_i64 pos=0;
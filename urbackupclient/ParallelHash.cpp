@@ -2,6 +2,7 @@
 #include "../Interface/Server.h"
 #include "../Interface/ThreadPool.h"
 #include "ClientHash.h"
+#include "ClientDirRecord.h"
 #include <algorithm>
 #include "database.h"
 #include "../stringtools.h"
@@ -10,14 +11,36 @@ namespace
 {
 	const size_t max_modify_file_buffer_size = 2 * 1024 * 1024;
 	const int64 file_buffer_commit_interval = 120 * 1000;
+	const size_t max_hash_jobs_per_worker = 4;
+
+	class ParallelHashWorker : public IThread
+	{
+	public:
+		ParallelHashWorker(ParallelHash* phash)
+			: phash(phash)
+		{}
+
+		void operator()()
+		{
+			phash->runHashWorker();
+			delete this;
+		}
+
+	private:
+		ParallelHash* phash;
+	};
 }
 
 ParallelHash::ParallelHash(IFile * phash_queue, int sha_version)
 	: do_quit(false), phash_queue(phash_queue), phash_queue_pos(0),
 	stdout_buf_size(0), stdout_buf_pos(0), mutex(Server->createMutex()),
-	last_file_buffer_commit_time(0), sha_version(sha_version), eof(false)
+	last_file_buffer_commit_time(0), sha_version(sha_version), eof(false),
+	hash_mutex(Server->createMutex()), hash_cond(Server->createCondition()),
+	workers_quit(false), hash_init_generation(0), index_hdat_file(NULL),
+	index_hdat_fs_block_size(0), snapshot_sequence_id(NULL), snapshot_sequence_id_reference(0)
 {
 	stdout_buf.resize(4090);
+	n_workers = (std::max)(1, watoi(Server->getServerParameter("phash_workers", "4")));
 	ticket = Server->getThreadPool()->execute(this, "phash");
 }
 
@@ -93,6 +116,8 @@ void ParallelHash::operator()()
 {
 	ClientDAO clientdao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_CLIENT));
 
+	startHashWorkers();
+
 	while (!do_quit)
 	{
 		bool had_msg = false;
@@ -117,15 +142,18 @@ void ParallelHash::operator()()
 
 					if (eof)
 					{
-						commitModifyFileBuffer(clientdao);
-						return;
+						break;
 					}
 				}
 			}
 		}
-		if (!had_msg)
+		if (!had_msg
+			&& !emitHashJobs(std::string::npos, 1000))
 		{
-			Server->wait(1000);
+			if (hash_jobs.empty())
+			{
+				Server->wait(1000);
+			}
 			CWData data;
 			data.addUShort(1);
 			data.addChar(0);
@@ -133,15 +161,147 @@ void ParallelHash::operator()()
 		}
 	}
 
+	stopHashWorkers();
+
 	commitModifyFileBuffer(clientdao);
 }
 
+void ParallelHash::runHashWorker()
+{
+	std::auto_ptr<ClientHash> worker_client_hash;
+	size_t worker_hash_generation = 0;
+
+	IScopedLock lock(hash_mutex.get());
+	while (true)
+	{
+		while (pending_hash_jobs.empty()
+			&& !workers_quit)
+		{
+			hash_cond->wait(&lock);
+		}
+
+		if (workers_quit)
+		{
+			return;
+		}
+
+		SHashJob* job = pending_hash_jobs.front();
+		pending_hash_jobs.pop_front();
+
+		if (worker_client_hash.get() == NULL
+			|| worker_hash_generation != hash_init_generation)
+		{
+			//The change block tracking data file is owned by client_hash
+			worker_client_hash.reset(new ClientHash(index_hdat_file, false, index_hdat_fs_block_size,
+				snapshot_sequence_id, snapshot_sequence_id_reference));
+			worker_hash_generation = hash_init_generation;
+		}
+
+		lock.relock(NULL);
+
+		bool ok = hashJob(*job, *worker_client_hash);
+
+		lock.relock(hash_mutex.get());
+
+		job->ok = ok;
+		job->done = true;
+		hash_cond->notify_all();
+	}
+}
+
+void ParallelHash::startHashWorkers()
+{
+	for (size_t i = 0; i < n_workers; ++i)
+	{
+		worker_tickets.push_back(Server->getThreadPool()->execute(new ParallelHashWorker(this), "phash worker"));
+	}
+}
+
+void ParallelHash::stopHashWorkers()
+{
+	{
+		IScopedLock lock(hash_mutex.get());
+		workers_quit = true;
+		hash_cond->notify_all();
+	}
+
+	Server->getThreadPool()->waitFor(worker_tickets);
+	worker_tickets.clear();
+
+	for (size_t i = 0; i < hash_jobs.size(); ++i)
+	{
+		delete hash_jobs[i];
+	}
+	hash_jobs.clear();
+	pending_hash_jobs.clear();
+}
+
+void ParallelHash::setHashInit(IFile* new_index_hdat_file, int64 new_index_hdat_fs_block_size,
+	size_t* new_snapshot_sequence_id, size_t new_snapshot_sequence_id_reference)
+{
+	IScopedLock lock(hash_mutex.get());
+	index_hdat_file = new_index_hdat_file;
+	index_hdat_fs_block_size = new_index_hdat_fs_block_size;
+	snapshot_sequence_id = new_snapshot_sequence_id;
+	snapshot_sequence_id_reference = new_snapshot_sequence_id_reference;
+	++hash_init_generation;
+}
+
+bool ParallelHash::emitHashJobs(size_t max_outstanding, int timeoutms)
+{
+	bool emitted = false;
+
+	IScopedLock lock(hash_mutex.get());
+	while (!hash_jobs.empty()
+		&& !do_quit)
+	{
+		SHashJob* job = hash_jobs.front();
+		if (!job->done)
+		{
+			if (hash_jobs.size() > max_outstanding)
+			{
+				hash_cond->wait(&lock, 1000);
+				continue;
+			}
+
+			if (!emitted && timeoutms > 0)
+			{
+				hash_cond->wait(&lock, timeoutms);
+				timeoutms = 0;
+				continue;
+			}
+
+			break;
+		}
+
+		hash_jobs.pop_front();
+
+		//Results are output in queue order
+		lock.relock(NULL);
+		finishHashJob(*job);
+		delete job;
+		lock.relock(hash_mutex.get());
+
+		emitted = true;
+	}
+
+	return emitted;
+}
+
 bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 {
 	char id;
 	if (!data.getChar(&id))
 		return false;
 
+	if (id == ID_HASH_FILE)
+	{
+		return queueHashFile(data);
+	}
+
+	//Everything else has to see the results of the queued files
+	emitHashJobs(0, 0);
+
 	if (id == ID_SET_CURR_DIRS)
 	{
 		if (!data.getStr2(&curr_dir)
@@ -165,9 +325,9 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 		std::string path_lower = strlower(curr_dir + os_file_sep());
 #endif
 
-		std::vector<SFileAndHash> files;
+		ClientDirRecord record;
 		int64 generation = -1;
-		if (clientdao.getFiles(path_lower, curr_tgroup, files, generation))
+		if (clientdao.getFiles(path_lower, curr_tgroup, record, generation))
 		{
 			if (generation != target_generation)
 				return true;
@@ -175,16 +335,22 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 			std::sort(curr_files.begin(), curr_files.end());
 
 			bool added_hash = false;
-			for (size_t i = 0; i < files.size(); ++i)
+			SFileAndHash key;
+			for (size_t i = 0; i < record.size(); ++i)
 			{
-				if (files[i].hash.empty())
+				size_t hash_size;
+				record.hash(i, hash_size);
+				if (hash_size == 0)
 				{
+					size_t name_size;
+					const char* name = record.name(i, name_size);
+					key.name.assign(name, name_size);
 					std::vector<SFileAndHash>::iterator it =
-						std::lower_bound(curr_files.begin(), curr_files.end(), files[i]);
+						std::lower_bound(curr_files.begin(), curr_files.end(), key);
 					if (it != curr_files.end()
-						&& it->name == files[i].name)
+						&& it->name == key.name)
 					{
-						files[i].hash = it->hash;
+						record.setHash(i, it->hash);
 						added_hash = true;
 					}
 				}
@@ -192,7 +358,7 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 
 			if (added_hash)
 			{
-				addModifyFileBuffer(clientdao, path_lower, curr_tgroup, files, target_generation);
+				addModifyFileBuffer(clientdao, path_lower, curr_tgroup, record.getData(), target_generation);
 			}
 
 			return true;
@@ -203,6 +369,7 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 	else if (id == ID_INIT_HASH)
 	{
 		client_hash.reset(new ClientHash(NULL, false, 0, NULL, 0));
+		setHashInit(NULL, 0, NULL, 0);
 		return true;
 	}
 	else if (id == ID_CBT_DATA)
@@ -221,6 +388,8 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 
 		client_hash.reset(new ClientHash(index_hdat_file, true, index_hdat_fs_block_size,
 			snapshot_sequence_id, static_cast<size_t>(snapshot_sequence_id_reference)));
+		setHashInit(index_hdat_file, index_hdat_fs_block_size,
+			snapshot_sequence_id, static_cast<size_t>(snapshot_sequence_id_reference));
 		return true;
 	}
 	else if (id == ID_PHASH_FINISH)
@@ -229,11 +398,11 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 		return true;
 	}
 
-	if (id != ID_HASH_FILE)
-	{
-		return false;
-	}
+	return false;
+}
 
+bool ParallelHash::queueHashFile(CRData & data)
+{
 	int64 file_id;
 	if (!data.getVarInt(&file_id))
 	{
@@ -246,54 +415,83 @@ bool ParallelHash::hashFile(CRData & data, ClientDAO& clientdao)
 		return false;
 	}
 
-	std::string full_path = curr_snapshot_dir + os_file_sep() + fn;
+	//Limit the number of hashes waiting for the output of an earlier file
+	emitHashJobs(n_workers*max_hash_jobs_per_worker - 1, 0);
 
-	SFileAndHash fandhash;
-	if (sha_version == 256)
-	{
-		HashSha256 hash_256;
-		if (!client_hash->getShaBinary(full_path, hash_256, false))
-		{
-			return false;
-		}
-
-		fandhash.hash = hash_256.finalize();
-	}
-	else if (sha_version == 528)
-	{
-		TreeHash treehash(client_hash->hasCbtFile() ? client_hash.get() : NULL);
-		if (!client_hash->getShaBinary(full_path, treehash, client_hash->hasCbtFile()))
-		{
-			return false;
-		}
-
-		fandhash.hash = treehash.finalize();
-	}
-	else
-	{
-		HashSha512 hash_512;
-		if (!client_hash->getShaBinary(full_path, hash_512, false))
-		{
-			return false;
-		}
-
-		fandhash.hash = hash_512.finalize();
+	SHashJob* job = new SHashJob;
+	job->file_id = file_id;
+	job->fn = fn;
+	job->full_path = curr_snapshot_dir + os_file_sep() + fn;
+	job->ok = false;
+	job->done = false;
+
+	IScopedLock lock(hash_mutex.get());
+	hash_jobs.push_back(job);
+	pending_hash_jobs.push_back(job);
+	hash_cond->notify_all();
+
+	return true;
+}
+
+bool ParallelHash::hashJob(SHashJob & job, ClientHash & job_client_hash)
+{
+	if (sha_version == 256)
+	{
+		HashSha256 hash_256;
+		if (!job_client_hash.getShaBinary(job.full_path, hash_256, false))
+		{
+			return false;
+		}
+
+		job.hash = hash_256.finalize();
+	}
+	else if (sha_version == 528)
+	{
+		TreeHash treehash(job_client_hash.hasCbtFile() ? &job_client_hash : NULL);
+		if (!job_client_hash.getShaBinary(job.full_path, treehash, job_client_hash.hasCbtFile()))
+		{
+			return false;
+		}
+
+		job.hash = treehash.finalize();
+	}
+	else
+	{
+		HashSha512 hash_512;
+		if (!job_client_hash.getShaBinary(job.full_path, hash_512, false))
+		{
+			return false;
+		}
+
+		job.hash = hash_512.finalize();
+	}
+
+	return true;
+}
+
+void ParallelHash::finishHashJob(SHashJob & job)
+{
+	if (!job.ok)
+	{
+		Server->Log("Error hashing file \"" + job.full_path + "\" id=" + convert(job.file_id), LL_ERROR);
+		return;
 	}
 
+	SFileAndHash fandhash;
+	fandhash.hash = job.hash;
+
 	CWData wdata;
 	wdata.addUShort(0);
 	wdata.addChar(1);
-	wdata.addVarInt(file_id);
+	wdata.addVarInt(job.file_id);
 	wdata.addString2(fandhash.hash);
-	fandhash.name = fn;
+	fandhash.name = job.fn;
 	*reinterpret_cast<_u16*>(wdata.getDataPtr()) = little_endian(static_cast<_u16>(wdata.getDataSize() - sizeof(_u16)));
 	curr_files.push_back(fandhash);
 
-	Server->Log("Parallel hash \"" + full_path + "\" id=" + convert(file_id) + " hash=" + base64_encode_dash(fandhash.hash), LL_DEBUG);
+	Server->Log("Parallel hash \"" + job.full_path + "\" id=" + convert(job.file_id) + " hash=" + base64_encode_dash(fandhash.hash), LL_DEBUG);
 
 	addToStdoutBuf(wdata.getDataPtr(), wdata.getDataSize());
-
-	return true;
 }
 
 void ParallelHash::addToStdoutBuf(const char * ptr, size_t size)
@@ -316,26 +514,17 @@ void ParallelHash::addToStdoutBuf(const char * ptr, size_t size)
 	stdout_buf_size += size;
 }
 
-size_t ParallelHash::calcBufferSize(const std::string &path, const std::vector<SFileAndHash> &data)
+size_t ParallelHash::calcBufferSize(const std::string &path, const std::string &record_data)
 {
-	size_t add_size = path.size() + sizeof(std::string) + sizeof(int) + sizeof(int64);
-	for (size_t i = 0; i<data.size(); ++i)
-	{
-		add_size += data[i].name.size();
-		add_size += sizeof(SFileAndHash);
-		add_size += data[i].hash.size();
-	}
-	add_size += sizeof(std::vector<SFile>);
-
-	return add_size;
+	return path.size() + record_data.size() + sizeof(SBufferItem);
 }
 
 void ParallelHash::addModifyFileBuffer(ClientDAO& clientdao, const std::string & path, int tgroup,
-	const std::vector<SFileAndHash>& files, int64 target_generation)
+	const std::string& record_data, int64 target_generation)
 {
-	modify_file_buffer_size += calcBufferSize(path, files);
+	modify_file_buffer_size += calcBufferSize(path, record_data);
 
-	modify_file_buffer.push_back(SBufferItem(path, tgroup, files, target_generation));
+	modify_file_buffer.push_back(SBufferItem(path, tgroup, record_data, target_generation));
 
 	if (last_file_buffer_commit_time == 0)
 	{
@@ -355,7 +544,7 @@ void ParallelHash::commitModifyFileBuffer(ClientDAO& clientdao)
 	for (size_t i = 0; i<modify_file_buffer.size(); ++i)
 	{
 		clientdao.modifyFiles(modify_file_buffer[i].path, modify_file_buffer[i].tgroup,
-			modify_file_buffer[i].files, modify_file_buffer[i].target_generation);
+			modify_file_buffer[i].record_data, modify_file_buffer[i].target_generation);
 	}
 
 	modify_file_buffer.clear();
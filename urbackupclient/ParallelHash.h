@@ -4,9 +4,12 @@
 #include "../Interface/File.h"
 #include "../Interface/Thread.h"
 #include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "../Interface/ThreadPool.h"
 #include "../common/data.h"
 #include "clientdao.h"
 #include <memory>
+#include <deque>
 
 namespace
 {
@@ -33,12 +36,32 @@ public:
 
 	void operator()();
 
+	void runHashWorker();
+
 private:
+	struct SHashJob
+	{
+		int64 file_id;
+		std::string fn;
+		std::string full_path;
+		std::string hash;
+		bool ok;
+		bool done;
+	};
+
 	bool hashFile(CRData& data, ClientDAO& clientdao);
+	bool queueHashFile(CRData& data);
+	bool hashJob(SHashJob& job, ClientHash& job_client_hash);
+	void finishHashJob(SHashJob& job);
+	bool emitHashJobs(size_t max_outstanding, int timeoutms);
+	void startHashWorkers();
+	void stopHashWorkers();
+	void setHashInit(IFile* new_index_hdat_file, int64 new_index_hdat_fs_block_size,
+		size_t* new_snapshot_sequence_id, size_t new_snapshot_sequence_id_reference);
 	void addToStdoutBuf(const char* ptr, size_t size);
-	void addModifyFileBuffer(ClientDAO& clientdao, const std::string& path, int tgroup, const std::vector<SFileAndHash>& files, int64 target_generation);
+	void addModifyFileBuffer(ClientDAO& clientdao, const std::string& path, int tgroup, const std::string& record_data, int64 target_generation);
 	void commitModifyFileBuffer(ClientDAO& clientdao);
-	size_t calcBufferSize(const std::string &path, const std::vector<SFileAndHash> &data);
+	size_t calcBufferSize(const std::string &path, const std::string &record_data);
 
 	std::vector<char> stdout_buf;
 	size_t stdout_buf_pos;
@@ -56,15 +79,28 @@ private:
 	int sha_version;
 	THREADPOOL_TICKET ticket;
 
+	std::auto_ptr<IMutex> hash_mutex;
+	std::auto_ptr<ICondition> hash_cond;
+	std::deque<SHashJob*> hash_jobs;
+	std::deque<SHashJob*> pending_hash_jobs;
+	std::vector<THREADPOOL_TICKET> worker_tickets;
+	size_t n_workers;
+	bool workers_quit;
+	size_t hash_init_generation;
+	IFile* index_hdat_file;
+	int64 index_hdat_fs_block_size;
+	size_t* snapshot_sequence_id;
+	size_t snapshot_sequence_id_reference;
+
 	struct SBufferItem
 	{
-		SBufferItem(std::string path, int tgroup, std::vector<SFileAndHash> files, int64 target_generation)
-			: path(path), tgroup(tgroup), files(files), target_generation(target_generation)
+		SBufferItem(std::string path, int tgroup, std::string record_data, int64 target_generation)
+			: path(path), tgroup(tgroup), record_data(record_data), target_generation(target_generation)
 		{}
 
 		std::string path;
 		int tgroup;
-		std::vector<SFileAndHash> files;
+		std::string record_data;
 		int64 target_generation;
 	};
 
@@ -2258,7 +2258,7 @@ bool IndexThread::readBackupScripts(bool full_backup)
 	return !scripts.empty();	
 }
 
-bool IndexThread::addMissingHashes(std::vector<SFileAndHash>* dbfiles, std::vector<SFileAndHash>* fsfiles, const std::string &orig_path,
+bool IndexThread::addMissingHashes(std::vector<SFileAndHash>* dbfiles, const ClientDirRecord* dbrecord, std::vector<SFileAndHash>* fsfiles, const std::string &orig_path,
 	const std::string& filepath, const std::string& namedpath, const std::vector<std::string>& exclude_dirs,
 	const std::vector<SIndexInclude>& include_dirs, bool calc_hashes)
 {
@@ -2282,19 +2282,22 @@ bool IndexThread::addMissingHashes(std::vector<SFileAndHash>* dbfiles, std::vect
 
 			bool needs_hashing=true;
 
-			if(dbfiles!=NULL)
+			if(dbrecord!=NULL)
 			{
-				std::vector<SFileAndHash>::iterator it = std::lower_bound(dbfiles->begin(), dbfiles->end(), fsfile);
+				size_t idx = dbrecord->find(fsfile.name);
 
-				if( it!=dbfiles->end()
-					&& it->name==fsfile.name
-					&& it->isdir==false
-					&& it->change_indicator==fsfile.change_indicator
-					&& it->size==fsfile.size
-					&& !it->hash.empty() )
+				if( idx<dbrecord->size()
+					&& !dbrecord->isdir(idx)
+					&& dbrecord->changeIndicator(idx)==fsfile.change_indicator
+					&& dbrecord->filesize(idx)==fsfile.size )
 				{
-					fsfile.hash=it->hash;
-					needs_hashing=false;
+					size_t hash_size;
+					const char* hash = dbrecord->hash(idx, hash_size);
+					if(hash_size>0)
+					{
+						fsfile.hash.assign(hash, hash_size);
+						needs_hashing=false;
+					}
 				}
 			}
 
@@ -2402,7 +2405,7 @@ std::vector<SFileAndHash> IndexThread::getFilesProxy(const std::string &orig_pat
 			}
 		}
 
-		std::vector<SFileAndHash> db_files;
+		ClientDirRecord db_record;
 		bool has_files = false;
 
 		if (use_db_hashes)
@@ -2411,7 +2414,7 @@ std::vector<SFileAndHash> IndexThread::getFilesProxy(const std::string &orig_pat
 			if (calculate_filehashes_on_client)
 			{
 #endif
-				has_files = cd->getFiles(path_lower, get_db_tgroup(), db_files, target_generation);
+				has_files = cd->getFiles(path_lower, get_db_tgroup(), db_record, target_generation);
 #ifndef _WIN32
 			}
 #endif
@@ -2445,16 +2448,16 @@ std::vector<SFileAndHash> IndexThread::getFilesProxy(const std::string &orig_pat
 		if(calculate_filehashes_on_client
 			&& (phash_queue==NULL || has_files) )
 		{
-			addMissingHashes(has_files ? &db_files : NULL, &fs_files, orig_path,
+			addMissingHashes(NULL, has_files ? &db_record : NULL, &fs_files, orig_path,
 				path, named_path, exclude_dirs, include_dirs, phash_queue==NULL);
 		}
 
 		if( has_files)
 		{
-			if(fs_files!=db_files)
+			if(!db_record.equals(fs_files))
 			{
 				++index_c_db_update;
-				modifyFilesInt(path_lower, get_db_tgroup(), fs_files, target_generation);
+				modifyFilesInt(path_lower, get_db_tgroup(), fs_files, target_generation, &db_record);
 			}
 		}
 		else
@@ -2482,7 +2485,7 @@ std::vector<SFileAndHash> IndexThread::getFilesProxy(const std::string &orig_pat
 
 			if(calculate_filehashes_on_client)
 			{
-				if(addMissingHashes(&fs_files, NULL, orig_path, path, named_path,
+				if(addMissingHashes(&fs_files, NULL, NULL, orig_path, path, named_path,
 					exclude_dirs, include_dirs, phash_queue==NULL))
 				{
 					++index_c_db_update;
@@ -2518,7 +2521,7 @@ std::vector<SFileAndHash> IndexThread::getFilesProxy(const std::string &orig_pat
 			if(calculate_filehashes_on_client
 				&& phash_queue==NULL)
 			{
-				addMissingHashes(NULL, &fs_files, orig_path, path, named_path,
+				addMissingHashes(NULL, NULL, &fs_files, orig_path, path, named_path,
 					exclude_dirs, include_dirs, true);
 			}
 
@@ -3665,27 +3668,30 @@ void IndexThread::doStop(void)
 }
 
 
-size_t IndexThread::calcBufferSize( std::string &path, const std::vector<SFileAndHash> &data )
+size_t IndexThread::calcBufferSize( std::string &path, const std::string &record_data )
 {
-	size_t add_size=path.size()+sizeof(std::string)+sizeof(int)+sizeof(int64);
-	for(size_t i=0;i<data.size();++i)
-	{
-		add_size+=data[i].name.size();
-		add_size+=sizeof(SFileAndHash);
-		add_size+=data[i].hash.size();
-	}
-	add_size+=sizeof(std::vector<SFile>);
-
-	return add_size;
+	return path.size()+record_data.size()+sizeof(SBufferItem);
 }
 
 
 void IndexThread::modifyFilesInt(std::string path, int tgroup,
-	const std::vector<SFileAndHash> &data, int64 target_generation)
+	const std::vector<SFileAndHash> &data, int64 target_generation, ClientDirRecord* old_record)
 {
-	modify_file_buffer_size+=calcBufferSize(path, data);
+	std::string record_data;
+	if(old_record!=NULL)
+	{
+		//Only writes the changed entries into the loaded record
+		old_record->assign(data);
+		record_data = old_record->getData();
+	}
+	else
+	{
+		ClientDirRecord::encode(data, record_data);
+	}
+
+	modify_file_buffer_size+=calcBufferSize(path, record_data);
 
-	modify_file_buffer.push_back(SBufferItem(path, tgroup, data, target_generation));
+	modify_file_buffer.push_back(SBufferItem(path, tgroup, record_data, target_generation));
 
 	if(last_file_buffer_commit_time==0)
 	{
@@ -3707,7 +3713,7 @@ void IndexThread::commitModifyFilesBuffer(void)
 	for(size_t i=0;i<modify_file_buffer.size();++i)
 	{
 		cd->modifyFiles(modify_file_buffer[i].path, modify_file_buffer[i].tgroup,
-			modify_file_buffer[i].files, modify_file_buffer[i].target_generation);
+			modify_file_buffer[i].record_data, modify_file_buffer[i].target_generation);
 	}
 	db->EndTransaction();
 
@@ -3718,9 +3724,12 @@ void IndexThread::commitModifyFilesBuffer(void)
 
 void IndexThread::addFilesInt( std::string path, int tgroup, const std::vector<SFileAndHash> &data )
 {
-	add_file_buffer_size+=calcBufferSize(path, data);
+	std::string record_data;
+	ClientDirRecord::encode(data, record_data);
+
+	add_file_buffer_size+=calcBufferSize(path, record_data);
 
-	add_file_buffer.push_back(SBufferItem(path, tgroup, data, 0));
+	add_file_buffer.push_back(SBufferItem(path, tgroup, record_data, 0));
 
 	if(last_file_buffer_commit_time==0)
 	{
@@ -3742,7 +3751,7 @@ void IndexThread::commitAddFilesBuffer()
 	db->BeginWriteTransaction();
 	for(size_t i=0;i<add_file_buffer.size();++i)
 	{
-		cd->addFiles(add_file_buffer[i].path, add_file_buffer[i].tgroup, add_file_buffer[i].files);
+		cd->addFiles(add_file_buffer[i].path, add_file_buffer[i].tgroup, add_file_buffer[i].record_data);
 	}
 	db->EndTransaction();
 
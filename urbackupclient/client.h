@@ -12,6 +12,7 @@
 #include "tokens.h"
 #include "ClientHash.h"
 #include "ParallelHash.h"
+#include "ClientDirRecord.h"
 
 #ifdef _WIN32
 #ifndef VSS_XP
@@ -423,12 +424,12 @@ private:
 		const std::vector<std::string>& exclude_dirs,
 		const std::vector<SIndexInclude>& include_dirs);
 
-	bool addMissingHashes(std::vector<SFileAndHash>* dbfiles, std::vector<SFileAndHash>* fsfiles, const std::string &orig_path,
+	bool addMissingHashes(std::vector<SFileAndHash>* dbfiles, const ClientDirRecord* dbrecord, std::vector<SFileAndHash>* fsfiles, const std::string &orig_path,
 		const std::string& filepath, const std::string& namedpath, const std::vector<std::string>& exclude_dirs,
 		const std::vector<SIndexInclude>& include_dirs, bool calc_hashes);
 
-	void modifyFilesInt(std::string path, int tgroup, const std::vector<SFileAndHash> &data, int64 target_generation);
-	size_t calcBufferSize( std::string &path, const std::vector<SFileAndHash> &data );
+	void modifyFilesInt(std::string path, int tgroup, const std::vector<SFileAndHash> &data, int64 target_generation, ClientDirRecord* old_record=NULL);
+	size_t calcBufferSize( std::string &path, const std::string &record_data );
 
 	void commitModifyFilesBuffer();
 
@@ -580,13 +581,13 @@ private:
 
 	struct SBufferItem
 	{
-		SBufferItem(std::string path, int tgroup, std::vector<SFileAndHash> files, int64 target_generation)
-			: path(path), tgroup(tgroup), files(files), target_generation(target_generation)
+		SBufferItem(std::string path, int tgroup, std::string record_data, int64 target_generation)
+			: path(path), tgroup(tgroup), record_data(record_data), target_generation(target_generation)
 		{}
 
 		std::string path;
 		int tgroup;
-		std::vector<SFileAndHash> files;
+		std::string record_data;
 		int64 target_generation;
 	};
 
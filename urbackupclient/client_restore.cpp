@@ -40,7 +40,12 @@
 #include "../fileservplugin/settings.h"
 #include "../fileservplugin/packet_ids.h"
 #include <memory>
+#include <vector>
 #include "../cryptoplugin/ICryptoFactory.h"
+#include "../urbackupcommon/image_restore_frame.h"
+
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "../common/miniz.h"
 
 #ifdef _WIN32
 const std::string pw_file="pw.txt";
@@ -72,6 +77,21 @@ std::string trim2(const std::string &str)
     }
 }
 
+bool readPipeFull(IPipe* pipe, char* buf, size_t bsize, int timeoutms)
+{
+	size_t read = 0;
+	while (read < bsize)
+	{
+		size_t r = pipe->Read(&buf[read], bsize - read, timeoutms);
+		if (r == 0)
+		{
+			return false;
+		}
+		read += r;
+	}
+	return true;
+}
+
 std::string getResponse(IPipe *c)
 {
 	CTCPStack tcpstack;
@@ -495,6 +515,113 @@ EDownloadResult retryDownload(EDownloadResult errrc, int img_id, std::string img
 	return errrc;
 }
 
+EDownloadResult downloadImageExtents(std::auto_ptr<IPipe>& client_pipe, std::auto_ptr<IFile>& out_file, int img_id, std::string img_time, std::string outfile,
+	_i64 imgsize, _i64 offset, int recur_depth, int64* o_imgsize, int64* o_output_file_size)
+{
+	std::vector<char> frame_data(c_image_restore_max_frame_size);
+	std::vector<char> comp_data(c_image_restore_max_frame_size);
+	bool has_data=false;
+	_i64 pos = offset==-1 ? 0 : offset;
+
+	while(true)
+	{
+		SImageRestoreFrame frame;
+		if(!readPipeFull(client_pipe.get(), (char*)&frame, sizeof(frame), 180000))
+		{
+			Server->Log("Read Timeout: Retrying", LL_WARNING);
+			client_pipe.reset(NULL);
+			out_file.reset(NULL);
+			if(has_data)
+			{
+				return retryDownload(EDownloadResult_TimeoutError2, img_id, img_time, outfile, false, pos, recur_depth, o_imgsize, o_output_file_size);
+			}
+			else
+			{
+				Server->Log("Read Timeout: No data", LL_ERROR);
+				return EDownloadResult_TimeoutError2;
+			}
+		}
+
+		_i64 frame_pos = little_endian(frame.pos);
+		_u32 frame_size = little_endian(frame.size);
+		_u32 comp_size = little_endian(frame.comp_size);
+
+		if(frame_pos==c_image_restore_end)
+		{
+			Server->Log("Restore finished", LL_INFO);
+			return EDownloadResult_Ok;
+		}
+
+		if(frame_size==0)
+		{
+			//Keepalive
+			continue;
+		}
+
+		if(frame_size>c_image_restore_max_frame_size
+			|| comp_size>c_image_restore_max_frame_size
+			|| frame_pos<0 || frame_pos+frame_size>imgsize)
+		{
+			Server->Log("Invalid image frame at position "+convert(frame_pos)+" with size "+convert(frame_size), LL_ERROR);
+			return EDownloadResult_SizeReadError;
+		}
+
+		char* data_buf = comp_size!=0 ? comp_data.data() : frame_data.data();
+		if(!readPipeFull(client_pipe.get(), data_buf, comp_size!=0 ? comp_size : frame_size, 180000))
+		{
+			Server->Log("Read Timeout: Retrying", LL_WARNING);
+			client_pipe.reset(NULL);
+			out_file.reset(NULL);
+			return retryDownload(EDownloadResult_TimeoutError2, img_id, img_time, outfile, false, pos, recur_depth, o_imgsize, o_output_file_size);
+		}
+
+		if(comp_size!=0)
+		{
+			mz_ulong decomp_size = frame_size;
+			int rc = mz_uncompress(reinterpret_cast<unsigned char*>(frame_data.data()), &decomp_size,
+				reinterpret_cast<const unsigned char*>(comp_data.data()), static_cast<mz_ulong>(comp_size));
+			if(rc!=MZ_OK || decomp_size!=frame_size)
+			{
+				Server->Log("Error decompressing image frame at position "+convert(frame_pos)+" (code "+convert(rc)+")", LL_ERROR);
+				return EDownloadResult_SizeReadError;
+			}
+		}
+
+		if (!out_file->Seek(frame_pos))
+		{
+			Server->Log("Seeking in output file failed (to position "+convert(frame_pos)+")", LL_ERROR);
+			return EDownloadResult_WriteFailed;
+		}
+
+		_u32 woff=0;
+		do
+		{
+			bool has_write_error = false;
+			_u32 w=out_file->Write(&frame_data[woff], frame_size-woff, &has_write_error);
+			if(w==0)
+			{
+				Server->Log("Writing to output file failed", LL_ERROR);
+				return EDownloadResult_WriteFailed;
+			}
+			if (has_write_error)
+			{
+				Server->Log("Writing to output file failed -2", LL_ERROR);
+				return EDownloadResult_WriteFailed;
+			}
+			woff+=w;
+		}
+		while(frame_size-woff>0);
+
+		if(!has_data && !restore_retry_ok)
+		{
+			restore_retry_ok=true;
+		}
+
+		has_data=true;
+		pos=frame_pos+frame_size;
+	}
+}
+
 EDownloadResult downloadImage(int img_id, std::string img_time, std::string outfile, bool mbr, _i64 offset=-1, int recur_depth=0, int64* o_imgsize=NULL, int64* o_output_file_size=NULL)
 {
 	std::string pw=getFile(pw_file);
@@ -514,7 +641,7 @@ EDownloadResult downloadImage(int img_id, std::string img_time, std::string outf
 		s_offset="&offset="+convert(offset);
 	}
 
-	tcpstack.Send(client_pipe.get(), "DOWNLOAD IMAGE#pw="+pw+"&img_id="+convert(img_id)+"&time="+img_time+"&mbr="+convert(mbr)+s_offset);
+	tcpstack.Send(client_pipe.get(), "DOWNLOAD IMAGE#pw="+pw+"&img_id="+convert(img_id)+"&time="+img_time+"&mbr="+convert(mbr)+s_offset+"&extents=1");
 
 	std::string restore_out=outfile;
 	Server->Log("Restoring to "+restore_out);
@@ -575,6 +702,19 @@ EDownloadResult downloadImage(int img_id, std::string img_time, std::string outf
 		}
 		return EDownloadResult_Ok;
 	}
+
+	_i64 stream_version = -1;
+	client_pipe->Read((char*)&stream_version, sizeof(_i64), 60000);
+
+	if (stream_version == c_image_restore_stream_extents)
+	{
+		return downloadImageExtents(client_pipe, out_file, img_id, img_time, outfile, imgsize, offset, recur_depth, o_imgsize, o_output_file_size);
+	}
+	else if (stream_version != c_image_restore_stream_blocks)
+	{
+		Server->Log("Error reading stream version", LL_ERROR);
+		return retryDownload(EDownloadResult_TimeoutError1, img_id, img_time, outfile, mbr, offset, recur_depth, o_imgsize, o_output_file_size);
+	}
 	else
 	{
 		_i64 read=0;
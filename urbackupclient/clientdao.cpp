@@ -17,6 +17,7 @@
 **************************************************************************/
 
 #include "clientdao.h"
+#include "ClientDirRecord.h"
 #include "../stringtools.h"
 #include "../Interface/Server.h"
 #include <memory.h>
@@ -164,7 +165,7 @@ std::string ClientDAO::escapeGlob(const std::string& glob)
 	return ret;
 }
 
-bool ClientDAO::getFiles(std::string path, int tgroup, std::vector<SFileAndHash> &data, int64& generation)
+bool ClientDAO::getFiles(std::string path, int tgroup, ClientDirRecord& record, int64& generation)
 {
 	q_get_files->Bind(path);
 	q_get_files->Bind(tgroup);
@@ -175,139 +176,17 @@ bool ClientDAO::getFiles(std::string path, int tgroup, std::vector<SFileAndHash>
 
 	generation = watoi64(res[0]["generation"]);
 
-	std::string &qdata=res[0]["data"];
-
-	if(qdata.empty())
-		return true;
-
-	int num=watoi(res[0]["num"]);
-	char *ptr=(char*)&qdata[0];
-	while(ptr-(char*)&qdata[0]<num)
-	{
-		SFileAndHash f;
-		unsigned short ss;
-		memcpy(&ss, ptr, sizeof(unsigned short));
-		ptr+=sizeof(unsigned short);
-		std::string tmp;
-		tmp.resize(ss);
-		memcpy(&tmp[0], ptr, ss);
-		f.name=(tmp);
-		ptr+=ss;
-		memcpy(&f.size, ptr, sizeof(int64));
-		ptr+=sizeof(int64);
-		memcpy(&f.change_indicator, ptr, sizeof(uint64));
-		ptr+=sizeof(uint64);
-		char isdir=*ptr;
-		++ptr;
-		if(isdir==0)
-			f.isdir=false;
-		else
-			f.isdir=true;
-		
-		unsigned short hashsize;
-		memcpy(&hashsize, ptr, sizeof(unsigned short));
-		ptr+=sizeof(unsigned short);
-
-		f.hash.resize(hashsize);
-		if(hashsize>0)
-		{
-			memcpy(&f.hash[0], ptr, hashsize);
-		}
-
-		ptr+=hashsize;
-
-		char issym=*ptr;
-		++ptr;
-		f.issym=issym==0?false:true;
-
-		char isspecialf=*ptr;
-		++ptr;
-		f.isspecialf= isspecialf ==0?false:true;
-
-
-		if(f.issym)
-		{
-			memcpy(&ss, ptr, sizeof(unsigned short));
-			ptr+=sizeof(unsigned short);
-			if(ss>0)
-			{
-				tmp.resize(ss);
-				memcpy(&tmp[0], ptr, ss);
-				f.symlink_target=(tmp);
-				ptr+=ss;
-			}			
-		}
-
-		data.push_back(f);
-	}
-	return true;
+	return record.set(res[0]["data"]);
 }
 
-char * constructData(const std::vector<SFileAndHash> &data, size_t &datasize)
+bool ClientDAO::getFiles(std::string path, int tgroup, std::vector<SFileAndHash> &data, int64& generation)
 {
-	datasize=0;
-	std::vector<std::string> utf;
-	utf.resize(data.size());
-	for(size_t i=0;i<data.size();++i)
-	{
-		utf[i]=(data[i].name);
-		datasize+=utf[i].size();
-		datasize+=sizeof(unsigned short);
-		datasize+=sizeof(int64)*2;
-		++datasize; //isdir
-		datasize+=sizeof(unsigned short);
-		datasize+=data[i].hash.size();
-		++datasize; //issym
-		++datasize; //isspecial
-		if(data[i].issym)
-		{
-			datasize+=sizeof(unsigned short);
-			datasize+=(data[i].symlink_target).size();
-		}
-	}
-	char *buffer=new char[datasize];
-	char *ptr=buffer;
-	for(size_t i=0;i<data.size();++i)
-	{
-		unsigned short ss=(unsigned short)utf[i].size();
-		memcpy(ptr, (char*)&ss, sizeof(unsigned short));
-		ptr+=sizeof(unsigned short);
-		memcpy(ptr, &utf[i][0], ss);
-		ptr+=ss;
-		memcpy(ptr, (char*)&data[i].size, sizeof(int64));
-		ptr+=sizeof(int64);
-		memcpy(ptr, (char*)&data[i].change_indicator, sizeof(uint64));
-		ptr+=sizeof(uint64);
-		char isdir=1;
-		if(!data[i].isdir)
-			isdir=0;
-		*ptr=isdir;
-		ptr+=sizeof(char);
-		unsigned short hashsize=static_cast<unsigned short>(data[i].hash.size());
-		memcpy(ptr, &hashsize, sizeof(hashsize));
-		ptr+=sizeof(hashsize);
-		memcpy(ptr, data[i].hash.data(), hashsize);
-		ptr+=hashsize;
-		char issym = data[i].issym?1:0;
-		*ptr=issym;
-		++ptr;
-		char isspecialf = data[i].isspecialf?1:0;
-		*ptr= isspecialf ?1:0;
-		++ptr;
-		if(data[i].issym)
-		{
-			std::string symlink_target = (data[i].symlink_target);
-			ss=(unsigned short)symlink_target.size();
-			memcpy(ptr, (char*)&ss, sizeof(unsigned short));
-			ptr+=sizeof(unsigned short);
-			if(ss>0)
-			{
-				memcpy(ptr, &symlink_target[0], ss);
-			}
-			ptr+=ss;
-		}
-	}
-	return buffer;
+	ClientDirRecord record;
+	if(!getFiles(path, tgroup, record, generation))
+		return false;
+
+	record.getAll(data);
+	return true;
 }
 
 std::string guidToString( GUID guid )
@@ -324,30 +203,38 @@ GUID randomGuid()
 
 void ClientDAO::addFiles(std::string path, int tgroup, const std::vector<SFileAndHash> &data)
 {
-	size_t ds;
-	char *buffer=constructData(data, ds);
+	std::string record_data;
+	ClientDirRecord::encode(data, record_data);
+	addFiles(path, tgroup, record_data);
+}
+
+void ClientDAO::addFiles(std::string path, int tgroup, const std::string& record_data)
+{
 	q_add_files->Bind(path);
 	q_add_files->Bind(tgroup);
-	q_add_files->Bind(ds);
-	q_add_files->Bind(buffer, (_u32)ds);
+	q_add_files->Bind(record_data.size());
+	q_add_files->Bind(record_data.data(), (_u32)record_data.size());
 	q_add_files->Write();
 	q_add_files->Reset();
-	delete []buffer;
 }
 
 void ClientDAO::modifyFiles(std::string path, int tgroup, const std::vector<SFileAndHash> &data, int64 target_generation)
 {
-	size_t ds;
-	char *buffer=constructData(data, ds);
-	q_modify_files->Bind(buffer, (_u32)ds);
-	q_modify_files->Bind(ds);
+	std::string record_data;
+	ClientDirRecord::encode(data, record_data);
+	modifyFiles(path, tgroup, record_data, target_generation);
+}
+
+void ClientDAO::modifyFiles(std::string path, int tgroup, const std::string& record_data, int64 target_generation)
+{
+	q_modify_files->Bind(record_data.data(), (_u32)record_data.size());
+	q_modify_files->Bind(record_data.size());
 	q_modify_files->Bind(target_generation+1);
 	q_modify_files->Bind(path);
 	q_modify_files->Bind(tgroup);
 	q_modify_files->Bind(target_generation);
 	q_modify_files->Write();
 	q_modify_files->Reset();
-	delete []buffer;
 }
 
 bool ClientDAO::hasFiles(std::string path, int tgroup)
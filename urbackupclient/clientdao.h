@@ -28,6 +28,8 @@ typedef struct _GUID {
 std::string guidToString(GUID guid);
 GUID randomGuid();
 
+class ClientDirRecord;
+
 enum EBackupDirFlag
 {
 	EBackupDirFlag_None = 0,
@@ -121,9 +123,12 @@ public:
 	}
 
 	bool getFiles(std::string path, int tgroup, std::vector<SFileAndHash> &data, int64& generation);
+	bool getFiles(std::string path, int tgroup, ClientDirRecord& record, int64& generation);
 
 	void addFiles(std::string path, int tgroup, const std::vector<SFileAndHash> &data);
+	void addFiles(std::string path, int tgroup, const std::string& record_data);
 	void modifyFiles(std::string path, int tgroup, const std::vector<SFileAndHash> &data, int64 target_generation);
+	void modifyFiles(std::string path, int tgroup, const std::string& record_data, int64 target_generation);
 	bool hasFiles(std::string path, int tgroup);
 	
 	void removeAllFiles(void);
@@ -59,6 +59,7 @@ extern IServer* Server;
 
 #include "ClientService.h"
 #include "client.h"
+#include "ClientDirRecord.h"
 #include "../stringtools.h"
 #include "ServerIdentityMgr.h"
 #include "../urbackupcommon/os_functions.h"
@@ -620,6 +621,46 @@ void update_client26_27(IDatabase* db)
 	db->Write("ALTER TABLE files ADD generation INTEGER DEFAULT 0");
 }
 
+void update_client27_28(IDatabase* db)
+{
+	IQuery* q_read = db->Prepare("SELECT rowid AS id, data FROM files WHERE rowid>? ORDER BY rowid ASC LIMIT 1000", false);
+	IQuery* q_update = db->Prepare("UPDATE files SET data=?, num=? WHERE rowid=?", false);
+	IQuery* q_del = db->Prepare("DELETE FROM files WHERE rowid=?", false);
+
+	int64 last_id = 0;
+	db_results res;
+	do
+	{
+		q_read->Bind(last_id);
+		res = q_read->Read();
+		q_read->Reset();
+
+		for (size_t i = 0; i < res.size(); ++i)
+		{
+			last_id = watoi64(res[i]["id"]);
+			std::string& data = res[i]["data"];
+			if (!ClientDirRecord::convertLegacy(data))
+			{
+				//Directory is indexed again
+				q_del->Bind(last_id);
+				q_del->Write();
+				q_del->Reset();
+				continue;
+			}
+
+			q_update->Bind(data.data(), static_cast<_u32>(data.size()));
+			q_update->Bind(data.size());
+			q_update->Bind(last_id);
+			q_update->Write();
+			q_update->Reset();
+		}
+	} while (!res.empty());
+
+	db->destroyQuery(q_read);
+	db->destroyQuery(q_update);
+	db->destroyQuery(q_del);
+}
+
 bool upgrade_client(void)
 {
 	IDatabase *db=Server->getDatabase(Server->getThreadID(), URBACKUPDB_CLIENT);
@@ -631,7 +672,7 @@ bool upgrade_client(void)
 		return false;
 	int ver=watoi(res_v[0]["tvalue"]);
 	int old_v;
-	int max_v = 27;
+	int max_v = 28;
 
 	if (ver > max_v)
 	{
@@ -759,6 +800,10 @@ bool upgrade_client(void)
 				update_client26_27(db);
 				++ver;
 				break;
+			case 27:
+				update_client27_28(db);
+				++ver;
+				break;
 			default:
 				break;
 		}
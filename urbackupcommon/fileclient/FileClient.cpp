@@ -51,6 +51,8 @@ namespace
 
 	const size_t maxQueuedFiles = 3000;
 	const size_t queuedFilesLow = 100;
+	const size_t maxBatchFiles = 256;
+	const size_t maxBatchSize = 32*1024;
 
 	std::string ipToString(sockaddr_in sa)
 	{
@@ -1450,18 +1452,16 @@ void FileClient::fillQueue()
 	std::vector<SQueueItem> queued_files;
 	int64 queue_starttime = Server->getTimeMS();
 
-	while(queued.size()<maxQueuedFiles
+	CWData batch_entries;
+	std::vector<SQueueItem> batch_files;
+	std::string batch_last_fn;
+
+	while(queued.size()+batch_files.size()<maxQueuedFiles
 		&& Server->getTimeMS()-queue_starttime<10000)
 	{
 		if(!tcpsock->isWritable())
 		{
-			if (needs_flush)
-			{
-				needs_flush = false;
-				Flush();
-			}
-
-			return;
+			break;
 		}
 
 		MetadataQueue metadata_queue = MetadataQueue_Data;
@@ -1472,14 +1472,55 @@ void FileClient::fillQueue()
 
 		if(queue_fn.empty())
 		{
-			if(needs_flush)
+			break;
+		}
+
+		//Plain file requests are sent in batches, with
+		//the file name prefix compressed against the previous one
+		if(protocol_version>3
+			&& metadata_queue==MetadataQueue_Data
+			&& file_id!=0
+			&& !finish_script
+			&& queue_fn.find("SCRIPT|")!=0)
+		{
+			size_t prefix_len=0;
+			while(prefix_len<batch_last_fn.size() && prefix_len<queue_fn.size()
+				&& batch_last_fn[prefix_len]==queue_fn[prefix_len])
 			{
-				needs_flush=false;
-				needs_send_flush=false;
-				Flush();
+				++prefix_len;
 			}
 
-			return;
+			batch_entries.addVarInt(prefix_len);
+			batch_entries.addString(queue_fn.substr(prefix_len));
+			batch_entries.addVarInt(file_id);
+			batch_files.push_back(SQueueItem(queue_fn, finish_script));
+			batch_last_fn = queue_fn;
+
+			if(batch_files.size()>=maxBatchFiles
+				|| batch_entries.getDataSize()>=maxBatchSize)
+			{
+				if(!sendQueueBatch(batch_entries, batch_files, queued_files))
+				{
+					break;
+				}
+				batch_last_fn.clear();
+				needs_send_flush=true;
+				needs_flush=true;
+			}
+
+			continue;
+		}
+
+		if(!batch_files.empty())
+		{
+			if(!sendQueueBatch(batch_entries, batch_files, queued_files))
+			{
+				queue_callback->unqueueFileFull(queue_fn, finish_script);
+				break;
+			}
+			batch_last_fn.clear();
+			needs_send_flush=true;
+			needs_flush=true;
 		}
 
 		CWData data;
@@ -1539,6 +1580,13 @@ void FileClient::fillQueue()
 		needs_flush=true;
 	}
 
+	if(!batch_files.empty()
+		&& sendQueueBatch(batch_entries, batch_files, queued_files))
+	{
+		needs_send_flush=true;
+		needs_flush=true;
+	}
+
 	if (needs_flush)
 	{
 		needs_flush = false;
@@ -1557,6 +1605,39 @@ void FileClient::fillQueue()
 	}
 }
 
+bool FileClient::sendQueueBatch(CWData& batch_entries, std::vector<SQueueItem>& batch_files, std::vector<SQueueItem>& queued_files)
+{
+	CWData data;
+	data.addUChar(ID_GET_FILE_BATCH);
+	data.addString(identity);
+	data.addChar(0);
+	data.addChar(protocol_version>1);
+	data.addChar(1);
+	data.addVarInt(batch_files.size());
+	data.addBuffer(batch_entries.getDataPtr(), batch_entries.getDataSize());
+
+	bool ret = true;
+	if(stack.Send( tcpsock, data.getDataPtr(), data.getDataSize(), c_default_timeout, false)!=data.getDataSize())
+	{
+		Server->Log("Queueing file batch failed", LL_DEBUG);
+		for(size_t i=0;i<batch_files.size();++i)
+		{
+			queue_callback->unqueueFileFull(batch_files[i].fn, batch_files[i].finish_script);
+		}
+		ret = false;
+	}
+	else
+	{
+		queued.insert(queued.end(), batch_files.begin(), batch_files.end());
+		queued_files.insert(queued_files.end(), batch_files.begin(), batch_files.end());
+	}
+
+	batch_entries.clear();
+	batch_files.clear();
+
+	return ret;
+}
+
 void FileClient::logProgress(const std::string& remotefn, _u64 filesize, _u64 received)
 {
 	int64 ct = Server->getTimeMS();
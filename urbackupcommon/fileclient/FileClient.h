@@ -9,6 +9,8 @@
 #include "../../Interface/File.h"
 #include "../../Interface/Mutex.h"
 
+class CWData;
+
 #define TCP_PORT 35621
 #define UDP_PORT 35622
 #define UDP_SOURCE_PORT 35623
@@ -217,6 +219,8 @@ private:
 
 		std::deque<SQueueItem> queued;
 
+		bool sendQueueBatch(CWData& batch_entries, std::vector<SQueueItem>& batch_files, std::vector<SQueueItem>& queued_files);
+
 		char dl_buf[BUFFERSIZE];
 		size_t dl_off;
 
@@ -34,6 +34,7 @@ const uchar ID_INFORM_METADATA_STREAM_END=11;
 const uchar ID_FLUSH_SOCKET=13;
 const uchar ID_SCRIPT_FINISH = 14;
 const uchar ID_FREE_SERVER_FILE=18;
+const uchar ID_GET_FILE_BATCH=19;
 
 //errors
 const unsigned int ERR_SEEKING_FAILED = 0;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../Interface/Types.h"
+
+/**
+* Framing of the extent based image restore stream (restore_version 2).
+* Every frame starts with this header (little endian), followed by
+* comp_size bytes of compressed data or, if comp_size is zero, by
+* size bytes of uncompressed data which belong at image position pos.
+* A frame with size zero carries no data and is used as keepalive.
+* The stream ends with a frame with position c_image_restore_end.
+*/
+
+#ifdef _WIN32
+#pragma pack(push)
+#endif
+#pragma pack(1)
+
+struct SImageRestoreFrame
+{
+	int64 pos;
+	_u32 size;
+	_u32 comp_size;
+};
+
+#ifdef _WIN32
+#pragma pack(pop)
+#else
+#pragma pack()
+#endif
+
+const int64 c_image_restore_end = 0x7fffffffffffffffLL;
+const _u32 c_image_restore_max_frame_size = 1024*1024;
+
+const int64 c_image_restore_stream_blocks = 1;
+const int64 c_image_restore_stream_extents = 2;
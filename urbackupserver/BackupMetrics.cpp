@@ -0,0 +1,136 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "BackupMetrics.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+IMutex* BackupMetrics::mutex = NULL;
+SBackupMetrics BackupMetrics::server_metrics;
+std::map<int64, SBackupMetrics> BackupMetrics::process_metrics;
+
+void BackupMetrics::init()
+{
+	mutex = Server->createMutex();
+}
+
+void BackupMetrics::record(logid_t logid, EBackupStage stage, int64 duration_us, int64 bytes, int64 items)
+{
+	if (duration_us < 0)
+	{
+		duration_us = 0;
+	}
+
+	IScopedLock lock(mutex);
+
+	add(server_metrics.stages[stage], duration_us, bytes, items);
+
+	if (logid.first != 0)
+	{
+		add(process_metrics[logid.first].stages[stage], duration_us, bytes, items);
+	}
+}
+
+void BackupMetrics::removeProcess(logid_t logid)
+{
+	IScopedLock lock(mutex);
+	process_metrics.erase(logid.first);
+}
+
+SBackupMetrics BackupMetrics::getServerMetrics()
+{
+	IScopedLock lock(mutex);
+	return server_metrics;
+}
+
+bool BackupMetrics::getProcessMetrics(logid_t logid, SBackupMetrics& metrics)
+{
+	IScopedLock lock(mutex);
+	std::map<int64, SBackupMetrics>::iterator it = process_metrics.find(logid.first);
+	if (it == process_metrics.end())
+	{
+		return false;
+	}
+
+	metrics = it->second;
+	return true;
+}
+
+int64 BackupMetrics::getTimeUS()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = {};
+	if (frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return static_cast<int64>(counter.QuadPart / frequency.QuadPart) * 1000000
+		+ static_cast<int64>(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#elif defined(__APPLE__)
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<int64>(tv.tv_sec) * 1000000 + tv.tv_usec;
+#else
+	timespec tp;
+	if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+	{
+		return Server->getTimeMS() * 1000;
+	}
+	return static_cast<int64>(tp.tv_sec) * 1000000 + tp.tv_nsec / 1000;
+#endif
+}
+
+const char* BackupMetrics::stageName(EBackupStage stage)
+{
+	switch (stage)
+	{
+	case EBackupStage_Download: return "download";
+	case EBackupStage_Hash: return "hash";
+	case EBackupStage_DedupLookup: return "dedup_lookup";
+	case EBackupStage_LinkCopy: return "link_copy";
+	case EBackupStage_DbCommit: return "db_commit";
+	case EBackupStage_Metadata: return "metadata";
+	default: return "unknown";
+	}
+}
+
+void BackupMetrics::add(SStageMetrics& metrics, int64 duration_us, int64 bytes, int64 items)
+{
+	++metrics.count;
+	metrics.items += items;
+	metrics.bytes += bytes;
+	metrics.sum_us += duration_us;
+
+	for (size_t i = 0; i < backup_metrics_nbuckets; ++i)
+	{
+		if (duration_us <= backup_metrics_buckets_us[i])
+		{
+			++metrics.buckets[i];
+			break;
+		}
+	}
+}
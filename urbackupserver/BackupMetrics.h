@@ -0,0 +1,108 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "server_log.h"
+#include <map>
+
+class IMutex;
+
+enum EBackupStage
+{
+	EBackupStage_Download = 0,
+	EBackupStage_Hash = 1,
+	EBackupStage_DedupLookup = 2,
+	EBackupStage_LinkCopy = 3,
+	EBackupStage_DbCommit = 4,
+	EBackupStage_Metadata = 5,
+	EBackupStage_Count = 6
+};
+
+//Upper bounds of the latency histogram buckets in microseconds
+const int64 backup_metrics_buckets_us[] = { 100, 1000, 10000, 100000, 1000000, 10000000 };
+const size_t backup_metrics_nbuckets = sizeof(backup_metrics_buckets_us) / sizeof(backup_metrics_buckets_us[0]);
+
+struct SStageMetrics
+{
+	SStageMetrics()
+		: count(0), items(0), bytes(0), sum_us(0)
+	{
+		for (size_t i = 0; i < backup_metrics_nbuckets; ++i)
+		{
+			buckets[i] = 0;
+		}
+	}
+
+	int64 count;
+	int64 items;
+	int64 bytes;
+	int64 sum_us;
+	//Not cumulative. Events slower than the last bound only count in count
+	int64 buckets[backup_metrics_nbuckets];
+};
+
+struct SBackupMetrics
+{
+	SStageMetrics stages[EBackupStage_Count];
+};
+
+/**
+* Counters and latency histograms of the stages of running backups
+* (per process, identified by its log id) and of the whole server
+*/
+class BackupMetrics
+{
+public:
+	static void init();
+
+	static void record(logid_t logid, EBackupStage stage, int64 duration_us, int64 bytes, int64 items = 1);
+
+	static void removeProcess(logid_t logid);
+
+	static SBackupMetrics getServerMetrics();
+	static bool getProcessMetrics(logid_t logid, SBackupMetrics& metrics);
+
+	static int64 getTimeUS();
+
+	static const char* stageName(EBackupStage stage);
+
+private:
+	static void add(SStageMetrics& metrics, int64 duration_us, int64 bytes, int64 items);
+
+	static IMutex* mutex;
+	static SBackupMetrics server_metrics;
+	static std::map<int64, SBackupMetrics> process_metrics;
+};
+
+class ScopedBackupStage
+{
+public:
+	ScopedBackupStage(logid_t logid, EBackupStage stage, int64 bytes = 0)
+		: logid(logid), stage(stage), bytes(bytes), starttime(BackupMetrics::getTimeUS()), stopped(false)
+	{}
+
+	~ScopedBackupStage()
+	{
+		stop();
+	}
+
+	void setBytes(int64 b)
+	{
+		bytes = b;
+	}
+
+	void stop()
+	{
+		if (!stopped)
+		{
+			stopped = true;
+			BackupMetrics::record(logid, stage, BackupMetrics::getTimeUS() - starttime, bytes);
+		}
+	}
+
+private:
+	logid_t logid;
+	EBackupStage stage;
+	int64 bytes;
+	int64 starttime;
+	bool stopped;
+};
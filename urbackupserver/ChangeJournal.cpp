@@ -0,0 +1,438 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ChangeJournal.h"
+#include "../urbackupcommon/change_ids.h"
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	const char all_actions[] = { CHANGE_REN_FILE, CHANGE_REN_DIR, CHANGE_DEL_FILE,
+		CHANGE_ADD_FILE, CHANGE_ADD_DIR, CHANGE_MOD, CHANGE_DEL_DIR };
+
+	bool isRenAction(char action)
+	{
+		return action == CHANGE_REN_FILE || action == CHANGE_REN_DIR;
+	}
+}
+
+ChangeJournal::ChangeJournal()
+	: next_seq(0)
+{
+}
+
+void ChangeJournal::addChangeCheck(const SChange& change)
+{
+	std::vector<int64> seqs;
+	getIndexed(fn1_index, change.action, change.fn1, seqs);
+
+	for (size_t i = 0; i < seqs.size(); ++i)
+	{
+		if (changes[seqs[i]] == change)
+		{
+			return;
+		}
+	}
+
+	insertChange(change);
+}
+
+void ChangeJournal::addChange(SChange change, char del_action, char mod_action)
+{
+	int64 del_seq = firstIndexed(fn1_index, del_action, change.fn1);
+
+	if (del_seq >= 0)
+	{
+		eraseChange(del_seq);
+		if (mod_action != CHANGE_NONE)
+		{
+			change.action = mod_action;
+		}
+	}
+
+	insertChange(change);
+}
+
+void ChangeJournal::delChange(SChange change, char add_action, char mod_action, char ren_action)
+{
+	bool add = true;
+
+	while (true)
+	{
+		if (ren_action == CHANGE_REN_DIR)
+		{
+			removeDirChildren(change.fn1);
+		}
+
+		if (mod_action != CHANGE_NONE)
+		{
+			eraseIndexed(fn1_index, mod_action, change.fn1);
+		}
+
+		int64 add_seq = lastIndexed(fn1_index, add_action, change.fn1);
+		int64 ren_seq = lastIndexed(fn2_index, ren_action, change.fn1);
+
+		if (add_seq >= 0 && add_seq > ren_seq)
+		{
+			//Created since the last backup. Nothing to delete.
+			eraseIndexed(fn1_index, add_action, change.fn1);
+			add = false;
+			break;
+		}
+
+		if (ren_seq < 0)
+		{
+			break;
+		}
+
+		//Renamed since the last backup. Delete the original instead.
+		eraseIndexed(fn1_index, add_action, change.fn1);
+		std::string orig_fn = changes[ren_seq].fn1;
+		eraseChange(ren_seq);
+		change.fn1 = orig_fn;
+	}
+
+	if (add)
+	{
+		insertChange(change);
+	}
+}
+
+void ChangeJournal::renChange(SChange change, char add_action, char mod_action, char ren_action)
+{
+	bool is_dir = ren_action == CHANGE_REN_DIR;
+
+	bool add_mod = false;
+	if (mod_action != CHANGE_NONE)
+	{
+		add_mod = eraseIndexed(fn1_index, mod_action, change.fn1);
+	}
+
+	int64 add_seq = lastIndexed(fn1_index, add_action, change.fn1);
+	int64 ren_seq = lastIndexed(fn2_index, ren_action, change.fn1);
+
+	if (add_seq >= 0 && add_seq > ren_seq)
+	{
+		//Created since the last backup. Create it with the new name instead.
+		SChange add_change = changes[add_seq];
+		add_change.fn1 = change.fn2;
+		updateChange(add_seq, add_change);
+
+		if (is_dir)
+		{
+			renameDirChildren(change.fn1, change.fn2, add_seq, false);
+		}
+	}
+	else if (ren_seq >= 0)
+	{
+		//Renamed before. Merge the renames.
+		SChange ren_change = changes[ren_seq];
+
+		if (mod_action != CHANGE_NONE
+			&& eraseIndexed(fn1_index, mod_action, ren_change.fn1))
+		{
+			add_mod = true;
+		}
+
+		if (ren_change.fn1 == change.fn2)
+		{
+			eraseChange(ren_seq);
+		}
+		else
+		{
+			ren_change.fn2 = change.fn2;
+			updateChange(ren_seq, ren_change);
+		}
+
+		if (is_dir)
+		{
+			renameDirChildren(change.fn1, change.fn2, ren_seq, false);
+		}
+	}
+	else
+	{
+		insertChange(change);
+
+		if (is_dir)
+		{
+			renameDirChildren(change.fn1, change.fn2, 0, true);
+		}
+	}
+
+	if (add_mod)
+	{
+		insertChange(SChange(CHANGE_MOD, change.fn2));
+	}
+}
+
+bool ChangeJournal::empty()
+{
+	return changes.empty();
+}
+
+size_t ChangeJournal::size()
+{
+	return changes.size();
+}
+
+void ChangeJournal::getChanges(std::vector<SChange>& ret)
+{
+	ret.reserve(ret.size() + changes.size());
+	for (std::map<int64, SChange>::iterator it = changes.begin();
+		it != changes.end(); ++it)
+	{
+		ret.push_back(it->second);
+	}
+}
+
+void ChangeJournal::clear()
+{
+	changes.clear();
+	fn1_index.clear();
+	fn2_index.clear();
+}
+
+int64 ChangeJournal::insertChange(const SChange& change)
+{
+	int64 seq = next_seq++;
+	changes[seq] = change;
+
+	fn1_index.insert(SIndexKey(indexKey(change.action, change.fn1), seq));
+	if (isRenAction(change.action))
+	{
+		fn2_index.insert(SIndexKey(indexKey(change.action, change.fn2), seq));
+	}
+
+	return seq;
+}
+
+void ChangeJournal::eraseChange(int64 seq)
+{
+	std::map<int64, SChange>::iterator it = changes.find(seq);
+	if (it == changes.end())
+	{
+		return;
+	}
+
+	fn1_index.erase(SIndexKey(indexKey(it->second.action, it->second.fn1), seq));
+	if (isRenAction(it->second.action))
+	{
+		fn2_index.erase(SIndexKey(indexKey(it->second.action, it->second.fn2), seq));
+	}
+
+	changes.erase(it);
+}
+
+void ChangeJournal::updateChange(int64 seq, const SChange& change)
+{
+	std::map<int64, SChange>::iterator it = changes.find(seq);
+	if (it == changes.end())
+	{
+		return;
+	}
+
+	fn1_index.erase(SIndexKey(indexKey(it->second.action, it->second.fn1), seq));
+	if (isRenAction(it->second.action))
+	{
+		fn2_index.erase(SIndexKey(indexKey(it->second.action, it->second.fn2), seq));
+	}
+
+	it->second = change;
+
+	fn1_index.insert(SIndexKey(indexKey(change.action, change.fn1), seq));
+	if (isRenAction(change.action))
+	{
+		fn2_index.insert(SIndexKey(indexKey(change.action, change.fn2), seq));
+	}
+}
+
+int64 ChangeJournal::firstIndexed(std::set<SIndexKey>& index, char action, const std::string& fn)
+{
+	std::string key = indexKey(action, fn);
+	std::set<SIndexKey>::iterator it = index.lower_bound(SIndexKey(key, (std::numeric_limits<int64>::min)()));
+	if (it != index.end() && it->first == key)
+	{
+		return it->second;
+	}
+	return -1;
+}
+
+int64 ChangeJournal::lastIndexed(std::set<SIndexKey>& index, char action, const std::string& fn)
+{
+	std::string key = indexKey(action, fn);
+	std::set<SIndexKey>::iterator it = index.upper_bound(SIndexKey(key, (std::numeric_limits<int64>::max)()));
+	if (it != index.begin())
+	{
+		--it;
+		if (it->first == key)
+		{
+			return it->second;
+		}
+	}
+	return -1;
+}
+
+void ChangeJournal::getIndexed(std::set<SIndexKey>& index, char action, const std::string& fn, std::vector<int64>& seqs)
+{
+	std::string key = indexKey(action, fn);
+	for (std::set<SIndexKey>::iterator it = index.lower_bound(SIndexKey(key, (std::numeric_limits<int64>::min)()));
+		it != index.end() && it->first == key; ++it)
+	{
+		seqs.push_back(it->second);
+	}
+}
+
+void ChangeJournal::getIndexedPrefix(std::set<SIndexKey>& index, char action, const std::string& dir, std::vector<int64>& seqs)
+{
+	std::string prefix = indexKey(action, dir + "/");
+	for (std::set<SIndexKey>::iterator it = index.lower_bound(SIndexKey(prefix, (std::numeric_limits<int64>::min)()));
+		it != index.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+	{
+		seqs.push_back(it->second);
+	}
+}
+
+void ChangeJournal::getAllIndexedPrefix(std::set<SIndexKey>& index, const std::string& dir, int64 min_seq, std::vector<int64>& seqs)
+{
+	std::vector<int64> action_seqs;
+	for (size_t i = 0; i < sizeof(all_actions); ++i)
+	{
+		getIndexedPrefix(index, all_actions[i], dir, action_seqs);
+	}
+
+	for (size_t i = 0; i < action_seqs.size(); ++i)
+	{
+		if (action_seqs[i] >= min_seq)
+		{
+			seqs.push_back(action_seqs[i]);
+		}
+	}
+}
+
+bool ChangeJournal::eraseIndexed(std::set<SIndexKey>& index, char action, const std::string& fn)
+{
+	std::vector<int64> seqs;
+	getIndexed(index, action, fn, seqs);
+
+	for (size_t i = 0; i < seqs.size(); ++i)
+	{
+		eraseChange(seqs[i]);
+	}
+
+	return !seqs.empty();
+}
+
+void ChangeJournal::removeDirChildren(const std::string& dir)
+{
+	std::vector<int64> seqs;
+	getAllIndexedPrefix(fn1_index, dir, 0, seqs);
+
+	for (size_t i = 0; i < seqs.size(); ++i)
+	{
+		const SChange& change = changes[seqs[i]];
+		if (isRenAction(change.action)
+			&& !isBelow(change.fn2, dir))
+		{
+			//Moved out of the directory before it was deleted
+			continue;
+		}
+
+		eraseChange(seqs[i]);
+	}
+
+	seqs.clear();
+	getAllIndexedPrefix(fn2_index, dir, 0, seqs);
+
+	for (size_t i = 0; i < seqs.size(); ++i)
+	{
+		std::map<int64, SChange>::iterator it = changes.find(seqs[i]);
+		if (it == changes.end())
+		{
+			continue;
+		}
+
+		SChange change = it->second;
+		//Moved into the directory before it was deleted
+		change.action = change.action == CHANGE_REN_DIR ? CHANGE_DEL_DIR : CHANGE_DEL_FILE;
+		change.fn2.clear();
+		updateChange(seqs[i], change);
+	}
+}
+
+void ChangeJournal::renameDirChildren(const std::string& dir, const std::string& new_dir, int64 min_seq, bool only_mod)
+{
+	std::vector<int64> seqs;
+
+	if (only_mod)
+	{
+		//Changed data has to be downloaded from the new location after the rename
+		getIndexedPrefix(fn1_index, CHANGE_MOD, dir, seqs);
+		std::sort(seqs.begin(), seqs.end());
+
+		for (size_t i = 0; i < seqs.size(); ++i)
+		{
+			if (seqs[i] < min_seq)
+			{
+				continue;
+			}
+
+			SChange change = changes[seqs[i]];
+			eraseChange(seqs[i]);
+			change.fn1 = replacePrefix(change.fn1, dir, new_dir);
+			insertChange(change);
+		}
+		return;
+	}
+
+	getAllIndexedPrefix(fn1_index, dir, min_seq, seqs);
+	getAllIndexedPrefix(fn2_index, dir, min_seq, seqs);
+	std::sort(seqs.begin(), seqs.end());
+	seqs.erase(std::unique(seqs.begin(), seqs.end()), seqs.end());
+
+	for (size_t i = 0; i < seqs.size(); ++i)
+	{
+		SChange change = changes[seqs[i]];
+		if (isBelow(change.fn1, dir))
+		{
+			change.fn1 = replacePrefix(change.fn1, dir, new_dir);
+		}
+		if (isBelow(change.fn2, dir))
+		{
+			change.fn2 = replacePrefix(change.fn2, dir, new_dir);
+		}
+		updateChange(seqs[i], change);
+	}
+}
+
+std::string ChangeJournal::indexKey(char action, const std::string& fn)
+{
+	return std::string(1, action) + fn;
+}
+
+bool ChangeJournal::isBelow(const std::string& fn, const std::string& dir)
+{
+	return fn.size() > dir.size()
+		&& fn[dir.size()] == '/'
+		&& fn.compare(0, dir.size(), dir) == 0;
+}
+
+std::string ChangeJournal::replacePrefix(const std::string& fn, const std::string& dir, const std::string& new_dir)
+{
+	return new_dir + fn.substr(dir.size());
+}
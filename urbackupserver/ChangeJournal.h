@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+/**
+* Compacts the change stream of continuous backups.
+* Pending changes are kept in replay order and indexed by
+* action and path, so that adding a change does not need to
+* scan all pending changes. The path index is ordered, so
+* changes below a directory can be found via a prefix range.
+*/
+class ChangeJournal
+{
+public:
+	struct SChange
+	{
+		SChange()
+		{
+
+		}
+
+		SChange(char action, std::string fn1)
+			: action(action), fn1(fn1)
+		{
+
+		}
+
+		char action;
+		std::string fn1;
+		std::string fn2;
+
+		bool operator==(const SChange& other)
+		{
+			return action==other.action
+				&& fn1==other.fn1
+				&& fn2==other.fn2;
+		}
+	};
+
+	ChangeJournal();
+
+	void addChangeCheck(const SChange& change);
+	void addChange(SChange change, char del_action, char mod_action);
+	void delChange(SChange change, char add_action, char mod_action, char ren_action);
+	void renChange(SChange change, char add_action, char mod_action, char ren_action);
+
+	bool empty();
+	size_t size();
+	void getChanges(std::vector<SChange>& ret);
+	void clear();
+
+private:
+	typedef std::pair<std::string, int64> SIndexKey;
+
+	int64 insertChange(const SChange& change);
+	void eraseChange(int64 seq);
+	void updateChange(int64 seq, const SChange& change);
+
+	int64 firstIndexed(std::set<SIndexKey>& index, char action, const std::string& fn);
+	int64 lastIndexed(std::set<SIndexKey>& index, char action, const std::string& fn);
+	void getIndexed(std::set<SIndexKey>& index, char action, const std::string& fn, std::vector<int64>& seqs);
+	void getIndexedPrefix(std::set<SIndexKey>& index, char action, const std::string& dir, std::vector<int64>& seqs);
+	void getAllIndexedPrefix(std::set<SIndexKey>& index, const std::string& dir, int64 min_seq, std::vector<int64>& seqs);
+	bool eraseIndexed(std::set<SIndexKey>& index, char action, const std::string& fn);
+
+	void removeDirChildren(const std::string& dir);
+	void renameDirChildren(const std::string& dir, const std::string& new_dir, int64 min_seq, bool only_mod);
+
+	static std::string indexKey(char action, const std::string& fn);
+	static bool isBelow(const std::string& fn, const std::string& dir);
+	static std::string replacePrefix(const std::string& fn, const std::string& dir, const std::string& new_dir);
+
+	std::map<int64, SChange> changes;
+	std::set<SIndexKey> fn1_index;
+	std::set<SIndexKey> fn2_index;
+	int64 next_seq;
+};
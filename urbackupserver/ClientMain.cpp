@@ -61,6 +61,7 @@
 #include "ImageBackup.h"
 #include "ContinuousBackup.h"
 #include "ThrottleUpdater.h"
+#include "HierarchicalThrottler.h"
 #include "../fileservplugin/IFileServ.h"
 #include "DataplanDb.h"
 
@@ -2164,14 +2165,43 @@ int ClientMain::getNumberOfRunningFileBackups(void)
 	return running_file_backups;
 }
 
-IPipeThrottler *ClientMain::getThrottler(int speed_bps)
+IPipeThrottler *ClientMain::getThrottler(ServerSettings* server_settings)
 {
+	int speed_bps;
+	HierarchicalThrottler* global_throttler=NULL;
+	if(internet_connection)
+	{
+		speed_bps=server_settings->getInternetSpeed();
+		int global_speed=server_settings->getGlobalInternetSpeed();
+		if(global_speed!=0
+			&& global_speed!=-1)
+		{
+			global_throttler=BackupServer::getGlobalInternetThrottler(global_speed);
+		}
+	}
+	else
+	{
+		speed_bps=server_settings->getLocalSpeed();
+		int global_speed=server_settings->getGlobalLocalSpeed();
+		if(global_speed!=0
+			&& global_speed!=-1)
+		{
+			global_throttler=BackupServer::getGlobalLocalThrottler(global_speed);
+		}
+	}
+
+	if((speed_bps==0 || speed_bps==-1)
+		&& global_throttler==NULL)
+	{
+		return NULL;
+	}
+
 	IScopedLock lock(throttle_mutex);
 
 	if(client_throttler==NULL)
 	{
-		client_throttler=Server->createPipeThrottler(new ThrottleUpdater(clientid,
-			internet_connection?ThrottleScope_Internet:ThrottleScope_Local));
+		client_throttler=new HierarchicalThrottler(clientname, new ThrottleUpdater(clientid,
+			internet_connection?ThrottleScope_Internet:ThrottleScope_Local), global_throttler, clientid);
 	}
 	else
 	{
@@ -2179,8 +2209,11 @@ IPipeThrottler *ClientMain::getThrottler(int speed_bps)
 		size_t bps = BackupServer::throttleSpeedToBps(speed_bps, percent_max);
 		client_throttler->changeThrottleLimit(bps,
 			percent_max);
+		client_throttler->setParent(global_throttler);
 	}
 
+	client_throttler->setWeight(static_cast<size_t>((std::max)(server_settings->getSettings()->throttle_weight, 1)));
+
 	return client_throttler;
 }
 
@@ -2323,17 +2356,10 @@ IPipe *ClientMain::getClientCommandConnection(int timeoutms, std::string* client
 		IPipe *ret=InternetServiceConnector::getConnection(curr_clientname, SERVICE_COMMANDS, timeoutms);
 		if(server_settings!=NULL && ret!=NULL)
 		{
-			int internet_speed=server_settings->getInternetSpeed();
-			if(internet_speed!=0
-				&& internet_speed!=-1)
+			IPipeThrottler* throttler=getThrottler(server_settings);
+			if(throttler!=NULL)
 			{
-				ret->addThrottler(getThrottler(internet_speed));
-			}
-			int global_internet_speed=server_settings->getGlobalInternetSpeed();
-			if(global_internet_speed!=0
-				&& global_internet_speed!=-1)
-			{
-				ret->addThrottler(BackupServer::getGlobalInternetThrottler(global_internet_speed));
+				ret->addThrottler(throttler);
 			}
 		}
 		return ret;
@@ -2343,17 +2369,10 @@ IPipe *ClientMain::getClientCommandConnection(int timeoutms, std::string* client
 		IPipe *ret=Server->ConnectStream(inet_ntoa(getClientaddr().sin_addr), serviceport, timeoutms);
 		if(server_settings!=NULL && ret!=NULL)
 		{
-			int local_speed=server_settings->getLocalSpeed();
-			if(local_speed!=0
-				&& local_speed!=-1)
-			{
-				ret->addThrottler(getThrottler(local_speed));
-			}
-			int global_local_speed=server_settings->getGlobalLocalSpeed();
-			if(global_local_speed!=0
-				&& global_local_speed!=-1)
+			IPipeThrottler* throttler=getThrottler(server_settings);
+			if(throttler!=NULL)
 			{
-				ret->addThrottler(BackupServer::getGlobalLocalThrottler(global_local_speed));
+				ret->addThrottler(throttler);
 			}
 		}
 		return ret;
@@ -2377,17 +2396,10 @@ _u32 ClientMain::getClientFilesrvConnection(FileClient *fc, ServerSettings* serv
 
 		if(server_settings!=NULL)
 		{
-			int internet_speed=server_settings->getInternetSpeed();
-			if(internet_speed!=0
-				&& internet_speed!=-1)
+			IPipeThrottler* throttler=getThrottler(server_settings);
+			if(throttler!=NULL)
 			{
-				fc->addThrottler(getThrottler(internet_speed));
-			}
-			int global_internet_speed=server_settings->getGlobalInternetSpeed();
-			if(global_internet_speed!=0
-				&& global_internet_speed!=-1)
-			{
-				fc->addThrottler(BackupServer::getGlobalInternetThrottler(global_internet_speed));
+				fc->addThrottler(throttler);
 			}
 		}
 
@@ -2402,17 +2414,10 @@ _u32 ClientMain::getClientFilesrvConnection(FileClient *fc, ServerSettings* serv
 
 		if(server_settings!=NULL)
 		{
-			int local_speed=server_settings->getLocalSpeed();
-			if(local_speed!=0
-				&& local_speed!=-1)
+			IPipeThrottler* throttler=getThrottler(server_settings);
+			if(throttler!=NULL)
 			{
-				fc->addThrottler(getThrottler(local_speed));
-			}
-			int global_local_speed=server_settings->getGlobalLocalSpeed();
-			if(global_local_speed!=0
-				&& global_local_speed!=-1)
-			{
-				fc->addThrottler(BackupServer::getGlobalLocalThrottler(global_local_speed));
+				fc->addThrottler(throttler);
 			}
 		}
 
@@ -2460,38 +2465,10 @@ bool ClientMain::getClientChunkedFilesrvConnection(std::auto_ptr<FileClientChunk
 
 	if(fc_chunked->getPipe()!=NULL && server_settings!=NULL)
 	{
-		int speed;
-		if(internet_connection)
-		{
-			speed=server_settings->getInternetSpeed();
-		}
-		else
+		IPipeThrottler* throttler=getThrottler(server_settings);
+		if(throttler!=NULL)
 		{
-			speed=server_settings->getLocalSpeed();
-		}
-		if(speed!=0
-			&& speed!=-1)
-		{
-			fc_chunked->addThrottler(getThrottler(speed));
-		}
-
-		if(internet_connection)
-		{
-			int global_speed=server_settings->getGlobalInternetSpeed();
-			if(global_speed!=0
-				&& global_speed!=-1)
-			{
-				fc_chunked->addThrottler(BackupServer::getGlobalInternetThrottler(global_speed));
-			}
-		}
-		else
-		{
-			int global_speed=server_settings->getGlobalLocalSpeed();
-			if(global_speed!=0
-				&& global_speed!=-1)
-			{
-				fc_chunked->addThrottler(BackupServer::getGlobalLocalThrottler(global_speed));
-			}
+			fc_chunked->addThrottler(throttler);
 		}
 	}
 
@@ -26,6 +26,7 @@ class IPipe;
 class ServerPingThread;
 class FileClient;
 class IPipeThrottler;
+class HierarchicalThrottler;
 class BackupServerContinuous;
 class ContinuousBackup;
 class Backup;
@@ -261,7 +262,7 @@ private:
 	bool sendFile(IPipe *cc, IFile *f, int timeout);
 	bool isBackupsRunningOkay(bool file, bool incr=false);	
 	bool updateCapabilities(void);
-	IPipeThrottler *getThrottler(int speed_bps);
+	IPipeThrottler *getThrottler(ServerSettings* server_settings);
 	bool inBackupWindow(Backup* backup);
 	void updateClientAccessKey();
 	bool isDataplanOkay(bool file);
@@ -342,7 +343,7 @@ private:
 	CTCPStack tcpstack;
 
 	IMutex* throttle_mutex;
-	IPipeThrottler *client_throttler;
+	HierarchicalThrottler *client_throttler;
 
 	int64 last_backup_try;
 	
@@ -0,0 +1,264 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "DirLinkIndex.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Database.h"
+#include "../Interface/DatabaseCursor.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../stringtools.h"
+
+IMutex* DirLinkIndex::mutex = NULL;
+common::lrucache<int, DirLinkIndex::SClientLinks*> DirLinkIndex::clients;
+size_t DirLinkIndex::n_entries = 0;
+size_t DirLinkIndex::max_entries = 0;
+
+void DirLinkIndex::init()
+{
+	mutex = Server->createMutex();
+	max_entries = static_cast<size_t>(watoi64(Server->getServerParameter("dir_link_index_max_entries", "500000")));
+}
+
+void DirLinkIndex::destroy()
+{
+	while (!clients.empty())
+	{
+		delete clients.evict_one().second;
+	}
+	n_entries = 0;
+
+	Server->destroy(mutex);
+}
+
+bool DirLinkIndex::getLinksInDirectory(IDatabase* db, int clientid, const std::string& dir,
+	std::vector<ServerLinkDao::DirectoryLinkEntry>& entries)
+{
+	if (!loadClient(db, clientid))
+	{
+		return false;
+	}
+
+	IScopedLock lock(mutex);
+
+	SClientLinks** links = clients.get(clientid, false);
+	if (links == NULL || !(*links)->indexed)
+	{
+		return false;
+	}
+
+	std::string prefix = dir + os_file_sep();
+
+	for (std::multimap<std::string, std::string>::iterator it = (*links)->targets.lower_bound(prefix);
+		it != (*links)->targets.end() && next(it->first, 0, prefix); ++it)
+	{
+		ServerLinkDao::DirectoryLinkEntry entry;
+		entry.name = it->second;
+		entry.target = it->first;
+		entries.push_back(entry);
+	}
+
+	return true;
+}
+
+bool DirLinkIndex::getDirectoryRefcount(IDatabase* db, int clientid, const std::string& name, int& refcount)
+{
+	if (!loadClient(db, clientid))
+	{
+		return false;
+	}
+
+	IScopedLock lock(mutex);
+
+	SClientLinks** links = clients.get(clientid, false);
+	if (links == NULL || !(*links)->indexed)
+	{
+		return false;
+	}
+
+	std::map<std::string, int>::iterator it = (*links)->refcounts.find(name);
+	refcount = it != (*links)->refcounts.end() ? it->second : 0;
+
+	return true;
+}
+
+void DirLinkIndex::addDirectoryLink(int clientid, const std::string& name, const std::string& target)
+{
+	IScopedLock lock(mutex);
+
+	SClientLinks** links = clients.get(clientid, false);
+	if (links == NULL || !(*links)->indexed)
+	{
+		return;
+	}
+
+	(*links)->targets.insert(std::make_pair(target, name));
+	++(*links)->refcounts[name];
+	++n_entries;
+
+	evictClients();
+}
+
+void DirLinkIndex::removeDirectoryLink(int clientid, const std::string& target)
+{
+	IScopedLock lock(mutex);
+
+	SClientLinks** links = clients.get(clientid, false);
+	if (links == NULL || !(*links)->indexed)
+	{
+		return;
+	}
+
+	std::pair<std::multimap<std::string, std::string>::iterator, std::multimap<std::string, std::string>::iterator> range
+		= (*links)->targets.equal_range(target);
+
+	removeTargets(*links, range.first, range.second);
+}
+
+void DirLinkIndex::removeLinksInDirectory(int clientid, const std::string& dir)
+{
+	IScopedLock lock(mutex);
+
+	SClientLinks** links = clients.get(clientid, false);
+	if (links == NULL || !(*links)->indexed)
+	{
+		return;
+	}
+
+	std::string prefix = dir + os_file_sep();
+
+	std::multimap<std::string, std::string>::iterator begin = (*links)->targets.lower_bound(prefix);
+	std::multimap<std::string, std::string>::iterator end = begin;
+	while (end != (*links)->targets.end() && next(end->first, 0, prefix))
+	{
+		++end;
+	}
+
+	removeTargets(*links, begin, end);
+}
+
+void DirLinkIndex::invalidate(int clientid)
+{
+	IScopedLock lock(mutex);
+
+	SClientLinks** links = clients.get(clientid, false);
+	if (links == NULL)
+	{
+		return;
+	}
+
+	n_entries -= (*links)->targets.size();
+	delete *links;
+	clients.del(clientid);
+}
+
+bool DirLinkIndex::loadClient(IDatabase* db, int clientid)
+{
+	if (max_entries == 0)
+	{
+		return false;
+	}
+
+	{
+		IScopedLock lock(mutex);
+
+		SClientLinks** links = clients.get(clientid);
+		if (links != NULL)
+		{
+			return (*links)->indexed;
+		}
+	}
+
+	SClientLinks* new_links = loadClientLinks(db, clientid);
+
+	IScopedLock lock(mutex);
+
+	SClientLinks** links = clients.get(clientid);
+	if (links != NULL)
+	{
+		//Loaded concurrently
+		delete new_links;
+		return (*links)->indexed;
+	}
+
+	clients.put(clientid, new_links);
+	n_entries += new_links->targets.size();
+
+	evictClients();
+
+	return new_links->indexed;
+}
+
+DirLinkIndex::SClientLinks* DirLinkIndex::loadClientLinks(IDatabase* db, int clientid)
+{
+	SClientLinks* links = new SClientLinks;
+
+	IQuery* q_links = db->Prepare("SELECT name, target FROM directory_links WHERE clientid=?", false);
+	q_links->Bind(clientid);
+
+	IDatabaseCursor* cursor = q_links->Cursor();
+
+	db_single_result res;
+	while (cursor->next(res))
+	{
+		if (links->targets.size() >= max_entries)
+		{
+			Server->Log("Client " + convert(clientid) + " has more than " + convert(max_entries) + " directory links. Not indexing them in memory.", LL_DEBUG);
+			links->targets.clear();
+			links->refcounts.clear();
+			links->indexed = false;
+			cursor->shutdown();
+			break;
+		}
+
+		links->targets.insert(std::make_pair(res["target"], res["name"]));
+		++links->refcounts[res["name"]];
+	}
+
+	db->destroyQuery(q_links);
+
+	return links;
+}
+
+void DirLinkIndex::removeTargets(SClientLinks* links, std::multimap<std::string, std::string>::iterator begin,
+	std::multimap<std::string, std::string>::iterator end)
+{
+	for (std::multimap<std::string, std::string>::iterator it = begin; it != end; ++it)
+	{
+		std::map<std::string, int>::iterator it_ref = links->refcounts.find(it->second);
+		if (it_ref != links->refcounts.end()
+			&& --it_ref->second <= 0)
+		{
+			links->refcounts.erase(it_ref);
+		}
+		--n_entries;
+	}
+
+	links->targets.erase(begin, end);
+}
+
+void DirLinkIndex::evictClients()
+{
+	while (n_entries > max_entries
+		&& clients.size() > 1)
+	{
+		SClientLinks* links = clients.evict_one().second;
+		n_entries -= links->targets.size();
+		delete links;
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "dao/ServerLinkDao.h"
+#include "../common/lrucache.h"
+#include <string>
+#include <vector>
+#include <map>
+
+class IMutex;
+class IDatabase;
+
+/**
+* In-memory index of the directory pool references (directory_links)
+* of recently used clients, ordered by link target. The links database
+* stays authoritative. All changes to it have to be mirrored here (or the
+* client invalidated). Clients with more references than the configured
+* maximum are not indexed and callers have to use the links database.
+*/
+class DirLinkIndex
+{
+public:
+	static void init();
+	static void destroy();
+
+	static bool getLinksInDirectory(IDatabase* db, int clientid, const std::string& dir,
+		std::vector<ServerLinkDao::DirectoryLinkEntry>& entries);
+	static bool getDirectoryRefcount(IDatabase* db, int clientid, const std::string& name, int& refcount);
+
+	static void addDirectoryLink(int clientid, const std::string& name, const std::string& target);
+	static void removeDirectoryLink(int clientid, const std::string& target);
+	static void removeLinksInDirectory(int clientid, const std::string& dir);
+
+	static void invalidate(int clientid);
+
+private:
+	struct SClientLinks
+	{
+		SClientLinks()
+			: indexed(true)
+		{}
+
+		bool indexed;
+		std::multimap<std::string, std::string> targets;
+		std::map<std::string, int> refcounts;
+	};
+
+	static bool loadClient(IDatabase* db, int clientid);
+	static SClientLinks* loadClientLinks(IDatabase* db, int clientid);
+
+	static void removeTargets(SClientLinks* links, std::multimap<std::string, std::string>::iterator begin,
+		std::multimap<std::string, std::string>::iterator end);
+
+	static void evictClients();
+
+	static IMutex* mutex;
+	static common::lrucache<int, SClientLinks*> clients;
+	static size_t n_entries;
+	static size_t max_entries;
+};
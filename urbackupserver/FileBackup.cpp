@@ -46,6 +46,7 @@
 #endif
 
 const unsigned int full_backup_construct_timeout=4*60*60*1000;
+const size_t hashpipe_ring_capacity=1024;
 extern std::string server_identity;
 
 FileBackup::FileBackup( ClientMain* client_main, int clientid, std::string clientname, std::string clientsubname, LogAction log_action,
@@ -454,8 +455,8 @@ void FileBackup::createHashThreads(bool use_reflink, bool ignore_hash_mismatches
 	assert(bsh==NULL);
 	assert(bsh_prepare==NULL);
 
-	hashpipe=Server->createMemoryPipe();
-	hashpipe_prepare=Server->createMemoryPipe();
+	hashpipe=Server->createMemoryPipe(hashpipe_ring_capacity);
+	hashpipe_prepare=Server->createMemoryPipe(hashpipe_ring_capacity);
 
 	bsh=new BackupServerHash(hashpipe, clientid, use_snapshots, use_reflink, use_tmpfiles, logid, use_snapshots);
 	bsh_prepare=new BackupServerPrepareHash(hashpipe_prepare, hashpipe, clientid, logid, ignore_hash_mismatches);
@@ -575,7 +576,7 @@ _i64 FileBackup::getIncrementalSize(IFile *f, const std::vector<size_t> &diffs,
 	return rsize;
 }
 
-void FileBackup::calculateDownloadSpeed(int64 ctime, FileClient & fc, FileClientChunked * fc_chunked)
+void FileBackup::calculateDownloadSpeed(int64 ctime, FileClient & fc, FileClientChunked * fc_chunked, int64 helper_transferred_bytes)
 {
 	if (speed_set_time == 0)
 	{
@@ -584,7 +585,7 @@ void FileBackup::calculateDownloadSpeed(int64 ctime, FileClient & fc, FileClient
 
 	if (ctime - speed_set_time>10000)
 	{
-		int64 received_data_bytes = fc.getTransferredBytes() + (fc_chunked != NULL ? fc_chunked->getTransferredBytes() : 0);
+		int64 received_data_bytes = fc.getTransferredBytes() + (fc_chunked != NULL ? fc_chunked->getTransferredBytes() : 0) + helper_transferred_bytes;
 
 		int64 new_bytes = received_data_bytes - last_speed_received_bytes;
 		int64 passed_time = ctime - speed_set_time;
@@ -96,7 +96,11 @@ public:
 
 	virtual bool has_error(void)=0;
 
-	virtual void create(get_data_callback_t get_data_callback, void *userdata)=0;
+	/**
+	* Adds the entries of the files database files_db. The entries
+	* have to be in key order if append is true.
+	*/
+	virtual void create(get_data_callback_t get_data_callback, void *userdata, IDatabase* files_db, bool append)=0;
 
 	virtual int64 get(const SIndexKey& key)=0;
 
@@ -0,0 +1,272 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "FilesDbShards.h"
+#include "../Interface/Server.h"
+#include "../Interface/Database.h"
+#include "../stringtools.h"
+#include "database.h"
+#include "dao/ServerFilesDao.h"
+#include "dao/ServerBackupDao.h"
+
+namespace
+{
+	const size_t sqlite_data_allocation_chunk_size = 50 * 1024 * 1024; //50MB
+	const int64 entry_id_shift = 40;
+}
+
+size_t FilesDbShards::num_shards = 0;
+std::vector<bool> FilesDbShards::opened_shards;
+
+bool FilesDbShards::open()
+{
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	if (db == NULL)
+	{
+		return false;
+	}
+
+	size_t n;
+	{
+		ServerBackupDao backupdao(db);
+		n = static_cast<size_t>(watoi(backupdao.getMiscValue("files_db_shards").value));
+	}
+
+	if (n > max_files_db_shards)
+	{
+		Server->Log("Number of files database shards (" + convert(n) + ") too large", LL_ERROR);
+		return false;
+	}
+
+	for (size_t i = 1; i <= n; ++i)
+	{
+		if (!openShard(i))
+		{
+			return false;
+		}
+	}
+
+	num_shards = n;
+
+	return true;
+}
+
+bool FilesDbShards::isMigrationPending()
+{
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	ServerBackupDao backupdao(db);
+	return backupdao.getMiscValue("files_db_shards_migration").exists;
+}
+
+size_t FilesDbShards::getNumShards()
+{
+	return num_shards;
+}
+
+DATABASE_ID FilesDbShards::getDatabaseId(size_t idx)
+{
+	if (idx == 0)
+	{
+		return URBACKUPDB_SERVER_FILES;
+	}
+
+	return URBACKUPDB_SERVER_FILES_SHARD + static_cast<DATABASE_ID>(idx - 1);
+}
+
+DATABASE_ID FilesDbShards::getDelDatabaseId(size_t idx)
+{
+	if (idx == 0)
+	{
+		return URBACKUPDB_SERVER_FILES_DEL;
+	}
+
+	return URBACKUPDB_SERVER_FILES_SHARD_DEL + static_cast<DATABASE_ID>(idx - 1);
+}
+
+DATABASE_ID FilesDbShards::getNewDatabaseId(size_t idx)
+{
+	if (idx == 0)
+	{
+		return URBACKUPDB_SERVER_FILES_NEW;
+	}
+
+	return URBACKUPDB_SERVER_FILES_SHARD_NEW + static_cast<DATABASE_ID>(idx - 1);
+}
+
+std::string FilesDbShards::getDatabaseName(size_t idx)
+{
+	if (idx == 0)
+	{
+		return "backup_server_files.db";
+	}
+
+	return "backup_server_files_" + convert(idx) + ".db";
+}
+
+std::string FilesDbShards::getDatabaseFilename(size_t idx)
+{
+	return "urbackup/" + getDatabaseName(idx);
+}
+
+size_t FilesDbShards::getClientIdx(int clientid)
+{
+	return getClientIdx(clientid, num_shards);
+}
+
+size_t FilesDbShards::getClientIdx(int clientid, size_t n_shards)
+{
+	if (n_shards == 0)
+	{
+		return 0;
+	}
+
+	return static_cast<size_t>(clientid) % n_shards + 1;
+}
+
+DATABASE_ID FilesDbShards::getClientDatabaseId(int clientid)
+{
+	return getDatabaseId(getClientIdx(clientid));
+}
+
+size_t FilesDbShards::getEntryIdx(int64 entryid)
+{
+	return static_cast<size_t>(entryid >> entry_id_shift);
+}
+
+DATABASE_ID FilesDbShards::getEntryDatabaseId(int64 entryid)
+{
+	return getDatabaseId(getEntryIdx(entryid));
+}
+
+bool FilesDbShards::openShard(size_t idx)
+{
+	if (idx < opened_shards.size()
+		&& opened_shards[idx])
+	{
+		return true;
+	}
+
+	std::string fn = getDatabaseFilename(idx);
+
+	str_map params;
+	params["wal_autocheckpoint"] = "0";
+
+	std::string sqlite_mmap_huge = Server->getServerParameter("sqlite_mmap_huge");
+	if (!sqlite_mmap_huge.empty())
+	{
+		params["mmap_size"] = sqlite_mmap_huge;
+	}
+
+	if (!Server->openDatabase(fn, getDatabaseId(idx), params))
+	{
+		Server->Log("Couldn't open files database shard \"" + fn + "\"", LL_ERROR);
+		return false;
+	}
+
+	str_map params_nil;
+	if (!Server->openDatabase(fn, getDelDatabaseId(idx), params_nil))
+	{
+		Server->Log("Couldn't open files database shard \"" + fn + "\" (2)", LL_ERROR);
+		return false;
+	}
+
+	Server->setDatabaseAllocationChunkSize(getDatabaseId(idx), sqlite_data_allocation_chunk_size);
+
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), getDatabaseId(idx));
+	if (db == NULL)
+	{
+		Server->Log("Couldn't open files database shard \"" + fn + "\" (3)", LL_ERROR);
+		return false;
+	}
+
+	if (db->Read("SELECT name FROM sqlite_master WHERE name='files' AND type='table'").empty())
+	{
+		Server->Log("Creating files database shard \"" + fn + "\"...", LL_INFO);
+
+		db->Write("PRAGMA journal_mode=WAL");
+
+		DBScopedWriteTransaction trans(db);
+
+		if (!db->Write("CREATE TABLE files ("
+			"id INTEGER PRIMARY KEY AUTOINCREMENT,"
+			"backupid INTEGER,"
+			"fullpath TEXT,"
+			"shahash BLOB,"
+			"filesize INTEGER,"
+			"created INTEGER DEFAULT (CAST(strftime('%s','now') as INTEGER)),"
+			"rsize INTEGER, clientid INTEGER, incremental INTEGER, hashpath TEXT, next_entry INTEGER, prev_entry INTEGER, pointed_to INTEGER)")
+			|| !db->Write("CREATE INDEX files_backupid ON files (backupid)")
+			|| !db->Write("CREATE TABLE files_incoming_stat (id INTEGER PRIMARY KEY AUTOINCREMENT, filesize INTEGER, clientid INTEGER, backupid INTEGER, existing_clients TEXT, direction INTEGER, incremental INTEGER)")
+			|| !db->Write("INSERT INTO sqlite_sequence (name, seq) VALUES ('files', " + convert(static_cast<int64>(idx) << entry_id_shift) + ")"))
+		{
+			Server->Log("Creating files database shard \"" + fn + "\" failed", LL_ERROR);
+			trans.rollback();
+			return false;
+		}
+	}
+
+	if (opened_shards.size() <= idx)
+	{
+		opened_shards.resize(idx + 1);
+	}
+	opened_shards[idx] = true;
+
+	return true;
+}
+
+void FilesDbShards::setNumShards(size_t n)
+{
+	num_shards = n;
+}
+
+FilesDaos::FilesDaos()
+{
+}
+
+FilesDaos::~FilesDaos()
+{
+	for (size_t i = 0; i < daos.size(); ++i)
+	{
+		delete daos[i];
+	}
+}
+
+ServerFilesDao& FilesDaos::getDao(size_t idx)
+{
+	if (daos.size() <= idx)
+	{
+		daos.resize(idx + 1, NULL);
+	}
+
+	if (daos[idx] == NULL)
+	{
+		daos[idx] = new ServerFilesDao(Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(idx)));
+	}
+
+	return *daos[idx];
+}
+
+ServerFilesDao& FilesDaos::getClientDao(int clientid)
+{
+	return getDao(FilesDbShards::getClientIdx(clientid));
+}
+
+ServerFilesDao& FilesDaos::getEntryDao(int64 entryid)
+{
+	return getDao(FilesDbShards::getEntryIdx(entryid));
+}
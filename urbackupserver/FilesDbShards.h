@@ -0,0 +1,95 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include <string>
+#include <vector>
+
+class IDatabase;
+class ServerFilesDao;
+
+const size_t max_files_db_shards = 64;
+
+/**
+* Optional layout of the files database where the file entries of the
+* clients are stored in several database files (shards) instead of only
+* in backup_server_files.db. A client's entries (and its part of the
+* incoming file statistics journal) are always in the same shard, so
+* backups, cleanups and statistics updates of clients in different shards
+* do not compete for the same database write lock. Entries of different
+* clients are only linked via the file entry index.
+*
+* Database index 0 is backup_server_files.db, the shards have the
+* indices 1 to getNumShards(). The entry ids of each database are in a
+* separate range, so the database of an entry can be found via its id.
+* The layout is changed with the "shard_files_db" app.
+*/
+class FilesDbShards
+{
+public:
+	/**
+	* Opens the shards of the current layout. Called after
+	* the main files database was opened.
+	*/
+	static bool open();
+
+	/**
+	* True if the "shard_files_db" app was interrupted
+	*/
+	static bool isMigrationPending();
+
+	static size_t getNumShards();
+
+	static size_t getNumDatabases() {
+		return getNumShards() + 1;
+	}
+
+	static DATABASE_ID getDatabaseId(size_t idx);
+	static DATABASE_ID getDelDatabaseId(size_t idx);
+	static DATABASE_ID getNewDatabaseId(size_t idx);
+	static std::string getDatabaseName(size_t idx);
+	static std::string getDatabaseFilename(size_t idx);
+
+	static size_t getClientIdx(int clientid);
+	static DATABASE_ID getClientDatabaseId(int clientid);
+
+	static size_t getEntryIdx(int64 entryid);
+	static DATABASE_ID getEntryDatabaseId(int64 entryid);
+
+	/**
+	* Opens (and creates if necessary) the shard with index idx
+	*/
+	static bool openShard(size_t idx);
+
+	/**
+	* Changes the layout used by getClientIdx(). Only used while migrating.
+	*/
+	static void setNumShards(size_t n);
+
+	static size_t getClientIdx(int clientid, size_t n_shards);
+
+private:
+	static size_t num_shards;
+	static std::vector<bool> opened_shards;
+};
+
+/**
+* Files database access objects of the current thread for each files database
+*/
+class FilesDaos
+{
+public:
+	FilesDaos();
+	~FilesDaos();
+
+	ServerFilesDao& getDao(size_t idx);
+
+	ServerFilesDao& getClientDao(int clientid);
+
+	ServerFilesDao& getEntryDao(int64 entryid);
+
+private:
+	FilesDaos(const FilesDaos& other);
+	FilesDaos& operator=(const FilesDaos& other);
+
+	std::vector<ServerFilesDao*> daos;
+};
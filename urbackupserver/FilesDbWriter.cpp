@@ -0,0 +1,230 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "FilesDbWriter.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "../Interface/Database.h"
+#include "../stringtools.h"
+#include "server_hash.h"
+#include "create_files_index.h"
+#include "dao/ServerFilesDao.h"
+#include "FilesDbShards.h"
+#include "BackupMetrics.h"
+#include <memory>
+#include <algorithm>
+
+std::vector<FilesDbWriter*> FilesDbWriter::writers;
+size_t FilesDbWriter::max_batch_size = 0;
+size_t FilesDbWriter::max_queue_size = 0;
+
+FilesDbWriter::FilesDbWriter(size_t db_idx)
+	: db_idx(db_idx), mutex(Server->createMutex()), cond(Server->createCondition()),
+	queued_ticket(0), done_ticket(0), running(false), do_stop(false)
+{
+}
+
+FilesDbWriter::~FilesDbWriter()
+{
+	Server->destroy(mutex);
+	Server->destroy(cond);
+}
+
+void FilesDbWriter::init()
+{
+	max_batch_size = static_cast<size_t>(watoi(Server->getServerParameter("files_db_batch_size", "1000")));
+	max_queue_size = max_batch_size * 4;
+
+	if (max_batch_size == 0)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < FilesDbShards::getNumDatabases(); ++i)
+	{
+		writers.push_back(new FilesDbWriter(i));
+		writers[i]->running = true;
+	}
+}
+
+void FilesDbWriter::start()
+{
+	for (size_t i = 0; i < writers.size(); ++i)
+	{
+		Server->createThread(writers[i], "files db writer");
+	}
+}
+
+void FilesDbWriter::operator()()
+{
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(db_idx));
+	ServerFilesDao filesdao(db);
+	std::auto_ptr<FileIndex> fileindex(create_lmdb_files_index());
+
+	std::vector<SFileEntry> entries;
+
+	IScopedLock lock(mutex);
+	while (true)
+	{
+		while (queue.empty()
+			&& !do_stop)
+		{
+			cond->wait(&lock);
+		}
+
+		if (queue.empty())
+		{
+			running = false;
+			cond->notify_all();
+			break;
+		}
+
+		size_t n = (std::min)(queue.size(), max_batch_size);
+		entries.assign(queue.begin(), queue.begin() + n);
+		queue.erase(queue.begin(), queue.begin() + n);
+		cond->notify_all();
+
+		lock.relock(NULL);
+
+		writeEntries(filesdao, *fileindex, entries);
+
+		lock.relock(mutex);
+
+		done_ticket += n;
+		cond->notify_all();
+	}
+
+	lock.relock(NULL);
+
+	fileindex.reset();
+	db->freeMemory();
+}
+
+int64 FilesDbWriter::addFile(const SFileEntry& entry)
+{
+	if (writers.empty())
+	{
+		return 0;
+	}
+
+	return writers[FilesDbShards::getClientIdx(entry.clientid)]->add(entry);
+}
+
+int64 FilesDbWriter::add(const SFileEntry& entry)
+{
+	IScopedLock lock(mutex);
+
+	while (running
+		&& queue.size() >= max_queue_size)
+	{
+		cond->wait(&lock);
+	}
+
+	if (!running || do_stop)
+	{
+		return 0;
+	}
+
+	queue.push_back(entry);
+	cond->notify_all();
+
+	return ++queued_ticket;
+}
+
+void FilesDbWriter::waitFor(int clientid, int64 ticket)
+{
+	writers[FilesDbShards::getClientIdx(clientid)]->wait(ticket);
+}
+
+void FilesDbWriter::wait(int64 ticket)
+{
+	IScopedLock lock(mutex);
+
+	while (done_ticket < ticket)
+	{
+		cond->wait(&lock);
+	}
+}
+
+void FilesDbWriter::flush()
+{
+	for (size_t i = 0; i < writers.size(); ++i)
+	{
+		int64 ticket;
+		{
+			IScopedLock lock(writers[i]->mutex);
+			ticket = writers[i]->queued_ticket;
+		}
+
+		writers[i]->wait(ticket);
+	}
+}
+
+void FilesDbWriter::stop()
+{
+	for (size_t i = 0; i < writers.size(); ++i)
+	{
+		writers[i]->stopWriter();
+	}
+}
+
+void FilesDbWriter::stopWriter()
+{
+	IScopedLock lock(mutex);
+	do_stop = true;
+	cond->notify_all();
+
+	while (running)
+	{
+		cond->wait(&lock);
+	}
+}
+
+void FilesDbWriter::writeEntries(ServerFilesDao& filesdao, FileIndex& fileindex, std::vector<SFileEntry>& entries)
+{
+	std::vector<std::pair<size_t, int64> > index_entries;
+
+	int64 starttime = BackupMetrics::getTimeUS();
+
+	{
+		DBScopedWriteTransaction trans(filesdao.getDatabase());
+
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			SFileEntry& entry = entries[i];
+			int64 entryid = BackupServerHash::addFileSQL(filesdao, fileindex, entry.backupid, entry.clientid, entry.incremental,
+				entry.fullpath, entry.hashpath, entry.shahash, entry.filesize, entry.rsize, entry.prev_entry, entry.prev_entry_clientid,
+				entry.next_entry, entry.update_fileindex, false);
+
+			if (entryid != 0)
+			{
+				index_entries.push_back(std::make_pair(i, entryid));
+			}
+		}
+	}
+
+	//Entries of all clients of this files database are committed together
+	BackupMetrics::record(logid_t(), EBackupStage_DbCommit, BackupMetrics::getTimeUS() - starttime, 0, static_cast<int64>(entries.size()));
+
+	for (size_t i = 0; i < index_entries.size(); ++i)
+	{
+		SFileEntry& entry = entries[index_entries[i].first];
+		FileIndex::put_delayed(FileIndex::SIndexKey(entry.shahash.c_str(), entry.filesize, entry.clientid), index_entries[i].second);
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "../Interface/Thread.h"
+#include <string>
+#include <deque>
+#include <vector>
+
+class IMutex;
+class ICondition;
+class ServerFilesDao;
+class FileIndex;
+
+/**
+* Writes the file entries of all running file backups to the files
+* database. The backup hash threads queue their new file entries and
+* continue, while the writer of the client's files database (see
+* FilesDbShards) applies everything queued in one write transaction
+* (group commit). Entries are added to the file entry index
+* after their transaction is committed. Callers that need the result of
+* an entry wait for the ticket returned by addFile(). The next entry of
+* an entry linked to an existing entry of the same client is read when
+* the entry is written, not when it is queued.
+*/
+class FilesDbWriter : public IThread
+{
+public:
+	struct SFileEntry
+	{
+		int backupid;
+		int clientid;
+		int incremental;
+		std::string fullpath;
+		std::string hashpath;
+		std::string shahash;
+		int64 filesize;
+		int64 rsize;
+		int64 prev_entry;
+		int64 prev_entry_clientid;
+		int64 next_entry;
+		bool update_fileindex;
+	};
+
+	FilesDbWriter(size_t db_idx);
+	~FilesDbWriter();
+
+	void operator()();
+
+	/**
+	* Creates a writer for each files database
+	*/
+	static void init();
+
+	static void start();
+
+	/**
+	* Queues the file entry. Returns the ticket of the entry
+	* or zero if the writer is not running, in which case the
+	* caller has to add the entry itself.
+	*/
+	static int64 addFile(const SFileEntry& entry);
+
+	/**
+	* Waits till the entry of this client with this ticket (and
+	* all entries queued before it) are committed
+	*/
+	static void waitFor(int clientid, int64 ticket);
+
+	static void flush();
+
+	/**
+	* Writes all queued entries and stops the writers. Entries
+	* are added by the callers afterwards.
+	*/
+	static void stop();
+
+private:
+	int64 add(const SFileEntry& entry);
+	void wait(int64 ticket);
+	void stopWriter();
+
+	void writeEntries(ServerFilesDao& filesdao, FileIndex& fileindex, std::vector<SFileEntry>& entries);
+
+	size_t db_idx;
+	IMutex* mutex;
+	ICondition* cond;
+	std::deque<SFileEntry> queue;
+	int64 queued_ticket;
+	int64 done_ticket;
+	bool running;
+	bool do_stop;
+
+	static std::vector<FilesDbWriter*> writers;
+	static size_t max_batch_size;
+	static size_t max_queue_size;
+};
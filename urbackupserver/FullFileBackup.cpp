@@ -227,6 +227,13 @@ bool FullFileBackup::doFileBackup()
 
 	bool queue_downloads = client_main->getProtocolVersions().filesrv_protocol_version>2;
 
+	if (!client_main->isOnInternetConnection()
+		&& server_settings->getSettings()->local_file_download_connections>1)
+	{
+		size_t n_helpers = server_download->addHelperConnections(server_settings->getSettings()->local_file_download_connections - 1, server_settings.get());
+		ServerLogger::Log(logid, clientname + ": Downloading files using " + convert(n_helpers + 1) + " connections", LL_DEBUG);
+	}
+
 	THREADPOOL_TICKET server_download_ticket = 
 		Server->getThreadPool()->execute(server_download.get(), "fbackup load");
 
@@ -299,7 +306,7 @@ bool FullFileBackup::doFileBackup()
 						}
 						else
 						{
-							int64 done_bytes = fc.getReceivedDataBytes(true) + linked_bytes;
+							int64 done_bytes = fc.getReceivedDataBytes(true) + server_download->getHelperReceivedDataBytes() + linked_bytes;
 							ServerStatus::setProcessDoneBytes(clientname, status_id, done_bytes);
 							ServerStatus::setProcessPcDone(clientname, status_id,
 								(std::min)(100, (int)(((float)done_bytes) / ((float)files_size / 100.f) + 0.5f)));
@@ -311,10 +318,10 @@ bool FullFileBackup::doFileBackup()
 
 					if (ctime - last_eta_update > eta_update_intervall)
 					{
-						calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, NULL, linked_bytes, last_eta_received_bytes, eta_estimated_speed, files_size);
+						calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, NULL, linked_bytes + server_download->getHelperReceivedDataBytes(), last_eta_received_bytes, eta_estimated_speed, files_size);
 					}
 
-					calculateDownloadSpeed(ctime, fc, NULL);
+					calculateDownloadSpeed(ctime, fc, NULL, server_download->getHelperTransferredBytes());
 
 				} while (server_download->sleepQueue());
 
@@ -608,7 +615,7 @@ bool FullFileBackup::doFileBackup()
 		}
 		else
 		{
-			int64 done_bytes = fc.getReceivedDataBytes(true) + linked_bytes;
+			int64 done_bytes = fc.getReceivedDataBytes(true) + server_download->getHelperReceivedDataBytes() + linked_bytes;
 			ServerStatus::setProcessDoneBytes(clientname, status_id, done_bytes);
 			ServerStatus::setProcessPcDone(clientname, status_id,
 				(std::min)(100,(int)(((float)done_bytes)/((float)files_size/100.f)+0.5f)));
@@ -620,10 +627,10 @@ bool FullFileBackup::doFileBackup()
 		int64 ctime = Server->getTimeMS();
 		if(ctime-last_eta_update>eta_update_intervall)
 		{
-			calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, NULL, linked_bytes, last_eta_received_bytes, eta_estimated_speed, files_size);
+			calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, NULL, linked_bytes + server_download->getHelperReceivedDataBytes(), last_eta_received_bytes, eta_estimated_speed, files_size);
 		}
 
-		calculateDownloadSpeed(ctime, fc, NULL);
+		calculateDownloadSpeed(ctime, fc, NULL, server_download->getHelperTransferredBytes());
 	}
 
 	addFilePathCorrections(server_download->getFilePathCorrections());
@@ -924,8 +931,8 @@ bool FullFileBackup::doFileBackup()
 		}
 	}
 
-	_i64 transferred_bytes=fc.getTransferredBytes();
-	_i64 transferred_compressed=fc.getRealTransferredBytes();
+	_i64 transferred_bytes=fc.getTransferredBytes()+server_download->getHelperTransferredBytes();
+	_i64 transferred_compressed=fc.getRealTransferredBytes()+server_download->getHelperRealTransferredBytes();
 	int64 passed_time=transfer_stop_time-full_backup_starttime;
 	if(passed_time==0) passed_time=1;
 
@@ -0,0 +1,363 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "HierarchicalThrottler.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+#include "../stringtools.h"
+#include <algorithm>
+
+namespace
+{
+	const int64 c_child_active_time = 1000;
+	const int64 c_child_prune_time = 60 * 1000;
+	const int64 c_max_wait_ms = 60 * 1000;
+	const int64 c_stats_log_interval = 10 * 60 * 1000;
+	const int64 c_min_bucket_size = 16 * 1024;
+	const size_t c_min_lease_quantum = 4096;
+	const size_t c_max_lease_quantum = 512 * 1024;
+}
+
+HierarchicalThrottler::HierarchicalThrottler(const std::string& name, IPipeThrottlerUpdater* updater,
+	HierarchicalThrottler* parent, int64 parent_key)
+	: name(name), parent(parent), parent_key(parent_key), weight(1),
+	updater(updater), throttle_bps(0), percent_max(false), percent_throttler(NULL),
+	tokens(0), parent_lease(0), parent_quantum(0), laststatsbytes(0)
+{
+	mutex = Server->createMutex();
+
+	int64 ctime = Server->getTimeMS();
+	lastupdatetime = ctime;
+	lastrefilltime = ctime;
+	lastprunetime = ctime;
+	laststatstime = ctime;
+
+	if (updater != NULL)
+	{
+		update_time_interval = updater->getUpdateIntervalMs();
+		bool p_percent_max = false;
+		size_t bps = updater->getThrottleLimit(p_percent_max);
+		setLimit(bps, p_percent_max);
+	}
+	else
+	{
+		update_time_interval = -1;
+	}
+
+	tokens = bucketSize();
+}
+
+HierarchicalThrottler::~HierarchicalThrottler()
+{
+	if (percent_throttler != NULL)
+	{
+		Server->destroy(percent_throttler);
+	}
+	Server->destroy(mutex);
+}
+
+bool HierarchicalThrottler::addBytes(size_t n_bytes, bool wait)
+{
+	int64 ctime = Server->getTimeMS();
+
+	int64 wait_ms = acquire(Server->getThreadID(), 1, n_bytes, ctime, wait);
+
+	if (wait_ms <= 0)
+	{
+		return true;
+	}
+
+	if (wait)
+	{
+		Server->wait(static_cast<unsigned int>((std::min)(wait_ms, c_max_wait_ms)));
+	}
+
+	return false;
+}
+
+int64 HierarchicalThrottler::acquire(int64 key, size_t key_weight, size_t n_bytes, int64 ctime, bool wait)
+{
+	int64 wait_ms;
+	HierarchicalThrottler* curr_parent = NULL;
+	size_t lease_bytes = 0;
+	size_t curr_weight = 1;
+	IPipeThrottler* curr_percent_throttler = NULL;
+	{
+		IScopedLock lock(mutex);
+
+		updateLimit(ctime);
+
+		wait_ms = reserve(key, key_weight, n_bytes, ctime);
+
+		if (parent != NULL)
+		{
+			if (parent_lease >= static_cast<int64>(n_bytes))
+			{
+				parent_lease -= n_bytes;
+			}
+			else
+			{
+				lease_bytes = (std::max)(static_cast<size_t>(n_bytes - parent_lease), parent_quantum);
+				parent_lease += lease_bytes - n_bytes;
+				curr_parent = parent;
+				curr_weight = weight;
+			}
+		}
+
+		if (percent_max)
+		{
+			curr_percent_throttler = percent_throttler;
+		}
+	}
+
+	if (curr_parent != NULL)
+	{
+		int64 parent_wait_ms = curr_parent->acquire(parent_key, curr_weight, lease_bytes, ctime, wait);
+
+		size_t new_quantum = curr_parent->leaseQuantum();
+		IScopedLock lock(mutex);
+		parent_quantum = new_quantum;
+
+		wait_ms = (std::max)(wait_ms, parent_wait_ms);
+	}
+
+	if (curr_percent_throttler != NULL)
+	{
+		curr_percent_throttler->addBytes(n_bytes, wait);
+	}
+
+	return wait_ms;
+}
+
+int64 HierarchicalThrottler::reserve(int64 key, size_t key_weight, size_t n_bytes, int64 ctime)
+{
+	stats.bytes += n_bytes;
+
+	SChild& child = children[key];
+	child.weight = key_weight;
+	child.last_active = ctime;
+
+	if (ctime - laststatstime > c_stats_log_interval)
+	{
+		logStats(ctime);
+	}
+
+	if (throttle_bps == 0)
+	{
+		return 0;
+	}
+
+	refill(ctime);
+
+	tokens -= n_bytes;
+
+	if (tokens >= 0)
+	{
+		child.next_free = ctime;
+		return 0;
+	}
+
+	//Saturated. Each active child gets its share of the bandwidth
+	int64 share_bps = (std::max)(static_cast<int64>(1),
+		static_cast<int64>(throttle_bps) * static_cast<int64>(key_weight) / static_cast<int64>(activeWeight(ctime)));
+
+	child.next_free = (std::max)(child.next_free, ctime) + static_cast<int64>(n_bytes) * 1000 / share_bps;
+
+	int64 wait_ms = child.next_free - ctime;
+
+	int64 burst = bucketSize();
+	if (-tokens > burst)
+	{
+		wait_ms = (std::max)(wait_ms, (-tokens - burst) * 1000 / static_cast<int64>(throttle_bps));
+	}
+
+	if (wait_ms > 0)
+	{
+		++stats.waits;
+		stats.wait_ms += wait_ms;
+	}
+
+	return wait_ms;
+}
+
+void HierarchicalThrottler::updateLimit(int64 ctime)
+{
+	if (updater.get() != NULL && update_time_interval >= 0 &&
+		ctime - lastupdatetime > update_time_interval)
+	{
+		bool p_percent_max = false;
+		size_t bps = updater->getThrottleLimit(p_percent_max);
+		setLimit(bps, p_percent_max);
+		lastupdatetime = ctime;
+	}
+}
+
+void HierarchicalThrottler::setLimit(size_t bps, bool p_percent_max)
+{
+	percent_max = p_percent_max;
+
+	if (percent_max)
+	{
+		//Probing for the maximum speed is done by the default throttler
+		if (percent_throttler == NULL)
+		{
+			percent_throttler = Server->createPipeThrottler(bps, true);
+		}
+		else
+		{
+			percent_throttler->changeThrottleLimit(bps, true);
+		}
+		throttle_bps = 0;
+	}
+	else
+	{
+		throttle_bps = bps;
+	}
+
+	tokens = (std::min)(tokens, bucketSize());
+}
+
+void HierarchicalThrottler::refill(int64 ctime)
+{
+	int64 passed_time = ctime - lastrefilltime;
+	if (passed_time <= 0)
+	{
+		return;
+	}
+
+	tokens = (std::min)(tokens + static_cast<int64>(throttle_bps) * passed_time / 1000, bucketSize());
+	lastrefilltime = ctime;
+}
+
+int64 HierarchicalThrottler::bucketSize()
+{
+	return (std::max)(static_cast<int64>(throttle_bps / 4), c_min_bucket_size);
+}
+
+size_t HierarchicalThrottler::leaseQuantum()
+{
+	IScopedLock lock(mutex);
+
+	if (throttle_bps == 0)
+	{
+		return c_max_lease_quantum;
+	}
+
+	return (std::min)((std::max)(throttle_bps / 50, c_min_lease_quantum), c_max_lease_quantum);
+}
+
+size_t HierarchicalThrottler::activeWeight(int64 ctime)
+{
+	bool prune = ctime - lastprunetime > c_child_prune_time;
+	if (prune)
+	{
+		lastprunetime = ctime;
+	}
+
+	size_t ret = 0;
+	for (std::map<int64, SChild>::iterator it = children.begin(); it != children.end();)
+	{
+		if (ctime - it->second.last_active <= c_child_active_time)
+		{
+			ret += it->second.weight;
+		}
+		else if (prune
+			&& ctime - it->second.last_active > c_child_prune_time)
+		{
+			children.erase(it++);
+			continue;
+		}
+		++it;
+	}
+
+	return (std::max)(ret, static_cast<size_t>(1));
+}
+
+void HierarchicalThrottler::logStats(int64 ctime)
+{
+	if (stats.bytes != laststatsbytes)
+	{
+		Server->Log("Throttle class " + name + ": " + PrettyPrintBytes(stats.bytes - laststatsbytes) + " in the last "
+			+ PrettyPrintTime(ctime - laststatstime) + ". Limit " + (throttle_bps == 0 ? "none" : PrettyPrintSpeed(throttle_bps))
+			+ ". Throttled " + convert(stats.waits) + " times for " + PrettyPrintTime(stats.wait_ms) + " total.", LL_DEBUG);
+	}
+
+	laststatstime = ctime;
+	laststatsbytes = stats.bytes;
+}
+
+void HierarchicalThrottler::changeThrottleLimit(size_t bps, bool p_percent_max)
+{
+	IScopedLock lock(mutex);
+
+	setLimit(bps, p_percent_max);
+}
+
+void HierarchicalThrottler::changeThrottleUpdater(IPipeThrottlerUpdater* new_updater)
+{
+	IScopedLock lock(mutex);
+
+	updater.reset(new_updater);
+
+	if (new_updater != NULL)
+	{
+		update_time_interval = new_updater->getUpdateIntervalMs();
+	}
+	else
+	{
+		update_time_interval = -1;
+	}
+}
+
+void HierarchicalThrottler::setParent(HierarchicalThrottler* new_parent)
+{
+	IScopedLock lock(mutex);
+
+	if (parent != new_parent)
+	{
+		parent = new_parent;
+		parent_lease = 0;
+		parent_quantum = 0;
+	}
+}
+
+void HierarchicalThrottler::setWeight(size_t new_weight)
+{
+	IScopedLock lock(mutex);
+
+	weight = (std::max)(new_weight, static_cast<size_t>(1));
+}
+
+HierarchicalThrottler::SStats HierarchicalThrottler::getStats()
+{
+	IScopedLock lock(mutex);
+
+	SStats ret = stats;
+	ret.throttle_bps = throttle_bps;
+
+	int64 ctime = Server->getTimeMS();
+	for (std::map<int64, SChild>::iterator it = children.begin(); it != children.end(); ++it)
+	{
+		if (ctime - it->second.last_active <= c_child_active_time)
+		{
+			++ret.active_children;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "../Interface/PipeThrottler.h"
+#include "../Interface/Types.h"
+#include <string>
+#include <map>
+#include <memory>
+
+class IMutex;
+
+/**
+* Token bucket throttler which is part of a throttle hierarchy
+* (global -> client -> stream). Bytes are charged to the throttler
+* and to all its parents. Streams are the threads using the throttler.
+* If a throttler is saturated, its bandwidth is shared between the
+* active children (streams or child throttlers) according to their weight.
+* Children lease bytes from their parent in larger quanta, so the
+* parent (e.g. the global throttler) is only locked once per quantum.
+*/
+class HierarchicalThrottler : public IPipeThrottler
+{
+public:
+	struct SStats
+	{
+		SStats()
+			: bytes(0), waits(0), wait_ms(0), throttle_bps(0), active_children(0)
+		{}
+
+		int64 bytes;
+		int64 waits;
+		int64 wait_ms;
+		size_t throttle_bps;
+		size_t active_children;
+	};
+
+	HierarchicalThrottler(const std::string& name, IPipeThrottlerUpdater* updater, HierarchicalThrottler* parent, int64 parent_key);
+	~HierarchicalThrottler();
+
+	virtual bool addBytes(size_t n_bytes, bool wait);
+	virtual void changeThrottleLimit(size_t bps, bool p_percent_max);
+	virtual void changeThrottleUpdater(IPipeThrottlerUpdater* new_updater);
+
+	void setParent(HierarchicalThrottler* new_parent);
+	void setWeight(size_t new_weight);
+
+	SStats getStats();
+
+private:
+	struct SChild
+	{
+		SChild()
+			: weight(1), last_active(0), next_free(0)
+		{}
+
+		size_t weight;
+		int64 last_active;
+		int64 next_free;
+	};
+
+	int64 acquire(int64 key, size_t key_weight, size_t n_bytes, int64 ctime, bool wait);
+	int64 reserve(int64 key, size_t key_weight, size_t n_bytes, int64 ctime);
+	void updateLimit(int64 ctime);
+	void setLimit(size_t bps, bool p_percent_max);
+	void refill(int64 ctime);
+	int64 bucketSize();
+	size_t leaseQuantum();
+	size_t activeWeight(int64 ctime);
+	void logStats(int64 ctime);
+
+	std::string name;
+	HierarchicalThrottler* parent;
+	int64 parent_key;
+	size_t weight;
+
+	IMutex* mutex;
+
+	std::auto_ptr<IPipeThrottlerUpdater> updater;
+	int64 update_time_interval;
+	int64 lastupdatetime;
+
+	size_t throttle_bps;
+	bool percent_max;
+	IPipeThrottler* percent_throttler;
+
+	int64 tokens;
+	int64 lastrefilltime;
+
+	std::map<int64, SChild> children;
+	int64 lastprunetime;
+
+	int64 parent_lease;
+	size_t parent_quantum;
+
+	SStats stats;
+	int64 laststatstime;
+	int64 laststatsbytes;
+};
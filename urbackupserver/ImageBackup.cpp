@@ -25,6 +25,7 @@
 #include "../fsimageplugin/IVHDFile.h"
 #include "../fsimageplugin/IFSImageFactory.h"
 #include "server_writer.h"
+#include "ImageBlockHasher.h"
 #include "zero_hash.h"
 #include "server_running.h"
 #include "../md5.h"
@@ -132,6 +133,7 @@ std::vector<ImageBackup::SImageDependency> ImageBackup::getDependencies(bool res
 bool ImageBackup::doBackup()
 {
 	bool cowraw_format = server_settings->getImageFileFormat()==image_file_format_cowraw;
+	bool chunkstore_format = server_settings->getImageFileFormat()==image_file_format_chunkstore;
 
 	if(r_incremental)
 	{
@@ -141,7 +143,7 @@ bool ImageBackup::doBackup()
 	{
 		ServerLogger::Log(logid, std::string("Starting ") + (scheduled ? "scheduled" : "unscheduled") + " full image backup of volume \""+letter+"\"...", LL_INFO);
 
-		if(cowraw_format)
+		if(cowraw_format || chunkstore_format)
 		{
 			synthetic_full=true;
 		}
@@ -531,6 +533,7 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 	IVHDFile *r_vhdfile=NULL;
 	IFile *hashfile=NULL;
 	IFile *parenthashfile=NULL;
+	std::auto_ptr<ImageBlockHasher> block_hasher;
 	std::auto_ptr<IFile> bitmap_file;
 	int64 blockcnt=0;
 	int64 numblocks=0;
@@ -539,7 +542,6 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 	int64 mbr_offset=0;
 	_u32 off=0;
 	bool persistent=false;
-	std::vector<unsigned char> zeroblockdata;
 	int64 nextblock=0;
 	int64 last_verified_block=0;
 	int64 vhd_blocksize=(1024*1024)/2;
@@ -876,8 +878,6 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 					if(drivesize%blocksize!=0)
 						++totalblocks;
 
-					zeroblockdata.resize(blocksize);
-
 					if (imagefn.empty())
 					{
 						imagefn = constructImagePath(sletter, image_file_format, pParentvhd);
@@ -905,12 +905,22 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 					{
 						image_format = IFSImageFactory::ImageFormat_RawCowFile;
 					}
+					else if(image_file_format == image_file_format_chunkstore)
+					{
+						image_format = IFSImageFactory::ImageFormat_ChunkStore;
+					}
 					else //default
 					{
 						image_format = IFSImageFactory::ImageFormat_CompressedVHD;
 					}
 
-					if(!has_parent)
+					if(image_format == IFSImageFactory::ImageFormat_ChunkStore)
+					{
+						std::string chunkstore_path = server_settings->getSettings()->backupfolder_uncompr + os_file_sep() + ".image_chunks";
+						r_vhdfile=image_fak->createChunkStoreFile(os_file_prefix(imagefn), has_parent ? pParentvhd : std::string(),
+							os_file_prefix(chunkstore_path), false, drivesize + mbr_size, (unsigned int)vhd_blocksize*blocksize);
+					}
+					else if(!has_parent)
 					{
 						r_vhdfile=image_fak->createVHDFile(os_file_prefix(imagefn), false, drivesize+mbr_size,
 							(unsigned int)vhd_blocksize*blocksize, true,
@@ -934,6 +944,9 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 						ServerLogger::Log(logid, "Error opening Hashfile \""+imagefn+".hash\"", LL_ERROR);
 						goto do_image_cleanup;
 					}
+
+					block_hasher.reset(new ImageBlockHasher(hashfile, blocksize, vhd_blocksize,
+						static_cast<size_t>(watoi(Server->getServerParameter("image_hash_threads", "4")))));
 					
 					if(transfer_bitmap)
 					{
@@ -1007,7 +1020,8 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 						}
 
 						if (vhd_size>0 && vhd_size >= 2040LL * 1024 * 1024 * 1024
-							&& image_file_format != image_file_format_cowraw)
+							&& image_file_format != image_file_format_cowraw
+							&& image_file_format != image_file_format_chunkstore)
 						{
 							ServerLogger::Log(logid, "Data on volume is too large for VHD files with " + PrettyPrintBytes(vhd_size) +
 								". VHD files have a maximum size of 2040GB. Please use another image file format.", LL_ERROR);
@@ -1281,12 +1295,12 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 								}
 							}
 
-							nextblock=updateNextblock(nextblock, currblock, &shactx, zeroblockdata.data(),
-								has_parent, hashfile, parenthashfile,
+							nextblock=updateNextblock(nextblock, currblock, block_hasher.get(),
+								has_parent, parenthashfile,
 								blocksize, mbr_offset, vhd_blocksize, warned_about_parenthashfile_error,
 								-1, vhdfile, 0);
 
-							sha256_update(&shactx, (unsigned char *)blockdata, blocksize);
+							block_hasher->addBlock(blockdata);
 
 							vhdfile->writeBuffer(mbr_offset+currblock*blocksize, blockdata, blocksize);
 							blockdata=vhdfile->getBuffer();
@@ -1294,9 +1308,7 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 							if(nextblock%vhd_blocksize==0 && nextblock!=0)
 							{
 								//Server->Log("Hash written "+convert(currblock), LL_DEBUG);
-								sha256_final(&shactx, verify_checksum);
-								hashfile->Write((char*)verify_checksum, sha_size);
-								sha256_init(&shactx);
+								block_hasher->finishVHDBlock(true);
 							}
 
 							if(vhdfile->hasError())
@@ -1315,7 +1327,7 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 								Server->destroy(cc);
 								cc = NULL;
 								nextblock = last_verified_block;
-								hashfile->Seek((nextblock / vhd_blocksize)*sha_size);
+								block_hasher->seek((nextblock / vhd_blocksize)*sha_size);
 								++num_hash_errors;
 								break;
 							}
@@ -1342,19 +1354,19 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 
 							if(nextblock<=totalblocks)
 							{
-								nextblock=updateNextblock(nextblock, totalblocks, &shactx, zeroblockdata.data(), has_parent,
-									hashfile, parenthashfile, blocksize, mbr_offset, vhd_blocksize, warned_about_parenthashfile_error,
+								nextblock=updateNextblock(nextblock, totalblocks, block_hasher.get(), has_parent,
+									parenthashfile, blocksize, mbr_offset, vhd_blocksize, warned_about_parenthashfile_error,
 									-1, vhdfile, 0);
 
 								if(nextblock!=0)
 								{
 									//Server->Log("Hash written "+convert(nextblock), LL_INFO);
-									unsigned char dig[sha_size];
-									sha256_final(&shactx, dig);
-									hashfile->Write((char*)dig, sha_size);
+									block_hasher->finishVHDBlock(false);
 								}
 							}
 
+							block_hasher->flush();
+
 							if(cc!=NULL)
 							{
 								transferred_bytes+=cc->getTransferedBytes();
@@ -1379,7 +1391,8 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 									vhdfile->setDoTrim(true);
 								}
 
-								if(synthetic_full && image_file_format!=image_file_format_cowraw)
+								if(synthetic_full && image_file_format!=image_file_format_cowraw
+									&& image_file_format!=image_file_format_chunkstore)
 								{
 									vhdfile->setDoMakeFull(true);
 								}
@@ -1520,19 +1533,19 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 								{
 									if(nextblock<hblock)
 									{
-										nextblock=updateNextblock(nextblock, hblock-1, &shactx, zeroblockdata.data(), has_parent,
-											hashfile, parenthashfile, blocksize, mbr_offset,
+										nextblock=updateNextblock(nextblock, hblock-1, block_hasher.get(), has_parent,
+											parenthashfile, blocksize, mbr_offset,
 											vhd_blocksize, warned_about_parenthashfile_error, -1, vhdfile, 1);
-										sha256_update(&shactx, zeroblockdata.data(), blocksize);						
+										block_hasher->addZeroBlock();
 									}
 									if( (nextblock%vhd_blocksize==0 || hblock==blocks) && nextblock!=0)
 									{
-										sha256_final(&shactx, verify_checksum);
-										hashfile->Write((char*)verify_checksum, sha_size);
-										sha256_init(&shactx);
+										block_hasher->finishVHDBlock(true);
 									}
 								}
 
+								block_hasher->getVerifyDigest(verify_checksum);
+
 								if( memcmp(verify_checksum, dig, sha_size)!=0)
 								{
 									Server->Log("Client hash="+base64_encode(dig, sha_size)+" Server hash="+base64_encode(verify_checksum, sha_size)+" hblock="+convert(hblock), LL_DEBUG);
@@ -1543,7 +1556,7 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 										Server->destroy(cc);
 										cc=NULL;
 										nextblock=last_verified_block;
-										hashfile->Seek((nextblock / vhd_blocksize)*sha_size);
+										block_hasher->seek((nextblock / vhd_blocksize)*sha_size);
 										++num_hash_errors;
 										break;
 									}
@@ -1580,8 +1593,8 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 								int64 vhdblock;
 								memcpy(&vhdblock, &buffer[off+sizeof(int64)], sizeof(int64));
 								vhdblock = little_endian(vhdblock);
-								nextblock = updateNextblock(nextblock, vhdblock+vhd_blocksize, &shactx, zeroblockdata.data(), has_parent,
-									hashfile, parenthashfile, blocksize, mbr_offset, vhd_blocksize, warned_about_parenthashfile_error,
+								nextblock = updateNextblock(nextblock, vhdblock+vhd_blocksize, block_hasher.get(), has_parent,
+									parenthashfile, blocksize, mbr_offset, vhd_blocksize, warned_about_parenthashfile_error,
 									vhdblock, vhdfile, 0);
 							}
 							else
@@ -1600,7 +1613,7 @@ bool ImageBackup::doImage(const std::string &pLetter, const std::string &pParent
 								Server->destroy(cc);
 								cc = NULL;
 								nextblock = last_verified_block;
-								hashfile->Seek((nextblock / vhd_blocksize)*sha_size);
+								block_hasher->seek((nextblock / vhd_blocksize)*sha_size);
 								++num_hash_errors;
 								break;
 							}
@@ -1762,8 +1775,8 @@ unsigned int ImageBackup::writeMBR(ServerVHDWriter* vhdfile, uint64 volsize)
 	return 1024*512;
 }
 
-int64 ImageBackup::updateNextblock(int64 nextblock, int64 currblock, sha256_ctx *shactx, unsigned char *zeroblockdata, bool parent_fn,
-	IFile *hashfile, IFile *parenthashfile, unsigned int blocksize,
+int64 ImageBackup::updateNextblock(int64 nextblock, int64 currblock, ImageBlockHasher* block_hasher, bool parent_fn,
+	IFile *parenthashfile, unsigned int blocksize,
 	int64 mbr_offset, int64 vhd_blocksize, bool& warned_about_parenthashfile_error, int64 empty_vhdblock_start,
 	ServerVHDWriter* vhdfile, int64 trim_add)
 {
@@ -1794,15 +1807,12 @@ int64 ImageBackup::updateNextblock(int64 nextblock, int64 currblock, sha256_ctx
 					trim_start_block = nextblock;
 				}
 
-				sha256_update(shactx, zeroblockdata, blocksize);
+				block_hasher->addZeroBlock();
 				++nextblock;
 
 				if(nextblock%vhd_blocksize==0 && nextblock!=0)
 				{
-					unsigned char dig[sha_size];
-					sha256_final(shactx, dig);
-					hashfile->Write((char*)dig, sha_size);
-					sha256_init(shactx);
+					block_hasher->finishVHDBlock(false);
 					break;
 				}
 			}
@@ -1820,7 +1830,7 @@ int64 ImageBackup::updateNextblock(int64 nextblock, int64 currblock, sha256_ctx
 		{
 			if(!parent_fn || nextblock==empty_vhdblock_start)
 			{
-				hashfile->Write((char*)zero_hash, sha_size);
+				block_hasher->addDigest((char*)zero_hash);
 			}
 			else
 			{
@@ -1832,7 +1842,7 @@ int64 ImageBackup::updateNextblock(int64 nextblock, int64 currblock, sha256_ctx
 						Server->Log("Seeking in parent hash file failed (may be caused by a volume with increased size)", LL_WARNING);
 						warned_about_parenthashfile_error=true;
 					}
-					hashfile->Write((char*)zero_hash, sha_size);
+					block_hasher->addDigest((char*)zero_hash);
 				}
 				else
 				{
@@ -1845,11 +1855,11 @@ int64 ImageBackup::updateNextblock(int64 nextblock, int64 currblock, sha256_ctx
 							Server->Log("Reading from parent hash file failed (may be caused by a volume with increased size)", LL_WARNING);
 							warned_about_parenthashfile_error=true;
 						}
-						hashfile->Write((char*)zero_hash, sha_size);
+						block_hasher->addDigest((char*)zero_hash);
 					}
 					else
 					{
-						hashfile->Write(dig, sha_size);
+						block_hasher->addDigest(dig);
 					}
 				}
 			}
@@ -1866,14 +1876,11 @@ int64 ImageBackup::updateNextblock(int64 nextblock, int64 currblock, sha256_ctx
 			trim_start_block = nextblock;
 		}
 
-		sha256_update(shactx, zeroblockdata, blocksize);
+		block_hasher->addZeroBlock();
 		++nextblock;
 		if(nextblock%vhd_blocksize==0 && nextblock!=0)
 		{
-			unsigned char dig[sha_size];
-			sha256_final(shactx, dig);
-			hashfile->Write((char*)dig, sha_size);
-			sha256_init(shactx);
+			block_hasher->finishVHDBlock(false);
 		}
 	}
 	
@@ -1922,6 +1929,10 @@ std::string ImageBackup::constructImagePath(const std::string &letter, std::stri
 	{
 		imgpath+=".vhd";
 	}
+	else if(image_file_format==image_file_format_chunkstore)
+	{
+		imgpath+=".cas";
+	}
 	else if(image_file_format==image_file_format_cowraw)
 	{
 		imgpath+=".raw";
@@ -0,0 +1,280 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ImageBlockHasher.h"
+#include "../Interface/Server.h"
+#include "../Interface/File.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include <string.h>
+
+namespace
+{
+	const unsigned int hash_size = 32;
+	const size_t max_pending_per_thread = 4;
+}
+
+ImageBlockHasher::ImageBlockHasher(IFile* hashfile, unsigned int blocksize, int64 vhd_blocksize, size_t n_threads)
+	: hashfile(hashfile), blocksize(blocksize), curr_job(NULL),
+	has_verify_dig(false), mutex(Server->createMutex()), cond(Server->createCondition()),
+	do_stop(false)
+{
+	zero_block.resize(blocksize);
+
+	zero_prefix_ctx.resize(static_cast<size_t>(vhd_blocksize) + 1);
+	sha256_init(&zero_prefix_ctx[0]);
+	for (size_t i = 1; i < zero_prefix_ctx.size(); ++i)
+	{
+		zero_prefix_ctx[i] = zero_prefix_ctx[i - 1];
+		sha256_update(&zero_prefix_ctx[i], reinterpret_cast<unsigned char*>(zero_block.data()), blocksize);
+	}
+
+	max_pending = (n_threads + 1)*max_pending_per_thread;
+
+	for (size_t i = 0; i < n_threads; ++i)
+	{
+		tickets.push_back(Server->getThreadPool()->execute(new Worker(this), "image block hash"));
+	}
+}
+
+ImageBlockHasher::~ImageBlockHasher()
+{
+	{
+		IScopedLock lock(mutex);
+		do_stop = true;
+		cond->notify_all();
+	}
+
+	Server->getThreadPool()->waitFor(tickets);
+
+	delete curr_job;
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		delete pending[i];
+	}
+	for (size_t i = 0; i < free_jobs.size(); ++i)
+	{
+		delete free_jobs[i];
+	}
+
+	Server->destroy(mutex);
+	Server->destroy(cond);
+}
+
+ImageBlockHasher::SJob* ImageBlockHasher::newJob()
+{
+	SJob* job;
+	if (!free_jobs.empty())
+	{
+		job = free_jobs.back();
+		free_jobs.pop_back();
+	}
+	else
+	{
+		job = new SJob;
+	}
+
+	job->zero_prefix = 0;
+	job->data_size = 0;
+	job->done = false;
+	job->verify = false;
+	return job;
+}
+
+void ImageBlockHasher::appendData(const char* data)
+{
+	if (curr_job->data.size() < curr_job->data_size + blocksize)
+	{
+		curr_job->data.resize(curr_job->data_size + blocksize);
+	}
+
+	memcpy(&curr_job->data[curr_job->data_size], data, blocksize);
+	curr_job->data_size += blocksize;
+}
+
+void ImageBlockHasher::addBlock(const char* data)
+{
+	if (curr_job == NULL)
+	{
+		curr_job = newJob();
+	}
+
+	appendData(data);
+}
+
+void ImageBlockHasher::addZeroBlock()
+{
+	if (curr_job == NULL)
+	{
+		curr_job = newJob();
+	}
+
+	if (curr_job->data_size == 0
+		&& curr_job->zero_prefix + 1 < zero_prefix_ctx.size())
+	{
+		++curr_job->zero_prefix;
+	}
+	else
+	{
+		appendData(zero_block.data());
+	}
+}
+
+void ImageBlockHasher::finishVHDBlock(bool verify)
+{
+	SJob* job = curr_job;
+	curr_job = NULL;
+
+	if (job == NULL)
+	{
+		job = newJob();
+	}
+
+	job->verify = verify;
+
+	if (job->data_size == 0
+		|| tickets.empty())
+	{
+		hashJob(job);
+		job->done = true;
+		pending.push_back(job);
+	}
+	else
+	{
+		pending.push_back(job);
+
+		IScopedLock lock(mutex);
+		jobs.push_back(job);
+		cond->notify_all();
+	}
+
+	writeDone(max_pending);
+}
+
+void ImageBlockHasher::addDigest(const char* dig)
+{
+	SJob* job = newJob();
+	memcpy(job->dig, dig, hash_size);
+	job->done = true;
+	pending.push_back(job);
+
+	writeDone(max_pending);
+}
+
+void ImageBlockHasher::getVerifyDigest(unsigned char* dig)
+{
+	flush();
+
+	if (has_verify_dig)
+	{
+		memcpy(dig, verify_dig, hash_size);
+		has_verify_dig = false;
+	}
+}
+
+void ImageBlockHasher::seek(int64 pos)
+{
+	flush();
+
+	if (curr_job != NULL)
+	{
+		free_jobs.push_back(curr_job);
+		curr_job = NULL;
+	}
+
+	hashfile->Seek(pos);
+}
+
+void ImageBlockHasher::flush()
+{
+	writeDone(0);
+}
+
+void ImageBlockHasher::writeDone(size_t max_pending)
+{
+	while (!pending.empty())
+	{
+		SJob* job = pending.front();
+
+		{
+			IScopedLock lock(mutex);
+			while (!job->done
+				&& pending.size() > max_pending)
+			{
+				cond->wait(&lock);
+			}
+
+			if (!job->done)
+			{
+				return;
+			}
+		}
+
+		hashfile->Write(reinterpret_cast<char*>(job->dig), hash_size);
+
+		if (job->verify)
+		{
+			memcpy(verify_dig, job->dig, hash_size);
+			has_verify_dig = true;
+		}
+
+		pending.pop_front();
+		free_jobs.push_back(job);
+	}
+}
+
+void ImageBlockHasher::hashJob(SJob* job)
+{
+	sha256_ctx ctx = zero_prefix_ctx[job->zero_prefix];
+	if (job->data_size > 0)
+	{
+		sha256_update(&ctx, reinterpret_cast<unsigned char*>(job->data.data()), static_cast<unsigned int>(job->data_size));
+	}
+	sha256_final(&ctx, job->dig);
+}
+
+void ImageBlockHasher::workerMain()
+{
+	IScopedLock lock(mutex);
+
+	while (true)
+	{
+		while (jobs.empty()
+			&& !do_stop)
+		{
+			cond->wait(&lock);
+		}
+
+		if (do_stop)
+		{
+			return;
+		}
+
+		SJob* job = jobs.front();
+		jobs.pop_front();
+
+		lock.relock(NULL);
+
+		hashJob(job);
+
+		lock.relock(mutex);
+
+		job->done = true;
+		cond->notify_all();
+	}
+}
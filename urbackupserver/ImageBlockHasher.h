@@ -0,0 +1,107 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "../Interface/Thread.h"
+#include "../Interface/ThreadPool.h"
+#include "../urbackupcommon/sha2/sha2.h"
+#include <vector>
+#include <deque>
+
+class IFile;
+class IMutex;
+class ICondition;
+
+/**
+* Calculates the SHA-256 hashes of the VHD blocks of an image backup
+* (the content of the image's .hash file). Blocks are collected per VHD
+* block by the image receive thread and hashed by a pool of worker
+* threads. The hashes are written to the hash file in VHD block order.
+* Zero blocks at the start of a VHD block are not hashed but
+* looked up in a table of precomputed hash states.
+*/
+class ImageBlockHasher
+{
+public:
+	ImageBlockHasher(IFile* hashfile, unsigned int blocksize, int64 vhd_blocksize, size_t n_threads);
+	~ImageBlockHasher();
+
+	void addBlock(const char* data);
+	void addZeroBlock();
+
+	/**
+	* Finishes the hash of the current VHD block.
+	* If verify is true the hash is returned by getVerifyDigest()
+	*/
+	void finishVHDBlock(bool verify);
+
+	/**
+	* Adds a VHD block with known hash
+	*/
+	void addDigest(const char* dig);
+
+	/**
+	* Waits for all outstanding hashes and returns the last hash
+	* of a VHD block finished with verify=true. Leaves dig unchanged
+	* if there was none since the last call.
+	*/
+	void getVerifyDigest(unsigned char* dig);
+
+	/**
+	* Writes all finished hashes, discards the partially added
+	* VHD block and moves the hash file to pos
+	*/
+	void seek(int64 pos);
+
+	void flush();
+
+private:
+	struct SJob
+	{
+		size_t zero_prefix;
+		std::vector<char> data;
+		size_t data_size;
+		bool done;
+		bool verify;
+		unsigned char dig[32];
+	};
+
+	class Worker : public IThread
+	{
+	public:
+		Worker(ImageBlockHasher* hasher)
+			: hasher(hasher) {}
+
+		void operator()() {
+			hasher->workerMain();
+			delete this;
+		}
+
+	private:
+		ImageBlockHasher* hasher;
+	};
+
+	void workerMain();
+	void hashJob(SJob* job);
+	void writeDone(size_t max_pending);
+	SJob* newJob();
+	void appendData(const char* data);
+
+	IFile* hashfile;
+	unsigned int blocksize;
+	std::vector<sha256_ctx> zero_prefix_ctx;
+	std::vector<char> zero_block;
+
+	SJob* curr_job;
+	std::deque<SJob*> pending;
+	std::deque<SJob*> jobs;
+	std::vector<SJob*> free_jobs;
+	size_t max_pending;
+
+	unsigned char verify_dig[32];
+	bool has_verify_dig;
+
+	IMutex* mutex;
+	ICondition* cond;
+	bool do_stop;
+	std::vector<THREADPOOL_TICKET> tickets;
+};
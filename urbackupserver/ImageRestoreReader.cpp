@@ -0,0 +1,317 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2017 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ImageRestoreReader.h"
+#include "../Interface/Server.h"
+#include "../fsimageplugin/IVHDFile.h"
+#include "../urbackupcommon/image_restore_frame.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../stringtools.h"
+#include <memory.h>
+#include <algorithm>
+
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "../common/miniz.h"
+
+namespace
+{
+	const size_t c_max_queued_frames = 8;
+	const int64 c_min_extent_granularity = 64*1024;
+}
+
+ImageRestoreReader::ImageRestoreReader(IVHDFile* vhdfile, int64 skip, int64 imgsize, bool compress)
+	: vhdfile(vhdfile), skip(skip), imgsize(imgsize), compress(compress),
+	mutex(Server->createMutex()), cond(Server->createCondition()),
+	do_stop(false), finished(false), has_error(false)
+{
+	//Frames never cross a window boundary, so that they do not
+	//cross a block of the image file either
+	int64 blocksize = vhdfile->getBlocksize();
+	if (blocksize <= 0)
+	{
+		blocksize = 4096;
+	}
+
+	window = blocksize;
+	if (window < c_image_restore_max_frame_size)
+	{
+		window = (c_image_restore_max_frame_size / blocksize)*blocksize;
+	}
+}
+
+ImageRestoreReader::~ImageRestoreReader()
+{
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		delete frames[i];
+	}
+	for (size_t i = 0; i < free_frames.size(); ++i)
+	{
+		delete free_frames[i];
+	}
+	Server->destroy(mutex);
+	Server->destroy(cond);
+}
+
+void ImageRestoreReader::enumerateExtents(int64 offset, int64& used_bytes, int64& used_bytes_offset)
+{
+	used_bytes = 0;
+	used_bytes_offset = 0;
+
+	//Bitmaps of raw images have a small block size. Check them
+	//with a coarser granularity to keep the number of seeks low
+	int64 blocksize = vhdfile->getBlocksize();
+	if (blocksize < c_min_extent_granularity
+		&& window % c_min_extent_granularity == 0)
+	{
+		blocksize = c_min_extent_granularity;
+	}
+	if (blocksize <= 0 || blocksize>window)
+	{
+		blocksize = window;
+	}
+
+	int64 end = skip + imgsize;
+
+	for (int64 wpos = (skip / window)*window; wpos < end; wpos += window)
+	{
+		vhdfile->Seek(wpos);
+		if (!vhdfile->has_sector(window))
+		{
+			continue;
+		}
+
+		if (blocksize == window)
+		{
+			addExtent(wpos, wpos + window);
+		}
+		else
+		{
+			for (int64 bpos = wpos; bpos < wpos + window && bpos < end; bpos += blocksize)
+			{
+				vhdfile->Seek(bpos);
+				if (vhdfile->has_sector(blocksize))
+				{
+					addExtent(bpos, bpos + blocksize);
+				}
+			}
+		}
+	}
+
+	std::vector<SExtent> new_extents;
+	for (size_t i = 0; i < extents.size(); ++i)
+	{
+		SExtent ext(extents[i].start - skip, extents[i].end - skip);
+		ext.start = (std::max)(ext.start, static_cast<int64>(0));
+		ext.end = (std::min)(ext.end, imgsize);
+
+		if (ext.end <= ext.start)
+		{
+			continue;
+		}
+
+		used_bytes += ext.end - ext.start;
+
+		if (ext.end <= offset)
+		{
+			used_bytes_offset += ext.end - ext.start;
+			continue;
+		}
+
+		if (ext.start < offset)
+		{
+			used_bytes_offset += offset - ext.start;
+			ext.start = offset;
+		}
+
+		new_extents.push_back(ext);
+	}
+
+	extents.swap(new_extents);
+}
+
+void ImageRestoreReader::addExtent(int64 start, int64 end)
+{
+	if (!extents.empty()
+		&& extents[extents.size() - 1].end == start)
+	{
+		extents[extents.size() - 1].end = end;
+	}
+	else
+	{
+		extents.push_back(SExtent(start, end));
+	}
+}
+
+void ImageRestoreReader::operator()()
+{
+	for (size_t i = 0; i < extents.size(); ++i)
+	{
+		int64 pos = extents[i].start;
+		while (pos < extents[i].end)
+		{
+			int64 window_end = ((skip + pos) / window + 1)*window - skip;
+			int64 frame_end = (std::min)((std::min)(extents[i].end, window_end),
+				pos + static_cast<int64>(c_image_restore_max_frame_size));
+
+			SFrame* frame;
+			{
+				IScopedLock lock(mutex);
+				while (frames.size() >= c_max_queued_frames
+					&& !do_stop)
+				{
+					cond->wait(&lock);
+				}
+
+				if (do_stop)
+				{
+					return;
+				}
+
+				if (!free_frames.empty())
+				{
+					frame = free_frames[free_frames.size() - 1];
+					free_frames.pop_back();
+				}
+				else
+				{
+					frame = new SFrame;
+				}
+			}
+
+			bool ok = readFrame(frame, pos, static_cast<_u32>(frame_end - pos));
+
+			if (ok && compress)
+			{
+				compressFrame(frame);
+			}
+
+			IScopedLock lock(mutex);
+			if (!ok)
+			{
+				free_frames.push_back(frame);
+				has_error = true;
+				finished = true;
+				cond->notify_all();
+				return;
+			}
+
+			frames.push_back(frame);
+			cond->notify_all();
+
+			pos = frame_end;
+		}
+	}
+
+	IScopedLock lock(mutex);
+	finished = true;
+	cond->notify_all();
+}
+
+bool ImageRestoreReader::readFrame(SFrame* frame, int64 pos, _u32 size)
+{
+	frame->pos = pos;
+	frame->size = size;
+	frame->comp_size = 0;
+	frame->data.resize(size);
+
+	if (!vhdfile->Seek(skip + pos))
+	{
+		Server->Log("Error seeking in image file to position " + convert(skip + pos) + " during restore", LL_ERROR);
+		return false;
+	}
+
+	size_t read = 0;
+	while (read < size)
+	{
+		size_t r = 0;
+		bool b = vhdfile->Read(&frame->data[read], size - read, r);
+		if (!b)
+		{
+			Server->Log("Error reading from VHD file during restore. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+		if (r == 0)
+		{
+			Server->Log("Padding " + convert(size - read) + " zero bytes during restore...", LL_WARNING);
+			memset(&frame->data[read], 0, size - read);
+			break;
+		}
+		read += r;
+	}
+
+	return true;
+}
+
+void ImageRestoreReader::compressFrame(SFrame* frame)
+{
+	comp_buf.resize(mz_compressBound(static_cast<mz_ulong>(frame->size)));
+
+	mz_ulong comp_size = static_cast<mz_ulong>(comp_buf.size());
+	int rc = mz_compress2(reinterpret_cast<unsigned char*>(comp_buf.data()), &comp_size,
+		reinterpret_cast<const unsigned char*>(frame->data.data()), static_cast<mz_ulong>(frame->size), 1);
+
+	if (rc == MZ_OK
+		&& comp_size < frame->size)
+	{
+		frame->comp_size = static_cast<_u32>(comp_size);
+		memcpy(frame->data.data(), comp_buf.data(), comp_size);
+	}
+}
+
+ImageRestoreReader::SFrame* ImageRestoreReader::getFrame(int timeoutms, bool& timeout)
+{
+	timeout = false;
+
+	IScopedLock lock(mutex);
+	if (frames.empty()
+		&& !finished)
+	{
+		cond->wait(&lock, timeoutms);
+	}
+
+	if (frames.empty())
+	{
+		timeout = !finished;
+		return NULL;
+	}
+
+	SFrame* ret = frames.front();
+	frames.pop_front();
+	cond->notify_all();
+	return ret;
+}
+
+void ImageRestoreReader::releaseFrame(SFrame* frame)
+{
+	IScopedLock lock(mutex);
+	free_frames.push_back(frame);
+}
+
+void ImageRestoreReader::stop()
+{
+	IScopedLock lock(mutex);
+	do_stop = true;
+	cond->notify_all();
+}
+
+bool ImageRestoreReader::hasError()
+{
+	IScopedLock lock(mutex);
+	return has_error;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "../Interface/Thread.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "../Interface/Types.h"
+#include <vector>
+#include <deque>
+
+class IVHDFile;
+
+/**
+* Reads the allocated extents of an image for restore.
+* The extents are enumerated from the block allocation of
+* the image (including its parents) before streaming starts.
+* A worker thread then reads them in large frames ahead of
+* the sender and optionally compresses them.
+*/
+class ImageRestoreReader : public IThread
+{
+public:
+	struct SFrame
+	{
+		int64 pos;
+		_u32 size;
+		_u32 comp_size;
+		std::vector<char> data;
+	};
+
+	ImageRestoreReader(IVHDFile* vhdfile, int64 skip, int64 imgsize, bool compress);
+	~ImageRestoreReader();
+
+	void enumerateExtents(int64 offset, int64& used_bytes, int64& used_bytes_offset);
+
+	void operator()();
+
+	SFrame* getFrame(int timeoutms, bool& timeout);
+	void releaseFrame(SFrame* frame);
+
+	void stop();
+
+	bool hasError();
+
+private:
+	struct SExtent
+	{
+		SExtent(int64 start, int64 end)
+			: start(start), end(end)
+		{}
+
+		int64 start;
+		int64 end;
+	};
+
+	void addExtent(int64 start, int64 end);
+	bool readFrame(SFrame* frame, int64 pos, _u32 size);
+	void compressFrame(SFrame* frame);
+
+	IVHDFile* vhdfile;
+	int64 skip;
+	int64 imgsize;
+	bool compress;
+	int64 window;
+
+	std::vector<SExtent> extents;
+	std::vector<char> comp_buf;
+
+	IMutex* mutex;
+	ICondition* cond;
+	std::deque<SFrame*> frames;
+	std::vector<SFrame*> free_frames;
+	bool do_stop;
+	bool finished;
+	bool has_error;
+};
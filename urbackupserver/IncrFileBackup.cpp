@@ -50,15 +50,16 @@ namespace
 IncrFileBackup::IncrFileBackup( ClientMain* client_main, int clientid, std::string clientname, std::string clientsubname, LogAction log_action,
 	int group, bool use_tmpfiles, std::string tmpfile_path, bool use_reflink, bool use_snapshots, std::string server_token, std::string details, bool scheduled)
 	: FileBackup(client_main, clientid, clientname, clientsubname, log_action, true, group, use_tmpfiles, tmpfile_path, use_reflink, use_snapshots, server_token, details, scheduled), 
-	intra_file_diffs(intra_file_diffs), hash_existing_mutex(NULL), filesdao(NULL), link_dao(NULL), link_journal_dao(NULL)
+	intra_file_diffs(intra_file_diffs), hash_existing_mutex(NULL), files_daos(NULL), filesdao(NULL), link_dao(NULL), link_journal_dao(NULL)
 {
 
 }
 
 bool IncrFileBackup::doFileBackup()
 {
-	ScopedFreeObjRef<ServerFilesDao*> free_filesdao(filesdao);
-	filesdao = new ServerFilesDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES));
+	ScopedFreeObjRef<FilesDaos*> free_files_daos(files_daos);
+	files_daos = new FilesDaos;
+	filesdao = &files_daos->getClientDao(clientid);
 	ScopedFreeObjRef<ServerLinkDao*> free_link_dao(link_dao);
 	ScopedFreeObjRef<ServerLinkJournalDao*> free_link_journal_dao(link_journal_dao);
 
@@ -389,6 +390,13 @@ bool IncrFileBackup::doFileBackup()
 
 	bool queue_downloads = client_main->getProtocolVersions().filesrv_protocol_version>2;
 
+	if (!client_main->isOnInternetConnection()
+		&& server_settings->getSettings()->local_file_download_connections>1)
+	{
+		size_t n_helpers = server_download->addHelperConnections(server_settings->getSettings()->local_file_download_connections - 1, server_settings.get());
+		ServerLogger::Log(logid, clientname + ": Downloading files using " + convert(n_helpers + 1) + " connections", LL_DEBUG);
+	}
+
 	THREADPOOL_TICKET server_download_ticket = 
 		Server->getThreadPool()->execute(server_download.get(), "fbackup load");
 
@@ -548,7 +556,7 @@ bool IncrFileBackup::doFileBackup()
 						else
 						{
 							int64 done_bytes = fc.getReceivedDataBytes(true)
-								+ (fc_chunked.get() ? fc_chunked->getReceivedDataBytes(true) : 0) + linked_bytes;
+								+ (fc_chunked.get() ? fc_chunked->getReceivedDataBytes(true) : 0) + server_download->getHelperReceivedDataBytes() + linked_bytes;
 							ServerStatus::setProcessDoneBytes(clientname, status_id, done_bytes);
 							ServerStatus::setProcessPcDone(clientname, status_id,
 								(std::min)(100, (int)(((float)done_bytes) / ((float)files_size / 100.f) + 0.5f)));
@@ -560,10 +568,10 @@ bool IncrFileBackup::doFileBackup()
 
 					if (ctime - last_eta_update > eta_update_intervall)
 					{
-						calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, fc_chunked.get(), linked_bytes, last_eta_received_bytes, eta_estimated_speed, files_size);
+						calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, fc_chunked.get(), linked_bytes + server_download->getHelperReceivedDataBytes(), last_eta_received_bytes, eta_estimated_speed, files_size);
 					}
 
-					calculateDownloadSpeed(ctime, fc, fc_chunked.get());
+					calculateDownloadSpeed(ctime, fc, fc_chunked.get(), server_download->getHelperTransferredBytes());
 				} while (server_download->sleepQueue());
 
 				if(server_download->isOffline() && !r_offline)
@@ -1215,7 +1223,7 @@ bool IncrFileBackup::doFileBackup()
 		else
 		{
 			int64 done_bytes = fc.getReceivedDataBytes(true)
-				+ (fc_chunked.get() ? fc_chunked->getReceivedDataBytes(true) : 0) + linked_bytes;
+				+ (fc_chunked.get() ? fc_chunked->getReceivedDataBytes(true) : 0) + server_download->getHelperReceivedDataBytes() + linked_bytes;
 			ServerStatus::setProcessDoneBytes(clientname, status_id, done_bytes);
 			ServerStatus::setProcessPcDone(clientname, status_id,
 				(std::min)(100,(int)(((float)done_bytes)/((float)files_size/100.f)+0.5f)) );
@@ -1227,10 +1235,10 @@ bool IncrFileBackup::doFileBackup()
 		int64 ctime = Server->getTimeMS();
 		if(ctime-last_eta_update>eta_update_intervall)
 		{
-			calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, fc_chunked.get(), linked_bytes, last_eta_received_bytes, eta_estimated_speed, files_size);
+			calculateEtaFileBackup(last_eta_update, eta_set_time, ctime, fc, fc_chunked.get(), linked_bytes + server_download->getHelperReceivedDataBytes(), last_eta_received_bytes, eta_estimated_speed, files_size);
 		}
 
-		calculateDownloadSpeed(ctime, fc, fc_chunked.get());
+		calculateDownloadSpeed(ctime, fc, fc_chunked.get(), server_download->getHelperTransferredBytes());
 	}
 
 	addFilePathCorrections(server_download->getFilePathCorrections());
@@ -1607,8 +1615,8 @@ bool IncrFileBackup::doFileBackup()
 	running_updater->stop();
 	backup_dao->updateFileBackupRunning(backupid);
 
-	_i64 transferred_bytes=fc.getTransferredBytes()+(fc_chunked.get()?fc_chunked->getTransferredBytes():0);
-	_i64 transferred_compressed=fc.getRealTransferredBytes()+(fc_chunked.get()?fc_chunked->getRealTransferredBytes():0);
+	_i64 transferred_bytes=fc.getTransferredBytes()+(fc_chunked.get()?fc_chunked->getTransferredBytes():0)+server_download->getHelperTransferredBytes();
+	_i64 transferred_compressed=fc.getRealTransferredBytes()+(fc_chunked.get()?fc_chunked->getRealTransferredBytes():0)+server_download->getHelperRealTransferredBytes();
 	int64 passed_time=incr_backup_stoptime-incr_backup_starttime;
 	ServerLogger::Log(logid, "Transferred "+PrettyPrintBytes(transferred_bytes)+" - Average speed: "+PrettyPrintSpeed((size_t)((transferred_bytes*1000)/(passed_time)) ), LL_INFO );
 	if(transferred_compressed>0)
@@ -1849,7 +1857,7 @@ void IncrFileBackup::addFileEntrySQLWithExisting( const std::string &fp, const s
 
 		if (entryid != 0)
 		{
-			ServerFilesDao::SFindFileEntry fentry = filesdao->getFileEntry(entryid);
+			ServerFilesDao::SFindFileEntry fentry = files_daos->getEntryDao(entryid).getFileEntry(entryid);
 			if (!fentry.exists)
 			{
 				Server->Log("File entry in database with id=" + convert(entryid) 
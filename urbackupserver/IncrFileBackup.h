@@ -4,6 +4,7 @@
 #include "dao/ServerFilesDao.h"
 #include "dao/ServerLinkDao.h"
 #include "dao/ServerLinkJournalDao.h"
+#include "FilesDbShards.h"
 
 struct SFile;
 class FileMetadata;
@@ -31,6 +32,7 @@ protected:
 
 	IMutex* hash_existing_mutex;
 
+	FilesDaos* files_daos;
 	ServerFilesDao* filesdao;
 	ServerLinkDao* link_dao;
 	ServerLinkJournalDao* link_journal_dao;
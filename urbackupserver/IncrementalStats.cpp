@@ -0,0 +1,470 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "IncrementalStats.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Database.h"
+#include "../Interface/Query.h"
+#include "../stringtools.h"
+#include "database.h"
+#include "dao/ServerFilesDao.h"
+#include "dao/ServerBackupDao.h"
+#include "FilesDbShards.h"
+#include <algorithm>
+#include <assert.h>
+
+namespace
+{
+	const size_t stats_shards = 16;
+	const unsigned int stats_flush_interval = 10 * 1000;
+}
+
+IMutex* IncrementalStats::flush_mutex = NULL;
+std::vector<IncrementalStats::SShard> IncrementalStats::shards;
+std::vector<IncrementalStats::SJournal> IncrementalStats::journals;
+bool IncrementalStats::unaccounted_done = false;
+
+void IncrementalStats::init()
+{
+	flush_mutex = Server->createMutex();
+
+	journals.resize(FilesDbShards::getNumDatabases());
+
+	shards.resize(stats_shards);
+	for (size_t i = 0; i < shards.size(); ++i)
+	{
+		shards[i].mutex = Server->createMutex();
+		shards[i].ids.resize(journals.size());
+	}
+
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	ServerBackupDao backupdao(db);
+
+	unaccounted_done = true;
+
+	for (size_t i = 0; i < journals.size(); ++i)
+	{
+		IDatabase* files_db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(i));
+		ServerFilesDao filesdao(files_db);
+
+		if (!upgradeJournal(files_db))
+		{
+			Server->Log("Upgrading statistics journal of files database " + convert(i) + " failed", LL_ERROR);
+		}
+
+		ServerBackupDao::CondString prev_applied = backupdao.getMiscValue(miscKey("incoming_stat_applied", i));
+
+		if (prev_applied.exists)
+		{
+			//Entries flushed by the previous instance, but not yet removed from the journal
+			delIdRanges(filesdao, prev_applied.value);
+		}
+
+		ServerBackupDao::CondString prev_start = backupdao.getMiscValue(miscKey("incoming_stat_start", i));
+		ServerBackupDao::CondString prev_accounted = backupdao.getMiscValue(miscKey("incoming_stat_accounted", i));
+
+		if (prev_start.exists && prev_accounted.exists)
+		{
+			//Flushed entries with the journal state of previous versions
+			filesdao.delIncomingStatRange(watoi64(prev_start.value), watoi64(prev_accounted.value));
+		}
+
+		journals[i].unaccounted_max_id = filesdao.getMaxIncomingStatId().value;
+
+		if (journals[i].unaccounted_max_id != 0)
+		{
+			unaccounted_done = false;
+		}
+	}
+
+	DBScopedWriteTransaction trans(db);
+	for (size_t i = 0; i < journals.size(); ++i)
+	{
+		resetJournalState(i);
+	}
+}
+
+void IncrementalStats::operator()()
+{
+	while (true)
+	{
+		Server->wait(stats_flush_interval);
+
+		flush();
+	}
+}
+
+void IncrementalStats::addIncomingFile(ServerFilesDao& filesdao, int64 filesize, int clientid, int backupid,
+	const std::string& existing_clients, int direction, int incremental)
+{
+	filesdao.addIncomingFile(filesize, clientid, backupid, existing_clients, direction, incremental);
+	int64 id = filesdao.getDatabase()->getLastInsertID();
+
+	if (shards.empty())
+	{
+		//Not running as server (e.g. cleanup app). Entry is accounted
+		//by ServerUpdateStats after the next server start
+		return;
+	}
+
+	SShard& shard = shards[static_cast<size_t>(clientid) % shards.size()];
+	size_t db_idx = FilesDbShards::getClientIdx(clientid);
+
+	IScopedLock lock(shard.mutex);
+	addEntry(shard.deltas, filesize, clientid, backupid, existing_clients, direction, incremental);
+	shard.ids[db_idx].push_back(id);
+}
+
+void IncrementalStats::flush()
+{
+	IScopedLock flush_lock(flush_mutex);
+
+	SDeltas deltas;
+	std::vector<std::vector<int64> > ids(journals.size());
+	bool has_new = false;
+	for (size_t i = 0; i < shards.size(); ++i)
+	{
+		SDeltas shard_deltas;
+		{
+			IScopedLock lock(shards[i].mutex);
+			std::swap(shard_deltas, shards[i].deltas);
+			for (size_t j = 0; j < ids.size(); ++j)
+			{
+				if (!shards[i].ids[j].empty())
+				{
+					ids[j].insert(ids[j].end(), shards[i].ids[j].begin(), shards[i].ids[j].end());
+					shards[i].ids[j].clear();
+					has_new = true;
+				}
+			}
+		}
+
+		mergeDeltas(deltas, shard_deltas);
+	}
+
+	if (!has_new)
+	{
+		return;
+	}
+
+	//Only entries whose deltas are applied here are removed from the journal.
+	//Entries written concurrently (delta not added yet) are flushed next time.
+	std::vector<std::string> applied(ids.size());
+
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+
+	{
+		ServerBackupDao backupdao(db);
+
+		DBScopedWriteTransaction trans(db);
+
+		applyDeltas(db, deltas);
+
+		for (size_t j = 0; j < ids.size(); ++j)
+		{
+			if (!ids[j].empty())
+			{
+				applied[j] = idRanges(ids[j]);
+				backupdao.delMiscValue(miscKey("incoming_stat_applied", j));
+				backupdao.addMiscValue(miscKey("incoming_stat_applied", j), applied[j]);
+			}
+		}
+
+		if (unaccounted_done)
+		{
+			db->Write("UPDATE backups SET size_calculated=1 WHERE size_calculated=0 AND done=1");
+		}
+	}
+
+	for (size_t j = 0; j < ids.size(); ++j)
+	{
+		if (!applied[j].empty())
+		{
+			IDatabase* files_db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(j));
+			ServerFilesDao filesdao(files_db);
+			delIdRanges(filesdao, applied[j]);
+		}
+	}
+}
+
+int64 IncrementalStats::getUnaccountedMaxId(size_t db_idx)
+{
+	IScopedLock flush_lock(flush_mutex);
+	return unaccounted_done ? 0 : journals[db_idx].unaccounted_max_id;
+}
+
+void IncrementalStats::setUnaccountedDone()
+{
+	IScopedLock flush_lock(flush_mutex);
+	unaccounted_done = true;
+}
+
+void IncrementalStats::resetJournalState(size_t db_idx)
+{
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+	ServerBackupDao backupdao(db);
+
+	backupdao.delMiscValue(miscKey("incoming_stat_applied", db_idx));
+	backupdao.delMiscValue(miscKey("incoming_stat_start", db_idx));
+	backupdao.delMiscValue(miscKey("incoming_stat_accounted", db_idx));
+}
+
+std::string IncrementalStats::miscKey(const std::string& name, size_t db_idx)
+{
+	if (db_idx == 0)
+	{
+		return name;
+	}
+
+	return name + "_" + convert(db_idx);
+}
+
+std::string IncrementalStats::idRanges(std::vector<int64>& ids)
+{
+	std::sort(ids.begin(), ids.end());
+
+	std::string ret;
+	size_t start = 0;
+	for (size_t i = 1; i <= ids.size(); ++i)
+	{
+		if (i == ids.size()
+			|| ids[i] > ids[i - 1] + 1)
+		{
+			if (!ret.empty())
+			{
+				ret += ",";
+			}
+			ret += convert(ids[start]) + "-" + convert(ids[i - 1]);
+			start = i;
+		}
+	}
+
+	return ret;
+}
+
+void IncrementalStats::delIdRanges(ServerFilesDao& filesdao, const std::string& ranges)
+{
+	std::vector<std::string> toks;
+	Tokenize(ranges, toks, ",");
+
+	DBScopedWriteTransaction trans(filesdao.getDatabase());
+
+	for (size_t i = 0; i < toks.size(); ++i)
+	{
+		int64 first = watoi64(getuntil("-", toks[i]));
+		int64 last = watoi64(getafter("-", toks[i]));
+
+		filesdao.delIncomingStatRange(first - 1, last);
+	}
+}
+
+bool IncrementalStats::upgradeJournal(IDatabase* files_db)
+{
+	db_results res = files_db->Read("SELECT sql FROM sqlite_master WHERE type='table' AND name='files_incoming_stat'");
+
+	if (res.empty()
+		|| res[0]["sql"].find("AUTOINCREMENT") != std::string::npos)
+	{
+		return true;
+	}
+
+	//Journal entry ids must not be reused after the journal was emptied
+	Server->Log("Upgrading statistics journal...", LL_INFO);
+
+	DBScopedWriteTransaction trans(files_db);
+
+	if (!files_db->Write("CREATE TABLE files_incoming_stat_new (id INTEGER PRIMARY KEY AUTOINCREMENT, filesize INTEGER, clientid INTEGER, backupid INTEGER, existing_clients TEXT, direction INTEGER, incremental INTEGER)")
+		|| !files_db->Write("INSERT INTO files_incoming_stat_new (id, filesize, clientid, backupid, existing_clients, direction, incremental) "
+			"SELECT id, filesize, clientid, backupid, existing_clients, direction, incremental FROM files_incoming_stat")
+		|| !files_db->Write("DROP TABLE files_incoming_stat")
+		|| !files_db->Write("ALTER TABLE files_incoming_stat_new RENAME TO files_incoming_stat"))
+	{
+		trans.rollback();
+		return false;
+	}
+
+	return true;
+}
+
+void IncrementalStats::mergeDeltas(SDeltas& deltas, SDeltas& other)
+{
+	for (std::map<int, _i64>::iterator it = other.clients.begin(); it != other.clients.end(); ++it)
+	{
+		deltas.clients[it->first] += it->second;
+	}
+	for (std::map<int, _i64>::iterator it = other.backups.begin(); it != other.backups.end(); ++it)
+	{
+		deltas.backups[it->first] += it->second;
+	}
+	for (std::map<int, SDelInfo>::iterator it = other.dels.begin(); it != other.dels.end(); ++it)
+	{
+		std::map<int, SDelInfo>::iterator it_del = deltas.dels.find(it->first);
+		if (it_del == deltas.dels.end())
+		{
+			deltas.dels.insert(*it);
+		}
+		else
+		{
+			it_del->second.delsize += it->second.delsize;
+		}
+	}
+}
+
+void IncrementalStats::addClients(const std::vector<int>& clients, int64 num, std::map<int, _i64>& data)
+{
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+		data[clients[i]] += num;
+	}
+}
+
+void IncrementalStats::addEntry(SDeltas& deltas, int64 filesize, int clientid, int backupid,
+	const std::string& existing_clients, int direction, int incremental)
+{
+	std::vector<int> clients;
+	std::vector<std::string> s_clients;
+	Tokenize(existing_clients, s_clients, ",");
+	clients.resize(s_clients.size());
+	for (size_t j = 0; j<s_clients.size(); ++j)
+	{
+		clients[j] = watoi(s_clients[j]);
+	}
+
+	if (direction == ServerFilesDao::c_direction_incoming)
+	{
+		int64 current_size_per_client = 0;
+		if (!clients.empty())
+		{
+			current_size_per_client = filesize / clients.size();
+
+			addClients(clients, -current_size_per_client, deltas.clients);
+		}
+
+		clients.push_back(clientid);
+		current_size_per_client = filesize / clients.size();
+
+		addClients(clients, current_size_per_client, deltas.clients);
+
+		deltas.backups[backupid] += filesize;
+	}
+	else if (direction == ServerFilesDao::c_direction_outgoing ||
+		direction == ServerFilesDao::c_direction_outgoing_nobackupstat)
+	{
+		int64 current_size_per_client = filesize;
+
+		if (!clients.empty())
+		{
+			current_size_per_client /= clients.size();
+		}
+
+		addClients(clients, -current_size_per_client, deltas.clients);
+
+		std::vector<int>::iterator it_client = std::find(clients.begin(), clients.end(), clientid);
+		if (it_client != clients.end())
+		{
+			clients.erase(it_client);
+		}
+
+		if (!clients.empty())
+		{
+			current_size_per_client = filesize / clients.size();
+
+			addClients(clients, current_size_per_client, deltas.clients);
+		}
+
+		if (direction != ServerFilesDao::c_direction_outgoing_nobackupstat)
+		{
+			std::map<int, SDelInfo>::iterator it = deltas.dels.find(backupid);
+			if (it == deltas.dels.end())
+			{
+				SDelInfo di;
+				di.delsize = filesize;
+				di.clientid = clientid;
+				di.incremental = incremental;
+				deltas.dels.insert(std::make_pair(backupid, di));
+			}
+			else
+			{
+				it->second.delsize += filesize;
+			}
+		}
+	}
+	else
+	{
+		Server->Log("Unknown direction in IncrementalStats::addEntry " + convert(direction), LL_ERROR);
+		assert(false);
+	}
+}
+
+void IncrementalStats::applyDeltas(IDatabase* db, SDeltas& deltas)
+{
+	IQuery* q_size_update = db->Prepare("UPDATE clients SET bytes_used_files=bytes_used_files+? WHERE id=?", false);
+	for (std::map<int, _i64>::iterator it = deltas.clients.begin(); it != deltas.clients.end(); ++it)
+	{
+		if (it->second == 0)
+		{
+			continue;
+		}
+
+		q_size_update->Bind(it->second);
+		q_size_update->Bind(it->first);
+		q_size_update->Write();
+		q_size_update->Reset();
+	}
+	db->destroyQuery(q_size_update);
+
+	IQuery* q_update_backups = db->Prepare("UPDATE backups SET size_bytes=(CASE WHEN size_bytes=-1 THEN 0 ELSE size_bytes END)+? WHERE id=?", false);
+	for (std::map<int, _i64>::iterator it = deltas.backups.begin(); it != deltas.backups.end(); ++it)
+	{
+		q_update_backups->Bind(it->second);
+		q_update_backups->Bind(it->first);
+		q_update_backups->Write();
+		q_update_backups->Reset();
+	}
+	db->destroyQuery(q_update_backups);
+
+	IQuery* q_get_del_size = db->Prepare("SELECT delsize FROM del_stats WHERE backupid=? AND image=0 AND created>datetime('now','-4 days')", false);
+	IQuery* q_add_del_size = db->Prepare("INSERT INTO del_stats (backupid, image, delsize, clientid, incremental, stoptime) VALUES (?, 0, ?, ?, ?, CURRENT_TIMESTAMP)", false);
+	IQuery* q_update_del_size = db->Prepare("UPDATE del_stats SET delsize=delsize+?,stoptime=CURRENT_TIMESTAMP WHERE backupid=? AND image=0 AND created>datetime('now','-4 days')", false);
+	for (std::map<int, SDelInfo>::iterator it = deltas.dels.begin(); it != deltas.dels.end(); ++it)
+	{
+		q_get_del_size->Bind(it->first);
+		db_results res = q_get_del_size->Read();
+		q_get_del_size->Reset();
+		if (res.empty())
+		{
+			q_add_del_size->Bind(it->first);
+			q_add_del_size->Bind(it->second.delsize);
+			q_add_del_size->Bind(it->second.clientid);
+			q_add_del_size->Bind(it->second.incremental);
+			q_add_del_size->Write();
+			q_add_del_size->Reset();
+		}
+		else
+		{
+			q_update_del_size->Bind(it->second.delsize);
+			q_update_del_size->Bind(it->first);
+			q_update_del_size->Write();
+			q_update_del_size->Reset();
+		}
+	}
+	db->destroyQuery(q_get_del_size);
+	db->destroyQuery(q_add_del_size);
+	db->destroyQuery(q_update_del_size);
+}
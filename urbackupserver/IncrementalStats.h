@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "../Interface/Thread.h"
+#include <string>
+#include <vector>
+#include <map>
+
+class IMutex;
+class IDatabase;
+class ServerFilesDao;
+
+struct SDelInfo
+{
+	_i64 delsize;
+	int clientid;
+	int incremental;
+};
+
+/**
+* Keeps the per-client and per-backup file usage statistics up to date
+* while files are added and removed. Every files_incoming_stat entry is
+* accounted in memory when it is written and the accumulated deltas are
+* flushed to the server database periodically, together with the ids of
+* the flushed journal entries. Those entries are then removed (again
+* after a restart if the server stopped before), so ServerUpdateStats only has to process
+* entries that were written before the server was started (e.g. because
+* the server was not shut down cleanly). Each files database
+* (see FilesDbShards) has its own journal.
+*/
+class IncrementalStats : public IThread
+{
+public:
+	struct SDeltas
+	{
+		std::map<int, _i64> clients;
+		std::map<int, _i64> backups;
+		std::map<int, SDelInfo> dels;
+	};
+
+	void operator()();
+
+	static void init();
+
+	static void addIncomingFile(ServerFilesDao& filesdao, int64 filesize, int clientid, int backupid,
+		const std::string& existing_clients, int direction, int incremental);
+
+	static void flush();
+
+	/**
+	* Journal entries of files database db_idx with an id up to this one
+	* were not accounted by this server instance. Zero if there are none left.
+	*/
+	static int64 getUnaccountedMaxId(size_t db_idx);
+	static void setUnaccountedDone();
+
+	/**
+	* Forgets which journal entries of files database db_idx were
+	* flushed. Only valid if none of its entries are flushed but
+	* still in the journal (e.g. after init()).
+	*/
+	static void resetJournalState(size_t db_idx);
+
+	static void addEntry(SDeltas& deltas, int64 filesize, int clientid, int backupid,
+		const std::string& existing_clients, int direction, int incremental);
+	static void applyDeltas(IDatabase* db, SDeltas& deltas);
+
+private:
+	struct SShard
+	{
+		IMutex* mutex;
+		SDeltas deltas;
+		//Journal entries (per files database) accounted in deltas
+		std::vector<std::vector<int64> > ids;
+	};
+
+	struct SJournal
+	{
+		int64 unaccounted_max_id;
+	};
+
+	static void addClients(const std::vector<int>& clients, int64 num, std::map<int, _i64>& data);
+	static void mergeDeltas(SDeltas& deltas, SDeltas& other);
+	static std::string miscKey(const std::string& name, size_t db_idx);
+	static std::string idRanges(std::vector<int64>& ids);
+	static void delIdRanges(ServerFilesDao& filesdao, const std::string& ranges);
+	static bool upgradeJournal(IDatabase* files_db);
+
+	static IMutex* flush_mutex;
+	static std::vector<SShard> shards;
+	static std::vector<SJournal> journals;
+	static bool unaccounted_done;
+};
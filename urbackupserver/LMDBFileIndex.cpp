@@ -108,13 +108,11 @@ void LMDBFileIndex::begin_txn(unsigned int flags)
 	}
 }
 
-void LMDBFileIndex::create(get_data_callback_t get_data_callback, void *userdata)
+void LMDBFileIndex::create(get_data_callback_t get_data_callback, void *userdata, IDatabase* files_db, bool append)
 {
 	begin_txn(0);
 
-	IDatabase *db=Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES_NEW);
-
-	ServerFilesDao filesdao(db);
+	ServerFilesDao filesdao(files_db);
 
 	size_t n_done=0;
 	size_t n_rows=0;
@@ -173,7 +171,7 @@ void LMDBFileIndex::create(get_data_callback_t get_data_callback, void *userdata
 				}
 			}
 			
-			put(key, id, MDB_APPEND);
+			put(key, id, append ? MDB_APPEND : 0);
 
 			if(_has_error)
 			{
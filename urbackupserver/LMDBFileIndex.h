@@ -21,7 +21,7 @@ public:
 
 	virtual bool has_error(void);
 
-	virtual void create(get_data_callback_t get_data_callback, void *userdata);
+	virtual void create(get_data_callback_t get_data_callback, void *userdata, IDatabase* files_db, bool append);
 
 	virtual int64 get(const SIndexKey& key);
 
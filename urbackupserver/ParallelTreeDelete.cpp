@@ -0,0 +1,434 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2017 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ParallelTreeDelete.h"
+#include "../Interface/Server.h"
+#include "../Interface/ThreadPool.h"
+#include "../Interface/Database.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../stringtools.h"
+#include "server_dir_links.h"
+#include "server_status.h"
+#include <set>
+#include <memory>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+namespace
+{
+	const size_t max_symlink_batch = 1000;
+}
+
+#ifndef _WIN32
+
+ParallelTreeDelete::ParallelTreeDelete(size_t n_workers, ServerLinkDao& link_dao, int clientid, logid_t logid)
+	: n_workers(n_workers), link_dao(link_dao), clientid(clientid), logid(logid),
+	mutex(Server->createMutex()), work_cond(Server->createCondition()), main_cond(Server->createCondition()),
+	root(NULL), delete_root(true), done(false), do_stop(false), has_error(false), working(0),
+	removed_files(0), removed_dirs(0)
+{
+	if (this->n_workers == 0)
+	{
+		this->n_workers = 1;
+	}
+}
+
+ParallelTreeDelete::~ParallelTreeDelete()
+{
+	Server->destroy(mutex);
+	Server->destroy(work_cond);
+	Server->destroy(main_cond);
+}
+
+bool ParallelTreeDelete::removeTree(const std::string& path, bool p_delete_root, volatile bool* do_quit)
+{
+	delete_root = p_delete_root;
+
+	if (delete_root)
+	{
+		struct stat64 f_info;
+		int rc = lstat64(path.c_str(), &f_info);
+		if (rc == 0 && S_ISLNK(f_info.st_mode))
+		{
+			if (unlink(path.c_str()) != 0)
+			{
+				ServerLogger::Log(logid, "Error deleting symlink \"" + path + "\". " + os_last_error_str(), LL_ERROR);
+			}
+			return true;
+		}
+	}
+
+	root = new SDirNode(NULL, path);
+	done = false;
+	do_stop = false;
+	has_error = false;
+	working = 0;
+	dir_queue.push_back(root);
+
+	std::vector<Worker*> workers;
+	std::vector<THREADPOOL_TICKET> tickets;
+	for (size_t i = 0; i < n_workers; ++i)
+	{
+		workers.push_back(new Worker(this));
+		tickets.push_back(Server->getThreadPool()->execute(workers[i], "tree delete"));
+	}
+
+	std::vector<SSymlinkItem> symlinks;
+	bool quit = false;
+	while (true)
+	{
+		{
+			IScopedLock lock(mutex);
+			while (!done && symlink_queue.empty()
+				&& !(quit && working == 0) )
+			{
+				main_cond->wait(&lock, 1000);
+
+				ServerStatus::updateActive();
+
+				if (!quit && do_quit != NULL && *do_quit)
+				{
+					quit = true;
+					do_stop = true;
+					work_cond->notify_all();
+				}
+			}
+
+			if (done || (quit && working == 0) )
+			{
+				break;
+			}
+
+			if (symlink_queue.size() > max_symlink_batch)
+			{
+				symlinks.assign(symlink_queue.begin(), symlink_queue.begin() + max_symlink_batch);
+				symlink_queue.erase(symlink_queue.begin(), symlink_queue.begin() + max_symlink_batch);
+			}
+			else
+			{
+				symlinks.swap(symlink_queue);
+			}
+		}
+
+		processSymlinks(symlinks);
+		symlinks.clear();
+	}
+
+	{
+		IScopedLock lock(mutex);
+		do_stop = true;
+		work_cond->notify_all();
+	}
+
+	Server->getThreadPool()->waitFor(tickets);
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		delete workers[i];
+	}
+
+	if (!done)
+	{
+		ServerLogger::Log(logid, "Deleting \"" + path + "\" was interrupted", LL_WARNING);
+		freeRemaining();
+		return false;
+	}
+
+	return !has_error;
+}
+
+void ParallelTreeDelete::Worker::operator()()
+{
+	tree_delete->workerRun();
+}
+
+void ParallelTreeDelete::workerRun()
+{
+	IScopedLock lock(mutex);
+	while (true)
+	{
+		while (dir_queue.empty() && !do_stop)
+		{
+			work_cond->wait(&lock);
+		}
+
+		if (do_stop)
+		{
+			break;
+		}
+
+		//Depth first keeps the number of queued directories small
+		SDirNode* node = dir_queue.back();
+		dir_queue.pop_back();
+		++working;
+
+		lock.relock(NULL);
+		processDir(node);
+		lock.relock(mutex);
+
+		--working;
+		if (working == 0 && do_stop)
+		{
+			main_cond->notify_all();
+		}
+	}
+}
+
+void ParallelTreeDelete::processDir(SDirNode* node)
+{
+	int dirfd = open(node->path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dirfd == -1)
+	{
+		ServerLogger::Log(logid, "No permission to access \"" + node->path + "\". " + os_last_error_str(), LL_ERROR);
+		{
+			IScopedLock lock(mutex);
+			has_error = true;
+			node->listed = true;
+		}
+		finishDir(node);
+		return;
+	}
+
+	DIR* dp = fdopendir(dirfd);
+	if (dp == NULL)
+	{
+		ServerLogger::Log(logid, "Error opening directory \"" + node->path + "\". " + os_last_error_str(), LL_ERROR);
+		close(dirfd);
+		{
+			IScopedLock lock(mutex);
+			has_error = true;
+			node->listed = true;
+		}
+		finishDir(node);
+		return;
+	}
+
+	std::vector<SDirNode*> subdirs;
+	std::vector<SSymlinkItem> symlinks;
+	int64 n_files = 0;
+	bool local_error = false;
+
+	struct dirent* dirp;
+	while ((dirp = readdir(dp)) != NULL)
+	{
+		if (strcmp(dirp->d_name, ".") == 0
+			|| strcmp(dirp->d_name, "..") == 0)
+		{
+			continue;
+		}
+
+		unsigned char d_type = dirp->d_type;
+
+		if (d_type == DT_UNKNOWN)
+		{
+			struct stat64 f_info;
+			if (fstatat64(dirfd, dirp->d_name, &f_info, AT_SYMLINK_NOFOLLOW) != 0)
+			{
+				ServerLogger::Log(logid, "No permission to stat \"" + node->path + "/" + dirp->d_name + "\". " + os_last_error_str(), LL_ERROR);
+				local_error = true;
+				continue;
+			}
+
+			if (S_ISLNK(f_info.st_mode))
+				d_type = DT_LNK;
+			else if (S_ISDIR(f_info.st_mode))
+				d_type = DT_DIR;
+			else
+				d_type = DT_REG;
+		}
+
+		if (d_type == DT_DIR)
+		{
+			subdirs.push_back(new SDirNode(node, node->path + "/" + dirp->d_name));
+		}
+		else if (d_type == DT_LNK)
+		{
+			symlinks.push_back(SSymlinkItem(node, node->path + "/" + dirp->d_name));
+		}
+		else
+		{
+			if (unlinkat(dirfd, dirp->d_name, 0) != 0)
+			{
+				ServerLogger::Log(logid, "Error deleting file \"" + node->path + "/" + dirp->d_name + "\". " + os_last_error_str(), LL_ERROR);
+				local_error = true;
+			}
+			else
+			{
+				++n_files;
+			}
+		}
+	}
+
+	closedir(dp);
+
+	IScopedLock lock(mutex);
+	removed_files += n_files;
+	if (local_error)
+	{
+		has_error = true;
+	}
+	node->pending += subdirs.size() + symlinks.size();
+	node->listed = true;
+	if (!subdirs.empty())
+	{
+		dir_queue.insert(dir_queue.end(), subdirs.begin(), subdirs.end());
+		work_cond->notify_all();
+	}
+	if (!symlinks.empty())
+	{
+		symlink_queue.insert(symlink_queue.end(), symlinks.begin(), symlinks.end());
+		main_cond->notify_all();
+	}
+	if (node->pending == 0)
+	{
+		lock.relock(NULL);
+		finishDir(node);
+	}
+}
+
+void ParallelTreeDelete::finishDir(SDirNode* node)
+{
+	while (node != NULL)
+	{
+		if (node != root || delete_root)
+		{
+			if (rmdir(node->path.c_str()) != 0)
+			{
+				ServerLogger::Log(logid, "Error deleting directory \"" + node->path + "\". " + os_last_error_str(), LL_ERROR);
+				IScopedLock lock(mutex);
+				has_error = true;
+			}
+		}
+
+		IScopedLock lock(mutex);
+		++removed_dirs;
+		SDirNode* parent = node->parent;
+		delete node;
+
+		if (parent == NULL)
+		{
+			done = true;
+			main_cond->notify_all();
+			work_cond->notify_all();
+			return;
+		}
+
+		--parent->pending;
+		if (parent->pending == 0 && parent->listed)
+		{
+			node = parent;
+		}
+		else
+		{
+			node = NULL;
+		}
+	}
+}
+
+void ParallelTreeDelete::processSymlinks(std::vector<SSymlinkItem>& symlinks)
+{
+	std::auto_ptr<DBScopedSynchronous> synchronous_link_dao(new DBScopedSynchronous(link_dao.getDatabase()));
+	link_dao.getDatabase()->BeginWriteTransaction();
+
+	for (size_t i = 0; i < symlinks.size(); ++i)
+	{
+		if (!remove_directory_link(symlinks[i].path, link_dao, clientid, synchronous_link_dao, false))
+		{
+			IScopedLock lock(mutex);
+			has_error = true;
+		}
+	}
+
+	link_dao.getDatabase()->EndTransaction();
+	synchronous_link_dao.reset();
+
+	std::vector<SDirNode*> finished;
+	{
+		IScopedLock lock(mutex);
+		for (size_t i = 0; i < symlinks.size(); ++i)
+		{
+			SDirNode* parent = symlinks[i].parent;
+			--parent->pending;
+			if (parent->pending == 0 && parent->listed)
+			{
+				finished.push_back(parent);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < finished.size(); ++i)
+	{
+		finishDir(finished[i]);
+	}
+}
+
+void ParallelTreeDelete::freeRemaining()
+{
+	std::set<SDirNode*> remaining;
+	for (size_t i = 0; i < dir_queue.size(); ++i)
+	{
+		for (SDirNode* node = dir_queue[i]; node != NULL; node = node->parent)
+		{
+			remaining.insert(node);
+		}
+	}
+	for (size_t i = 0; i < symlink_queue.size(); ++i)
+	{
+		for (SDirNode* node = symlink_queue[i].parent; node != NULL; node = node->parent)
+		{
+			remaining.insert(node);
+		}
+	}
+
+	for (std::set<SDirNode*>::iterator it = remaining.begin(); it != remaining.end(); ++it)
+	{
+		delete *it;
+	}
+
+	dir_queue.clear();
+	symlink_queue.clear();
+	root = NULL;
+}
+
+bool remove_directory_link_dir_parallel(const std::string &path, ServerLinkDao& link_dao, int clientid, size_t n_workers,
+	logid_t logid, volatile bool* do_quit)
+{
+	IScopedLock lock(NULL);
+	dir_link_lock_client_mutex(clientid, lock);
+
+	ParallelTreeDelete tree_delete(n_workers, link_dao, clientid, logid);
+	return tree_delete.removeTree(os_file_prefix(path), true, do_quit);
+}
+
+#else //_WIN32
+
+bool remove_directory_link_dir_parallel(const std::string &path, ServerLinkDao& link_dao, int clientid, size_t n_workers,
+	logid_t logid, volatile bool* do_quit)
+{
+	return remove_directory_link_dir(path, link_dao, clientid);
+}
+
+#endif //_WIN32
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../Interface/Thread.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "../Interface/Types.h"
+#include "dao/ServerLinkDao.h"
+#include "server_log.h"
+#include <string>
+#include <vector>
+#include <deque>
+
+/**
+* Deletes a backup directory tree using multiple worker threads.
+* Files are unlinked relative to the directory file descriptor of
+* their parent by the workers. Symlinks (directory links into the
+* directory pool) are handed back to the calling thread, which
+* processes them in batches in one links database transaction per batch.
+*/
+class ParallelTreeDelete
+{
+public:
+	ParallelTreeDelete(size_t n_workers, ServerLinkDao& link_dao, int clientid, logid_t logid);
+	~ParallelTreeDelete();
+
+	bool removeTree(const std::string& path, bool delete_root, volatile bool* do_quit);
+
+	int64 getRemovedFiles() {
+		return removed_files;
+	}
+
+	int64 getRemovedDirs() {
+		return removed_dirs;
+	}
+
+private:
+	struct SDirNode
+	{
+		SDirNode(SDirNode* parent, const std::string& path)
+			: parent(parent), path(path), pending(0), listed(false)
+		{}
+
+		SDirNode* parent;
+		std::string path;
+		size_t pending;
+		bool listed;
+	};
+
+	struct SSymlinkItem
+	{
+		SSymlinkItem(SDirNode* parent, const std::string& path)
+			: parent(parent), path(path)
+		{}
+
+		SDirNode* parent;
+		std::string path;
+	};
+
+	class Worker : public IThread
+	{
+	public:
+		Worker(ParallelTreeDelete* tree_delete)
+			: tree_delete(tree_delete)
+		{}
+
+		void operator()();
+
+	private:
+		ParallelTreeDelete* tree_delete;
+	};
+
+	void workerRun();
+	void processDir(SDirNode* node);
+	void finishDir(SDirNode* node);
+	void processSymlinks(std::vector<SSymlinkItem>& symlinks);
+	void freeRemaining();
+
+	size_t n_workers;
+	ServerLinkDao& link_dao;
+	int clientid;
+	logid_t logid;
+
+	IMutex* mutex;
+	ICondition* work_cond;
+	ICondition* main_cond;
+
+	std::deque<SDirNode*> dir_queue;
+	std::vector<SSymlinkItem> symlink_queue;
+	SDirNode* root;
+	bool delete_root;
+	bool done;
+	bool do_stop;
+	bool has_error;
+	size_t working;
+
+	int64 removed_files;
+	int64 removed_dirs;
+};
+
+bool remove_directory_link_dir_parallel(const std::string &path, ServerLinkDao& link_dao, int clientid, size_t n_workers,
+	logid_t logid, volatile bool* do_quit);
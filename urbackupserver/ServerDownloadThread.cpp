@@ -32,6 +32,7 @@
 #include "../urbackupcommon/os_functions.h"
 #include "server.h"
 #include "FileMetadataDownloadThread.h"
+#include "BackupMetrics.h"
 
 namespace
 {
@@ -52,10 +53,11 @@ ServerDownloadThread::ServerDownloadThread( FileClient& fc, FileClientChunked* f
 	is_offline(false), client_main(client_main), filesrv_protocol_version(filesrv_protocol_version), skipping(false), queue_size(0),
 	all_downloads_ok(true), incremental_num(incremental_num), logid(logid), has_timeout(false), with_hashes(with_hashes), with_metadata(client_main->getProtocolVersions().file_meta>0), shares_without_snapshot(shares_without_snapshot),
 	with_sparse_hashing(with_sparse_hashing), exp_backoff(false), num_embedded_metadata_files(0), file_metadata_download(file_metadata_download), num_issues(0), last_snap_num_issues(0), has_disk_error(false), sc_failure_fatal(sc_failure_fatal),
-	tmpfile_num(0)
+	tmpfile_num(0), is_helper(false), num_pending_shadowcopy_actions(0), processing_item(false)
 {
 	mutex = Server->createMutex();
 	cond = Server->createCondition();
+	idle_cond = Server->createCondition();
 
 	if (BackupServer::useTreeHashing())
 	{
@@ -69,8 +71,19 @@ ServerDownloadThread::ServerDownloadThread( FileClient& fc, FileClientChunked* f
 
 ServerDownloadThread::~ServerDownloadThread()
 {
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		delete helpers[i];
+	}
+
+	for (size_t i = 0; i < helper_fcs.size(); ++i)
+	{
+		delete helper_fcs[i];
+	}
+
 	Server->destroy(mutex);
 	Server->destroy(cond);
+	Server->destroy(idle_cond);
 }
 
 void ServerDownloadThread::operator()( void )
@@ -85,17 +98,36 @@ void ServerDownloadThread::operator()( void )
 		fc.setQueueCallback(this);
 	}
 
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		helper_tickets.push_back(Server->getThreadPool()->execute(helpers[i], "fbackup load helper"));
+	}
+
+	bool curr_is_shadowcopy_action = false;
 	while(true)
 	{
 		SQueueItem curr;
 		{
 			IScopedLock lock(mutex);
+			processing_item = false;
+			if (curr_is_shadowcopy_action)
+			{
+				--num_pending_shadowcopy_actions;
+			}
+			if (dl_queue.empty())
+			{
+				idle_cond->notify_all();
+			}
+
 			while(dl_queue.empty())
 			{
 				cond->wait(&lock);
 			}
 			curr = dl_queue.front();
 			dl_queue.pop_front();
+			processing_item = true;
+			curr_is_shadowcopy_action = curr.action == EQueueAction_StartShadowcopy
+				|| curr.action == EQueueAction_StopShadowcopy;
 
 			if(curr.action == EQueueAction_Fileclient)
 			{
@@ -201,6 +233,8 @@ void ServerDownloadThread::operator()( void )
 		}
 		else if(curr.action==EQueueAction_StopShadowcopy)
 		{
+			waitForHelpersIdle();
+
 			if (!stop_shadowcopy(curr.fn))
 			{
 				IScopedLock lock(mutex);
@@ -234,7 +268,15 @@ void ServerDownloadThread::operator()( void )
 		}
 	}
 
-	if(!is_offline && !skipping && client_main->getProtocolVersions().file_meta>0)
+	{
+		IScopedLock lock(mutex);
+		processing_item = false;
+		idle_cond->notify_all();
+	}
+
+	stopHelpers();
+
+	if(!is_helper && !is_offline && !skipping && client_main->getProtocolVersions().file_meta>0)
 	{
 		_u32 rc = fc.InformMetadataStreamEnd(server_token, 3);
 
@@ -283,6 +325,18 @@ void ServerDownloadThread::addToQueueFull(size_t id, const std::string &fn, cons
 			ni.script_random = Server->getRandomNumber();
 		}
 	}
+	else if (!metadata_only
+		&& !at_front_postpone_quitstop
+		&& !helpers.empty())
+	{
+		ServerDownloadThread* dl_thread = selectDownloadThread();
+		if (dl_thread != this)
+		{
+			dl_thread->addToQueueFull(id, fn, short_fn, curr_path, os_path, predicted_filesize, metadata,
+				is_script, metadata_only, folder_items, sha_dig, false, 0, display_fn, write_metadata);
+			return;
+		}
+	}
 
 	IScopedLock lock(mutex);
 
@@ -354,6 +408,7 @@ void ServerDownloadThread::addToQueueStartShadowcopy(const std::string& fn)
 
 	IScopedLock lock(mutex);
 	dl_queue.push_back(ni);
+	++num_pending_shadowcopy_actions;
 	cond->notify_one();
 }
 
@@ -368,6 +423,7 @@ void ServerDownloadThread::addToQueueStopShadowcopy(const std::string& fn)
 
 	IScopedLock lock(mutex);
 	dl_queue.push_back(ni);
+	++num_pending_shadowcopy_actions;
 	cond->notify_one();
 }
 
@@ -490,6 +546,8 @@ bool ServerDownloadThread::load_file(SQueueItem todl)
 
 	int64 script_start_time = Server->getTimeSeconds()-60;
 
+	ScopedBackupStage download_stage(logid, EBackupStage_Download);
+
     _u32 rc=fc.GetFile(cfn, fd, hashed_transfer, todl.metadata_only, todl.folder_items, todl.is_script, with_metadata ? (todl.id+1) : 0);
 
 	int hash_retries=5;
@@ -502,6 +560,9 @@ bool ServerDownloadThread::load_file(SQueueItem todl)
 		--hash_retries;
 	}
 
+	download_stage.setBytes(fd!=NULL ? fd->Size() : 0);
+	download_stage.stop();
+
 	bool ret = true;
 	bool hash_file = false;
 	bool script_ok = true;
@@ -760,6 +821,7 @@ bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 	int64 script_start_time = Server->getTimeSeconds()-60;
 
 	IFile* sparse_extents_f=NULL;
+	ScopedBackupStage download_stage(logid, EBackupStage_Download);
 	_u32 rc=fc_chunked->GetFilePatch((cfn), dlfiles.orig_file, dlfiles.patchfile, dlfiles.chunkhashes, dlfiles.hashoutput,
 		todl.predicted_filesize, with_metadata ? (todl.id+1) : 0, todl.is_script, &sparse_extents_f);
 
@@ -792,6 +854,9 @@ bool ServerDownloadThread::load_file_patch(SQueueItem todl)
 		--hash_retries;
 	}
 
+	download_stage.setBytes(dlfiles.patchfile->Size());
+	download_stage.stop();
+
 	ScopedDeleteFile sparse_extents_f_delete(sparse_extents_f);
 
 	if(download_filesize<0)
@@ -1007,8 +1072,23 @@ void ServerDownloadThread::hashFile(std::string dstpath, std::string hashpath, I
 
 bool ServerDownloadThread::isOffline()
 {
-	IScopedLock lock(mutex);
-	return is_offline;
+	{
+		IScopedLock lock(mutex);
+		if (is_offline)
+		{
+			return true;
+		}
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		if (helpers[i]->isOffline())
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 void ServerDownloadThread::queueStop()
@@ -1023,19 +1103,50 @@ void ServerDownloadThread::queueStop()
 
 bool ServerDownloadThread::isDownloadOk( size_t id )
 {
-	return !download_nok_ids.hasId(id);
+	if (download_nok_ids.hasId(id))
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		if (!helpers[i]->isDownloadOk(id))
+		{
+			return false;
+		}
+	}
+
+	return true;
 }
 
 
 bool ServerDownloadThread::isDownloadPartial( size_t id )
 {
-	return download_partial_ids.hasId(id);
+	if (download_partial_ids.hasId(id))
+	{
+		return true;
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		if (helpers[i]->isDownloadPartial(id))
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 
 size_t ServerDownloadThread::getMaxOkId()
 {
-	return max_ok_id;
+	size_t ret = max_ok_id;
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		ret = (std::max)(ret, helpers[i]->getMaxOkId());
+	}
+	return ret;
 }
 
 std::string ServerDownloadThread::getQueuedFileFull(FileClient::MetadataQueue& metadata, size_t& folder_items, bool& finish_script, int64& file_id)
@@ -1119,7 +1230,7 @@ IFsFile * ServerDownloadThread::getTempFile()
 	{
 		size_t num = tmpfile_num++;
 			
-		std::string fn = backuppath + os_file_sep() + tmpfile_dirname + os_file_sep() + convert(num);
+		std::string fn = backuppath + os_file_sep() + tmpfile_dirname + os_file_sep() + tmpfile_prefix + convert(num);
 		pfd = Server->openFile(os_file_prefix(fn), MODE_RW_CREATE);
 
 		if (pfd == NULL)
@@ -1474,10 +1585,20 @@ bool ServerDownloadThread::stop_shadowcopy(std::string path)
 
 bool ServerDownloadThread::sleepQueue()
 {
-	IScopedLock lock(mutex);
-	if(queue_size>max_queue_size)
+	size_t total_queue_size;
+	{
+		IScopedLock lock(mutex);
+		total_queue_size = queue_size;
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		IScopedLock lock(helpers[i]->mutex);
+		total_queue_size += helpers[i]->queue_size;
+	}
+
+	if(total_queue_size>max_queue_size*(helpers.size()+1))
 	{
-		lock.relock(NULL);
 		Server->wait(1000);
 		return true;
 	}
@@ -1496,12 +1617,30 @@ size_t ServerDownloadThread::getNumEmbeddedMetadataFiles()
 
 size_t ServerDownloadThread::getNumIssues()
 {
-	return num_issues;
+	size_t ret = num_issues;
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		ret += helpers[i]->getNumIssues();
+	}
+	return ret;
 }
 
 bool ServerDownloadThread::getHasDiskError()
 {
-	return has_disk_error;
+	if (has_disk_error)
+	{
+		return true;
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		if (helpers[i]->getHasDiskError())
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 bool ServerDownloadThread::deleteTempFolder()
@@ -1523,9 +1662,16 @@ void ServerDownloadThread::queueSkip()
 	SQueueItem ni;
 	ni.action = EQueueAction_Skip;
 
-	IScopedLock lock(mutex);
-	dl_queue.push_front(ni);
-	cond->notify_one();
+	{
+		IScopedLock lock(mutex);
+		dl_queue.push_front(ni);
+		cond->notify_one();
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		helpers[i]->queueSkip();
+	}
 }
 
 void ServerDownloadThread::unqueueFileFull( const std::string& fn, bool finish_script)
@@ -1563,8 +1709,23 @@ void ServerDownloadThread::unqueueFileChunked( const std::string& remotefn )
 
 bool ServerDownloadThread::isAllDownloadsOk()
 {
-	IScopedLock lock(mutex);
-	return all_downloads_ok;
+	{
+		IScopedLock lock(mutex);
+		if (!all_downloads_ok)
+		{
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		if (!helpers[i]->isAllDownloadsOk())
+		{
+			return false;
+		}
+	}
+
+	return true;
 }
 
 bool ServerDownloadThread::logScriptOutput(std::string cfn, const SQueueItem &todl, std::string& sha_dig, int64 script_start_times, bool& hash_file)
@@ -1859,12 +2020,38 @@ bool ServerDownloadThread::logScriptOutput(std::string cfn, const SQueueItem &to
 
 bool ServerDownloadThread::hasTimeout()
 {
-	return has_timeout;
+	if (has_timeout)
+	{
+		return true;
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		if (helpers[i]->hasTimeout())
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 bool ServerDownloadThread::shouldBackoff()
 {
-	return exp_backoff;
+	if (exp_backoff)
+	{
+		return true;
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		if (helpers[i]->shouldBackoff())
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 void ServerDownloadThread::postponeQuitStop( size_t idx )
@@ -1998,4 +2185,131 @@ void ServerDownloadThread::logVssLogdata()
 			ServerLogger::Log(logid, entries[i].data, entries[i].loglevel);
 		}
 	}
-}
\ No newline at end of file
+}
+
+//Has to be called before the download thread is started.
+//Plain full file downloads are then spread over the additional connections
+size_t ServerDownloadThread::addHelperConnections(size_t n, ServerSettings* server_settings)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		FileClient* helper_fc = new FileClient(false, client_main->getIdentity(), filesrv_protocol_version,
+			client_main->isOnInternetConnection(), client_main, use_tmpfiles ? NULL : client_main);
+
+		_u32 rc = client_main->getClientFilesrvConnection(helper_fc, server_settings, 10000);
+		if (rc != ERR_CONNECTED)
+		{
+			ServerLogger::Log(logid, "Could not open additional file download connection to " + clientname + ". Using "
+				+ convert(helpers.size() + 1) + " connection(s).", LL_WARNING);
+			delete helper_fc;
+			break;
+		}
+
+		helper_fc->setProgressLogCallback(fc.getProgressLogCallback());
+
+		helper_fcs.push_back(helper_fc);
+
+		ServerDownloadThread* helper = new ServerDownloadThread(*helper_fc, NULL, backuppath, backuppath_hashes,
+			last_backuppath, last_backuppath_complete, hashed_transfer, save_incomplete_file, clientid,
+			clientname, clientsubname, use_tmpfiles, tmpfile_path, server_token, use_reflink, backupid, r_incremental,
+			hashpipe_prepare, client_main, filesrv_protocol_version, incremental_num, logid, with_hashes,
+			shares_without_snapshot, with_sparse_hashing, file_metadata_download, sc_failure_fatal);
+
+		helper->is_helper = true;
+		helper->tmpfile_prefix = convert(helpers.size() + 1) + "_";
+
+		helpers.push_back(helper);
+	}
+
+	return helpers.size();
+}
+
+int64 ServerDownloadThread::getHelperReceivedDataBytes()
+{
+	int64 ret = 0;
+	for (size_t i = 0; i < helper_fcs.size(); ++i)
+	{
+		ret += helper_fcs[i]->getReceivedDataBytes(true);
+	}
+	return ret;
+}
+
+int64 ServerDownloadThread::getHelperTransferredBytes()
+{
+	int64 ret = 0;
+	for (size_t i = 0; i < helper_fcs.size(); ++i)
+	{
+		ret += helper_fcs[i]->getTransferredBytes();
+	}
+	return ret;
+}
+
+int64 ServerDownloadThread::getHelperRealTransferredBytes()
+{
+	int64 ret = 0;
+	for (size_t i = 0; i < helper_fcs.size(); ++i)
+	{
+		ret += helper_fcs[i]->getRealTransferredBytes();
+	}
+	return ret;
+}
+
+ServerDownloadThread* ServerDownloadThread::selectDownloadThread()
+{
+	size_t min_queue_size;
+	{
+		IScopedLock lock(mutex);
+		//Files have to be downloaded from the snapshot,
+		//so keep everything in order while a snapshot is being created or removed
+		if (num_pending_shadowcopy_actions > 0
+			|| is_offline)
+		{
+			return this;
+		}
+		min_queue_size = queue_size;
+	}
+
+	ServerDownloadThread* ret = this;
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		IScopedLock lock(helpers[i]->mutex);
+		if (!helpers[i]->is_offline
+			&& helpers[i]->queue_size < min_queue_size)
+		{
+			min_queue_size = helpers[i]->queue_size;
+			ret = helpers[i];
+		}
+	}
+
+	return ret;
+}
+
+void ServerDownloadThread::waitForHelpersIdle()
+{
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		ServerDownloadThread* helper = helpers[i];
+		IScopedLock lock(helper->mutex);
+		while (!helper->dl_queue.empty()
+			|| helper->processing_item)
+		{
+			helper->idle_cond->wait(&lock, 1000);
+		}
+	}
+}
+
+void ServerDownloadThread::stopHelpers()
+{
+	if (helpers.empty())
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < helpers.size(); ++i)
+	{
+		helpers[i]->queueStop();
+	}
+
+	Server->getThreadPool()->waitFor(helper_tickets);
+	helper_tickets.clear();
+}
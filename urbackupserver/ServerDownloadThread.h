@@ -11,6 +11,7 @@
 #include "../Interface/Pipe.h"
 #include "../Interface/File.h"
 #include "../Interface/Thread.h"
+#include "../Interface/ThreadPool.h"
 #include "../urbackupcommon/fileclient/FileClient.h"
 #include "../urbackupcommon/fileclient/FileClientChunked.h"
 #include "ClientMain.h"
@@ -19,6 +20,7 @@
 
 class FileClient;
 class FileClientChunked;
+class ServerSettings;
 
 namespace server {
 	class FileMetadataDownloadThread;
@@ -214,6 +216,14 @@ public:
 
 	bool deleteTempFolder();
 
+	size_t addHelperConnections(size_t n, ServerSettings* server_settings);
+
+	int64 getHelperReceivedDataBytes();
+
+	int64 getHelperTransferredBytes();
+
+	int64 getHelperRealTransferredBytes();
+
 private:
 
 	IFsFile* getTempFile();
@@ -240,6 +250,12 @@ private:
 
 	void logVssLogdata();
 
+	ServerDownloadThread* selectDownloadThread();
+
+	void waitForHelpersIdle();
+
+	void stopHelpers();
+
 
 	FileClient& fc;
 	FileClientChunked* fc_chunked;
@@ -303,4 +319,13 @@ private:
 	bool sc_failure_fatal;
 
 	size_t tmpfile_num;
+
+	bool is_helper;
+	std::string tmpfile_prefix;
+	std::vector<FileClient*> helper_fcs;
+	std::vector<ServerDownloadThread*> helpers;
+	std::vector<THREADPOOL_TICKET> helper_tickets;
+	size_t num_pending_shadowcopy_actions;
+	bool processing_item;
+	ICondition* idle_cond;
 };
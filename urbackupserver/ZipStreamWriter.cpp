@@ -0,0 +1,696 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "ZipStreamWriter.h"
+#include "../Interface/Server.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include "../stringtools.h"
+#include "../urbackupcommon/os_functions.h"
+#include "../common/data.h"
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "../common/miniz.h"
+#include <string.h>
+#include <algorithm>
+#include <set>
+
+namespace
+{
+	const _u32 zip_chunk_size = 1024 * 1024;
+	const int64 zip64_file_limit = 0xF0000000LL;
+	const _u32 zip_max32 = 0xFFFFFFFF;
+	const unsigned short zip_max16 = 0xFFFF;
+
+	const _u32 sig_local_header = 0x04034b50;
+	const _u32 sig_data_descriptor = 0x08074b50;
+	const _u32 sig_central_header = 0x02014b50;
+	const _u32 sig_zip64_end = 0x06064b50;
+	const _u32 sig_zip64_locator = 0x07064b50;
+	const _u32 sig_end = 0x06054b50;
+
+	const unsigned short flag_data_descriptor = 1 << 3;
+	const unsigned short flag_utf8 = 1 << 11;
+
+	const unsigned short method_store = 0;
+	const unsigned short method_deflate = 8;
+
+	const unsigned short zip_version = 20;
+	const unsigned short zip64_version = 45;
+
+	const char* compressed_extensions[] = { "zip", "gz", "tgz", "bz2", "xz", "7z", "rar", "zst", "lz4",
+		"jpg", "jpeg", "png", "gif", "webp", "heic", "mp3", "ogg", "flac", "aac", "m4a", "mp4", "m4v",
+		"mkv", "avi", "mov", "wmv", "webm", "docx", "xlsx", "pptx", "odt", "ods", "jar", "cab", "msi", NULL };
+
+	void get_dos_time(time_t* last_modified, unsigned short& dos_time, unsigned short& dos_date)
+	{
+		time_t t = last_modified != NULL ? *last_modified : time(NULL);
+		struct tm tm_val;
+#ifdef _WIN32
+		if (localtime_s(&tm_val, &t) != 0)
+#else
+		if (localtime_r(&t, &tm_val) == NULL)
+#endif
+		{
+			dos_time = 0;
+			dos_date = (1 << 5) | 1;
+			return;
+		}
+
+		if (tm_val.tm_year < 80)
+		{
+			tm_val.tm_year = 80;
+			tm_val.tm_mon = 0;
+			tm_val.tm_mday = 1;
+			tm_val.tm_hour = 0;
+			tm_val.tm_min = 0;
+			tm_val.tm_sec = 0;
+		}
+
+		dos_time = static_cast<unsigned short>((tm_val.tm_hour << 11) + (tm_val.tm_min << 5) + (tm_val.tm_sec >> 1));
+		dos_date = static_cast<unsigned short>(((tm_val.tm_year + 1900 - 1980) << 9) + ((tm_val.tm_mon + 1) << 5) + tm_val.tm_mday);
+	}
+
+	_u32 gf2_matrix_times(const _u32* mat, _u32 vec)
+	{
+		_u32 sum = 0;
+		while (vec)
+		{
+			if (vec & 1)
+			{
+				sum ^= *mat;
+			}
+			vec >>= 1;
+			++mat;
+		}
+		return sum;
+	}
+
+	void gf2_matrix_square(_u32* square, const _u32* mat)
+	{
+		for (int n = 0; n < 32; ++n)
+		{
+			square[n] = gf2_matrix_times(mat, mat[n]);
+		}
+	}
+}
+
+ZipStreamWriter::ZipStreamWriter(THREAD_ID tid, size_t n_threads)
+	: tid(tid), output_offset(0), has_error(false),
+	mutex(Server->createMutex()), cond(Server->createCondition()),
+	do_stop(false), max_inflight((std::max)(static_cast<size_t>(1), n_threads) * 4),
+	n_entries(0)
+{
+	for (size_t i = 0; i < (std::max)(static_cast<size_t>(1), n_threads); ++i)
+	{
+		workers.push_back(new Worker(this));
+		tickets.push_back(Server->getThreadPool()->execute(workers[i], "zip compress"));
+	}
+}
+
+ZipStreamWriter::~ZipStreamWriter()
+{
+	{
+		IScopedLock lock(mutex);
+		do_stop = true;
+		cond->notify_all();
+	}
+
+	Server->getThreadPool()->waitFor(tickets);
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		delete workers[i];
+	}
+
+	std::set<SEntry*> entries;
+	for (size_t i = 0; i < output_queue.size(); ++i)
+	{
+		entries.insert(output_queue[i]->entry);
+		delete output_queue[i];
+	}
+
+	for (std::set<SEntry*>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		Server->destroy((*it)->file);
+		delete *it;
+	}
+
+	Server->destroy(mutex);
+	Server->destroy(cond);
+}
+
+bool ZipStreamWriter::isCompressedType(const std::string& fn)
+{
+	std::string ext = strlower(findextension(fn));
+	for (size_t i = 0; compressed_extensions[i] != NULL; ++i)
+	{
+		if (ext == compressed_extensions[i])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+ZipStreamWriter::SEntry* ZipStreamWriter::newEntry(const std::string& archivename, time_t* last_modified,
+	const std::string& extra_local, const std::string& extra_central)
+{
+	SEntry* entry = new SEntry;
+	entry->name = archivename;
+	entry->file = NULL;
+	entry->is_dir = false;
+	entry->compress = false;
+	entry->zip64 = false;
+	get_dos_time(last_modified, entry->dos_time, entry->dos_date);
+	entry->extra_local = extra_local;
+	entry->extra_central = extra_central;
+	entry->local_offset = 0;
+	entry->crc = 0;
+	entry->comp_size = 0;
+	entry->uncomp_size = 0;
+	return entry;
+}
+
+bool ZipStreamWriter::addDirectory(const std::string& archivename, time_t* last_modified,
+	const std::string& extra_local, const std::string& extra_central)
+{
+	SEntry* entry = newEntry(archivename, last_modified, extra_local, extra_central);
+	entry->is_dir = true;
+
+	SChunk* chunk = new SChunk;
+	chunk->entry = entry;
+	chunk->offset = 0;
+	chunk->size = 0;
+	chunk->first = true;
+	chunk->last = true;
+	chunk->done = true;
+	chunk->error = false;
+	chunk->crc = 0;
+
+	queueChunk(chunk, false);
+
+	return writeChunks(false);
+}
+
+bool ZipStreamWriter::addFile(const std::string& archivename, IFsFile* file, time_t* last_modified,
+	const std::string& extra_local, const std::string& extra_central, bool compress)
+{
+	SEntry* entry = newEntry(archivename, last_modified, extra_local, extra_central);
+	entry->file = file;
+	entry->compress = compress;
+
+	int64 fsize = file->Size();
+	entry->zip64 = fsize >= zip64_file_limit;
+
+	int64 offset = 0;
+	do
+	{
+		SChunk* chunk = new SChunk;
+		chunk->entry = entry;
+		chunk->offset = offset;
+		chunk->size = static_cast<_u32>((std::min)(fsize - offset, static_cast<int64>(zip_chunk_size)));
+		chunk->first = offset == 0;
+		chunk->last = offset + chunk->size >= fsize;
+		chunk->done = false;
+		chunk->error = false;
+		chunk->crc = 0;
+
+		queueChunk(chunk, true);
+
+		offset += chunk->size;
+
+		if (!writeChunks(false))
+		{
+			dropEntry(entry, chunk->last);
+			return false;
+		}
+	} while (offset < fsize);
+
+	return true;
+}
+
+void ZipStreamWriter::dropEntry(SEntry* entry, bool last_queued)
+{
+	IScopedLock lock(mutex);
+
+	std::vector<SChunk*> remaining;
+	for (std::deque<SChunk*>::iterator it = output_queue.begin(); it != output_queue.end();)
+	{
+		if ((*it)->entry == entry)
+		{
+			remaining.push_back(*it);
+			it = output_queue.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if (last_queued && remaining.empty())
+	{
+		//Last chunk was written, so the entry is already released
+		return;
+	}
+
+	for (std::deque<SChunk*>::iterator it = jobs.begin(); it != jobs.end();)
+	{
+		if ((*it)->entry == entry)
+		{
+			(*it)->done = true;
+			it = jobs.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	for (size_t i = 0; i < remaining.size(); ++i)
+	{
+		while (!remaining[i]->done)
+		{
+			cond->wait(&lock);
+		}
+		delete remaining[i];
+	}
+
+	Server->destroy(entry->file);
+	delete entry;
+}
+
+void ZipStreamWriter::queueChunk(SChunk* chunk, bool with_job)
+{
+	IScopedLock lock(mutex);
+	output_queue.push_back(chunk);
+	if (with_job)
+	{
+		jobs.push_back(chunk);
+		cond->notify_all();
+	}
+}
+
+bool ZipStreamWriter::writeChunks(bool wait_all)
+{
+	while (!has_error)
+	{
+		SChunk* chunk;
+		{
+			IScopedLock lock(mutex);
+			while (!output_queue.empty()
+				&& !output_queue.front()->done
+				&& (wait_all || output_queue.size() > max_inflight))
+			{
+				cond->wait(&lock);
+			}
+
+			if (output_queue.empty()
+				|| !output_queue.front()->done)
+			{
+				return true;
+			}
+
+			chunk = output_queue.front();
+			output_queue.pop_front();
+		}
+
+		bool b = writeChunk(chunk);
+
+		if (chunk->last)
+		{
+			Server->destroy(chunk->entry->file);
+			delete chunk->entry;
+		}
+		delete chunk;
+
+		if (!b)
+		{
+			has_error = true;
+		}
+	}
+
+	return false;
+}
+
+bool ZipStreamWriter::writeChunk(SChunk* chunk)
+{
+	SEntry* entry = chunk->entry;
+
+	if (chunk->error)
+	{
+		Server->Log("Error reading file data of \"" + entry->name + "\" for ZIP file download", LL_ERROR);
+		return false;
+	}
+
+	if (chunk->first)
+	{
+		entry->local_offset = output_offset;
+		if (!writeLocalHeader(entry))
+		{
+			return false;
+		}
+	}
+
+	if (!chunk->data.empty()
+		&& !output(chunk->data.data(), chunk->data.size()))
+	{
+		return false;
+	}
+
+	entry->crc = chunk->first ? chunk->crc : crc32Combine(entry->crc, chunk->crc, chunk->size);
+	entry->comp_size += chunk->data.size();
+	entry->uncomp_size += chunk->size;
+
+	if (chunk->last)
+	{
+		if (!entry->is_dir
+			&& !writeDataDescriptor(entry))
+		{
+			return false;
+		}
+
+		addCentralRecord(entry);
+	}
+
+	return true;
+}
+
+bool ZipStreamWriter::writeLocalHeader(SEntry* entry)
+{
+	CWData data;
+	data.addUInt(sig_local_header);
+	data.addUShort(entry->zip64 ? zip64_version : zip_version);
+	data.addUShort(flag_utf8 | (entry->is_dir ? 0 : flag_data_descriptor));
+	data.addUShort(entry->compress ? method_deflate : method_store);
+	data.addUShort(entry->dos_time);
+	data.addUShort(entry->dos_date);
+	data.addUInt(0);
+	data.addUInt(entry->zip64 ? zip_max32 : 0);
+	data.addUInt(entry->zip64 ? zip_max32 : 0);
+	data.addUShort(static_cast<unsigned short>(entry->name.size()));
+	data.addUShort(static_cast<unsigned short>(entry->extra_local.size() + (entry->zip64 ? 20 : 0)));
+	data.addBuffer(entry->name.data(), entry->name.size());
+	if (entry->zip64)
+	{
+		data.addUShort(0x0001);
+		data.addUShort(16);
+		data.addUInt64(0);
+		data.addUInt64(0);
+	}
+	data.addBuffer(entry->extra_local.data(), entry->extra_local.size());
+
+	return output(data.getDataPtr(), data.getDataSize());
+}
+
+bool ZipStreamWriter::writeDataDescriptor(SEntry* entry)
+{
+	CWData data;
+	data.addUInt(sig_data_descriptor);
+	data.addUInt(entry->crc);
+	if (entry->zip64)
+	{
+		data.addUInt64(entry->comp_size);
+		data.addUInt64(entry->uncomp_size);
+	}
+	else
+	{
+		data.addUInt(static_cast<_u32>(entry->comp_size));
+		data.addUInt(static_cast<_u32>(entry->uncomp_size));
+	}
+
+	return output(data.getDataPtr(), data.getDataSize());
+}
+
+void ZipStreamWriter::addCentralRecord(SEntry* entry)
+{
+	CWData zip64_extra;
+	if (entry->uncomp_size >= zip_max32)
+	{
+		zip64_extra.addUInt64(entry->uncomp_size);
+	}
+	if (entry->comp_size >= zip_max32)
+	{
+		zip64_extra.addUInt64(entry->comp_size);
+	}
+	if (entry->local_offset >= zip_max32)
+	{
+		zip64_extra.addUInt64(entry->local_offset);
+	}
+
+	bool zip64 = entry->zip64 || zip64_extra.getDataSize() > 0;
+	size_t extra_size = entry->extra_central.size() + (zip64_extra.getDataSize() > 0 ? 4 + zip64_extra.getDataSize() : 0);
+
+	CWData data;
+	data.addUInt(sig_central_header);
+	data.addUShort(zip64_version);
+	data.addUShort(zip64 ? zip64_version : zip_version);
+	data.addUShort(flag_utf8 | (entry->is_dir ? 0 : flag_data_descriptor));
+	data.addUShort(entry->compress ? method_deflate : method_store);
+	data.addUShort(entry->dos_time);
+	data.addUShort(entry->dos_date);
+	data.addUInt(entry->crc);
+	data.addUInt(static_cast<_u32>((std::min)(entry->comp_size, static_cast<int64>(zip_max32))));
+	data.addUInt(static_cast<_u32>((std::min)(entry->uncomp_size, static_cast<int64>(zip_max32))));
+	data.addUShort(static_cast<unsigned short>(entry->name.size()));
+	data.addUShort(static_cast<unsigned short>(extra_size));
+	data.addUShort(0);
+	data.addUShort(0);
+	data.addUShort(0);
+	data.addUInt(entry->is_dir ? 0x10 : 0);
+	data.addUInt(static_cast<_u32>((std::min)(entry->local_offset, static_cast<int64>(zip_max32))));
+	data.addBuffer(entry->name.data(), entry->name.size());
+	if (zip64_extra.getDataSize() > 0)
+	{
+		data.addUShort(0x0001);
+		data.addUShort(static_cast<unsigned short>(zip64_extra.getDataSize()));
+		data.addBuffer(zip64_extra.getDataPtr(), zip64_extra.getDataSize());
+	}
+	data.addBuffer(entry->extra_central.data(), entry->extra_central.size());
+
+	central_dir.append(data.getDataPtr(), data.getDataSize());
+	++n_entries;
+}
+
+bool ZipStreamWriter::finish()
+{
+	if (!writeChunks(true))
+	{
+		return false;
+	}
+
+	return writeCentralDirectory();
+}
+
+bool ZipStreamWriter::writeCentralDirectory()
+{
+	int64 cd_offset = output_offset;
+	int64 cd_size = central_dir.size();
+
+	if (!central_dir.empty()
+		&& !output(central_dir.data(), central_dir.size()))
+	{
+		return false;
+	}
+
+	CWData data;
+
+	if (n_entries >= zip_max16
+		|| cd_offset >= zip_max32
+		|| cd_size >= zip_max32)
+	{
+		int64 zip64_end_offset = output_offset;
+
+		data.addUInt(sig_zip64_end);
+		data.addUInt64(44);
+		data.addUShort(zip64_version);
+		data.addUShort(zip64_version);
+		data.addUInt(0);
+		data.addUInt(0);
+		data.addUInt64(n_entries);
+		data.addUInt64(n_entries);
+		data.addUInt64(cd_size);
+		data.addUInt64(cd_offset);
+
+		data.addUInt(sig_zip64_locator);
+		data.addUInt(0);
+		data.addUInt64(zip64_end_offset);
+		data.addUInt(1);
+	}
+
+	data.addUInt(sig_end);
+	data.addUShort(0);
+	data.addUShort(0);
+	data.addUShort(static_cast<unsigned short>((std::min)(n_entries, static_cast<int64>(zip_max16))));
+	data.addUShort(static_cast<unsigned short>((std::min)(n_entries, static_cast<int64>(zip_max16))));
+	data.addUInt(static_cast<_u32>((std::min)(cd_size, static_cast<int64>(zip_max32))));
+	data.addUInt(static_cast<_u32>((std::min)(cd_offset, static_cast<int64>(zip_max32))));
+	data.addUShort(0);
+
+	return output(data.getDataPtr(), data.getDataSize());
+}
+
+bool ZipStreamWriter::output(const char* buf, size_t bsize)
+{
+	if (!Server->WriteRaw(tid, buf, bsize, false))
+	{
+		Server->Log("Error writing ZIP file data to output", LL_INFO);
+		return false;
+	}
+
+	output_offset += bsize;
+	return true;
+}
+
+_u32 ZipStreamWriter::crc32Combine(_u32 crc1, _u32 crc2, int64 len2)
+{
+	if (len2 <= 0)
+	{
+		return crc1;
+	}
+
+	_u32 even[32];
+	_u32 odd[32];
+
+	odd[0] = 0xedb88320UL;
+	_u32 row = 1;
+	for (int n = 1; n < 32; ++n)
+	{
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+
+	do
+	{
+		gf2_matrix_square(even, odd);
+		if (len2 & 1)
+		{
+			crc1 = gf2_matrix_times(even, crc1);
+		}
+		len2 >>= 1;
+
+		if (len2 == 0)
+		{
+			break;
+		}
+
+		gf2_matrix_square(odd, even);
+		if (len2 & 1)
+		{
+			crc1 = gf2_matrix_times(odd, crc1);
+		}
+		len2 >>= 1;
+	} while (len2 != 0);
+
+	return crc1 ^ crc2;
+}
+
+ZipStreamWriter::Worker::Worker(ZipStreamWriter* writer)
+	: writer(writer)
+{
+}
+
+void ZipStreamWriter::Worker::operator()()
+{
+	std::vector<char> buf(zip_chunk_size);
+
+	while (true)
+	{
+		SChunk* chunk;
+		{
+			IScopedLock lock(writer->mutex);
+			while (writer->jobs.empty()
+				&& !writer->do_stop)
+			{
+				writer->cond->wait(&lock);
+			}
+
+			if (writer->do_stop)
+			{
+				return;
+			}
+
+			chunk = writer->jobs.front();
+			writer->jobs.pop_front();
+		}
+
+		bool ok = processChunk(chunk, buf);
+
+		IScopedLock lock(writer->mutex);
+		chunk->error = !ok;
+		chunk->done = true;
+		writer->cond->notify_all();
+	}
+}
+
+bool ZipStreamWriter::Worker::processChunk(SChunk* chunk, std::vector<char>& buf)
+{
+	_u32 read = 0;
+	while (read < chunk->size)
+	{
+		bool has_error = false;
+		_u32 r = chunk->entry->file->Read(chunk->offset + read, &buf[read], chunk->size - read, &has_error);
+		if (r == 0 || has_error)
+		{
+			Server->Log("Error reading from \"" + chunk->entry->file->getFilename() + "\" at offset "
+				+ convert(chunk->offset + read) + ". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+		read += r;
+	}
+
+	chunk->crc = static_cast<_u32>(mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const unsigned char*>(buf.data()), chunk->size));
+
+	if (!chunk->entry->compress)
+	{
+		chunk->data.assign(buf.data(), chunk->size);
+		return true;
+	}
+
+	mz_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (mz_deflateInit2(&stream, MZ_DEFAULT_LEVEL, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 9, MZ_DEFAULT_STRATEGY) != MZ_OK)
+	{
+		return false;
+	}
+
+	chunk->data.resize(mz_deflateBound(&stream, chunk->size) + 64);
+
+	stream.next_in = reinterpret_cast<const unsigned char*>(buf.data());
+	stream.avail_in = chunk->size;
+	stream.next_out = reinterpret_cast<unsigned char*>(&chunk->data[0]);
+	stream.avail_out = static_cast<unsigned int>(chunk->data.size());
+
+	int rc = mz_deflate(&stream, chunk->last ? MZ_FINISH : MZ_SYNC_FLUSH);
+	size_t comp_size = stream.total_out;
+	mz_deflateEnd(&stream);
+
+	if ((chunk->last && rc != MZ_STREAM_END)
+		|| (!chunk->last && rc != MZ_OK)
+		|| stream.avail_in != 0)
+	{
+		Server->Log("Error compressing data of \"" + chunk->entry->name + "\" for ZIP file download. rc=" + convert(rc), LL_ERROR);
+		return false;
+	}
+
+	chunk->data.resize(comp_size);
+
+	return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "../Interface/Types.h"
+#include "../Interface/Thread.h"
+#include "../Interface/ThreadPool.h"
+#include "../Interface/File.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <time.h>
+
+class IMutex;
+class ICondition;
+
+/**
+* Writes a ZIP64 archive directly to the HTTP output of a thread.
+* Files are split into chunks which are read and deflate compressed
+* by a pool of worker threads. Every chunk is compressed by its own
+* compressor and ends on a byte boundary (sync flush), so the
+* compressed chunks concatenated form one deflate stream. Sizes and
+* CRC follow the file data in a data descriptor, so output starts as
+* soon as the first chunk is compressed.
+*/
+class ZipStreamWriter
+{
+public:
+	ZipStreamWriter(THREAD_ID tid, size_t n_threads);
+	~ZipStreamWriter();
+
+	bool addDirectory(const std::string& archivename, time_t* last_modified,
+		const std::string& extra_local, const std::string& extra_central);
+
+	/**
+	* Takes ownership of file
+	*/
+	bool addFile(const std::string& archivename, IFsFile* file, time_t* last_modified,
+		const std::string& extra_local, const std::string& extra_central, bool compress);
+
+	bool finish();
+
+	static bool isCompressedType(const std::string& fn);
+
+private:
+	struct SEntry
+	{
+		std::string name;
+		IFsFile* file;
+		bool is_dir;
+		bool compress;
+		bool zip64;
+		unsigned short dos_time;
+		unsigned short dos_date;
+		std::string extra_local;
+		std::string extra_central;
+		int64 local_offset;
+		_u32 crc;
+		int64 comp_size;
+		int64 uncomp_size;
+	};
+
+	struct SChunk
+	{
+		SEntry* entry;
+		int64 offset;
+		_u32 size;
+		bool first;
+		bool last;
+		bool done;
+		bool error;
+		_u32 crc;
+		std::string data;
+	};
+
+	class Worker : public IThread
+	{
+	public:
+		Worker(ZipStreamWriter* writer);
+		void operator()();
+
+	private:
+		bool processChunk(SChunk* chunk, std::vector<char>& buf);
+
+		ZipStreamWriter* writer;
+	};
+
+	SEntry* newEntry(const std::string& archivename, time_t* last_modified,
+		const std::string& extra_local, const std::string& extra_central);
+	void queueChunk(SChunk* chunk, bool with_job);
+	void dropEntry(SEntry* entry, bool last_queued);
+	bool writeChunks(bool wait_all);
+	bool writeChunk(SChunk* chunk);
+	bool writeLocalHeader(SEntry* entry);
+	bool writeDataDescriptor(SEntry* entry);
+	void addCentralRecord(SEntry* entry);
+	bool writeCentralDirectory();
+	bool output(const char* buf, size_t bsize);
+
+	static _u32 crc32Combine(_u32 crc1, _u32 crc2, int64 len2);
+
+	THREAD_ID tid;
+	int64 output_offset;
+	bool has_error;
+
+	IMutex* mutex;
+	ICondition* cond;
+	bool do_stop;
+	std::deque<SChunk*> jobs;
+	std::deque<SChunk*> output_queue;
+	size_t max_inflight;
+
+	std::string central_dir;
+	int64 n_entries;
+
+	std::vector<Worker*> workers;
+	std::vector<THREADPOOL_TICKET> tickets;
+};
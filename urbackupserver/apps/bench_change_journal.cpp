@@ -0,0 +1,121 @@
+#include "../../Interface/Server.h"
+#include "../../stringtools.h"
+#include "../../urbackupcommon/change_ids.h"
+#include "../ChangeJournal.h"
+#include <vector>
+
+namespace
+{
+	class BenchRandom
+	{
+	public:
+		BenchRandom(unsigned int seed)
+			: state(seed)
+		{
+		}
+
+		unsigned int next(unsigned int max)
+		{
+			state = state * 1103515245 + 12345;
+			return (state >> 8) % max;
+		}
+
+	private:
+		unsigned int state;
+	};
+
+	std::string benchFn(unsigned int dir, unsigned int file)
+	{
+		return "dir" + convert(dir) + "/file" + convert(file);
+	}
+
+	std::string benchDir(unsigned int dir)
+	{
+		return "dir" + convert(dir);
+	}
+}
+
+int bench_change_journal()
+{
+	int64 n_changes = watoi64(Server->getServerParameter("bench_changes", "100000"));
+	unsigned int n_dirs = static_cast<unsigned int>(watoi(Server->getServerParameter("bench_dirs", "100")));
+	unsigned int n_files = static_cast<unsigned int>(watoi(Server->getServerParameter("bench_files", "1000")));
+	int n_rounds = watoi(Server->getServerParameter("bench_rounds", "3"));
+
+	if (n_changes <= 0 || n_dirs == 0 || n_files == 0 || n_rounds <= 0)
+	{
+		Server->Log("Invalid benchmark parameters (bench_changes, bench_dirs, bench_files, bench_rounds)", LL_ERROR);
+		return 1;
+	}
+
+	Server->Log("Benchmarking continuous backup change compaction with " + convert(n_changes) + " changes in "
+		+ convert(n_dirs) + " directories with " + convert(n_files) + " files each...", LL_INFO);
+
+	for (int round = 0; round < n_rounds; ++round)
+	{
+		BenchRandom rnd(static_cast<unsigned int>(round + 1));
+		ChangeJournal journal;
+
+		int64 starttime = Server->getTimeMS();
+
+		for (int64 i = 0; i < n_changes; ++i)
+		{
+			unsigned int dir = rnd.next(n_dirs);
+			unsigned int file = rnd.next(n_files);
+			unsigned int op = rnd.next(1000);
+
+			if (op < 600)
+			{
+				journal.addChangeCheck(ChangeJournal::SChange(CHANGE_MOD, benchFn(dir, file)));
+			}
+			else if (op < 750)
+			{
+				journal.addChange(ChangeJournal::SChange(CHANGE_ADD_FILE, benchFn(dir, file)), CHANGE_DEL_FILE, CHANGE_MOD);
+			}
+			else if (op < 900)
+			{
+				journal.delChange(ChangeJournal::SChange(CHANGE_DEL_FILE, benchFn(dir, file)), CHANGE_ADD_FILE, CHANGE_MOD, CHANGE_REN_FILE);
+			}
+			else if (op < 990)
+			{
+				ChangeJournal::SChange change(CHANGE_REN_FILE, benchFn(dir, file));
+				change.fn2 = benchFn(dir, rnd.next(n_files));
+				if (change.fn1 != change.fn2)
+				{
+					journal.renChange(change, CHANGE_ADD_FILE, CHANGE_MOD, CHANGE_REN_FILE);
+				}
+			}
+			else if (op < 995)
+			{
+				ChangeJournal::SChange change(CHANGE_REN_DIR, benchDir(dir));
+				change.fn2 = benchDir(rnd.next(n_dirs));
+				if (change.fn1 != change.fn2)
+				{
+					journal.renChange(change, CHANGE_ADD_DIR, CHANGE_NONE, CHANGE_REN_DIR);
+				}
+			}
+			else if (op < 998)
+			{
+				journal.addChange(ChangeJournal::SChange(CHANGE_ADD_DIR, benchDir(dir)), CHANGE_DEL_DIR, CHANGE_NONE);
+			}
+			else
+			{
+				journal.delChange(ChangeJournal::SChange(CHANGE_DEL_DIR, benchDir(dir)), CHANGE_ADD_DIR, CHANGE_NONE, CHANGE_REN_DIR);
+			}
+		}
+
+		int64 compact_time = Server->getTimeMS() - starttime;
+
+		std::vector<ChangeJournal::SChange> replay_changes;
+		journal.getChanges(replay_changes);
+
+		int64 total_time = Server->getTimeMS() - starttime;
+
+		Server->Log("Round " + convert(round + 1) + ": compacted " + convert(n_changes) + " changes to "
+			+ convert(replay_changes.size()) + " in " + convert(compact_time) + "ms (replay order in "
+			+ convert(total_time - compact_time) + "ms, "
+			+ convert(compact_time>0 ? n_changes * 1000 / compact_time : n_changes*1000) + " changes/s)", LL_INFO);
+	}
+
+	return 0;
+}
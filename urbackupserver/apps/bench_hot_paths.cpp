@@ -0,0 +1,870 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "../../Interface/Server.h"
+#include "../../Interface/File.h"
+#include "../../Interface/Pipe.h"
+#include "../../stringtools.h"
+#include "../../urbackupcommon/os_functions.h"
+#include "../../urbackupcommon/chunk_hasher.h"
+#include "../../urbackupcommon/TreeHash.h"
+#include "../../urbackupcommon/filelist_utils.h"
+#include "../../urbackupcommon/CompressedPipe2.h"
+#include "../../urbackupcommon/json.h"
+#include "../../fileservplugin/chunk_settings.h"
+#include "../../fsimageplugin/CompressedFile.h"
+#include "../treediff/TreeDiff.h"
+#include "../LMDBFileIndex.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <memory.h>
+#include <string.h>
+
+/**
+* Benchmark suite for the hot paths of file and image backups. All
+* data sets are generated from bench_seed, so runs with the same
+* parameters process the same data. Parameters:
+*
+* bench_kernels: Comma separated list of kernels to run (default: all)
+* bench_seed: Seed of the synthetic data sets
+* bench_size_mb: Size of the synthetic image/file data
+* bench_files: Number of files in the synthetic file tree
+* bench_index_entries: Number of entries in the synthetic file index
+* bench_messages: Number of pipe messages
+* bench_rounds: Number of timed rounds per kernel
+* bench_dir: Scratch directory (default: urbackup_bench in working directory)
+* bench_output: "text" or "json" (JSON is printed to stdout)
+*/
+
+namespace
+{
+	const size_t bench_block_size = 4096;
+	const size_t bench_files_per_dir = 100;
+	const size_t bench_subdirs = 10;
+
+	class BenchRandom
+	{
+	public:
+		BenchRandom(uint64 seed)
+			: state(seed*0x9E3779B97F4A7C15ULL + 1)
+		{}
+
+		uint64 next()
+		{
+			//xorshift64*
+			state ^= state >> 12;
+			state ^= state << 25;
+			state ^= state >> 27;
+			return state * 0x2545F4914F6CDD1DULL;
+		}
+
+		size_t next(size_t max)
+		{
+			return static_cast<size_t>(next() % max);
+		}
+
+	private:
+		uint64 state;
+	};
+
+	struct SBenchParams
+	{
+		uint64 seed;
+		int64 data_size;
+		size_t n_files;
+		size_t n_index_entries;
+		size_t n_messages;
+		int n_rounds;
+		std::string dir;
+	};
+
+	struct SBenchResult
+	{
+		SBenchResult(const std::string& name)
+			: name(name), bytes(0), items(0)
+		{}
+
+		std::string name;
+		int64 bytes;
+		int64 items;
+		std::vector<int64> durations_ms;
+	};
+
+	class BenchTimer
+	{
+	public:
+		BenchTimer(SBenchResult& res)
+			: res(res), starttime(Server->getTimeMS())
+		{}
+
+		~BenchTimer()
+		{
+			res.durations_ms.push_back(Server->getTimeMS() - starttime);
+		}
+
+	private:
+		SBenchResult& res;
+		int64 starttime;
+	};
+
+	/**
+	* Image-like blocks: A mix of unused (zero), text-like (compressible)
+	* and random (already compressed/encrypted) blocks
+	*/
+	void fill_synthetic_data(BenchRandom& rnd, char* buf, size_t bsize)
+	{
+		static const char* words[] = { "backup ", "client ", "server ", "image ", "file ", "volume ",
+			"chunk ", "hash ", "index ", "config\n", "<xml attr=\"1\">", "0123456789" };
+		const size_t n_words = sizeof(words) / sizeof(words[0]);
+
+		for (size_t off = 0; off < bsize; off += bench_block_size)
+		{
+			size_t bend = (std::min)(off + bench_block_size, bsize);
+			size_t type = rnd.next(10);
+			if (type < 3)
+			{
+				memset(buf + off, 0, bend - off);
+			}
+			else if (type < 7)
+			{
+				size_t i = off;
+				while (i < bend)
+				{
+					const char* w = words[rnd.next(n_words)];
+					size_t wlen = (std::min)(strlen(w), bend - i);
+					memcpy(buf + i, w, wlen);
+					i += wlen;
+				}
+			}
+			else
+			{
+				for (size_t i = off; i < bend; i += sizeof(uint64))
+				{
+					uint64 r = rnd.next();
+					memcpy(buf + i, &r, (std::min)(sizeof(r), bend - i));
+				}
+			}
+		}
+	}
+
+	IFile* create_synthetic_file(const SBenchParams& params)
+	{
+		IFile* f = Server->openMemoryFile();
+		if (f == NULL)
+		{
+			return NULL;
+		}
+
+		BenchRandom rnd(params.seed);
+		std::vector<char> buf(1024 * 1024);
+		for (int64 pos = 0; pos < params.data_size; pos += buf.size())
+		{
+			_u32 towrite = static_cast<_u32>((std::min)(static_cast<int64>(buf.size()), params.data_size - pos));
+			fill_synthetic_data(rnd, buf.data(), towrite);
+			if (f->Write(buf.data(), towrite) != towrite)
+			{
+				Server->destroy(f);
+				return NULL;
+			}
+		}
+
+		return f;
+	}
+
+	/**
+	* File tree with bench_files files in directories with bench_subdirs
+	* sub-directories each having bench_files_per_dir files. If modified is set
+	* the file tree is changed like between two incremental backups.
+	*/
+	bool write_synthetic_filelist(const SBenchParams& params, bool modified, IFile* f, size_t& n_entries)
+	{
+		BenchRandom rnd(params.seed);
+		BenchRandom mod_rnd(params.seed + 1);
+
+		n_entries = 0;
+		size_t n_dirs = (params.n_files + bench_files_per_dir*bench_subdirs - 1) / (bench_files_per_dir*bench_subdirs);
+		size_t file_idx = 0;
+		for (size_t d = 0; d < n_dirs; ++d)
+		{
+			SFile dir;
+			dir.isdir = true;
+			dir.name = "dir" + convert(d);
+			dir.last_modified = 1500000000 + static_cast<int64>(rnd.next(100000000));
+			writeFileItem(f, dir);
+			++n_entries;
+
+			for (size_t s = 0; s < bench_subdirs && file_idx < params.n_files; ++s)
+			{
+				SFile subdir;
+				subdir.isdir = true;
+				subdir.name = "sub" + convert(s);
+				subdir.last_modified = 1500000000 + static_cast<int64>(rnd.next(100000000));
+				writeFileItem(f, subdir);
+				++n_entries;
+
+				for (size_t i = 0; i < bench_files_per_dir && file_idx < params.n_files; ++i, ++file_idx)
+				{
+					SFile file;
+					file.name = "file_" + convert(file_idx) + (rnd.next(2) == 0 ? ".txt" : ".dat");
+					file.size = static_cast<int64>(rnd.next(10 * 1024 * 1024));
+					file.last_modified = 1500000000 + static_cast<int64>(rnd.next(100000000));
+
+					if (modified)
+					{
+						size_t change = mod_rnd.next(1000);
+						if (change < 5)
+						{
+							//deleted
+							continue;
+						}
+						else if (change < 15)
+						{
+							file.last_modified += 1;
+							file.size += static_cast<int64>(mod_rnd.next(4096));
+						}
+					}
+
+					writeFileItem(f, file);
+					++n_entries;
+				}
+
+				if (modified && mod_rnd.next(50) == 0)
+				{
+					SFile file;
+					file.name = "new_file_" + convert(file_idx) + ".txt";
+					file.size = static_cast<int64>(mod_rnd.next(1024 * 1024));
+					file.last_modified = 1700000000;
+					writeFileItem(f, file);
+					++n_entries;
+				}
+
+				SFile up;
+				up.isdir = true;
+				up.name = "..";
+				writeFileItem(f, up);
+				++n_entries;
+			}
+
+			SFile up;
+			up.isdir = true;
+			up.name = "..";
+			writeFileItem(f, up);
+			++n_entries;
+		}
+
+		return true;
+	}
+
+	std::string filelist_fn(const SBenchParams& params, bool modified)
+	{
+		return params.dir + os_file_sep() + (modified ? "filelist_2.ub" : "filelist_1.ub");
+	}
+
+	bool create_filelist(const SBenchParams& params, bool modified, size_t& n_entries)
+	{
+		std::auto_ptr<IFile> f(Server->openFile(filelist_fn(params, modified), MODE_WRITE));
+		if (f.get() == NULL)
+		{
+			Server->Log("Error creating file list " + filelist_fn(params, modified) + ". " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		return write_synthetic_filelist(params, modified, f.get(), n_entries);
+	}
+
+	bool bench_chunk_hashs(const SBenchParams& params, std::vector<SBenchResult>& results)
+	{
+		std::auto_ptr<IFile> f(create_synthetic_file(params));
+		std::auto_ptr<IFile> hashoutput(Server->openMemoryFile());
+		if (f.get() == NULL || hashoutput.get() == NULL)
+		{
+			return false;
+		}
+
+		SBenchResult res("chunk_hashs");
+		res.bytes = params.data_size;
+		res.items = (params.data_size + c_checkpoint_dist - 1) / c_checkpoint_dist;
+
+		for (int round = 0; round < params.n_rounds; ++round)
+		{
+			f->Seek(0);
+			BenchTimer timer(res);
+			if (!build_chunk_hashs(f.get(), hashoutput.get(), NULL, NULL, false))
+			{
+				Server->Log("Building chunk hashes failed", LL_ERROR);
+				return false;
+			}
+		}
+
+		results.push_back(res);
+		return true;
+	}
+
+	bool bench_tree_hash(const SBenchParams& params, std::vector<SBenchResult>& results)
+	{
+		std::auto_ptr<IFile> f(create_synthetic_file(params));
+		if (f.get() == NULL)
+		{
+			return false;
+		}
+
+		std::string data = f->Read(static_cast<int64>(0), static_cast<_u32>(params.data_size));
+		if (static_cast<int64>(data.size()) != params.data_size)
+		{
+			return false;
+		}
+
+		SBenchResult res("tree_hash");
+		res.bytes = params.data_size;
+		res.items = (params.data_size + treehash_blocksize - 1) / treehash_blocksize;
+
+		for (int round = 0; round < params.n_rounds; ++round)
+		{
+			BenchTimer timer(res);
+			TreeHash tree_hash(NULL);
+			for (size_t pos = 0; pos < data.size(); pos += c_small_hash_dist)
+			{
+				tree_hash.hash(data.data() + pos, static_cast<_u32>((std::min)(static_cast<size_t>(c_small_hash_dist), data.size() - pos)));
+			}
+			tree_hash.finalize();
+		}
+
+		results.push_back(res);
+		return true;
+	}
+
+	bool bench_filelist_parser(const SBenchParams& params, std::vector<SBenchResult>& results)
+	{
+		size_t n_entries;
+		if (!create_filelist(params, false, n_entries))
+		{
+			return false;
+		}
+
+		std::string data = getFile(filelist_fn(params, false));
+
+		SBenchResult res("filelist_parser");
+		res.bytes = data.size();
+		res.items = n_entries;
+
+		for (int round = 0; round < params.n_rounds; ++round)
+		{
+			BenchTimer timer(res);
+			FileListParser parser;
+			SFile entry;
+			std::map<std::string, std::string> extra;
+			size_t n_parsed = 0;
+			for (size_t i = 0; i < data.size(); ++i)
+			{
+				if (parser.nextEntry(data[i], entry, &extra))
+				{
+					++n_parsed;
+					extra.clear();
+				}
+			}
+
+			if (n_parsed != n_entries)
+			{
+				Server->Log("File list parser returned " + convert(n_parsed) + " entries. Expected at least " + convert(n_entries), LL_ERROR);
+				return false;
+			}
+		}
+
+		results.push_back(res);
+		return true;
+	}
+
+	bool bench_tree_diff(const SBenchParams& params, std::vector<SBenchResult>& results)
+	{
+		size_t n_entries;
+		size_t n_entries_modified;
+		if (!create_filelist(params, false, n_entries)
+			|| !create_filelist(params, true, n_entries_modified))
+		{
+			return false;
+		}
+
+		SBenchResult res("tree_diff");
+		res.bytes = getFile(filelist_fn(params, false)).size() + getFile(filelist_fn(params, true)).size();
+		res.items = n_entries + n_entries_modified;
+
+		for (int round = 0; round < params.n_rounds; ++round)
+		{
+			BenchTimer timer(res);
+			bool error = false;
+			std::vector<size_t> deleted_ids;
+			std::vector<size_t> large_unchanged_subtrees;
+			std::vector<size_t> modified_inplace_ids;
+			std::vector<size_t> dir_diffs;
+			std::vector<size_t> deleted_inplace_ids;
+			std::vector<size_t> diffs = TreeDiff::diffTrees(filelist_fn(params, false), filelist_fn(params, true), error,
+				&deleted_ids, &large_unchanged_subtrees, &modified_inplace_ids, dir_diffs, &deleted_inplace_ids, false, false);
+
+			if (error)
+			{
+				Server->Log("Error diffing file trees", LL_ERROR);
+				return false;
+			}
+		}
+
+		results.push_back(res);
+		return true;
+	}
+
+	FileIndex::SIndexKey bench_index_key(uint64 seed, size_t idx)
+	{
+		BenchRandom rnd(seed ^ (static_cast<uint64>(idx) << 20));
+		char hash[bytes_in_index];
+		for (size_t i = 0; i < bytes_in_index; i += sizeof(uint64))
+		{
+			uint64 r = rnd.next();
+			memcpy(hash + i, &r, (std::min)(sizeof(r), bytes_in_index - i));
+		}
+		return FileIndex::SIndexKey(hash, static_cast<int64>(rnd.next(1024 * 1024 * 1024)), static_cast<int>(idx % 10) + 1);
+	}
+
+	bool bench_file_index(const SBenchParams& params, std::vector<SBenchResult>& results)
+	{
+		const std::string index_fn = "urbackup/fileindex/backup_server_files_index.lmdb";
+
+		if (FileExists(index_fn))
+		{
+			Server->Log("File index exists in working directory. Not running file index benchmark. Please use an empty working directory.", LL_WARNING);
+			return true;
+		}
+
+		if (!os_directory_exists("urbackup/fileindex")
+			&& !os_create_dir_recursive("urbackup/fileindex"))
+		{
+			Server->Log("Error creating file index directory. " + os_last_error_str(), LL_ERROR);
+			return false;
+		}
+
+		LMDBFileIndex::initFileIndex();
+
+		bool ret = true;
+		{
+			LMDBFileIndex fileindex(true);
+
+			SBenchResult res_put("file_index_put");
+			res_put.items = params.n_index_entries;
+			{
+				BenchTimer timer(res_put);
+				fileindex.start_transaction();
+				for (size_t i = 0; i < params.n_index_entries; ++i)
+				{
+					fileindex.put(bench_index_key(params.seed, i), static_cast<int64>(i) + 1);
+
+					if (i % 10000 == 9999)
+					{
+						fileindex.commit_transaction();
+						fileindex.start_transaction();
+					}
+				}
+				fileindex.commit_transaction();
+			}
+
+			if (fileindex.has_error())
+			{
+				Server->Log("Error creating synthetic file index", LL_ERROR);
+				ret = false;
+			}
+
+			SBenchResult res_get("file_index_lookup");
+			res_get.items = params.n_index_entries;
+
+			for (int round = 0; round < params.n_rounds && ret; ++round)
+			{
+				BenchRandom rnd(params.seed + round);
+				BenchTimer timer(res_get);
+				for (size_t i = 0; i < params.n_index_entries; ++i)
+				{
+					//90% hits
+					size_t idx = rnd.next(params.n_index_entries + params.n_index_entries / 9);
+					int64 entryid = fileindex.get_any_client(bench_index_key(params.seed, idx));
+					if (idx < params.n_index_entries
+						&& entryid != static_cast<int64>(idx) + 1)
+					{
+						Server->Log("Looking up file index entry " + convert(idx) + " failed. Got " + convert(entryid), LL_ERROR);
+						ret = false;
+						break;
+					}
+				}
+			}
+
+			if (ret)
+			{
+				results.push_back(res_put);
+				results.push_back(res_get);
+			}
+		}
+
+		LMDBFileIndex::shutdownFileIndex();
+
+		Server->deleteFile(index_fn);
+		Server->deleteFile(index_fn + "-lock");
+
+		return ret;
+	}
+
+	bool bench_compressed_file(const SBenchParams& params, std::vector<SBenchResult>& results)
+	{
+		std::auto_ptr<IFile> data(create_synthetic_file(params));
+		if (data.get() == NULL)
+		{
+			return false;
+		}
+
+		std::string fn = params.dir + os_file_sep() + "image.vhdz";
+
+		SBenchResult res_write("compressed_file_write");
+		res_write.bytes = params.data_size;
+		res_write.items = (params.data_size + bench_block_size - 1) / bench_block_size;
+
+		SBenchResult res_read("compressed_file_read");
+		res_read.bytes = params.data_size;
+		res_read.items = res_write.items;
+
+		std::vector<char> buf(512 * 1024);
+		for (int round = 0; round < params.n_rounds; ++round)
+		{
+			IFile* f = Server->openFile(fn, MODE_RW_CREATE);
+			if (f == NULL)
+			{
+				Server->Log("Error opening " + fn + ". " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+
+			{
+				BenchTimer timer(res_write);
+				CompressedFile compressed_file(f, false, false);
+				data->Seek(0);
+				_u32 read;
+				while ((read = data->Read(buf.data(), static_cast<_u32>(buf.size()))) > 0)
+				{
+					for (_u32 off = 0; off < read; off += bench_block_size)
+					{
+						_u32 towrite = (std::min)(static_cast<_u32>(bench_block_size), read - off);
+						if (compressed_file.Write(buf.data() + off, towrite) != towrite)
+						{
+							Server->Log("Error writing to compressed file", LL_ERROR);
+							return false;
+						}
+					}
+				}
+
+				if (!compressed_file.finish())
+				{
+					Server->Log("Error finishing compressed file", LL_ERROR);
+					return false;
+				}
+			}
+
+			f = Server->openFile(fn, MODE_READ);
+			if (f == NULL)
+			{
+				Server->Log("Error opening " + fn + ". " + os_last_error_str(), LL_ERROR);
+				return false;
+			}
+
+			{
+				BenchTimer timer(res_read);
+				CompressedFile compressed_file(f, true, true);
+				int64 read_bytes = 0;
+				_u32 read;
+				while ((read = compressed_file.Read(buf.data(), static_cast<_u32>(bench_block_size))) > 0)
+				{
+					read_bytes += read;
+				}
+
+				if (compressed_file.hasError()
+					|| read_bytes != params.data_size)
+				{
+					Server->Log("Error reading compressed file. Read " + convert(read_bytes) + " bytes", LL_ERROR);
+					return false;
+				}
+			}
+		}
+
+		Server->deleteFile(fn);
+
+		results.push_back(res_write);
+		results.push_back(res_read);
+		return true;
+	}
+
+	bool bench_memory_pipes(const SBenchParams& params, std::vector<SBenchResult>& results)
+	{
+		const size_t message_size = 200;
+		const size_t batch_size = 64;
+
+		for (int ring = 0; ring < 2; ++ring)
+		{
+			SBenchResult res(ring ? "ring_memory_pipe" : "memory_pipe");
+			res.bytes = params.n_messages*message_size;
+			res.items = params.n_messages;
+
+			for (int round = 0; round < params.n_rounds; ++round)
+			{
+				std::auto_ptr<IPipe> pipe(ring ? Server->createMemoryPipe(1024) : Server->createMemoryPipe());
+
+				BenchTimer timer(res);
+				std::string msg(message_size, 'x');
+				std::string ret;
+				for (size_t i = 0; i < params.n_messages; i += batch_size)
+				{
+					size_t n = (std::min)(batch_size, params.n_messages - i);
+					for (size_t j = 0; j < n; ++j)
+					{
+						pipe->Write(msg);
+					}
+
+					for (size_t j = 0; j < n; ++j)
+					{
+						if (pipe->Read(&ret) != message_size)
+						{
+							Server->Log("Received message with wrong size", LL_ERROR);
+							return false;
+						}
+					}
+				}
+			}
+
+			results.push_back(res);
+		}
+
+		return true;
+	}
+
+	bool bench_compressed_pipe2(const SBenchParams& params, std::vector<SBenchResult>& results)
+	{
+		std::auto_ptr<IFile> f(create_synthetic_file(params));
+		if (f.get() == NULL)
+		{
+			return false;
+		}
+
+		std::string data = f->Read(static_cast<int64>(0), static_cast<_u32>(params.data_size));
+
+		const size_t message_size = 32 * 1024;
+
+		SBenchResult res("compressed_pipe2");
+		res.bytes = data.size();
+		res.items = (data.size() + message_size - 1) / message_size;
+
+		std::vector<char> buf(message_size);
+		for (int round = 0; round < params.n_rounds; ++round)
+		{
+			CompressedPipe2 pipe(Server->createMemoryPipe(), 6);
+			pipe.destroyBackendPipeOnDelete(true);
+
+			BenchTimer timer(res);
+			for (size_t pos = 0; pos < data.size(); pos += message_size)
+			{
+				size_t towrite = (std::min)(message_size, data.size() - pos);
+				if (!pipe.Write(data.data() + pos, towrite))
+				{
+					Server->Log("Error writing to compressed pipe", LL_ERROR);
+					return false;
+				}
+
+				size_t read_bytes = 0;
+				while (read_bytes < towrite)
+				{
+					size_t read = pipe.Read(buf.data(), buf.size(), 10000);
+					if (read == 0)
+					{
+						Server->Log("Error reading from compressed pipe", LL_ERROR);
+						return false;
+					}
+					read_bytes += read;
+				}
+			}
+		}
+
+		results.push_back(res);
+		return true;
+	}
+
+	typedef bool(*bench_kernel_t)(const SBenchParams& params, std::vector<SBenchResult>& results);
+
+	struct SBenchKernel
+	{
+		const char* name;
+		bench_kernel_t func;
+	};
+
+	const SBenchKernel bench_kernels[] = {
+		{ "chunk_hashs", bench_chunk_hashs },
+		{ "tree_hash", bench_tree_hash },
+		{ "file_index", bench_file_index },
+		{ "filelist_parser", bench_filelist_parser },
+		{ "tree_diff", bench_tree_diff },
+		{ "compressed_file", bench_compressed_file },
+		{ "memory_pipe", bench_memory_pipes },
+		{ "compressed_pipe2", bench_compressed_pipe2 }
+	};
+
+	void result_stats(const SBenchResult& res, int64& min_ms, int64& max_ms, double& avg_ms)
+	{
+		min_ms = res.durations_ms.empty() ? 0 : res.durations_ms[0];
+		max_ms = min_ms;
+		int64 total_ms = 0;
+		for (size_t i = 0; i < res.durations_ms.size(); ++i)
+		{
+			min_ms = (std::min)(min_ms, res.durations_ms[i]);
+			max_ms = (std::max)(max_ms, res.durations_ms[i]);
+			total_ms += res.durations_ms[i];
+		}
+		avg_ms = res.durations_ms.empty() ? 0 : static_cast<double>(total_ms) / res.durations_ms.size();
+	}
+
+	//Per second rates are based on the fastest round
+	double per_second(int64 n, int64 min_ms)
+	{
+		return static_cast<double>(n) * 1000 / (std::max)(min_ms, static_cast<int64>(1));
+	}
+
+	void log_result(const SBenchResult& res)
+	{
+		int64 min_ms, max_ms;
+		double avg_ms;
+		result_stats(res, min_ms, max_ms, avg_ms);
+
+		std::string msg = res.name + ": " + convert(res.durations_ms.size()) + " rounds min=" + convert(min_ms)
+			+ "ms avg=" + convert(avg_ms) + "ms max=" + convert(max_ms) + "ms";
+
+		if (res.bytes > 0)
+		{
+			msg += " " + convert(per_second(res.bytes, min_ms) / (1024 * 1024)) + " MB/s";
+		}
+
+		if (res.items > 0)
+		{
+			msg += " " + convert(static_cast<int64>(per_second(res.items, min_ms))) + " items/s latency="
+				+ convert(static_cast<double>(min_ms) * 1000 / res.items) + "us";
+		}
+
+		Server->Log(msg, LL_INFO);
+	}
+
+	JSON::Object json_result(const SBenchResult& res)
+	{
+		int64 min_ms, max_ms;
+		double avg_ms;
+		result_stats(res, min_ms, max_ms, avg_ms);
+
+		JSON::Object ret;
+		ret.set("name", res.name);
+		ret.set("rounds", static_cast<int>(res.durations_ms.size()));
+		ret.set("bytes", res.bytes);
+		ret.set("items", res.items);
+		ret.set("min_ms", min_ms);
+		ret.set("avg_ms", avg_ms);
+		ret.set("max_ms", max_ms);
+		ret.set("bytes_per_s", per_second(res.bytes, min_ms));
+		ret.set("items_per_s", per_second(res.items, min_ms));
+		ret.set("latency_us", res.items > 0 ? static_cast<double>(min_ms) * 1000 / res.items : 0.0);
+		return ret;
+	}
+}
+
+int bench_hot_paths()
+{
+	SBenchParams params;
+	params.seed = static_cast<uint64>(watoi64(Server->getServerParameter("bench_seed", "1")));
+	params.data_size = watoi64(Server->getServerParameter("bench_size_mb", "64")) * 1024 * 1024;
+	params.n_files = static_cast<size_t>(watoi64(Server->getServerParameter("bench_files", "100000")));
+	params.n_index_entries = static_cast<size_t>(watoi64(Server->getServerParameter("bench_index_entries", "200000")));
+	params.n_messages = static_cast<size_t>(watoi64(Server->getServerParameter("bench_messages", "1000000")));
+	params.n_rounds = watoi(Server->getServerParameter("bench_rounds", "3"));
+	params.dir = Server->getServerParameter("bench_dir", Server->getServerWorkingDir() + os_file_sep() + "urbackup_bench");
+	std::string kernels = Server->getServerParameter("bench_kernels", "all");
+	bool json_output = Server->getServerParameter("bench_output") == "json";
+
+	if (params.data_size <= 0 || params.n_files == 0 || params.n_index_entries == 0
+		|| params.n_messages == 0 || params.n_rounds <= 0)
+	{
+		Server->Log("Invalid benchmark parameters (bench_size_mb, bench_files, bench_index_entries, bench_messages, bench_rounds)", LL_ERROR);
+		return 1;
+	}
+
+	std::vector<std::string> selected;
+	Tokenize(kernels, selected, ",");
+
+	if (!os_directory_exists(params.dir)
+		&& !os_create_dir_recursive(params.dir))
+	{
+		Server->Log("Error creating benchmark directory " + params.dir + ". " + os_last_error_str(), LL_ERROR);
+		return 1;
+	}
+
+	std::vector<SBenchResult> results;
+	int rc = 0;
+	for (size_t i = 0; i < sizeof(bench_kernels) / sizeof(bench_kernels[0]); ++i)
+	{
+		if (kernels != "all"
+			&& std::find(selected.begin(), selected.end(), bench_kernels[i].name) == selected.end())
+		{
+			continue;
+		}
+
+		Server->Log(std::string("Running benchmark ") + bench_kernels[i].name + "...", LL_INFO);
+
+		size_t n_results = results.size();
+		if (!bench_kernels[i].func(params, results))
+		{
+			Server->Log(std::string("Benchmark ") + bench_kernels[i].name + " failed", LL_ERROR);
+			rc = 1;
+		}
+
+		for (size_t j = n_results; j < results.size(); ++j)
+		{
+			log_result(results[j]);
+		}
+	}
+
+	Server->deleteFile(filelist_fn(params, false));
+	Server->deleteFile(filelist_fn(params, true));
+	os_remove_dir(params.dir);
+
+	if (json_output)
+	{
+		JSON::Object ret;
+		ret.set("seed", params.seed);
+		ret.set("size_mb", params.data_size / (1024 * 1024));
+		ret.set("files", params.n_files);
+		ret.set("index_entries", params.n_index_entries);
+		ret.set("messages", params.n_messages);
+		ret.set("rounds", params.n_rounds);
+		ret.set("ok", rc == 0);
+
+		JSON::Array json_results;
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			json_results.add(json_result(results[i]));
+		}
+		ret.set("results", json_results);
+
+		std::cout << ret.stringify(false) << std::endl;
+	}
+
+	return rc;
+}
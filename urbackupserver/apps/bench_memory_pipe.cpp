@@ -0,0 +1,121 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "../../Interface/Server.h"
+#include "../../Interface/Pipe.h"
+#include "../../Interface/Thread.h"
+#include "../../Interface/ThreadPool.h"
+#include "../../stringtools.h"
+#include <memory>
+#include <vector>
+
+namespace
+{
+	class BenchPipeWriter : public IThread
+	{
+	public:
+		BenchPipeWriter(IPipe* pipe, int64 n_messages, size_t message_size)
+			: pipe(pipe), n_messages(n_messages), message_size(message_size)
+		{
+		}
+
+		void operator()()
+		{
+			std::string msg(message_size, 'x');
+			for (int64 i = 0; i < n_messages; ++i)
+			{
+				msg[0] = static_cast<char>(i & 0xFF);
+				pipe->Write(msg);
+			}
+			delete this;
+		}
+
+	private:
+		IPipe* pipe;
+		int64 n_messages;
+		size_t message_size;
+	};
+
+	bool bench_pipe(IPipe* pipe, int64 n_messages, size_t message_size, size_t n_writers, int64& duration_ms)
+	{
+		int64 starttime = Server->getTimeMS();
+
+		std::vector<THREADPOOL_TICKET> tickets;
+		for (size_t i = 0; i < n_writers; ++i)
+		{
+			tickets.push_back(Server->getThreadPool()->execute(new BenchPipeWriter(pipe, n_messages, message_size), "bench pipe write"));
+		}
+
+		bool ok = true;
+		std::string msg;
+		for (int64 i = 0; i < n_messages*static_cast<int64>(n_writers); ++i)
+		{
+			if (pipe->Read(&msg) != message_size)
+			{
+				ok = false;
+			}
+		}
+
+		Server->getThreadPool()->waitFor(tickets);
+
+		duration_ms = Server->getTimeMS() - starttime;
+
+		return ok;
+	}
+}
+
+int bench_memory_pipe()
+{
+	int64 n_messages = watoi64(Server->getServerParameter("bench_messages", "1000000"));
+	size_t message_size = static_cast<size_t>(watoi(Server->getServerParameter("bench_message_size", "200")));
+	size_t n_writers = static_cast<size_t>(watoi(Server->getServerParameter("bench_writers", "1")));
+	size_t ring_capacity = static_cast<size_t>(watoi(Server->getServerParameter("bench_ring_capacity", "1024")));
+	int n_rounds = watoi(Server->getServerParameter("bench_rounds", "3"));
+
+	if (n_messages <= 0 || message_size == 0 || n_writers == 0 || n_rounds <= 0)
+	{
+		Server->Log("Invalid benchmark parameters (bench_messages, bench_message_size, bench_writers, bench_rounds)", LL_ERROR);
+		return 1;
+	}
+
+	Server->Log("Benchmarking memory pipes with " + convert(n_messages) + " messages of " + convert(message_size)
+		+ " bytes from " + convert(n_writers) + " writer threads...", LL_INFO);
+
+	for (int round = 0; round < n_rounds; ++round)
+	{
+		for (int ring = 0; ring < 2; ++ring)
+		{
+			std::auto_ptr<IPipe> pipe(ring ? Server->createMemoryPipe(ring_capacity) : Server->createMemoryPipe());
+
+			int64 duration_ms;
+			if (!bench_pipe(pipe.get(), n_messages, message_size, n_writers, duration_ms))
+			{
+				Server->Log("Received message with wrong size", LL_ERROR);
+				return 1;
+			}
+
+			int64 total_messages = n_messages*static_cast<int64>(n_writers);
+
+			Server->Log("Round " + convert(round + 1) + ": " + (ring ? "ring pipe " : "deque pipe") + " transferred "
+				+ convert(total_messages) + " messages in " + convert(duration_ms) + "ms ("
+				+ convert(duration_ms>0 ? total_messages * 1000 / duration_ms : total_messages * 1000) + " messages/s)", LL_INFO);
+		}
+	}
+
+	return 0;
+}
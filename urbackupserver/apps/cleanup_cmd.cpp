@@ -161,6 +161,10 @@ int vacuum_databases()
 	dbs.push_back(URBACKUPDB_SERVER_FILES);
 	dbs.push_back(URBACKUPDB_SERVER_LINKS);
 	dbs.push_back(URBACKUPDB_SERVER_LINK_JOURNAL);
+	for (size_t i = 1; i < FilesDbShards::getNumDatabases(); ++i)
+	{
+		dbs.push_back(FilesDbShards::getDatabaseId(i));
+	}
 
 	for (size_t i = 0; i < dbs.size(); ++i)
 	{
@@ -18,6 +18,7 @@
 
 #include "app.h"
 #include "../../stringtools.h"
+#include "../FilesDbShards.h"
 
 int repair_cmd(void)
 {
@@ -29,6 +30,10 @@ int repair_cmd(void)
 	dbs.push_back(URBACKUPDB_SERVER_FILES);
 	dbs.push_back(URBACKUPDB_SERVER_LINKS);
 	dbs.push_back(URBACKUPDB_SERVER_LINK_JOURNAL);
+	for (size_t i = 1; i < FilesDbShards::getNumDatabases(); ++i)
+	{
+		dbs.push_back(FilesDbShards::getDatabaseId(i));
+	}
 
 	for (size_t i = 0; i < dbs.size(); ++i)
 	{
@@ -56,6 +61,10 @@ int repair_cmd(void)
 	db_names.push_back("_files");
 	db_names.push_back("_links");
 	db_names.push_back("_link_journal");
+	for (size_t i = 1; i < FilesDbShards::getNumDatabases(); ++i)
+	{
+		db_names.push_back("_files_" + convert(i));
+	}
 
 	for (size_t i = 0; i < db_names.size(); ++i)
 	{
@@ -0,0 +1,323 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "app.h"
+#include "shard_files_db.h"
+#include "../../stringtools.h"
+#include "../../Interface/DatabaseCursor.h"
+#include "../FileIndex.h"
+#include "../create_files_index.h"
+#include "../FilesDbShards.h"
+#include "../IncrementalStats.h"
+#include "../dao/ServerBackupDao.h"
+#include "../dao/ServerFilesDao.h"
+#include "../serverinterface/helper.h"
+#include <memory>
+#include <algorithm>
+
+extern SStartupStatus startup_status;
+
+namespace
+{
+	const size_t fileindex_commit_n = 10000;
+
+	bool copy_client_entries(IDatabase* src_db, IDatabase* dst_db, int clientid, int64& n_entries)
+	{
+		DBScopedWriteTransaction trans(dst_db);
+
+		//Entries of a previous interrupted run
+		IQuery* q_del = dst_db->Prepare("DELETE FROM files WHERE clientid=?", false);
+		q_del->Bind(clientid);
+		bool ok = q_del->Write();
+		dst_db->destroyQuery(q_del);
+
+		q_del = dst_db->Prepare("DELETE FROM files_incoming_stat WHERE clientid=?", false);
+		q_del->Bind(clientid);
+		ok = ok && q_del->Write();
+		dst_db->destroyQuery(q_del);
+
+		ok = ok && dst_db->Write("DROP TABLE IF EXISTS entry_map")
+			&& dst_db->Write("CREATE TEMPORARY TABLE entry_map (old_id INTEGER PRIMARY KEY, new_id INTEGER)");
+
+		if (!ok)
+		{
+			trans.rollback();
+			return false;
+		}
+
+		IQuery* q_get = src_db->Prepare("SELECT id, backupid, fullpath, hashpath, shahash, filesize, created, rsize, incremental, next_entry, prev_entry, pointed_to FROM files WHERE clientid=? ORDER BY id ASC", false);
+		IQuery* q_add = dst_db->Prepare("INSERT INTO files (backupid, fullpath, hashpath, shahash, filesize, created, rsize, clientid, incremental, next_entry, prev_entry, pointed_to) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", false);
+		IQuery* q_map = dst_db->Prepare("INSERT INTO entry_map (old_id, new_id) VALUES (?, ?)", false);
+
+		q_get->Bind(clientid);
+		IDatabaseCursor* cur = q_get->Cursor();
+
+		db_single_result res;
+		while (ok && cur->next(res))
+		{
+			const std::string& shahash = res["shahash"];
+			q_add->Bind(watoi(res["backupid"]));
+			q_add->Bind(res["fullpath"]);
+			q_add->Bind(res["hashpath"]);
+			q_add->Bind(shahash.c_str(), static_cast<_u32>(shahash.size()));
+			q_add->Bind(watoi64(res["filesize"]));
+			q_add->Bind(watoi64(res["created"]));
+			q_add->Bind(watoi64(res["rsize"]));
+			q_add->Bind(clientid);
+			q_add->Bind(watoi(res["incremental"]));
+			q_add->Bind(watoi64(res["next_entry"]));
+			q_add->Bind(watoi64(res["prev_entry"]));
+			q_add->Bind(watoi(res["pointed_to"]));
+			ok = q_add->Write();
+			q_add->Reset();
+
+			q_map->Bind(watoi64(res["id"]));
+			q_map->Bind(dst_db->getLastInsertID());
+			ok = ok && q_map->Write();
+			q_map->Reset();
+
+			++n_entries;
+		}
+
+		ok = ok && !cur->has_error();
+
+		src_db->destroyQuery(q_get);
+		dst_db->destroyQuery(q_add);
+		dst_db->destroyQuery(q_map);
+
+		if (ok)
+		{
+			IQuery* q_remap = dst_db->Prepare("UPDATE files SET next_entry=(SELECT new_id FROM entry_map WHERE old_id=files.next_entry) WHERE clientid=? AND next_entry!=0", false);
+			q_remap->Bind(clientid);
+			ok = q_remap->Write();
+			dst_db->destroyQuery(q_remap);
+
+			q_remap = dst_db->Prepare("UPDATE files SET prev_entry=(SELECT new_id FROM entry_map WHERE old_id=files.prev_entry) WHERE clientid=? AND prev_entry!=0", false);
+			q_remap->Bind(clientid);
+			ok = ok && q_remap->Write();
+			dst_db->destroyQuery(q_remap);
+		}
+
+		if (ok)
+		{
+			//Not yet accounted statistics journal entries
+			q_get = src_db->Prepare("SELECT filesize, backupid, existing_clients, direction, incremental FROM files_incoming_stat WHERE clientid=? ORDER BY id ASC", false);
+			q_get->Bind(clientid);
+			cur = q_get->Cursor();
+
+			ServerFilesDao dst_filesdao(dst_db);
+			while (cur->next(res))
+			{
+				dst_filesdao.addIncomingFile(watoi64(res["filesize"]), clientid, watoi(res["backupid"]),
+					res["existing_clients"], watoi(res["direction"]), watoi(res["incremental"]));
+			}
+
+			ok = !cur->has_error();
+			src_db->destroyQuery(q_get);
+		}
+
+		dst_db->Write("DROP TABLE entry_map");
+
+		if (!ok)
+		{
+			trans.rollback();
+		}
+
+		return ok;
+	}
+
+	bool update_client_fileindex(IDatabase* dst_db, FileIndex* fileindex, int clientid)
+	{
+		IQuery* q_get = dst_db->Prepare("SELECT id, shahash, filesize FROM files WHERE clientid=? AND pointed_to!=0", false);
+		q_get->Bind(clientid);
+		IDatabaseCursor* cur = q_get->Cursor();
+
+		fileindex->start_transaction();
+
+		size_t n_put = 0;
+		db_single_result res;
+		while (cur->next(res))
+		{
+			fileindex->put(FileIndex::SIndexKey(res["shahash"].c_str(), watoi64(res["filesize"]), clientid), watoi64(res["id"]));
+
+			++n_put;
+			if (n_put % fileindex_commit_n == 0)
+			{
+				fileindex->commit_transaction();
+				fileindex->start_transaction();
+			}
+		}
+
+		fileindex->commit_transaction();
+
+		bool ok = !cur->has_error() && !fileindex->has_error();
+		dst_db->destroyQuery(q_get);
+
+		return ok;
+	}
+
+	bool remove_client_entries(IDatabase* src_db, int clientid)
+	{
+		DBScopedWriteTransaction trans(src_db);
+
+		IQuery* q_del = src_db->Prepare("DELETE FROM files WHERE clientid=?", false);
+		q_del->Bind(clientid);
+		bool ok = q_del->Write();
+		src_db->destroyQuery(q_del);
+
+		q_del = src_db->Prepare("DELETE FROM files_incoming_stat WHERE clientid=?", false);
+		q_del->Bind(clientid);
+		ok = ok && q_del->Write();
+		src_db->destroyQuery(q_del);
+
+		if (!ok)
+		{
+			trans.rollback();
+		}
+
+		return ok;
+	}
+}
+
+int shard_files_db()
+{
+	std::string s_new_shards = Server->getServerParameter("files_db_shards");
+	if (s_new_shards.empty())
+	{
+		Server->Log("Number of files database shards not specified (parameter \"files_db_shards\")", LL_ERROR);
+		return 1;
+	}
+
+	size_t new_shards = static_cast<size_t>(watoi(s_new_shards));
+	if (new_shards > max_files_db_shards)
+	{
+		Server->Log("Number of files database shards must not be larger than " + convert(max_files_db_shards), LL_ERROR);
+		return 1;
+	}
+
+	open_server_database(true);
+
+	if (!create_files_index(startup_status))
+	{
+		Server->Log("Error opening file entry index", LL_ERROR);
+		return 1;
+	}
+
+	std::auto_ptr<FileIndex> fileindex(create_lmdb_files_index());
+	if (fileindex.get() == NULL)
+	{
+		Server->Log("Error opening file entry index -2", LL_ERROR);
+		return 1;
+	}
+
+	IDatabase* db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
+
+	size_t curr_shards = FilesDbShards::getNumShards();
+
+	Server->Log("Changing number of files database shards from " + convert(curr_shards) + " to " + convert(new_shards) + "...", LL_INFO);
+
+	//Removes flushed entries from the statistics journals, so they
+	//can be moved between the files databases
+	IncrementalStats::init();
+
+	{
+		ServerBackupDao backupdao(db);
+		backupdao.delMiscValue("files_db_shards_migration");
+		backupdao.addMiscValue("files_db_shards_migration", convert(new_shards));
+	}
+
+	//Entries might be in any of the databases if a previous run was interrupted
+	size_t n_databases = (std::max)(curr_shards, new_shards) + 1;
+
+	for (size_t i = 1; i < n_databases; ++i)
+	{
+		if (!FilesDbShards::openShard(i))
+		{
+			return 1;
+		}
+
+		if (i > curr_shards)
+		{
+			IncrementalStats::resetJournalState(i);
+		}
+	}
+
+	int64 n_entries = 0;
+	int64 n_clients = 0;
+
+	for (size_t src_idx = 0; src_idx < n_databases; ++src_idx)
+	{
+		IDatabase* src_db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(src_idx));
+
+		db_results res_clients = src_db->Read("SELECT DISTINCT clientid FROM files UNION SELECT DISTINCT clientid FROM files_incoming_stat");
+
+		for (size_t i = 0; i < res_clients.size(); ++i)
+		{
+			int clientid = watoi(res_clients[i]["clientid"]);
+			size_t dst_idx = FilesDbShards::getClientIdx(clientid, new_shards);
+
+			if (dst_idx == src_idx)
+			{
+				continue;
+			}
+
+			Server->Log("Moving file entries of client " + convert(clientid) + " from "
+				+ FilesDbShards::getDatabaseName(src_idx) + " to " + FilesDbShards::getDatabaseName(dst_idx) + "...", LL_INFO);
+
+			IDatabase* dst_db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(dst_idx));
+
+			if (!copy_client_entries(src_db, dst_db, clientid, n_entries))
+			{
+				Server->Log("Copying file entries of client " + convert(clientid) + " failed", LL_ERROR);
+				return 2;
+			}
+
+			if (!update_client_fileindex(dst_db, fileindex.get(), clientid))
+			{
+				Server->Log("Updating file entry index for client " + convert(clientid) + " failed", LL_ERROR);
+				return 2;
+			}
+
+			if (!remove_client_entries(src_db, clientid))
+			{
+				Server->Log("Removing moved file entries of client " + convert(clientid) + " failed", LL_ERROR);
+				return 2;
+			}
+
+			++n_clients;
+		}
+	}
+
+	{
+		DBScopedWriteTransaction trans(db);
+		ServerBackupDao backupdao(db);
+		backupdao.delMiscValue("files_db_shards");
+		backupdao.addMiscValue("files_db_shards", convert(new_shards));
+		backupdao.delMiscValue("files_db_shards_migration");
+	}
+
+	Server->Log("Moved " + convert(n_entries) + " file entries of " + convert(n_clients) + " clients. The files database now has "
+		+ convert(new_shards) + " shards.", LL_INFO);
+
+	if (n_databases > new_shards + 1)
+	{
+		Server->Log("Database files of shards with index larger than " + convert(new_shards) + " are empty now and can be deleted", LL_INFO);
+	}
+
+	return 0;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+int shard_files_db();
\ No newline at end of file
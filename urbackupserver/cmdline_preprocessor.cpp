@@ -300,6 +300,17 @@ void read_config_file(std::string fn, std::vector<std::string>& real_args)
 				real_args.push_back(val);
 			}
 		}
+		if (settings->getValue("METRICS_TOKEN", &val))
+		{
+			val = trim(unquote_value(val));
+
+			if (!val.empty())
+			{
+				//Token is read by the server itself, so it does not show up in the process list
+				real_args.push_back("--metrics_config");
+				real_args.push_back(fn);
+			}
+		}
 	}	
 
 	if(destroy_server)
@@ -512,6 +523,22 @@ int action_verify_hashes(std::vector<std::string> args)
 		"Specify file backup(s) to verify",
 		true, "all", "file backup set", cmd);
 
+	TCLAP::ValueArg<int> threads_arg("t", "threads",
+		"Number of threads reading and hashing files in parallel",
+		false, 4, "number", cmd);
+
+	TCLAP::ValueArg<int> sample_arg("s", "sample",
+		"Only verify a random sample of this percentage of files",
+		false, 100, "percent", cmd);
+
+	TCLAP::ValueArg<int> min_backupid_arg("b", "newer-than-backupid",
+		"Only verify files in file backups with an id larger than this id",
+		false, 0, "backup id", cmd);
+
+	TCLAP::ValueArg<std::string> report_arg("r", "report",
+		"Write a machine-readable verification report (JSON) to this file",
+		false, "", "path", cmd);
+
 	TCLAP::ValueArg<std::string> user_arg("u", "user",
 		"Change process to run as specific user",
 		false, "urbackup", "user", cmd);
@@ -533,6 +560,17 @@ int action_verify_hashes(std::vector<std::string> args)
 		real_args.push_back("--delete_verify_failed");
 		real_args.push_back("true");
 	}
+	real_args.push_back("--verify_threads");
+	real_args.push_back(convert(threads_arg.getValue()));
+	real_args.push_back("--verify_sample");
+	real_args.push_back(convert(sample_arg.getValue()));
+	real_args.push_back("--verify_min_backupid");
+	real_args.push_back(convert(min_backupid_arg.getValue()));
+	if(!report_arg.getValue().empty())
+	{
+		real_args.push_back("--verify_report");
+		real_args.push_back(report_arg.getValue());
+	}
 
 	if(verify_arg.getValue()=="all")
 	{
@@ -27,6 +27,7 @@
 #include "../urbackupcommon/os_functions.h"
 #include "serverinterface/helper.h"
 #include "dao/ServerBackupDao.h"
+#include "FilesDbShards.h"
 
 namespace
 {
@@ -71,11 +72,14 @@ db_results create_callback(size_t n_done, size_t n_rows, void *userdata)
 	return ret;
 }
 
-bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
+bool create_files_index_db(FileIndex& fileindex, SStartupStatus& status, size_t idx)
 {
 	Server->destroyAllDatabases();
 
-	IDatabase* db=Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES_DEL);
+	std::string db_fn = FilesDbShards::getDatabaseFilename(idx);
+	std::string db_new_fn = db_fn.substr(0, db_fn.size() - 3) + "_new.db";
+
+	IDatabase* db=Server->getDatabase(Server->getThreadID(), FilesDbShards::getDelDatabaseId(idx));
 	IDatabase* db_files_new = NULL;
 
 	if(db->getEngineName()=="sqlite")
@@ -83,8 +87,8 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 		Server->Log("Deleting database journal...", LL_INFO);
 		db->Write("PRAGMA journal_mode = DELETE");
 
-		if (FileExists("urbackup/backup_server_files.db-journal")
-			|| FileExists("urbackup/backup_server_files.db-wal"))
+		if (FileExists(db_fn + "-journal")
+			|| FileExists(db_fn + "-wal"))
 		{
 			Server->Log("Deleting database journal failed. Aborting.", LL_ERROR);
 			return false;
@@ -92,44 +96,42 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 
 		Server->destroyAllDatabases();
 
-		Server->deleteFile("urbackup/backup_server_files_new.db");
+		Server->deleteFile(db_new_fn);
 
 		Server->Log("Copying/reflinking database...", LL_INFO);
-		if (!os_create_hardlink("urbackup/backup_server_files_new.db",
-			"urbackup/backup_server_files.db", true, NULL))
+		if (!os_create_hardlink(db_new_fn, db_fn, true, NULL))
 		{
 			Server->Log("Reflinking failed. Falling back to copying...", LL_DEBUG);
 
-			if (!copy_file("urbackup/backup_server_files.db",
-				"urbackup/backup_server_files_new.db"))
+			if (!copy_file(db_fn, db_new_fn))
 			{
 				Server->Log("Copying file failed. " + os_last_error_str(), LL_ERROR);
 				return false;
 			}
 		}
 
-		str_map params;
-		if (!Server->openDatabase("urbackup/backup_server_files_new.db", URBACKUPDB_SERVER_FILES_NEW, params))
-		{
-			Server->Log("Couldn't open Database backup_server_files_new.db. Exiting. Expecting database at \"" +
-				Server->getServerWorkingDir() + os_file_sep() + "urbackup" + os_file_sep() + "backup_server_files_new.db\"", LL_ERROR);
-			return false;
-		}
-
-		Server->setDatabaseAllocationChunkSize(URBACKUPDB_SERVER_FILES_NEW, sqlite_data_allocation_chunk_size);
-
-		db_files_new = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES_NEW);
-		if (db_files_new ==NULL)
-		{
-			Server->Log("Couldn't open backup server database. Exiting. Expecting database at \"" +
-				Server->getServerWorkingDir() + os_file_sep() + "urbackup" + os_file_sep() + "backup_server_files_new.db\"", LL_ERROR);
-			return false;
+		str_map params;
+		if (!Server->openDatabase(db_new_fn, FilesDbShards::getNewDatabaseId(idx), params))
+		{
+			Server->Log("Couldn't open Database " + ExtractFileName(db_new_fn) + ". Exiting. Expecting database at \"" +
+				Server->getServerWorkingDir() + os_file_sep() + "urbackup" + os_file_sep() + ExtractFileName(db_new_fn) + "\"", LL_ERROR);
+			return false;
+		}
+
+		Server->setDatabaseAllocationChunkSize(FilesDbShards::getNewDatabaseId(idx), sqlite_data_allocation_chunk_size);
+
+		db_files_new = Server->getDatabase(Server->getThreadID(), FilesDbShards::getNewDatabaseId(idx));
+		if (db_files_new ==NULL)
+		{
+			Server->Log("Couldn't open backup server database. Exiting. Expecting database at \"" +
+				Server->getServerWorkingDir() + os_file_sep() + "urbackup" + os_file_sep() + ExtractFileName(db_new_fn) + "\"", LL_ERROR);
+			return false;
 		}
 
 		db_files_new->Write("PRAGMA journal_mode = OFF");
 		db_files_new->Write("PRAGMA synchronous = OFF");
 
-		db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
+		db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(idx));
 
 		if (db == NULL)
 		{
@@ -138,9 +140,6 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 		}
 	}
 
-	status.creating_filesindex=true;
-	Server->Log("Creating file entry index. This might take a while...", LL_WARNING);
-	
 	Server->Log("Getting number of files...", LL_INFO);
 	
 	db_results res = db->Read("SELECT COUNT(*) AS c FROM files");
@@ -168,7 +167,7 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 
 	{
 		DBScopedWriteTransaction write_transaction(db_files_new);
-		fileindex.create(create_callback, &data);
+		fileindex.create(create_callback, &data, db_files_new, idx == 0);
 	}
 
 	if(fileindex.has_error())
@@ -190,7 +189,7 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 
 		Server->destroyAllDatabases();
 
-		std::auto_ptr<IFile> db_file(Server->openFile("urbackup/backup_server_files_new.db", MODE_RW));
+		std::auto_ptr<IFile> db_file(Server->openFile(db_new_fn, MODE_RW));
 
 		if (db_file.get() == NULL)
 		{
@@ -203,14 +202,13 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 
 		Server->Log("Renaming back result...", LL_INFO);
 
-		if (!os_rename_file("urbackup/backup_server_files_new.db",
-			"urbackup/backup_server_files.db"))
+		if (!os_rename_file(db_new_fn, db_fn))
 		{
 			Server->Log("Renaming database file failed. " + os_last_error_str(), LL_ERROR);
 			return false;
 		}
 
-		db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
+		db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(idx));
 
 		if (db == NULL)
 		{
@@ -221,6 +219,27 @@ bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
 		db->Write("PRAGMA journal_mode = WAL");
 	}
 
+	return true;
+}
+
+bool create_files_index_common(FileIndex& fileindex, SStartupStatus& status)
+{
+	status.creating_filesindex=true;
+	Server->Log("Creating file entry index. This might take a while...", LL_WARNING);
+
+	for (size_t i = 0; i < FilesDbShards::getNumDatabases(); ++i)
+	{
+		if (FilesDbShards::getNumDatabases() > 1)
+		{
+			Server->Log("Adding entries of files database " + ExtractFileName(FilesDbShards::getDatabaseFilename(i)) + " to file entry index...", LL_INFO);
+		}
+
+		if (!create_files_index_db(fileindex, status, i))
+		{
+			return false;
+		}
+	}
+
 	status.creating_filesindex=false;
 
 	return true;
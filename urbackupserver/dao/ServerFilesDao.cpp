@@ -410,15 +410,17 @@ void ServerFilesDao::addIncomingFile(int64 filesize, int clientid, int backupid,
 * @return int64 c
 * @sql
 *       SELECT COUNT(*) AS c
-*       FROM files_incoming_stat
+*       FROM files_incoming_stat WHERE id<=:max_id(int64)
 */
-ServerFilesDao::CondInt64 ServerFilesDao::getIncomingStatsCount(void)
+ServerFilesDao::CondInt64 ServerFilesDao::getIncomingStatsCount(int64 max_id)
 {
 	if(q_getIncomingStatsCount==NULL)
 	{
-		q_getIncomingStatsCount=db->Prepare("SELECT COUNT(*) AS c FROM files_incoming_stat", false);
+		q_getIncomingStatsCount=db->Prepare("SELECT COUNT(*) AS c FROM files_incoming_stat WHERE id<=?", false);
 	}
+	q_getIncomingStatsCount->Bind(max_id);
 	db_results res=q_getIncomingStatsCount->Read();
+	q_getIncomingStatsCount->Reset();
 	CondInt64 ret = { false, 0 };
 	if(!res.empty())
 	{
@@ -445,21 +447,64 @@ void ServerFilesDao::delIncomingStatEntry(int64 id)
 	q_delIncomingStatEntry->Reset();
 }
 
+/**
+* @-SQLGenAccess
+* @func void ServerFilesDao::delIncomingStatRange
+* @sql
+*       DELETE FROM files_incoming_stat WHERE id>:min_id(int64) AND id<=:max_id(int64)
+*/
+void ServerFilesDao::delIncomingStatRange(int64 min_id, int64 max_id)
+{
+	if(q_delIncomingStatRange==NULL)
+	{
+		q_delIncomingStatRange=db->Prepare("DELETE FROM files_incoming_stat WHERE id>? AND id<=?", false);
+	}
+	q_delIncomingStatRange->Bind(min_id);
+	q_delIncomingStatRange->Bind(max_id);
+	q_delIncomingStatRange->Write();
+	q_delIncomingStatRange->Reset();
+}
+
+/**
+* @-SQLGenAccess
+* @func int64 ServerFilesDao::getMaxIncomingStatId
+* @return int64 max_id
+* @sql
+*       SELECT MAX(id) AS max_id FROM files_incoming_stat
+*/
+ServerFilesDao::CondInt64 ServerFilesDao::getMaxIncomingStatId(void)
+{
+	if(q_getMaxIncomingStatId==NULL)
+	{
+		q_getMaxIncomingStatId=db->Prepare("SELECT MAX(id) AS max_id FROM files_incoming_stat", false);
+	}
+	db_results res=q_getMaxIncomingStatId->Read();
+	CondInt64 ret = { false, 0 };
+	if(!res.empty())
+	{
+		ret.exists=true;
+		ret.value=watoi64(res[0]["max_id"]);
+	}
+	return ret;
+}
+
 /**
 * @-SQLGenAccess
 * @func vector<SIncomingStat> ServerFilesDao::getIncomingStats
 * @return int64 id, int64 filesize, int clientid, int backupid, string existing_clients, int direction, int incremental
 * @sql
 *       SELECT id, filesize, clientid, backupid, existing_clients, direction, incremental
-*       FROM files_incoming_stat LIMIT 10000
+*       FROM files_incoming_stat WHERE id<=:max_id(int64) LIMIT 10000
 */
-std::vector<ServerFilesDao::SIncomingStat> ServerFilesDao::getIncomingStats(void)
+std::vector<ServerFilesDao::SIncomingStat> ServerFilesDao::getIncomingStats(int64 max_id)
 {
 	if(q_getIncomingStats==NULL)
 	{
-		q_getIncomingStats=db->Prepare("SELECT id, filesize, clientid, backupid, existing_clients, direction, incremental FROM files_incoming_stat LIMIT 10000", false);
+		q_getIncomingStats=db->Prepare("SELECT id, filesize, clientid, backupid, existing_clients, direction, incremental FROM files_incoming_stat WHERE id<=? LIMIT 10000", false);
 	}
+	q_getIncomingStats->Bind(max_id);
 	db_results res=q_getIncomingStats->Read();
+	q_getIncomingStats->Reset();
 	std::vector<ServerFilesDao::SIncomingStat> ret;
 	ret.resize(res.size());
 	for(size_t i=0;i<res.size();++i)
@@ -696,6 +741,8 @@ void ServerFilesDao::prepareQueries()
 	q_addIncomingFile=NULL;
 	q_getIncomingStatsCount=NULL;
 	q_delIncomingStatEntry=NULL;
+	q_delIncomingStatRange=NULL;
+	q_getMaxIncomingStatId=NULL;
 	q_getIncomingStats=NULL;
 	q_deleteFiles=NULL;
 	q_removeDanglingFiles=NULL;
@@ -729,6 +776,8 @@ void ServerFilesDao::destroyQueries()
 	db->destroyQuery(q_addIncomingFile);
 	db->destroyQuery(q_getIncomingStatsCount);
 	db->destroyQuery(q_delIncomingStatEntry);
+	db->destroyQuery(q_delIncomingStatRange);
+	db->destroyQuery(q_getMaxIncomingStatId);
 	db->destroyQuery(q_getIncomingStats);
 	db->destroyQuery(q_deleteFiles);
 	db->destroyQuery(q_removeDanglingFiles);
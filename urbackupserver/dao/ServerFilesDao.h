@@ -93,9 +93,11 @@ public:
 	bool createTemporaryPathLookupIndex(void);
 	CondInt64 lookupEntryIdByPath(const std::string& fullpath);
 	void addIncomingFile(int64 filesize, int clientid, int backupid, const std::string& existing_clients, int direction, int incremental);
-	CondInt64 getIncomingStatsCount(void);
+	CondInt64 getIncomingStatsCount(int64 max_id);
 	void delIncomingStatEntry(int64 id);
-	std::vector<SIncomingStat> getIncomingStats(void);
+	void delIncomingStatRange(int64 min_id, int64 max_id);
+	CondInt64 getMaxIncomingStatId(void);
+	std::vector<SIncomingStat> getIncomingStats(int64 max_id);
 	void deleteFiles(int backupid);
 	void removeDanglingFiles(void);
 	bool createTemporaryLastFilesTable(void);
@@ -135,6 +137,8 @@ private:
 	IQuery* q_addIncomingFile;
 	IQuery* q_getIncomingStatsCount;
 	IQuery* q_delIncomingStatEntry;
+	IQuery* q_delIncomingStatRange;
+	IQuery* q_getMaxIncomingStatId;
 	IQuery* q_getIncomingStats;
 	IQuery* q_deleteFiles;
 	IQuery* q_removeDanglingFiles;
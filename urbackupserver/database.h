@@ -8,5 +8,9 @@ const DATABASE_ID URBACKUPDB_SERVER_LINKS = 24;
 const DATABASE_ID URBACKUPDB_SERVER_LINK_JOURNAL = 25;
 const DATABASE_ID URBACKUPDB_SERVER_SETTINGS=30;
 const DATABASE_ID URBACKUPDB_SERVER_FILES_NEW = 26;
+//Files database shards (up to max_files_db_shards ids each)
+const DATABASE_ID URBACKUPDB_SERVER_FILES_SHARD = 100;
+const DATABASE_ID URBACKUPDB_SERVER_FILES_SHARD_DEL = 200;
+const DATABASE_ID URBACKUPDB_SERVER_FILES_SHARD_NEW = 300;
 
 #endif //DATABASE_H
\ No newline at end of file
@@ -71,6 +71,10 @@ SStartupStatus startup_status;
 #include "server_archive.h"
 #include "server_settings.h"
 #include "server_update_stats.h"
+#include "IncrementalStats.h"
+#include "FilesDbWriter.h"
+#include "BackupMetrics.h"
+#include "FilesDbShards.h"
 #include "../urbackupcommon/os_functions.h"
 #include "InternetServiceConnector.h"
 #include "filedownload.h"
@@ -88,6 +92,7 @@ SStartupStatus startup_status;
 #include "../Interface/DatabaseCursor.h"
 #include <set>
 #include "apps/check_files_index.h"
+#include "apps/shard_files_db.h"
 #include "../fileservplugin/IFileServ.h"
 #include "../fileservplugin/IFileServFactory.h"
 #include "restore_client.h"
@@ -136,6 +141,7 @@ const unsigned short serviceport=35623;
 std::vector<IAction*> gActions;
 
 void init_mutex1(void);
+void init_metrics_token(void);
 void destroy_mutex1(void);
 void writeZeroblockdata(void);
 bool testEscape(void);
@@ -145,6 +151,9 @@ bool test_amatch(void);
 bool verify_hashes(std::string arg);
 void updateRights(int t_userid, std::string s_rights, IDatabase *db);
 int md5sum_check();
+int bench_change_journal();
+int bench_memory_pipe();
+int bench_hot_paths();
 
 std::string lang="en";
 std::string time_format_str="%Y-%m-%d %H:%M";
@@ -237,6 +246,12 @@ void open_server_database(bool init_db)
 		exit(1);
 	}
 
+	if (!FilesDbShards::open())
+	{
+		Server->Log("Couldn't open files database shards. Exiting.", LL_ERROR);
+		exit(1);
+	}
+
 	if (!sqlite_mmap_small.empty())
 	{
 		params["mmap_size"] = sqlite_mmap_small;
@@ -331,6 +346,13 @@ void start_wal_checkpoint_threads()
 		"urbackup" + os_file_sep() + "backup_server_files.db", URBACKUPDB_SERVER_FILES);
 	Server->createThread(wal_checkpoint_thread, "files checkpoint");
 
+	for (size_t i = 1; i < FilesDbShards::getNumDatabases(); ++i)
+	{
+		wal_checkpoint_thread = new WalCheckpointThread(100 * 1024 * 1024, 1000 * 1024 * 1024,
+			"urbackup" + os_file_sep() + FilesDbShards::getDatabaseName(i), FilesDbShards::getDatabaseId(i));
+		Server->createThread(wal_checkpoint_thread, "files" + convert(i) + " checkpoint");
+	}
+
 	wal_checkpoint_thread = new WalCheckpointThread(10 * 1024 * 1024, 100 * 1024 * 1024,
 		"urbackup" + os_file_sep() + "backup_server.db", URBACKUPDB_SERVER, "main");
 	Server->createThread(wal_checkpoint_thread, "main checkpoint");
@@ -499,6 +521,22 @@ DLLEXPORT void LoadActions(IServer* pServer)
 		{
 			rc = patch_hash();
 		}
+		else if (app == "bench_change_journal")
+		{
+			rc = bench_change_journal();
+		}
+		else if (app == "bench_memory_pipe")
+		{
+			rc = bench_memory_pipe();
+		}
+		else if (app == "bench")
+		{
+			rc = bench_hot_paths();
+		}
+		else if (app == "shard_files_db")
+		{
+			rc = shard_files_db();
+		}
 		else if (app == "hash")
 		{
 			std::auto_ptr<IFsFile> f(Server->openFile(Server->getServerParameter("hash_file"), MODE_READ_SEQUENTIAL));
@@ -619,9 +657,17 @@ DLLEXPORT void LoadActions(IServer* pServer)
 
 	
 	open_server_database(true);
+
+	if (FilesDbShards::isMigrationPending())
+	{
+		Server->Log("Changing the layout of the files database was interrupted. Please run the \"shard_files_db\" app again. Exiting.", LL_ERROR);
+		exit(1);
+	}
 	
 
 	ServerStatus::init_mutex();
+	BackupMetrics::init();
+	init_metrics_token();
 	ServerSettings::init_mutex();
 	ClientMain::init_mutex();
 	DataplanDb::init();
@@ -662,6 +708,10 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	dbs.push_back(URBACKUPDB_SERVER_FILES);
 	dbs.push_back(URBACKUPDB_SERVER_LINKS);
 	dbs.push_back(URBACKUPDB_SERVER_LINK_JOURNAL);
+	for (size_t i = 1; i < FilesDbShards::getNumDatabases(); ++i)
+	{
+		dbs.push_back(FilesDbShards::getDatabaseId(i));
+	}
 
 	for (size_t i = 0; i < dbs.size(); ++i)
 	{
@@ -692,6 +742,9 @@ DLLEXPORT void LoadActions(IServer* pServer)
 		exit(1);
 	}
 
+	IncrementalStats::init();
+	FilesDbWriter::init();
+
 	{
 		IScopedLock lock(startup_status.mutex);
 		startup_status.upgrading_database=false;
@@ -783,6 +836,7 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	ADD_ACTION(start_backup);
 	ADD_ACTION(add_client);
 	ADD_ACTION(restore_prepare_wait);
+	ADD_ACTION(metrics);
 
 	if(Server->getServerParameter("allow_shutdown")=="true")
 	{
@@ -855,6 +909,8 @@ DLLEXPORT void LoadActions(IServer* pServer)
 	}
 
 	Server->createThread(new ImageMount, "image umount");
+	Server->createThread(new IncrementalStats, "stats accounting");
+	FilesDbWriter::start();
 
 	Server->setLogCircularBufferSize(20);
 
@@ -929,11 +985,17 @@ DLLEXPORT void UnloadActions(void)
 		ClientMain::destroy_mutex();
 	}
 
+	FilesDbWriter::stop();
+
 	std::vector<DATABASE_ID> db_ids;
 	db_ids.push_back(URBACKUPDB_SERVER);
 	db_ids.push_back(URBACKUPDB_SERVER_FILES);
 	db_ids.push_back(URBACKUPDB_SERVER_LINKS);
 	db_ids.push_back(URBACKUPDB_SERVER_LINK_JOURNAL);
+	for (size_t i = 1; i < FilesDbShards::getNumDatabases(); ++i)
+	{
+		db_ids.push_back(FilesDbShards::getDatabaseId(i));
+	}
 
 	if (!shutdown_ok)
 	{
@@ -1526,7 +1588,7 @@ bool upgrade35_36()
 		return false;
 	}
 
-	if(!db->Write("CREATE TABLE files_incoming_stat (id INTEGER PRIMARY KEY, filesize INTEGER, clientid INTEGER, backupid INTEGER, existing_clients TEXT, direction INTEGER, incremental INTEGER)"))
+	if(!db->Write("CREATE TABLE files_incoming_stat (id INTEGER PRIMARY KEY AUTOINCREMENT, filesize INTEGER, clientid INTEGER, backupid INTEGER, existing_clients TEXT, direction INTEGER, incremental INTEGER)"))
 	{
 		return false;
 	}
@@ -1732,7 +1794,7 @@ bool upgrade44_45()
 		}
 	}
 
-	if (!db->Write("CREATE TABLE files_db.files_incoming_stat (id INTEGER PRIMARY KEY, filesize INTEGER, clientid INTEGER, backupid INTEGER, existing_clients TEXT, direction INTEGER, incremental INTEGER)"))
+	if (!db->Write("CREATE TABLE files_db.files_incoming_stat (id INTEGER PRIMARY KEY AUTOINCREMENT, filesize INTEGER, clientid INTEGER, backupid INTEGER, existing_clients TEXT, direction INTEGER, incremental INTEGER)"))
 	{
 		return false;
 	}
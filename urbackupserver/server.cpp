@@ -36,12 +36,13 @@
 #include <memory.h>
 #include <algorithm>
 #include "ThrottleUpdater.h"
+#include "HierarchicalThrottler.h"
 #include "../fsimageplugin/IFSImageFactory.h"
 
 const int max_offline=5;
 
-IPipeThrottler *BackupServer::global_internet_throttler=NULL;
-IPipeThrottler *BackupServer::global_local_throttler=NULL;
+HierarchicalThrottler *BackupServer::global_internet_throttler=NULL;
+HierarchicalThrottler *BackupServer::global_local_throttler=NULL;
 IMutex *BackupServer::throttle_mutex=NULL;
 bool BackupServer::file_snapshots_enabled=false;
 bool BackupServer::image_snapshots_enabled = false;
@@ -628,7 +629,7 @@ size_t BackupServer::throttleSpeedToBps(int speed_bps, bool & percent_max)
 	return bps;
 }
 
-IPipeThrottler *BackupServer::getGlobalInternetThrottler(int speed_bps)
+HierarchicalThrottler *BackupServer::getGlobalInternetThrottler(int speed_bps)
 {
 	IScopedLock lock(throttle_mutex);
 
@@ -641,8 +642,8 @@ IPipeThrottler *BackupServer::getGlobalInternetThrottler(int speed_bps)
 
 	if(global_internet_throttler==NULL)
 	{
-		global_internet_throttler=Server->createPipeThrottler(
-			new ThrottleUpdater(-1, ThrottleScope_GlobalInternet));
+		global_internet_throttler=new HierarchicalThrottler("global internet",
+			new ThrottleUpdater(-1, ThrottleScope_GlobalInternet), NULL, 0);
 	}
 	else
 	{
@@ -654,7 +655,7 @@ IPipeThrottler *BackupServer::getGlobalInternetThrottler(int speed_bps)
 	return global_internet_throttler;
 }
 
-IPipeThrottler *BackupServer::getGlobalLocalThrottler(int speed_bps)
+HierarchicalThrottler *BackupServer::getGlobalLocalThrottler(int speed_bps)
 {
 	IScopedLock lock(throttle_mutex);
 
@@ -667,8 +668,8 @@ IPipeThrottler *BackupServer::getGlobalLocalThrottler(int speed_bps)
 
 	if(global_local_throttler==NULL)
 	{
-		global_local_throttler=Server->createPipeThrottler(
-			new ThrottleUpdater(-1, ThrottleScope_GlobalLocal));
+		global_local_throttler=new HierarchicalThrottler("global local",
+			new ThrottleUpdater(-1, ThrottleScope_GlobalLocal), NULL, 0);
 	}
 	else
 	{
@@ -680,6 +681,12 @@ IPipeThrottler *BackupServer::getGlobalLocalThrottler(int speed_bps)
 	return global_local_throttler;
 }
 
+HierarchicalThrottler *BackupServer::getGlobalThrottler(bool internet)
+{
+	IScopedLock lock(throttle_mutex);
+	return internet ? global_internet_throttler : global_local_throttler;
+}
+
 void BackupServer::cleanupThrottlers(void)
 {
 	if(global_internet_throttler!=NULL)
@@ -8,6 +8,7 @@
 #include "../urbackupcommon/fileclient/FileClient.h"
 
 class IPipeThrottler;
+class HierarchicalThrottler;
 class IMutex;
 class IDatabase;
 
@@ -29,8 +30,9 @@ public:
 	void operator()(void);
 
 	static size_t throttleSpeedToBps(int speed_bps, bool& percent_max);
-	static IPipeThrottler *getGlobalInternetThrottler(int speed_bps);
-	static IPipeThrottler *getGlobalLocalThrottler(int speed_bps);
+	static HierarchicalThrottler *getGlobalInternetThrottler(int speed_bps);
+	static HierarchicalThrottler *getGlobalLocalThrottler(int speed_bps);
+	static HierarchicalThrottler *getGlobalThrottler(bool internet);
 
 	static void cleanupThrottlers(void);
 
@@ -86,8 +88,8 @@ private:
 
 	IPipe *exitpipe;
 
-	static IPipeThrottler *global_internet_throttler;
-	static IPipeThrottler *global_local_throttler;
+	static HierarchicalThrottler *global_internet_throttler;
+	static HierarchicalThrottler *global_local_throttler;
 	static IMutex *throttle_mutex;
 
 	bool internet_only_mode;
@@ -40,6 +40,8 @@
 #include "restore_client.h"
 #include "serverinterface/backups.h"
 #include "dao/ServerBackupDao.h"
+#include "ImageRestoreReader.h"
+#include "../urbackupcommon/image_restore_frame.h"
 
 const unsigned short serviceport=35623;
 extern IFSImageFactory *image_fak;
@@ -195,7 +197,7 @@ void ServerChannelThread::operator()(void)
 					input=np;
 				}
 				curr_ident = client_main->getIdentity();
-				tcpstack.Send(input, curr_ident +"1CHANNEL capa="+convert(constructCapabilities())+"&token="+server_token+"&restore_version=1&virtual_client="+EscapeParamString(virtual_client));
+				tcpstack.Send(input, curr_ident +"1CHANNEL capa="+convert(constructCapabilities())+"&token="+server_token+"&restore_version=2&virtual_client="+EscapeParamString(virtual_client));
 
 				lasttime=Server->getTimeMS();
 				lastpingtime=lasttime;
@@ -985,6 +987,17 @@ void ServerChannelThread::DOWNLOAD_IMAGE(str_map& params)
 			_i64 imgsize = (_i64)vhdfile->getSize() - skip;
 			_i64 r=little_endian(imgsize);
 			input->Write((char*)&r, sizeof(_i64));
+
+			if (params["extents"] == "1")
+			{
+				bool is_ok = sendImageExtents(vhdfile, skip, imgsize, offset, params["with_used_bytes"] == "1",
+					params["compress"] == "1", restore_process.getStatusId());
+				backup_dao.setRestoreDone(is_ok ? 1 : 0, restore_id);
+				image_fak->destroyVHDFile(vhdfile);
+				db->destroyAllQueries();
+				return;
+			}
+
 			unsigned int blocksize=vhdfile->getBlocksize();
 			char buffer[4096];
 			size_t read;
@@ -1118,6 +1131,117 @@ void ServerChannelThread::DOWNLOAD_IMAGE(str_map& params)
 	db->destroyAllQueries();
 }
 
+bool ServerChannelThread::sendImageExtents(IVHDFile* vhdfile, int skip, _i64 imgsize, uint64 offset, bool with_used_bytes, bool compress, size_t status_id)
+{
+	ImageRestoreReader reader(vhdfile, skip, imgsize, compress);
+
+	int64 used_bytes;
+	int64 used_transferred_bytes;
+	reader.enumerateExtents(static_cast<int64>(offset), used_bytes, used_transferred_bytes);
+
+	if (with_used_bytes)
+	{
+		_i64 r = little_endian(used_bytes);
+		input->Write((char*)&r, sizeof(_i64));
+	}
+
+	ServerStatus::setProcessPcDone(clientname, status_id, 0);
+	int pcdone = 0;
+
+	THREADPOOL_TICKET reader_ticket = Server->getThreadPool()->execute(&reader, "image restore read");
+
+	int64 last_update_time = Server->getTimeMS();
+	lasttime = Server->getTimeMS();
+
+	bool is_ok = true;
+	bool finished = false;
+	while (is_ok && !finished)
+	{
+		bool timeout;
+		ImageRestoreReader::SFrame* frame = reader.getFrame(1000, timeout);
+
+		SImageRestoreFrame header;
+		if (frame != NULL)
+		{
+			header.pos = little_endian(frame->pos);
+			header.size = little_endian(frame->size);
+			header.comp_size = little_endian(frame->comp_size);
+		}
+		else if (timeout)
+		{
+			if (Server->getTimeMS() - lasttime <= 30000)
+			{
+				continue;
+			}
+			header.pos = little_endian(static_cast<int64>(0));
+			header.size = 0;
+			header.comp_size = 0;
+		}
+		else if (reader.hasError())
+		{
+			is_ok = false;
+			break;
+		}
+		else
+		{
+			header.pos = little_endian(c_image_restore_end);
+			header.size = 0;
+			header.comp_size = 0;
+			finished = true;
+		}
+
+		bool b = input->Write((char*)&header, sizeof(header), 60000, frame == NULL);
+		if (b && frame != NULL)
+		{
+			_u32 data_size = frame->comp_size != 0 ? frame->comp_size : frame->size;
+			b = input->Write(frame->data.data(), data_size, 60000, false);
+			used_transferred_bytes += frame->size;
+		}
+
+		if (frame != NULL)
+		{
+			reader.releaseFrame(frame);
+		}
+
+		if (!b)
+		{
+			Server->Log("Writing to output pipe failed processMsg-3", LL_ERROR);
+			Server->destroy(input);
+			input = NULL;
+			is_ok = false;
+			break;
+		}
+
+		lasttime = Server->getTimeMS();
+
+		if (Server->getTimeMS() - last_update_time>60000)
+		{
+			last_update_time = Server->getTimeMS();
+			ServerStatus::updateActive();
+
+			if (used_bytes > 0)
+			{
+				int pcdone_new = static_cast<int>((used_transferred_bytes * 100) / used_bytes);
+				if (pcdone_new != pcdone)
+				{
+					pcdone = pcdone_new;
+					ServerStatus::setProcessPcDone(clientname, status_id, pcdone);
+				}
+			}
+		}
+	}
+
+	reader.stop();
+	Server->getThreadPool()->waitFor(reader_ticket);
+
+	if (!is_ok && input != NULL)
+	{
+		input->Flush();
+	}
+
+	return is_ok;
+}
+
 void ServerChannelThread::DOWNLOAD_FILES( str_map& params )
 {
 	int backupid=watoi(params["backupid"])-img_id_offset;
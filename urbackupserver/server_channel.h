@@ -6,6 +6,7 @@
 
 class ClientMain;
 class IDatabase;
+class IVHDFile;
 
 class ServerSettings;
 namespace {
@@ -48,6 +49,7 @@ private:
 	void GET_FILE_BACKUPS_TOKENS(str_map& params);
 	void GET_FILE_LIST_TOKENS(str_map& params);
 	void DOWNLOAD_IMAGE(str_map& params);
+	bool sendImageExtents(IVHDFile* vhdfile, int skip, _i64 imgsize, uint64 offset, bool with_used_bytes, bool compress, size_t status_id);
 	void DOWNLOAD_FILES(str_map& params);
 	void DOWNLOAD_FILES_TOKENS(str_map& params);
 	void RESTORE_PERCENT( str_map params );
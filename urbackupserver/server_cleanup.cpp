@@ -36,8 +36,10 @@
 #include "apps/cleanup_cmd.h"
 #include "dao/ServerCleanupDao.h"
 #include "dao/ServerLinkDao.h"
+#include "DirLinkIndex.h"
 #include "dao/ServerFilesDao.h"
 #include "server_dir_links.h"
+#include "ParallelTreeDelete.h"
 #include <stdio.h>
 #include <algorithm>
 #include "create_files_index.h"
@@ -45,6 +47,9 @@
 #include "copy_storage.h"
 #include <assert.h>
 #include <set>
+#include "../fsimageplugin/IFSImageFactory.h"
+
+extern IFSImageFactory *image_fak;
 
 IMutex *ServerCleanupThread::mutex=NULL;
 ICondition *ServerCleanupThread::cond=NULL;
@@ -95,7 +100,7 @@ void ServerCleanupThread::operator()(void)
 	{
 		cleanupdao.reset(new ServerCleanupDao(db));
 		backupdao.reset(new ServerBackupDao(db));
-		filesdao.reset(new ServerFilesDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES)));
+		files_daos.reset(new FilesDaos);
 		fileindex.reset(create_lmdb_files_index());
 
 		switch(cleanup_action.action)
@@ -135,7 +140,7 @@ void ServerCleanupThread::operator()(void)
 		
 		cleanupdao.reset();
 		backupdao.reset();
-		filesdao.reset();
+		files_daos.reset();
 		fileindex.reset();
 
 		Server->destroyDatabases(Server->getThreadID());
@@ -192,7 +197,7 @@ void ServerCleanupThread::operator()(void)
 
 			cleanupdao.reset(new ServerCleanupDao(db));
 			backupdao.reset(new ServerBackupDao(db));
-			filesdao.reset(new ServerFilesDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES)));
+			files_daos.reset(new FilesDaos);
 			fileindex.reset(create_lmdb_files_index());
 
 			{
@@ -205,7 +210,7 @@ void ServerCleanupThread::operator()(void)
 			
 			cleanupdao.reset();
 			backupdao.reset();
-			filesdao.reset();
+			files_daos.reset();
 			fileindex.reset();
 
 
@@ -330,7 +335,7 @@ void ServerCleanupThread::operator()(void)
 
 				cleanupdao.reset(new ServerCleanupDao(db));
 				backupdao.reset(new ServerBackupDao(db));
-				filesdao.reset(new ServerFilesDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES)));
+				files_daos.reset(new FilesDaos);
 				fileindex.reset(create_lmdb_files_index());
 
 				{
@@ -345,7 +350,7 @@ void ServerCleanupThread::operator()(void)
 
 				cleanupdao.reset();
 				backupdao.reset();
-				filesdao.reset();
+				files_daos.reset();
 				fileindex.reset();
 
 				{
@@ -540,7 +545,7 @@ void ServerCleanupThread::do_remove_unknown(void)
 			{
 				Server->Log("Path for file backup [id="+convert(res_file_backups[j].id)+" path="+res_file_backups[j].path+" clientname="+clientname+"] does not exist. Deleting it from the database.", LL_WARNING);
 
-				removeFileBackupSql(backupid);
+				removeFileBackupSql(clientid, backupid);
 
 			}
 		}
@@ -623,7 +628,7 @@ void ServerCleanupThread::do_remove_unknown(void)
 					{
 						std::string extension = findextension(image_files[l].name);
 
-						if (extension != "vhd" && extension != "vhdz" && extension != "raw")
+						if (extension != "vhd" && extension != "vhdz" && extension != "raw" && extension != "cas")
 							continue;
 
 						found_image = true;
@@ -649,6 +654,10 @@ void ServerCleanupThread::do_remove_unknown(void)
 							}
 							else
 							{
+								if (extension == "cas" && image_fak != NULL)
+								{
+									image_fak->releaseChunkStoreFile(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name + os_file_sep() + image_files[l].name));
+								}
 								os_remove_nonempty_dir(os_file_prefix(backupfolder + os_file_sep() + clientname + os_file_sep() + cf.name));
 							}
 						}
@@ -723,30 +732,40 @@ void ServerCleanupThread::do_remove_unknown(void)
 	IDatabaseCursor* cur = q_backup_ids->Cursor();
 	db_single_result res;
 
-	IDatabase* files_db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
-
-	files_db->Write("CREATE TEMPORARY TABLE backups (id INTEGER PRIMARY KEY)");
-
-	IQuery* q_insert = files_db->Prepare("INSERT INTO backups (id) VALUES (?)", false);
-
-	bool ok = true;
+	std::vector<std::string> backup_ids;
 	while (cur->next(res))
 	{
-		q_insert->Bind(res["id"]);
-		ok &= q_insert->Write();
-		q_insert->Reset();
+		backup_ids.push_back(res["id"]);
 	}
 
 	db->destroyQuery(q_backup_ids);
-	files_db->destroyQuery(q_insert);
 
-	if (ok)
+	for (size_t i = 0; i < FilesDbShards::getNumDatabases(); ++i)
 	{
-		filesdao->removeDanglingFiles();
-		Server->Log("Deleted " + convert(files_db->getLastChanges()) + " file entries", LL_INFO);
-	}
+		IDatabase* files_db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(i));
+
+		files_db->Write("CREATE TEMPORARY TABLE backups (id INTEGER PRIMARY KEY)");
 
-	files_db->Write("DROP TABLE backups");
+		IQuery* q_insert = files_db->Prepare("INSERT INTO backups (id) VALUES (?)", false);
+
+		bool ok = true;
+		for (size_t j = 0; j < backup_ids.size(); ++j)
+		{
+			q_insert->Bind(backup_ids[j]);
+			ok &= q_insert->Write();
+			q_insert->Reset();
+		}
+
+		files_db->destroyQuery(q_insert);
+
+		if (ok)
+		{
+			files_daos->getDao(i).removeDanglingFiles();
+			Server->Log("Deleted " + convert(files_db->getLastChanges()) + " file entries", LL_INFO);
+		}
+
+		files_db->Write("DROP TABLE backups");
+	}
 
 	FileIndex::flush();
 }
@@ -801,6 +820,15 @@ bool ServerCleanupThread::deleteImage(logid_t logid, std::string clientname, std
 	if (image_extension != "raw")
 	{
 		bool b = true;
+		if (image_extension == "cas"
+			&& os_get_file_type(os_file_prefix(path)) & EFileType_File)
+		{
+			if (image_fak==NULL
+				|| !image_fak->releaseChunkStoreFile(os_file_prefix(path)))
+			{
+				ServerLogger::Log(logid, "Releasing chunks of image " + path + " failed. Some chunks may not be freed.", LL_WARNING);
+			}
+		}
 		if (!deleteAndTruncateFile(logid, path))
 		{
 			b = false;
@@ -1477,8 +1505,10 @@ bool ServerCleanupThread::deleteFileBackup(const std::string &backupfolder, int
 	else
 	{
 		ServerLinkDao link_dao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_LINKS));
+		ServerSettings settings(db);
+		size_t delete_threads = static_cast<size_t>((std::max)(1, settings.getSettings()->cleanup_delete_threads));
 
-		b=remove_directory_link_dir(path, link_dao, clientid);
+		b=remove_directory_link_dir_parallel(path, link_dao, clientid, delete_threads, logid, &do_quit);
 	}
 
 	bool del=true;
@@ -1510,7 +1540,7 @@ bool ServerCleanupThread::deleteFileBackup(const std::string &backupfolder, int
 	}
 	if(del || force_remove)
 	{
-		removeFileBackupSql(backupid);
+		removeFileBackupSql(clientid, backupid);
 
 
 	}
@@ -1793,12 +1823,23 @@ bool ServerCleanupThread::backup_database(void)
 		copy_backup.push_back("backup_server_links.db");
 		copy_backup.push_back("backup_server_link_journal.db");
 
+		for (size_t i = 1; i < FilesDbShards::getNumDatabases(); ++i)
+		{
+			copy_backup_ids.push_back(FilesDbShards::getDatabaseId(i));
+			copy_backup.push_back(FilesDbShards::getDatabaseName(i));
+		}
+
 		copy_backup.push_back("backup_server.db-wal");
 		copy_backup.push_back("backup_server_settings.db-wal");
 		copy_backup.push_back("backup_server_files.db-wal");
 		copy_backup.push_back("backup_server_links.db-wal");
 		copy_backup.push_back("backup_server_link_journal.db-wal");
 
+		for (size_t i = 1; i < FilesDbShards::getNumDatabases(); ++i)
+		{
+			copy_backup.push_back(FilesDbShards::getDatabaseName(i) + "-wal");
+		}
+
 
 		bool integrity_ok = true;
 		{
@@ -2252,6 +2293,11 @@ void ServerCleanupThread::check_symlinks( const ServerCleanupDao::SClientInfo& c
 		link_dao.updateLinkReferenceTarget(target_adjustments[i].second, target_adjustments[i].first);
 	}
 
+	if(!del_ids.empty() || !target_adjustments.empty())
+	{
+		DirLinkIndex::invalidate(clientid);
+	}
+
 	if(os_directory_exists(pool_root))
 	{
 		std::vector<SFile> first_files = getFiles(pool_root, NULL);
@@ -2471,19 +2517,21 @@ void ServerCleanupThread::cleanup_other()
 	ServerLogger::Log(logid, "Done cleaning up client lists.", LL_INFO);
 }
 
-void ServerCleanupThread::removeFileBackupSql( int backupid )
+void ServerCleanupThread::removeFileBackupSql(int clientid, int backupid)
 {
-	DBScopedSynchronous synchronous_files(filesdao->getDatabase());
-	filesdao->BeginWriteTransaction();
+	ServerFilesDao& filesdao = files_daos->getClientDao(clientid);
+
+	DBScopedSynchronous synchronous_files(filesdao.getDatabase());
+	filesdao.BeginWriteTransaction();
 
 	BackupServerHash::SInMemCorrection correction;
 
-	ServerFilesDao::SBackupIdMinMax minmax = filesdao->getBackupIdMinMax(backupid);
+	ServerFilesDao::SBackupIdMinMax minmax = filesdao.getBackupIdMinMax(backupid);
 
 	correction.max_correct = minmax.tmax;
 	correction.min_correct = minmax.tmin;
 
-	IQuery* q_iterate = filesdao->getDatabase()->Prepare("SELECT id, shahash, filesize, rsize, clientid, backupid, incremental, next_entry, prev_entry, pointed_to FROM files WHERE backupid=?", false);
+	IQuery* q_iterate = filesdao.getDatabase()->Prepare("SELECT id, shahash, filesize, rsize, clientid, backupid, incremental, next_entry, prev_entry, pointed_to FROM files WHERE backupid=?", false);
 	q_iterate->Bind(backupid);
 	IDatabaseCursor* cursor = q_iterate->Cursor();
 
@@ -2547,37 +2595,37 @@ void ServerCleanupThread::removeFileBackupSql( int backupid )
 			modified_file_entry_index = true;
 		}
 
-		BackupServerHash::deleteFileSQL(*filesdao, *fileindex.get(), res["shahash"].c_str(),
+		BackupServerHash::deleteFileSQL(filesdao, *fileindex.get(), res["shahash"].c_str(),
 			filesize, rsize, clientid, backupid, incremental, id, prev_entry, next_entry, pointed_to, false, false, false, true, &correction);
 	}
-	filesdao->getDatabase()->destroyQuery(q_iterate);
+	filesdao.getDatabase()->destroyQuery(q_iterate);
 
 	for (std::map<int64, int64>::iterator it_next = correction.next_entries.begin();
 		 it_next != correction.next_entries.end(); ++it_next)
 	{
-		filesdao->setNextEntry(it_next->second, it_next->first);
+		filesdao.setNextEntry(it_next->second, it_next->first);
 	}
 
 	for (std::map<int64, int64>::iterator it_prev = correction.prev_entries.begin();
 		 it_prev != correction.prev_entries.end(); ++it_prev)
 	{
-		filesdao->setPrevEntry(it_prev->second, it_prev->first);
+		filesdao.setPrevEntry(it_prev->second, it_prev->first);
 	}
 
 	for (std::map<int64, int>::iterator it_pointed_to = correction.pointed_to.begin();
 		 it_pointed_to != correction.pointed_to.end(); ++it_pointed_to)
 	{
-		filesdao->setPointedTo(it_pointed_to->second, it_pointed_to->first);
+		filesdao.setPointedTo(it_pointed_to->second, it_pointed_to->first);
 	}
 
-	filesdao->deleteFiles(backupid);
+	filesdao.deleteFiles(backupid);
 
 	if (modified_file_entry_index)
 	{
 		FileIndex::flush();
 	}
 
-	filesdao->endTransaction();
+	filesdao.endTransaction();
 
 	cleanupdao->removeFileBackup(backupid);
 }
@@ -11,6 +11,7 @@
 #include <memory>
 #include <set>
 #include "FileIndex.h"
+#include "FilesDbShards.h"
 #include "server_log.h"
 
 class ServerSettings;
@@ -158,7 +159,7 @@ private:
 
 	bool deleteFileBackup(const std::string &backupfolder, int clientid, int backupid, bool force_remove=false);
 
-	void removeFileBackupSql( int backupid );
+	void removeFileBackupSql(int clientid, int backupid);
 
 	void deletePendingClients(void);
 
@@ -203,7 +204,7 @@ private:
 
 	std::auto_ptr<ServerCleanupDao> cleanupdao;
 	std::auto_ptr<ServerBackupDao> backupdao;
-	std::auto_ptr<ServerFilesDao> filesdao;
+	std::auto_ptr<FilesDaos> files_daos;
 	std::auto_ptr<FileIndex> fileindex;
 
 	logid_t logid;
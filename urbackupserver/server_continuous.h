@@ -20,6 +20,8 @@
 #include "dao/ServerFilesDao.h"
 #include "FileIndex.h"
 #include "create_files_index.h"
+#include "FilesDbShards.h"
+#include "ChangeJournal.h"
 
 extern std::string server_identity;
 extern std::string server_token;
@@ -39,30 +41,7 @@ public:
 		}
 	};
 
-	struct SChange
-	{
-		SChange()
-		{
-
-		}
-
-		SChange(char action, std::string fn1)
-			: action(action), fn1(fn1)
-		{
-
-		}
-
-		char action;
-		std::string fn1;
-		std::string fn2;
-
-		bool operator==(const SChange& other)
-		{
-			return action==other.action
-				&& fn1==other.fn1
-				&& fn2==other.fn2;
-		}
-	};
+	typedef ChangeJournal::SChange SChange;
 
 	BackupServerContinuous(ClientMain* client_main, const std::string& continuous_path, const std::string& continuous_hash_path, const std::string& continuous_path_backup,
 		const std::string& tmpfile_path, bool use_tmpfiles, int clientid, const std::string& clientname, int backupid, bool use_snapshots, bool use_reflink,
@@ -89,7 +68,7 @@ public:
 	{
 		server_settings.reset(new ServerSettings(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER)));
 		backupdao.reset(new ServerBackupDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER)));
-		filesdao.reset(new ServerFilesDao(Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES)));
+		filesdao.reset(new ServerFilesDao(Server->getDatabase(Server->getThreadID(), FilesDbShards::getClientDatabaseId(clientid))));
 		fileindex.reset(create_lmdb_files_index());
 
 		hashed_transfer_full = true;
@@ -150,9 +129,12 @@ public:
 
 			if(!compacted_changes.empty())
 			{
-				for(size_t i=0;i<compacted_changes.size();++i)
+				std::vector<SChange> replay_changes;
+				compacted_changes.getChanges(replay_changes);
+
+				for(size_t i=0;i<replay_changes.size();++i)
 				{
-					queueChange(compacted_changes[i]);
+					queueChange(replay_changes[i]);
 				}
 
 				while(!dl_queue.empty())
@@ -295,25 +277,25 @@ private:
 			switch(id)
 			{
 			case CHANGE_MOD:
-				addChangeCheck(change);
+				compacted_changes.addChangeCheck(change);
 				break;
 			case CHANGE_ADD_FILE:
-				addChange(change, CHANGE_DEL_FILE, CHANGE_MOD);
+				compacted_changes.addChange(change, CHANGE_DEL_FILE, CHANGE_MOD);
 				break;
 			case CHANGE_ADD_DIR:
-				addChange(change, CHANGE_DEL_DIR, CHANGE_NONE);
+				compacted_changes.addChange(change, CHANGE_DEL_DIR, CHANGE_NONE);
 				break;
 			case CHANGE_DEL_FILE:
-				delChange(change, CHANGE_ADD_FILE, CHANGE_MOD, CHANGE_REN_FILE);
+				compacted_changes.delChange(change, CHANGE_ADD_FILE, CHANGE_MOD, CHANGE_REN_FILE);
 				break;
 			case CHANGE_DEL_DIR:
-				delChange(change, CHANGE_DEL_FILE, CHANGE_NONE, CHANGE_REN_DIR);
+				compacted_changes.delChange(change, CHANGE_ADD_DIR, CHANGE_NONE, CHANGE_REN_DIR);
 				break;
 			case CHANGE_REN_FILE:
-				renChange(change, CHANGE_ADD_FILE, CHANGE_MOD, CHANGE_REN_FILE);
+				compacted_changes.renChange(change, CHANGE_ADD_FILE, CHANGE_MOD, CHANGE_REN_FILE);
 				break;
 			case CHANGE_REN_DIR:
-				renChange(change, CHANGE_ADD_DIR, CHANGE_NONE, CHANGE_REN_DIR);
+				compacted_changes.renChange(change, CHANGE_ADD_DIR, CHANGE_NONE, CHANGE_REN_DIR);
 				break;
 			}
 		}
@@ -321,156 +303,6 @@ private:
 		return true;
 	}
 
-	void addChangeCheck(const SChange& change)
-	{
-		std::vector<SChange>::iterator it=std::find(
-			compacted_changes.begin(), compacted_changes.end(), change);
-
-		if(it==compacted_changes.end())
-		{
-			compacted_changes.push_back(change);
-		}		
-	}
-
-	void addChange(SChange& change, char del_action, char mod_action)
-	{
-		for(size_t i=0;i<compacted_changes.size();)
-		{
-			if(compacted_changes[i].action==del_action 
-				&& compacted_changes[i].fn1==change.fn1)
-			{
-				compacted_changes.erase(compacted_changes.begin()+i);
-				if(mod_action != CHANGE_NONE)
-				{
-					change.action=mod_action;
-				}
-				break;
-			}
-			else
-			{
-				++i;
-			}
-		}
-		compacted_changes.push_back(change);
-	}
-
-	void delChange(SChange change, char add_action, char mod_action, char ren_action)
-	{
-		size_t sweeps=1;
-		bool add=true;
-		for(size_t l=0;l<sweeps;++l)
-		{
-			for(size_t i=0;i<compacted_changes.size();++i)
-			{
-				bool del=false;
-				if(compacted_changes[i].action==add_action
-					&& compacted_changes[i].fn1==change.fn1)
-				{
-					del=true;
-					add=false;
-				}
-				else if( mod_action!=CHANGE_NONE
-					&& compacted_changes[i].action==mod_action
-					&& compacted_changes[i].fn1==change.fn1)
-				{
-					del=true;
-				}
-				else if( compacted_changes[i].action==ren_action
-					&& compacted_changes[i].fn2==change.fn1)
-				{
-					bool do_del=true;
-					for(size_t j=0;j<compacted_changes.size();++j)
-					{
-						if(compacted_changes[j].action==add_action
-							&& compacted_changes[j].fn1==change.fn1)
-						{
-							do_del=false;
-							break;
-						}
-					}
-
-					if(do_del)
-					{
-						del=true;
-						change.fn1=compacted_changes[i].fn1;
-						sweeps=2;
-					}
-				}
-
-				if(del)
-				{
-					compacted_changes.erase(compacted_changes.begin()+i);
-				}
-				else
-				{
-					++i;
-				}
-			}
-		}
-		
-		if(add)
-		{
-			compacted_changes.push_back(change);
-		}
-	}
-
-	void renChange( SChange& change, char add_action, char mod_action, char ren_action )
-	{
-		bool add_mod=false;
-		bool add=true;
-		std::string other_fn1;
-		size_t sweeps=1;
-		for(size_t l=0;l<sweeps;++l)
-		{
-			for(size_t i=0;i<compacted_changes.size();++i)
-			{
-				bool del=false;
-				if(compacted_changes[i].action==ren_action
-					&& compacted_changes[i].fn2==change.fn1)
-				{
-					del=true;
-					other_fn1=change.fn1;
-					change.fn1=compacted_changes[i].fn1;
-					sweeps=2;
-				}
-				else if(compacted_changes[i].action==mod_action
-					&& (compacted_changes[i].fn1==change.fn1
-					|| (!other_fn1.empty() && compacted_changes[i].fn1==other_fn1) ) )
-				{
-					del=true;
-					add_mod=true;
-				}
-				else if(compacted_changes[i].action==add_action
-					&& compacted_changes[i].fn1==change.fn1)
-				{
-					add=false;
-					compacted_changes[i].fn1=change.fn2;
-				}
-
-				if(del)
-				{
-					compacted_changes.erase(compacted_changes.begin()+i);
-				}
-				else
-				{
-					++i;
-				}
-			}
-		}
-		
-
-		if(add)
-		{
-			compacted_changes.push_back(change);
-		}
-
-		if(add_mod)
-		{
-			SChange mod_change(CHANGE_MOD, change.fn2);
-			compacted_changes.push_back(mod_change);
-		}
-	}
-
 	bool checkHeaderAndUpdate(CRData& data, bool& skip)
 	{
 		unsigned int num_sequences;
@@ -907,7 +739,7 @@ private:
 
 	std::vector<std::string> changes;
 	std::vector<SSequence> sequences;
-	std::vector<SChange> compacted_changes;
+	ChangeJournal compacted_changes;
 
 	IMutex* mutex;
 	ICondition* cond;
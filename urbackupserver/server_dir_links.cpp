@@ -25,20 +25,61 @@
 #include "../Interface/Database.h"
 #include "../Interface/File.h"
 #include "database.h"
+#include "DirLinkIndex.h"
 
 namespace
 {
-	void reference_all_sublinks(ServerLinkDao& link_dao, int clientid, const std::string& target, const std::string& new_target)
+	void add_directory_link(ServerLinkDao& link_dao, int clientid, const std::string& name, const std::string& target)
+	{
+		link_dao.addDirectoryLink(clientid, name, target);
+		DirLinkIndex::addDirectoryLink(clientid, name, target);
+	}
+
+	void remove_directory_link_entry(ServerLinkDao& link_dao, int clientid, const std::string& target)
+	{
+		link_dao.removeDirectoryLink(clientid, target);
+		DirLinkIndex::removeDirectoryLink(clientid, target);
+	}
+
+	void remove_links_in_directory(ServerLinkDao& link_dao, int clientid, const std::string& dir)
+	{
+		link_dao.removeDirectoryLinkGlob(clientid, escape_glob_sql(dir)+os_file_sep()+"*");
+		DirLinkIndex::removeLinksInDirectory(clientid, dir);
+	}
+
+	std::vector<ServerLinkDao::DirectoryLinkEntry> get_links_in_directory(ServerLinkDao& link_dao, int clientid, const std::string& dir)
+	{
+		std::vector<ServerLinkDao::DirectoryLinkEntry> entries;
+		if(DirLinkIndex::getLinksInDirectory(link_dao.getDatabase(), clientid, dir, entries))
+		{
+			return entries;
+		}
+
+		return link_dao.getLinksInDirectory(clientid, escape_glob_sql(dir)+os_file_sep()+"*");
+	}
+
+	int get_directory_refcount(ServerLinkDao& link_dao, int clientid, const std::string& name)
 	{
-		std::string escaped_target = escape_glob_sql(target);
+		int refcount;
+		if(DirLinkIndex::getDirectoryRefcount(link_dao.getDatabase(), clientid, name, refcount)
+			&& refcount>0)
+		{
+			return refcount;
+		}
+
+		//The pool directory gets deleted if there are no references. Only trust the database for that
+		return link_dao.getDirectoryRefcount(clientid, name);
+	}
 
-		std::vector<ServerLinkDao::DirectoryLinkEntry> entries = link_dao.getLinksInDirectory(clientid, escaped_target+os_file_sep()+"*");
+	void reference_all_sublinks(ServerLinkDao& link_dao, int clientid, const std::string& target, const std::string& new_target)
+	{
+		std::vector<ServerLinkDao::DirectoryLinkEntry> entries = get_links_in_directory(link_dao, clientid, target);
 
 		for(size_t i=0;i<entries.size();++i)
 		{
 			std::string subpath = entries[i].target.substr(target.size());
 			std::string new_link_path = new_target + subpath;
-			link_dao.addDirectoryLink(clientid, entries[i].name, new_link_path);
+			add_directory_link(link_dao, clientid, entries[i].name, new_link_path);
 		}
 	}
 
@@ -135,7 +176,7 @@ bool link_directory_pool( int clientid, const std::string& target_dir, const std
 			return false;
 		}
 
-		link_dao->addDirectoryLink(clientid, pool_name, target_dir);
+		add_directory_link(*link_dao, clientid, pool_name, target_dir);
 		reference_all_sublinks(*link_dao, clientid, src_dir, target_dir);
 		refcount_bigger_one=true;
 	}
@@ -155,9 +196,9 @@ bool link_directory_pool( int clientid, const std::string& target_dir, const std
 			return false;
 		}
 
-		link_dao->addDirectoryLink(clientid, pool_name, src_dir);
+		add_directory_link(*link_dao, clientid, pool_name, src_dir);
 		reference_all_sublinks(*link_dao, clientid, src_dir, target_dir);
-		link_dao->addDirectoryLink(clientid, pool_name, target_dir);
+		add_directory_link(*link_dao, clientid, pool_name, target_dir);
 				
 
 		int64 replay_entry_id;
@@ -177,8 +218,8 @@ bool link_directory_pool( int clientid, const std::string& target_dir, const std
 			if(!transaction)
 			{
 				Server->Log("Error starting filesystem transaction", LL_ERROR);
-				link_dao->removeDirectoryLink(clientid, src_dir);
-				link_dao->removeDirectoryLink(clientid, target_dir);
+				remove_directory_link_entry(*link_dao, clientid, src_dir);
+				remove_directory_link_entry(*link_dao, clientid, target_dir);
 				return false;
 			}
 		}
@@ -187,8 +228,8 @@ bool link_directory_pool( int clientid, const std::string& target_dir, const std
 		{
 			Server->Log("Could not rename folder \""+src_dir+"\" to \""+link_src_dir+"\"", LL_ERROR);
 			os_finish_transaction(transaction);
-			link_dao->removeDirectoryLink(clientid, src_dir);
-			link_dao->removeDirectoryLink(clientid, target_dir);
+			remove_directory_link_entry(*link_dao, clientid, src_dir);
+			remove_directory_link_entry(*link_dao, clientid, target_dir);
 			
 			if (!with_transaction)
 			{
@@ -203,8 +244,8 @@ bool link_directory_pool( int clientid, const std::string& target_dir, const std
 			Server->Log("Could not create a symbolic link at \""+src_dir+"\" to \""+link_src_dir+"\"", LL_ERROR);
 			os_rename_file(link_src_dir, src_dir, transaction);
 			os_finish_transaction(transaction);
-			link_dao->removeDirectoryLink(clientid, src_dir);
-			link_dao->removeDirectoryLink(clientid, target_dir);
+			remove_directory_link_entry(*link_dao, clientid, src_dir);
+			remove_directory_link_entry(*link_dao, clientid, target_dir);
 
 			if (!with_transaction)
 			{
@@ -219,8 +260,8 @@ bool link_directory_pool( int clientid, const std::string& target_dir, const std
 			if(!os_finish_transaction(transaction))
 			{
 				Server->Log("Error finishing filesystem transaction", LL_ERROR);
-				link_dao->removeDirectoryLink(clientid, src_dir);
-				link_dao->removeDirectoryLink(clientid, target_dir);
+				remove_directory_link_entry(*link_dao, clientid, src_dir);
+				remove_directory_link_entry(*link_dao, clientid, target_dir);
 				return false;
 			}
 		}
@@ -240,11 +281,11 @@ bool link_directory_pool( int clientid, const std::string& target_dir, const std
 		Server->Log("Error creating symbolic link from \"" + link_src_dir +"\" to \"" +
 			target_dir+"\" -2", LL_ERROR);
 
-		link_dao->removeDirectoryLink(clientid, target_dir);
+		remove_directory_link_entry(*link_dao, clientid, target_dir);
 
 		if(refcount_bigger_one)
 		{
-			link_dao->removeDirectoryLinkGlob(clientid, escape_glob_sql(target_dir)+os_file_sep()+"*");
+			remove_links_in_directory(*link_dao, clientid, target_dir);
 		}
 
 		return false;
@@ -336,12 +377,12 @@ bool remove_directory_link(const std::string & path, ServerLinkDao & link_dao, i
 		link_dao.getDatabase()->BeginWriteTransaction();
 	}
 
-	link_dao.removeDirectoryLink(clientid, target_raw);
+	remove_directory_link_entry(link_dao, clientid, target_raw);
 
 	if (link_dao.getLastChanges()>0)
 	{
 		bool ret = true;
-		if (link_dao.getDirectoryRefcount(clientid, pool_name) == 0)
+		if (get_directory_refcount(link_dao, clientid, pool_name) == 0)
 		{
 			ret = remove_directory_link_dir(path, link_dao, clientid, false, false);
 			ret = ret && os_remove_dir(os_file_prefix(pool_path));
@@ -353,7 +394,7 @@ bool remove_directory_link(const std::string & path, ServerLinkDao & link_dao, i
 		}
 		else
 		{
-			link_dao.removeDirectoryLinkGlob(clientid, escape_glob_sql(target_raw) + os_file_sep() + "*");
+			remove_links_in_directory(link_dao, clientid, target_raw);
 		}
 	}
 	else
@@ -453,9 +494,11 @@ bool is_directory_link(const std::string & path)
 void init_dir_link_mutex()
 {
 	dir_link_mutex=Server->createMutex();
+	DirLinkIndex::init();
 }
 
 void destroy_dir_link_mutex()
 {
 	Server->destroy(dir_link_mutex);
+	DirLinkIndex::destroy();
 }
@@ -28,10 +28,14 @@
 #include "../stringtools.h"
 #include "server_log.h"
 #include "server_cleanup.h"
+#include "IncrementalStats.h"
+#include "FilesDbWriter.h"
+#include "FilesDbShards.h"
 #include "create_files_index.h"
 #include <algorithm>
 #include <memory.h>
 #include "../urbackupcommon/file_metadata.h"
+#include "BackupMetrics.h"
 #include <assert.h>
 #ifdef _WIN32
 #include <Windows.h>
@@ -54,8 +58,9 @@ void destroy_mutex1(void)
 
 BackupServerHash::BackupServerHash(IPipe *pPipe, int pClientid, bool use_snapshots, bool use_reflink, bool use_tmpfiles, logid_t logid,
 	bool snapshot_file_inplace)
-	: use_snapshots(use_snapshots), use_reflink(use_reflink), use_tmpfiles(use_tmpfiles), filesdao(NULL), old_backupfolders_loaded(false),
-	  logid(logid), snapshot_file_inplace(snapshot_file_inplace)
+	: use_snapshots(use_snapshots), use_reflink(use_reflink), use_tmpfiles(use_tmpfiles), filesdao(NULL), files_daos(NULL), old_backupfolders_loaded(false),
+	  logid(logid), snapshot_file_inplace(snapshot_file_inplace), async_file_entries(false), last_file_entry_ticket(0),
+	  index_file_entry_ticket(0)
 {
 	pipe=pPipe;
 	clientid=pClientid;
@@ -82,9 +87,10 @@ BackupServerHash::~BackupServerHash(void)
 
 void BackupServerHash::setupDatabase(void)
 {
-	db=Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
+	db=Server->getDatabase(Server->getThreadID(), FilesDbShards::getClientDatabaseId(clientid));
 
-	filesdao = new ServerFilesDao(db);
+	files_daos = new FilesDaos;
+	filesdao = &files_daos->getClientDao(clientid);
 
 	fileindex=create_lmdb_files_index(); 
 }
@@ -96,18 +102,26 @@ void BackupServerHash::deinitDatabase(void)
 	delete fileindex;
 	fileindex=NULL;
 
-	delete filesdao;
+	delete files_daos;
+	files_daos = NULL;
 	filesdao =NULL;
 }
 
 void BackupServerHash::operator()(void)
 {
 	setupDatabase();
+	async_file_entries=true;
 
+	//Outside of the loop, so the pipe can reuse the buffer
+	std::string data;
 	while(true)
 	{
+		if(pipe->getNumElements()==0)
+		{
+			waitForFileEntries(true);
+		}
+
 		working=false;
-		std::string data;
 		size_t rc=pipe->Read(&data, static_cast<int>(60000) );
 		if(rc==0)
 		{
@@ -119,6 +133,7 @@ void BackupServerHash::operator()(void)
 		working=true;
 		if(data=="exit")
 		{
+			waitForFileEntries(true);
 			deinitDatabase();
 			Server->Log("server_hash Thread finished - normal");
 			Server->destroyDatabases(Server->getThreadID());
@@ -269,20 +284,75 @@ void BackupServerHash::operator()(void)
 
 void BackupServerHash::addFileSQL(int backupid, int clientid, int incremental, const std::string &fp, const std::string &hash_path, const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex)
 {
-	addFileSQL(*filesdao, *fileindex, backupid, clientid, incremental, fp, hash_path, shahash, filesize, rsize, prev_entry, prev_entry_clientid, next_entry, update_fileindex);
+	FilesDbWriter::SFileEntry entry;
+	entry.backupid = backupid;
+	entry.clientid = clientid;
+	entry.incremental = incremental;
+	entry.fullpath = fp;
+	entry.hashpath = hash_path;
+	entry.shahash = shahash;
+	entry.filesize = filesize;
+	entry.rsize = rsize;
+	entry.prev_entry = prev_entry;
+	entry.prev_entry_clientid = prev_entry_clientid;
+	entry.next_entry = next_entry;
+	entry.update_fileindex = update_fileindex;
+
+	int64 ticket = FilesDbWriter::addFile(entry);
+
+	if(ticket==0)
+	{
+		ScopedBackupStage db_stage(logid, EBackupStage_DbCommit);
+		addFileSQL(*filesdao, *fileindex, backupid, clientid, incremental, fp, hash_path, shahash, filesize, rsize, prev_entry, prev_entry_clientid, next_entry, update_fileindex);
+		return;
+	}
+
+	if(!async_file_entries)
+	{
+		FilesDbWriter::waitFor(clientid, ticket);
+		return;
+	}
+
+	last_file_entry_ticket = ticket;
+
+	if(filesize>=link_file_min_size
+		&& (prev_entry_clientid!=clientid || prev_entry==0 || update_fileindex) )
+	{
+		//Entry will be added to the file entry index. Next lookup has to wait for it
+		index_file_entry_ticket = ticket;
+	}
 }
 
-void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int backupid, const int clientid, int incremental, const std::string &fp,
-	const std::string &hash_path, const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex)
+void BackupServerHash::waitForFileEntries(bool all)
+{
+	if(all)
+	{
+		if(last_file_entry_ticket!=0)
+		{
+			FilesDbWriter::waitFor(clientid, last_file_entry_ticket);
+		}
+		last_file_entry_ticket=0;
+		index_file_entry_ticket=0;
+	}
+	else if(index_file_entry_ticket!=0)
+	{
+		FilesDbWriter::waitFor(clientid, index_file_entry_ticket);
+		index_file_entry_ticket=0;
+	}
+}
+
+int64 BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int backupid, const int clientid, int incremental, const std::string &fp,
+	const std::string &hash_path, const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex,
+	bool put_fileindex)
 {
 	if (filesize < link_file_min_size)
 	{
 		assert(prev_entry_clientid == 0);
 		assert(prev_entry == 0);
 		assert(next_entry == 0);
-		filesdao.addIncomingFile(filesize, clientid, backupid, std::string(), ServerFilesDao::c_direction_incoming, incremental);
+		IncrementalStats::addIncomingFile(filesdao, filesize, clientid, backupid, std::string(), ServerFilesDao::c_direction_incoming, incremental);
 		filesdao.addFileEntryExternal(backupid, fp, hash_path, shahash, filesize, rsize, clientid, incremental, next_entry, prev_entry, 0);
-		return;
+		return 0;
 	}
 
 	bool new_for_client=false;
@@ -325,7 +395,7 @@ void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex
 		
 		if(prev_entry==0)
 		{
-			filesdao.addIncomingFile(filesize, clientid, backupid, clients, ServerFilesDao::c_direction_incoming, incremental);
+			IncrementalStats::addIncomingFile(filesdao, filesize, clientid, backupid, clients, ServerFilesDao::c_direction_incoming, incremental);
 		}
 		else
 		{
@@ -345,6 +415,23 @@ void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex
 			}
 		}
 	}
+	else
+	{
+		//Entries may be queued (FilesDbWriter) and the previous entry
+		//may have got a new next entry since the caller looked it up
+		ServerFilesDao::SFindFileEntry fentry = filesdao.getFileEntry(prev_entry);
+
+		if(fentry.exists)
+		{
+			next_entry = fentry.next_entry;
+		}
+		else
+		{
+			prev_entry=0;
+			next_entry=0;
+			update_fileindex=true;
+		}
+	}
 
 	if(update_fileindex)
 	{
@@ -376,8 +463,14 @@ void BackupServerHash::addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex
 		FILEENTRY_DEBUG(Server->Log("New fileindex entry for \"" + fp + "\""
 			" id=" + convert(entryid)
 			+" hash="+base64_encode(reinterpret_cast<const unsigned char*>(shahash.c_str()), bytes_in_index), LL_DEBUG));
-		fileindex.put_delayed(FileIndex::SIndexKey(shahash.c_str(), filesize, clientid), entryid);
+		if(put_fileindex)
+		{
+			fileindex.put_delayed(FileIndex::SIndexKey(shahash.c_str(), filesize, clientid), entryid);
+		}
+		return entryid;
 	}
+
+	return 0;
 }
 
 void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int64 id)
@@ -411,7 +504,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 					+ " has pointed_to!=0 but should be zero. The file entry index may be damaged.", LL_WARNING));
 			}
 
-			filesdao.addIncomingFile(filesize, clientid, backupid, convert(clientid),
+			IncrementalStats::addIncomingFile(filesdao, filesize, clientid, backupid, convert(clientid),
 				with_backupstat ? ServerFilesDao::c_direction_outgoing : ServerFilesDao::c_direction_outgoing_nobackupstat,
 				incremental);
 
@@ -489,7 +582,7 @@ void BackupServerHash::deleteFileSQL(ServerFilesDao& filesdao, FileIndex& filein
 		}
 		
 
-		filesdao.addIncomingFile(filesize, clientid, backupid, clients,
+		IncrementalStats::addIncomingFile(filesdao, filesize, clientid, backupid, clients,
 			with_backupstat? ServerFilesDao::c_direction_outgoing : ServerFilesDao::c_direction_outgoing_nobackupstat,
 			incremental);
 
@@ -604,6 +697,8 @@ bool BackupServerHash::findFileAndLink(const std::string &tfn, IFile *tf, std::s
 	bool first_logmsg=true;
 	bool copy=true;
 
+	waitForFileEntries(false);
+
 	SFindState find_state;
 	ServerFilesDao::SFindFileEntry existing_file = findFileHash(sha2, t_filesize, clientid, find_state);
 
@@ -630,6 +725,7 @@ bool BackupServerHash::findFileAndLink(const std::string &tfn, IFile *tf, std::s
 		}
 		if (!b)
 		{
+			ScopedBackupStage link_stage(logid, EBackupStage_LinkCopy);
 			b = os_create_hardlink(os_file_prefix(tfn), os_file_prefix(existing_file.fullpath), use_snapshots, &too_many_hardlinks);
 		}
 		if(!b)
@@ -662,7 +758,10 @@ bool BackupServerHash::findFileAndLink(const std::string &tfn, IFile *tf, std::s
 					}
 					first_logmsg=false;
 
-					deleteFileSQL(*filesdao, *fileindex, sha2.c_str(), t_filesize, existing_file.rsize, existing_file.clientid, existing_file.backupid, existing_file.incremental,
+					//Queued entries of other backups may be linked to this entry
+					FilesDbWriter::flush();
+
+					deleteFileSQL(files_daos->getEntryDao(existing_file.id), *fileindex, sha2.c_str(), t_filesize, existing_file.rsize, existing_file.clientid, existing_file.backupid, existing_file.incremental,
 						existing_file.id, existing_file.prev_entry, existing_file.next_entry, existing_file.pointed_to, true, true, detach_dbs, false, NULL);
 
 					existing_file = findFileHash(sha2, t_filesize, clientid, find_state);
@@ -722,7 +821,7 @@ bool BackupServerHash::findFileAndLink(const std::string &tfn, IFile *tf, std::s
 								Server->Log("Error opening hash source file \""+existing_file.hashpath+"\". " + os_last_error_str(), LL_ERROR);
 							}
 
-							if (write_metadata && !write_file_metadata(hash_fn, this, metadata, false))
+							if (write_metadata && !writeFileMetadata(hash_fn, metadata))
 							{
 								ServerLogger::Log(logid, "Error writing file metadata -2", LL_ERROR);
 								has_error = true;
@@ -821,7 +920,7 @@ bool BackupServerHash::findFileAndLink(const std::string &tfn, IFile *tf, std::s
 				}
 			}
 
-			if(write_metadata && !write_file_metadata(hash_fn, this, metadata, false))
+			if(write_metadata && !writeFileMetadata(hash_fn, metadata))
 			{
 				ServerLogger::Log(logid, "Error writing file metadata -1", LL_ERROR);
 				has_error=true;
@@ -948,6 +1047,7 @@ void BackupServerHash::addFile(int backupid, int incremental, IFile *tf, const s
 			}
 			else
 			{
+				ScopedBackupStage copy_stage(logid, EBackupStage_LinkCopy, t_filesize);
 				bool r;
 				if(hashoutput_fn.empty())
 				{
@@ -994,6 +1094,8 @@ void BackupServerHash::addFile(int backupid, int incremental, IFile *tf, const s
 				{
 					r=patchFile(tf, orig_fn, tfn, hashoutput_fn, hash_fn, t_filesize, extent_iterator);
 				}
+
+				copy_stage.stop();
 				
 				if(!r)
 				{
@@ -1018,7 +1120,7 @@ void BackupServerHash::addFile(int backupid, int incremental, IFile *tf, const s
 						metadata.rsize=cow_filesize;
 					}
 
-					if(!write_file_metadata(hash_fn, this, metadata, false))
+					if(!writeFileMetadata(hash_fn, metadata))
 					{
 						ServerLogger::Log(logid, "Writing metadata to "+hash_fn+" failed", LL_ERROR);
 						has_error=true;
@@ -1064,6 +1166,8 @@ bool BackupServerHash::freeSpace(int64 fs, const std::string &fp)
 
 ServerFilesDao::SFindFileEntry BackupServerHash::findFileHash(const std::string &pHash, _i64 filesize, int clientid, SFindState& state)
 {
+	ScopedBackupStage dedup_stage(logid, EBackupStage_DedupLookup);
+
 	int64 entryid;
 	
 	bool save_orig=false;
@@ -1173,7 +1277,7 @@ ServerFilesDao::SFindFileEntry BackupServerHash::findFileHash(const std::string
 		return ret;
 	}
 
-	state.prev = filesdao->getFileEntry(entryid);
+	state.prev = files_daos->getEntryDao(entryid).getFileEntry(entryid);
 
 	if(!state.prev.exists)
 	{
@@ -1787,6 +1891,12 @@ bool BackupServerHash::renameFile(IFile *tf, const std::string &dest)
 	return true;
 }
 
+bool BackupServerHash::writeFileMetadata(const std::string& hash_fn, const FileMetadata& metadata)
+{
+	ScopedBackupStage metadata_stage(logid, EBackupStage_Metadata);
+	return write_file_metadata(hash_fn, this, metadata, false);
+}
+
 bool BackupServerHash::correctPath( std::string& ff, std::string& f_hashpath )
 {
 	if(!old_backupfolders_loaded)
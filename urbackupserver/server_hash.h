@@ -17,6 +17,7 @@
 #include "../urbackupcommon/ExtentIterator.h"
 
 class FileMetadata;
+class FilesDaos;
 
 const int64 link_file_min_size = 2048;
 
@@ -70,9 +71,13 @@ public:
 	void addFileSQL(int backupid, int clientid, int incremental, const std::string &fp, const std::string &hash_path,
 		const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid, int64 next_entry, bool update_fileindex);
 
-	static void addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int backupid, int clientid, int incremental, const std::string &fp,
+	/**
+	* Returns the id of the new entry if it has to be added to the file entry
+	* index (zero otherwise). It is added by this function if put_fileindex is true.
+	*/
+	static int64 addFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int backupid, int clientid, int incremental, const std::string &fp,
 		const std::string &hash_path, const std::string &shahash, _i64 filesize, _i64 rsize, int64 prev_entry, int64 prev_entry_clientid,
-		int64 next_entry, bool update_fileindex);
+		int64 next_entry, bool update_fileindex, bool put_fileindex=true);
 		
 		
 	static void deleteFileSQL(ServerFilesDao& filesdao, FileIndex& fileindex, int64 id);
@@ -128,13 +133,18 @@ private:
 	bool renameFileWithHashoutput(IFile *tf, const std::string &dest, const std::string hash_dest, ExtentIterator* extent_iterator);
 	bool renameFile(IFile *tf, const std::string &dest);
 
+	bool writeFileMetadata(const std::string& hash_fn, const FileMetadata& metadata);
+
 	bool correctPath(std::string& ff, std::string& f_hashpath);
 
+	void waitForFileEntries(bool all);
+
 	bool punchHoleOrZero(IFile *tf, int64 offset, int64 size);
 
 	std::map<std::pair<std::string, _i64>, std::vector<STmpFile> > files_tmp;
 
 	ServerFilesDao* filesdao;
+	FilesDaos* files_daos;
 
 	IPipe *pipe;
 
@@ -172,4 +182,8 @@ private:
 	bool enabled_sparse;
 
 	bool snapshot_file_inplace;
+
+	bool async_file_entries;
+	int64 last_file_entry_ticket;
+	int64 index_file_entry_ticket;
 };
\ No newline at end of file
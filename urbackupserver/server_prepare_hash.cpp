@@ -30,6 +30,7 @@
 #include <memory.h>
 #include "../common/adler32.h"
 #include "../urbackupcommon/file_metadata.h"
+#include "BackupMetrics.h"
 
 namespace
 {
@@ -69,10 +70,11 @@ BackupServerPrepareHash::~BackupServerPrepareHash(void)
 
 void BackupServerPrepareHash::operator()(void)
 {
+	//Outside of the loop, so the pipe can reuse the buffer
+	std::string data;
 	while(true)
 	{
 		working=false;
-		std::string data;
 		size_t rc=pipe->Read(&data);
 		if(data=="exit")
 		{
@@ -175,6 +177,7 @@ void BackupServerPrepareHash::operator()(void)
 				}
 
 				ServerLogger::Log(logid, "PT: Hashing file \""+ExtractFileName(tfn)+"\"", LL_DEBUG);
+				ScopedBackupStage hash_stage(logid, EBackupStage_Hash, tf->Size());
 				std::string h;
 				if(!diff_file)
 				{
@@ -224,6 +227,8 @@ void BackupServerPrepareHash::operator()(void)
 					}
 				}
 
+				hash_stage.stop();
+
 				if (h.empty())
 				{
 					ServerLogger::Log(logid, "Error while hashing file \"" + tf->getFilename() + "\" (destination: \""+ tfn+"\"). Failing backup.", LL_ERROR);
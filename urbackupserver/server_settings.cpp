@@ -389,6 +389,7 @@ void ServerSettings::readSettingsDefault(ISettingsReader* settings_default,
 	settings->local_image_transfer_mode=settings_default->getValue("local_image_transfer_mode", "hashed");
 	settings->internet_image_transfer_mode=settings_default->getValue("internet_image_transfer_mode", "raw");
 	settings->update_stats_cachesize=static_cast<size_t>(settings_global->getValue("update_stats_cachesize", 200*1024));
+	settings->cleanup_delete_threads=settings_global->getValue("cleanup_delete_threads", 8);
 	settings->global_soft_fs_quota= settings_global->getValue("global_soft_fs_quota", "95%");
 	settings->client_quota=settings_default->getValue("client_quota", "");
 	settings->end_to_end_file_backup_verification=(settings_default->getValue("end_to_end_file_backup_verification", "false")=="true");
@@ -401,6 +402,8 @@ void ServerSettings::readSettingsDefault(ISettingsReader* settings_default,
 	settings->verify_using_client_hashes=(settings_default->getValue("verify_using_client_hashes", "false")=="true");
 	settings->internet_readd_file_entries=(settings_default->getValue("internet_readd_file_entries", "true")=="true");
 	settings->max_running_jobs_per_client=atoi(settings_default->getValue("max_running_jobs_per_client", "1").c_str());
+	settings->local_file_download_connections=atoi(settings_default->getValue("local_file_download_connections", "1").c_str());
+	settings->throttle_weight=atoi(settings_default->getValue("throttle_weight", "1").c_str());
 	settings->create_linked_user_views=(settings_default->getValue("create_linked_user_views", "false")=="true");
 	settings->background_backups=(settings_default->getValue("background_backups", "true")=="true");
 	settings->local_incr_image_style=settings_default->getValue("local_incr_image_style", incr_image_style_to_full);
@@ -568,6 +571,8 @@ void ServerSettings::readSettingsClient(ISettingsReader* settings_client)
 	readBoolClientSetting(settings_client, "internet_readd_file_entries", &settings->internet_readd_file_entries);
 	readBoolClientSetting(settings_client, "background_backups", &settings->background_backups);
 	readIntClientSetting(settings_client, "max_running_jobs_per_client", &settings->max_running_jobs_per_client);
+	readIntClientSetting(settings_client, "local_file_download_connections", &settings->local_file_download_connections);
+	readIntClientSetting(settings_client, "throttle_weight", &settings->throttle_weight);
 	readBoolClientSetting(settings_client, "create_linked_user_views", &settings->create_linked_user_views);
 
 	readStringClientSetting(settings_client, "local_incr_image_style", &settings->local_incr_image_style);
@@ -12,6 +12,7 @@ namespace
 	const char* image_file_format_vhd = "vhd";
 	const char* image_file_format_vhdz = "vhdz";
 	const char* image_file_format_cowraw = "cowraw";
+	const char* image_file_format_chunkstore = "chunkstore";
 
 	const char* full_image_style_full = "full";
 	const char* full_image_style_synthetic = "synthetic";
@@ -99,6 +100,7 @@ struct SSettings
 	std::string local_image_transfer_mode;
 	std::string internet_image_transfer_mode;
 	size_t update_stats_cachesize;
+	int cleanup_delete_threads;
 	std::string global_soft_fs_quota;
 	std::string client_quota;
 	bool end_to_end_file_backup_verification;
@@ -113,6 +115,8 @@ struct SSettings
 	bool internet_readd_file_entries;
 	std::string client_access_key;
 	int max_running_jobs_per_client;
+	int local_file_download_connections;
+	int throttle_weight;
 	bool background_backups;
 	bool create_linked_user_views;
 	std::string local_incr_image_style;
@@ -22,6 +22,7 @@
 #include "../Interface/Server.h"
 #include "../Interface/Pipe.h"
 #include "action_header.h"
+#include "BackupMetrics.h"
 #include <time.h>
 #include <algorithm>
 #include <assert.h>
@@ -264,6 +265,10 @@ bool ServerStatus::stopProcess( const std::string &clientname, size_t id )
 
 	if(it!=s->processes.end())
 	{
+		if(it->logid!=logid_t())
+		{
+			BackupMetrics::removeProcess(it->logid);
+		}
 		s->processes.erase(it);
 		return true;
 	}
@@ -30,6 +30,7 @@
 #include "../Interface/DatabaseCursor.h"
 #include "create_files_index.h"
 #include "dao/ServerFilesDao.h"
+#include "FilesDbShards.h"
 #include <algorithm>
 
 ServerUpdateStats::ServerUpdateStats(bool image_repair_mode, bool interruptible)
@@ -41,13 +42,6 @@ void ServerUpdateStats::createQueries(void)
 {
 	q_get_images=db->Prepare("SELECT id,clientid,path FROM backup_images WHERE complete=1 AND running<datetime('now','-300 seconds')", false);
 	q_update_images_size=db->Prepare("UPDATE clients SET bytes_used_images=? WHERE id=?", false);
-	q_get_sizes=db->Prepare("SELECT id, bytes_used_files FROM clients", false);
-	q_size_update=db->Prepare("UPDATE clients SET bytes_used_files=? WHERE id=?", false);
-	q_update_backups=db->Prepare("UPDATE backups SET size_bytes=? WHERE id=?", false);
-	q_get_backup_size=db->Prepare("SELECT size_bytes FROM backups WHERE id=?", false);
-	q_get_del_size=db->Prepare("SELECT delsize FROM del_stats WHERE backupid=? AND image=0 AND created>datetime('now','-4 days')", false);
-	q_add_del_size=db->Prepare("INSERT INTO del_stats (backupid, image, delsize, clientid, incremental, stoptime) VALUES (?, 0, ?, ?, ?, CURRENT_TIMESTAMP)", false);
-	q_update_del_size=db->Prepare("UPDATE del_stats SET delsize=?,stoptime=CURRENT_TIMESTAMP WHERE backupid=? AND image=0 AND created>datetime('now','-4 days')", false);
 	q_save_client_hist=db->Prepare("INSERT INTO clients_hist (id, name, lastbackup, lastseen, lastbackup_image, bytes_used_files, bytes_used_images, hist_id) SELECT id, name, lastbackup, lastseen, lastbackup_image, bytes_used_files, bytes_used_images, ? AS hist_id FROM clients", false);
 	q_set_file_backup_null=db->Prepare("UPDATE backups SET size_bytes=0 WHERE size_bytes=-1 AND complete=1", false);
 	q_create_hist=db->Prepare("INSERT INTO clients_hist_id (created) VALUES (CURRENT_TIMESTAMP)", false);
@@ -58,13 +52,6 @@ void ServerUpdateStats::destroyQueries(void)
 {
 	db->destroyQuery(q_get_images);
 	db->destroyQuery(q_update_images_size);
-	db->destroyQuery(q_get_sizes);
-	db->destroyQuery(q_size_update);
-	db->destroyQuery(q_update_backups);
-	db->destroyQuery(q_get_backup_size);
-	db->destroyQuery(q_get_del_size);
-	db->destroyQuery(q_add_del_size);
-	db->destroyQuery(q_update_del_size);
 	db->destroyQuery(q_save_client_hist);
 	db->destroyQuery(q_set_file_backup_null);
 	db->destroyQuery(q_create_hist);
@@ -98,6 +85,8 @@ void ServerUpdateStats::operator()(void)
 
 	if(!image_repair_mode)
 	{
+		IncrementalStats::flush();
+
 		q_create_hist->Write();
 		q_create_hist->Reset();
 
@@ -210,24 +199,89 @@ void ServerUpdateStats::measureSpeed(void)
 void ServerUpdateStats::update_files(void)
 {
 	num_updated_files=0;
-	
-	Server->Log("Updating file statistics...");
 
-	IDatabase* files_db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
-	ServerFilesDao filesdao(files_db);
+	std::vector<int64> max_ids;
+	bool has_unaccounted=false;
+	for(size_t i=0;i<FilesDbShards::getNumDatabases();++i)
+	{
+		max_ids.push_back(IncrementalStats::getUnaccountedMaxId(i));
+		if(max_ids[i]!=0)
+		{
+			has_unaccounted=true;
+		}
+	}
+
+	if(!has_unaccounted)
+	{
+		return;
+	}
 	
-	size_t total_num = static_cast<size_t>(filesdao.getIncomingStatsCount().value);
-	size_t total_i=0;
+	Server->Log("Updating file statistics...");
 
-	std::map<int, _i64> size_data_clients=getFilebackupSizesClients();
-	std::map<int, _i64> size_data_backups;
-	std::map<int, SDelInfo> del_sizes;
+	IncrementalStats::SDeltas deltas;
 
 	DBScopedSynchronous synchonous_db(db);
-	DBScopedSynchronous synchonous_files_db(files_db);
 
-	DBScopedWriteTransaction files_db_transaction(NULL);
-	bool started_transaction = false;
+	std::vector<IDatabase*> files_dbs;
+	std::vector<DBScopedSynchronous*> synchronous_files_dbs;
+	std::vector<bool> started_transactions;
+
+	bool interrupted=false;
+	for(size_t i=0;i<max_ids.size() && !interrupted;++i)
+	{
+		if(max_ids[i]==0)
+		{
+			continue;
+		}
+
+		IDatabase* files_db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(i));
+		files_dbs.push_back(files_db);
+		synchronous_files_dbs.push_back(new DBScopedSynchronous(files_db));
+		started_transactions.push_back(false);
+
+		bool started_transaction=false;
+		interrupted = !update_files(files_db, max_ids[i], deltas, started_transaction);
+		started_transactions[started_transactions.size()-1]=started_transaction;
+	}
+
+	if(!interrupted)
+	{
+		DBScopedWriteTransaction db_transaction(db);
+
+		IncrementalStats::applyDeltas(db, deltas);
+
+		db->Write("UPDATE backups SET size_calculated=1 WHERE size_calculated=0 AND done=1");
+	}
+
+	for(size_t i=0;i<files_dbs.size();++i)
+	{
+		if(started_transactions[i])
+		{
+			if(interrupted)
+			{
+				files_dbs[i]->RollbackTransaction();
+			}
+			else
+			{
+				files_dbs[i]->EndTransaction();
+			}
+		}
+
+		delete synchronous_files_dbs[i];
+	}
+
+	if(!interrupted)
+	{
+		IncrementalStats::setUnaccountedDone();
+	}
+}
+
+bool ServerUpdateStats::update_files(IDatabase* files_db, int64 max_id, IncrementalStats::SDeltas& deltas, bool& started_transaction)
+{
+	ServerFilesDao filesdao(files_db);
+	
+	size_t total_num = static_cast<size_t>(filesdao.getIncomingStatsCount(max_id).value);
+	size_t total_i=0;
 	
 	std::vector<ServerFilesDao::SIncomingStat> stat_entries;
 
@@ -238,18 +292,17 @@ void ServerUpdateStats::update_files(void)
 		{
 			if( ClientMain::getNumberOfRunningFileBackups()>0 )
 			{
-				files_db_transaction.rollback();
-				return;
+				return false;
 			}
 		}
 
 		ServerStatus::updateActive();
 
-		stat_entries = filesdao.getIncomingStats();
+		stat_entries = filesdao.getIncomingStats(max_id);
 
 		if(!started_transaction && !stat_entries.empty())
 		{
-			files_db_transaction.reset(files_db);
+			files_db->BeginWriteTransaction();
 			started_transaction = true;
 		}
 
@@ -270,198 +323,15 @@ void ServerUpdateStats::update_files(void)
 
 			ServerFilesDao::SIncomingStat& entry = stat_entries[i];
 
-			std::vector<int> clients;
-			std::vector<std::string> s_clients;
-			Tokenize(entry.existing_clients, s_clients, ",");
-			clients.resize(s_clients.size());
-			for(size_t j=0;j<s_clients.size();++j)
-			{
-				clients[j]=watoi(s_clients[j]);
-			}
-
-			
-			if(entry.direction== ServerFilesDao::c_direction_incoming)
-			{
-				int64 current_size_per_client = 0; 
-				if(!clients.empty())
-				{
-					current_size_per_client=entry.filesize/clients.size();
-
-					add(clients, -current_size_per_client, size_data_clients);
-				}			
-
-				clients.push_back(entry.clientid);
-				current_size_per_client = entry.filesize/clients.size();
-				
-				add(clients, current_size_per_client, size_data_clients);
-
-				add(size_data_backups, entry.backupid, entry.filesize);
-			}
-			else if(entry.direction== ServerFilesDao::c_direction_outgoing ||
-				entry.direction== ServerFilesDao::c_direction_outgoing_nobackupstat)
-			{
-				int64 current_size_per_client = entry.filesize;
-				
-				if(!clients.empty())
-				{
-					current_size_per_client/=clients.size();
-				}
-
-				add(clients, -current_size_per_client, size_data_clients);
-
-				std::vector<int>::iterator it_client = std::find(clients.begin(), clients.end(), entry.clientid);
-				if(it_client!=clients.end())
-				{
-					clients.erase(it_client);
-				}
-
-				if(!clients.empty())
-				{
-					current_size_per_client = entry.filesize/clients.size();
-
-					add(clients, current_size_per_client, size_data_clients);
-				}				
-
-				if(entry.direction!= ServerFilesDao::c_direction_outgoing_nobackupstat)
-				{
-					add_del(del_sizes, entry.backupid, entry.filesize, entry.clientid, entry.incremental);
-				}
-			}
-			else
-			{
-				Server->Log("Unknown direction in ServerUpdateStats::update_files " + convert((int)entry.direction), LL_ERROR);
-				assert(false);
-			}
+			IncrementalStats::addEntry(deltas, entry.filesize, entry.clientid, entry.backupid,
+				entry.existing_clients, entry.direction, entry.incremental);
 
 			filesdao.delIncomingStatEntry(entry.id);
 		}
 	}
 	while(!stat_entries.empty());
 
-
-	DBScopedWriteTransaction db_transaction(db);
-
-	updateSizes(size_data_clients);
-	updateDels(del_sizes);
-	updateBackups(size_data_backups);
-
-	db->Write("UPDATE backups SET size_calculated=1 WHERE size_calculated=0 AND done=1");
-}
-
-std::map<int, _i64> ServerUpdateStats::getFilebackupSizesClients(void)
-{
-	std::map<int, _i64> ret;
-	db_results res=q_get_sizes->Read();
-	q_get_sizes->Reset();
-	for(size_t i=0;i<res.size();++i)
-	{
-		ret.insert(std::pair<int, _i64>(watoi(res[i]["id"]), os_atoi64(res[i]["bytes_used_files"])));
-	}
-	return ret;
-}
-
-void ServerUpdateStats::updateSizes(std::map<int, _i64> & size_data)
-{
-	for(std::map<int, _i64>::iterator it=size_data.begin();it!=size_data.end();++it)
-	{
-		q_size_update->Bind(it->second);
-		q_size_update->Bind(it->first);
-		q_size_update->Write();
-		q_size_update->Reset();
-	}
-}
-
-void ServerUpdateStats::add(const std::vector<int>& subset, int64 num, std::map<int, _i64> &data)
-{
-	for(size_t i=0;i<subset.size();++i)
-	{
-		data[subset[i]]+=num;
-	}
-}
-
-void ServerUpdateStats::add(std::map<int, _i64> &data, int backupid, _i64 filesize)
-{
-	std::map<int, _i64>::iterator it=data.find(backupid);
-	if(it==data.end())
-	{
-		q_get_backup_size->Bind(backupid);
-		db_results res=q_get_backup_size->Read();
-		q_get_backup_size->Reset();
-		if(!res.empty())
-		{
-			_i64 b_fs=os_atoi64(res[0]["size_bytes"]);
-			if(b_fs!=-1)
-			{
-				filesize+=b_fs;
-			}
-		}
-		data.insert(std::pair<int, _i64>(backupid, filesize));
-	}
-	else
-	{
-		it->second+=filesize;
-	}
-}
-
-void ServerUpdateStats::updateBackups(std::map<int, _i64> &data)
-{
-	for(std::map<int, _i64>::iterator it=data.begin();it!=data.end();++it)
-	{
-		q_update_backups->Bind(it->second);
-		q_update_backups->Bind(it->first);
-		q_update_backups->Write();
-		q_update_backups->Reset();
-	}
-}
-
-void ServerUpdateStats::add_del(std::map<int, SDelInfo> &data, int backupid, _i64 filesize, int clientid, int incremental)
-{
-	std::map<int, SDelInfo>::iterator it=data.find(backupid);
-	if(it==data.end())
-	{
-		q_get_del_size->Bind(backupid);
-		db_results res=q_get_del_size->Read();
-		q_get_del_size->Reset();
-		if(!res.empty())
-		{
-			filesize+=os_atoi64(res[0]["delsize"]);
-		}
-		SDelInfo di;
-		di.delsize=filesize;
-		di.clientid=clientid;
-		di.incremental=incremental;
-		data.insert(std::pair<int, SDelInfo>(backupid, di));
-	}
-	else
-	{
-		it->second.delsize+=filesize;
-	}
-}
-
-void ServerUpdateStats::updateDels(std::map<int, SDelInfo> &data)
-{
-	for(std::map<int, SDelInfo>::iterator it=data.begin();it!=data.end();++it)
-	{
-		q_get_del_size->Bind(it->first);
-		db_results res=q_get_del_size->Read();
-		q_get_del_size->Reset();
-		if(res.empty())
-		{
-			q_add_del_size->Bind(it->first);
-			q_add_del_size->Bind(it->second.delsize);
-			q_add_del_size->Bind(it->second.clientid);
-			q_add_del_size->Bind(it->second.incremental);
-			q_add_del_size->Write();
-			q_add_del_size->Reset();
-		}
-		else
-		{
-			q_update_del_size->Bind(it->second.delsize);
-			q_update_del_size->Bind(it->first);
-			q_update_del_size->Write();
-			q_update_del_size->Reset();
-		}
-	}
+	return true;
 }
 
 bool ServerUpdateStats::repairImagePath(str_map img)
@@ -2,19 +2,13 @@
 #include "../Interface/Thread.h"
 #include "dao/ServerBackupDao.h"
 #include "FileIndex.h"
+#include "IncrementalStats.h"
 #include <memory>
 
 class IQuery;
 class IDatabase;
 class ServerSettings;
 
-struct SDelInfo
-{
-	_i64 delsize;
-	int clientid;
-	int incremental;
-};
-
 class ServerUpdateStats : public IThread
 {
 public:
@@ -27,19 +21,12 @@ public:
 private:
 
 	void update_files(void);
+	bool update_files(IDatabase* files_db, int64 max_id, IncrementalStats::SDeltas& deltas, bool& started_transaction);
 	void update_images(void);
 
 	void createQueries(void);
 	void destroyQueries(void);
 
-	std::map<int, _i64> getFilebackupSizesClients(void);
-	void add(const std::vector<int>& subset, int64 num, std::map<int, _i64> &data);
-	void updateSizes(std::map<int, _i64> & size_data);
-	void add(std::map<int, _i64> &data, int backupid, _i64 filesize);
-	void add_del(std::map<int, SDelInfo> &data, int backupid, _i64 filesize, int clientid, int incremental);
-	void updateBackups(std::map<int, _i64> &data);
-	void updateDels(std::map<int, SDelInfo> &data);
-
 	bool repairImagePath(str_map img);
 
 	void measureSpeed(void);
@@ -49,13 +36,6 @@ private:
 
 	IQuery *q_get_images;
 	IQuery *q_update_images_size;
-    IQuery *q_get_sizes;
-	IQuery *q_size_update;
-	IQuery *q_update_backups;
-	IQuery *q_get_backup_size;
-	IQuery *q_get_del_size;
-	IQuery *q_add_del_size;
-	IQuery *q_update_del_size;
 	IQuery *q_save_client_hist;
 	IQuery *q_set_file_backup_null;
 	IQuery *q_create_hist;
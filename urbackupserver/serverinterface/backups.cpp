@@ -943,7 +943,7 @@ namespace backupaccess
 			std::string filename = ExtractFileName(path);
 			std::string extension = findextension(filename);
 
-			if (extension == "vhd" || extension == "vhdz")
+			if (extension == "vhd" || extension == "vhdz" || extension == "cas")
 			{
 				std::auto_ptr<IVHDFile> vhdfile(image_fak->createVHDFile(path, true, 0));
 				if (vhdfile.get() != NULL)
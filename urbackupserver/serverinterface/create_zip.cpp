@@ -24,67 +24,12 @@
 #include "backups.h"
 #include <memory>
 #include "../../common/data.h"
-
-#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
-#include "../../common/miniz.h"
-#ifndef _WIN32
-#define _fdopen fdopen
-#define _close close
-#include <unistd.h>
-#else
-#include <io.h>
-#include <fcntl.h>
-#endif
+#include "../ZipStreamWriter.h"
 
 namespace
 {
 
-struct MiniZFileInfo
-{
-	uint64 file_offset;
-	int64 last_writetime;
-	THREAD_ID tid;
-};
-
-size_t my_mz_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
-{
-  MiniZFileInfo* fileInfo = reinterpret_cast<MiniZFileInfo*>(pOpaque);
-  if(fileInfo->file_offset!=file_ofs)
-  {
-	  Server->Log("Streaming ZIP file failed at file offset " + convert(file_ofs) + " bufsize " + convert(n)+
-		  " stream offset "+convert(fileInfo->file_offset), LL_ERROR);
-	  return 0;
-  }
-
-  fileInfo->file_offset=file_ofs+n;
-  
-  bool b=Server->WriteRaw(fileInfo->tid, reinterpret_cast<const char*>(pBuf), n, false);
-
-  if(b)
-	fileInfo->last_writetime = Server->getTimeMS();
-
-  return b?n:0;
-}
-
-mz_bool my_mz_needs_keepalive(void *pOpaque)
-{
-	MiniZFileInfo* fileInfo = reinterpret_cast<MiniZFileInfo*>(pOpaque);
-	return (Server->getTimeMS() - fileInfo->last_writetime > 1000) ? 1 : 0;
-}
-
-bool my_miniz_init(mz_zip_archive *pZip, MiniZFileInfo* fileInfo)
-{
-	pZip->m_pWrite = my_mz_write_func;
-	pZip->m_pIO_opaque = fileInfo;
-	pZip->m_pNeeds_keepalive = my_mz_needs_keepalive;
-
-	if (!mz_zip_writer_init_v2(pZip, 0, MZ_ZIP_FLAG_CASE_SENSITIVE))
-		return false;
-  
-	return true;
-}
-
-bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername, const std::string& folderbase, const std::string& foldername, const std::string& start_foldername,
+bool add_dir(ZipStreamWriter& zip, const std::string& archivefoldername, const std::string& folderbase, const std::string& foldername, const std::string& start_foldername,
 	    const std::string& hashfolderbase, const std::string& hashfoldername, const std::string& filter,
 		bool token_authentication, const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_special)
 {
@@ -262,72 +207,34 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 		//TODO: ZIP has extensions for NTFS/Unix/MacOS attributes, symbolic links, NTFS ACL, ... use them
 
-		std::string os_err;
+		std::string extra_local(extra_data_local.getDataPtr(), extra_data_local.getDataSize());
+		std::string extra_central(extra_data_central.getDataPtr(), extra_data_central.getDataSize());
 
-		mz_bool rc;
 		if(file.isdir)
 		{
-			rc = mz_zip_writer_add_mem_ex_v2(&zip_archive, (archivename + "/").c_str(), NULL, 0, NULL, 0,
-											MZ_DEFAULT_LEVEL|MZ_ZIP_FLAG_UTF8_FILENAME,
-											0, 0, last_modified, extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
-											extra_data_central.getDataPtr(), extra_data_central.getDataSize());
-
-			if (rc == MZ_FALSE)
+			if (!zip.addDirectory(archivename + "/", last_modified, extra_local, extra_central))
 			{
-				os_err = os_last_error_str();
+				Server->Log("Error while adding directory \"" + filename + "\" to ZIP file", LL_ERROR);
+				return false;
 			}
 		}
 		else
-		{	
+		{
 			std::auto_ptr<IFsFile> add_file(Server->openFile(os_file_prefix(filename), MODE_READ_SEQUENTIAL_BACKUP));
 			if (add_file.get() == NULL)
 			{
 				Server->Log("Error opening file \"" + filename + "\" for ZIP file download. " + os_last_error_str(), LL_ERROR);
 				return false;
 			}
-			int64 fsize = add_file->Size();
-#ifndef _WIN32
-			int fd = add_file->getOsHandle(true);
-#else
-			int fd =_open_osfhandle(reinterpret_cast<intptr_t>(add_file->getOsHandle(true)), _O_RDONLY);
-			if (fd == -1)
-			{
-				Server->Log("Error opening file fd for \"" + filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
-				return false;
-			}
-#endif
-			add_file.reset();
 
-			FILE* file = _fdopen(fd, "r");
-			if (file != NULL)
+			if (!zip.addFile(archivename, add_file.release(), last_modified, extra_local, extra_central,
+				!ZipStreamWriter::isCompressedType(file.name)))
 			{
-				rc = mz_zip_writer_add_cfile(&zip_archive, archivename.c_str(), file, fsize, last_modified, NULL, 0,
-					MZ_DEFAULT_LEVEL|MZ_ZIP_FLAG_UTF8_FILENAME,
-					extra_data_local.getDataPtr(), extra_data_local.getDataSize(),
-					extra_data_central.getDataPtr(), extra_data_central.getDataSize());
-
-				if (rc == MZ_FALSE)
-				{
-					os_err = os_last_error_str();
-				}
-
-				fclose(file);
-			}
-			else
-			{
-				Server->Log("Error opening FILE handle for \"" + filename + "\" for ZIP file download." + os_last_error_str(), LL_ERROR);
-				_close(fd);
+				Server->Log("Error while adding file \"" + filename + "\" to ZIP file", LL_ERROR);
 				return false;
 			}
 		}
 
-		if(rc==MZ_FALSE)
-		{
-			mz_zip_error err = mz_zip_get_last_error(&zip_archive);
-			Server->Log("Error while adding file \""+filename+"\" to ZIP file. Error: "+mz_zip_get_error_string(err)+ (os_err.empty() ? "" : (". OS error: "+os_err)), LL_ERROR);
-			return false;
-		}
-
 		if(file.isdir)
 		{
 			
@@ -348,7 +255,7 @@ bool add_dir(mz_zip_archive& zip_archive, const std::string& archivefoldername,
 
 			if (!symlink_loop && symlink_outside)
 			{
-				if (!add_dir(zip_archive, archivename, folderbase, filename, start_foldername, hashfolderbase, next_hashfoldername, filter,
+				if (!add_dir(zip, archivename, folderbase, filename, start_foldername, hashfolderbase, next_hashfoldername, filter,
 								token_authentication, backup_tokens, tokens, false))
 				{
 					return false;
@@ -373,38 +280,26 @@ bool create_zip_to_output(const std::string& folderbase, const std::string& fold
 	const std::string& hashfoldername, const std::string& filter, bool token_authentication,
 	const std::vector<backupaccess::SToken> &backup_tokens, const std::vector<std::string> &tokens, bool skip_hashes)
 {
-	mz_zip_archive zip_archive;
-	memset(&zip_archive, 0, sizeof(zip_archive));
-
-	MiniZFileInfo file_info = {};
-
-	file_info.tid=Server->getThreadID();
-	file_info.last_writetime = Server->getTimeMS();
-
-	if(!my_miniz_init(&zip_archive, &file_info))
+	int n_threads = watoi(Server->getServerParameter("zip_download_threads", "4"));
+	if (n_threads <= 0)
 	{
-		Server->Log("Error while initializing ZIP archive", LL_ERROR);
-		return false;
+		n_threads = 1;
 	}
 
-	if(!add_dir(zip_archive, "", folderbase, foldername, foldername, hashfolderbase,
+	ZipStreamWriter zip(Server->getThreadID(), n_threads);
+
+	if(!add_dir(zip, "", folderbase, foldername, foldername, hashfolderbase,
 		hashfoldername, filter, token_authentication, backup_tokens, tokens, skip_hashes))
 	{
 		Server->Log("Error while adding files and folders to ZIP archive", LL_ERROR);
 		return false;
 	}
 
-	if(!mz_zip_writer_finalize_archive(&zip_archive))
+	if(!zip.finish())
 	{
 		Server->Log("Error while finalizing ZIP archive", LL_ERROR);
 		return false;
 	}
 
-	if(!mz_zip_writer_end(&zip_archive))
-	{
-		Server->Log("Error while ending ZIP archive writer", LL_ERROR);
-		return false;
-	}
-
 	return true;
 }
\ No newline at end of file
@@ -0,0 +1,281 @@
+/*************************************************************************
+*    UrBackup - Client/Server backup system
+*    Copyright (C) 2011-2016 Martin Raiber
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU Affero General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU Affero General Public License for more details.
+*
+*    You should have received a copy of the GNU Affero General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef CLIENT_ONLY
+
+#include "action_header.h"
+#include "../server_status.h"
+#include "../BackupMetrics.h"
+#include "../server.h"
+#include "../HierarchicalThrottler.h"
+#include "../../Interface/SettingsReader.h"
+
+namespace
+{
+	std::string prom_escape(const std::string& val)
+	{
+		std::string ret;
+		ret.reserve(val.size());
+		for (size_t i = 0; i < val.size(); ++i)
+		{
+			if (val[i] == '\\' || val[i] == '"')
+			{
+				ret += '\\';
+				ret += val[i];
+			}
+			else if (val[i] == '\n')
+			{
+				ret += "\\n";
+			}
+			else
+			{
+				ret += val[i];
+			}
+		}
+		return ret;
+	}
+
+	std::string prom_seconds(int64 us)
+	{
+		//Exact to the microsecond, also for large sums
+		std::string frac = convert(us % 1000000);
+		return convert(us / 1000000) + "." + std::string(6 - frac.size(), '0') + frac;
+	}
+
+	class PromFamilies
+	{
+	public:
+		void add(const std::string& name, const std::string& type, const std::string& help)
+		{
+			SFamily family;
+			family.name = name;
+			family.type = type;
+			family.help = help;
+			families.push_back(family);
+		}
+
+		void sample(const std::string& name, const std::string& labels, const std::string& val)
+		{
+			for (size_t i = 0; i < families.size(); ++i)
+			{
+				if (name.compare(0, families[i].name.size(), families[i].name) == 0)
+				{
+					families[i].samples += name + "{" + labels + "} " + val + "\n";
+					return;
+				}
+			}
+		}
+
+		std::string str()
+		{
+			std::string ret;
+			for (size_t i = 0; i < families.size(); ++i)
+			{
+				ret += "# HELP " + families[i].name + " " + families[i].help + "\n";
+				ret += "# TYPE " + families[i].name + " " + families[i].type + "\n";
+				ret += families[i].samples;
+			}
+			return ret;
+		}
+
+	private:
+		struct SFamily
+		{
+			std::string name;
+			std::string type;
+			std::string help;
+			std::string samples;
+		};
+
+		std::vector<SFamily> families;
+	};
+
+	void add_stage_families(PromFamilies& families, const std::string& prefix, const std::string& subject)
+	{
+		families.add(prefix + "_duration_seconds", "histogram", "Duration of backup pipeline stage operations of " + subject);
+		families.add(prefix + "_items_total", "counter", "Number of files or database entries processed by backup pipeline stages of " + subject);
+		families.add(prefix + "_bytes_total", "counter", "Number of bytes processed by backup pipeline stages of " + subject);
+	}
+
+	void stage_samples(PromFamilies& families, const std::string& prefix, const std::string& labels, const SBackupMetrics& metrics)
+	{
+		for (int s = 0; s < EBackupStage_Count; ++s)
+		{
+			const SStageMetrics& stage = metrics.stages[s];
+			std::string stage_labels = labels + "stage=\"" + BackupMetrics::stageName(static_cast<EBackupStage>(s)) + "\"";
+
+			int64 cumulative = 0;
+			for (size_t i = 0; i < backup_metrics_nbuckets; ++i)
+			{
+				cumulative += stage.buckets[i];
+				families.sample(prefix + "_duration_seconds_bucket", stage_labels + ",le=\"" + prom_seconds(backup_metrics_buckets_us[i]) + "\"", convert(cumulative));
+			}
+			families.sample(prefix + "_duration_seconds_bucket", stage_labels + ",le=\"+Inf\"", convert(stage.count));
+			families.sample(prefix + "_duration_seconds_sum", stage_labels, prom_seconds(stage.sum_us));
+			families.sample(prefix + "_duration_seconds_count", stage_labels, convert(stage.count));
+			families.sample(prefix + "_items_total", stage_labels, convert(stage.items));
+			families.sample(prefix + "_bytes_total", stage_labels, convert(stage.bytes));
+		}
+	}
+
+	void throttle_samples(PromFamilies& families, const std::string& throttle_class, HierarchicalThrottler* throttler)
+	{
+		if (throttler == NULL)
+		{
+			return;
+		}
+
+		HierarchicalThrottler::SStats stats = throttler->getStats();
+		std::string labels = "class=\"" + throttle_class + "\"";
+
+		families.sample("urbackup_throttle_bytes_total", labels, convert(stats.bytes));
+		families.sample("urbackup_throttle_waits_total", labels, convert(stats.waits));
+		families.sample("urbackup_throttle_wait_seconds_total", labels, prom_seconds(stats.wait_ms * 1000));
+		families.sample("urbackup_throttle_limit_bytes_per_second", labels, convert(stats.throttle_bps));
+		families.sample("urbackup_throttle_active_clients", labels, convert(stats.active_children));
+	}
+
+	std::string metrics_token;
+
+	std::string read_metrics_token()
+	{
+		std::string config_fn = Server->getServerParameter("metrics_config");
+		if (config_fn.empty())
+		{
+			return std::string();
+		}
+
+		std::auto_ptr<ISettingsReader> settings(Server->createFileSettingsReader(config_fn));
+		std::string val;
+		if (settings.get() == NULL
+			|| !settings->getValue("METRICS_TOKEN", &val))
+		{
+			return std::string();
+		}
+
+		val = trim(val);
+		if (val.size() >= 2
+			&& (val[0] == '"' || val[0] == '\'')
+			&& val[val.size() - 1] == val[0])
+		{
+			val = val.substr(1, val.size() - 2);
+		}
+
+		return trim(val);
+	}
+
+	bool token_equals(const std::string& a, const std::string& b)
+	{
+		//Takes the same time independent of where the tokens differ
+		unsigned char diff = a.size() == b.size() ? 0 : 1;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			diff |= static_cast<unsigned char>(a[i] ^ (b.empty() ? 0 : b[i % b.size()]));
+		}
+		return diff == 0;
+	}
+
+	bool has_metrics_rights(Helper& helper, str_map& GET, str_map& POST)
+	{
+		if (!metrics_token.empty())
+		{
+			std::string token = GET["token"];
+			if (token.empty())
+			{
+				token = POST["token"];
+			}
+
+			if (token_equals(metrics_token, token))
+			{
+				return true;
+			}
+		}
+
+		SUser *session = helper.getSession();
+		return session != NULL && session->id != SESSION_ID_INVALID
+			&& helper.getRights("status") == RIGHT_ALL;
+	}
+}
+
+void init_metrics_token(void)
+{
+	metrics_token = read_metrics_token();
+}
+
+ACTION_IMPL(metrics)
+{
+	Helper helper(tid, &POST, &PARAMS);
+
+	if (!has_metrics_rights(helper, GET, POST))
+	{
+		JSON::Object ret;
+		ret.set("error", JSON::Value(1));
+		helper.Write(ret.stringify(false));
+		return;
+	}
+
+	PromFamilies families;
+	add_stage_families(families, "urbackup_stage", "all backups");
+	add_stage_families(families, "urbackup_process_stage", "running processes");
+	families.add("urbackup_process_pcdone", "gauge", "Percent done of running processes");
+	families.add("urbackup_process_speed_bytes_per_second", "gauge", "Current speed of running processes");
+	families.add("urbackup_process_hashqueue_size", "gauge", "Files queued for storing of running processes");
+	families.add("urbackup_process_prepare_hashqueue_size", "gauge", "Files queued for hashing of running processes");
+	families.add("urbackup_process_done_bytes", "gauge", "Bytes done of running processes");
+	families.add("urbackup_process_total_bytes", "gauge", "Total bytes of running processes");
+	families.add("urbackup_throttle_bytes_total", "counter", "Bytes transferred through the global throttlers");
+	families.add("urbackup_throttle_waits_total", "counter", "Number of times transfers were throttled by the global throttlers");
+	families.add("urbackup_throttle_wait_seconds_total", "counter", "Time transfers were throttled by the global throttlers");
+	families.add("urbackup_throttle_limit_bytes_per_second", "gauge", "Current limit of the global throttlers (0 if unlimited or relative to the maximum speed)");
+	families.add("urbackup_throttle_active_clients", "gauge", "Clients currently sharing the bandwidth of the global throttlers");
+
+	stage_samples(families, "urbackup_stage", std::string(), BackupMetrics::getServerMetrics());
+	throttle_samples(families, "internet", BackupServer::getGlobalThrottler(true));
+	throttle_samples(families, "local", BackupServer::getGlobalThrottler(false));
+
+	std::vector<SStatus> clients = ServerStatus::getStatus();
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+		for (size_t j = 0; j < clients[i].processes.size(); ++j)
+		{
+			const SProcess& process = clients[i].processes[j];
+
+			std::string labels = "client=\"" + prom_escape(clients[i].client) + "\",process_id=\"" + convert(process.id)
+				+ "\",action=\"" + convert(static_cast<int>(process.action)) + "\"";
+
+			families.sample("urbackup_process_pcdone", labels, convert(process.pcdone));
+			families.sample("urbackup_process_speed_bytes_per_second", labels, convert(process.speed_bpms * 1000));
+			families.sample("urbackup_process_hashqueue_size", labels, convert(process.hashqueuesize));
+			families.sample("urbackup_process_prepare_hashqueue_size", labels, convert(process.prepare_hashqueuesize));
+			families.sample("urbackup_process_done_bytes", labels, convert(process.done_bytes));
+			families.sample("urbackup_process_total_bytes", labels, convert(process.total_bytes));
+
+			SBackupMetrics metrics;
+			if (process.logid != logid_t()
+				&& BackupMetrics::getProcessMetrics(process.logid, metrics))
+			{
+				stage_samples(families, "urbackup_process_stage", labels + ",", metrics);
+			}
+		}
+	}
+
+	Server->setContentType(tid, "text/plain; version=0.0.4");
+	helper.Write(families.str());
+}
+
+#endif //CLIENT_ONLY
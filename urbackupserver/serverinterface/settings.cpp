@@ -155,6 +155,8 @@ JSON::Object getJSONClientSettings(ServerSettings &settings)
 	SET_SETTING(internet_full_image_style);
 	SET_SETTING(create_linked_user_views);
 	SET_SETTING(max_running_jobs_per_client);
+	SET_SETTING(local_file_download_connections);
+	SET_SETTING(throttle_weight);
 	SET_SETTING(cbt_volumes);
 	SET_SETTING(cbt_crash_persistent_volumes);
 	SET_SETTING(ignore_disk_errors);
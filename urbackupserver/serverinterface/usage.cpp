@@ -24,6 +24,7 @@
 #include "../create_files_index.h"
 #include "../dao/ServerFilesDao.h"
 #include "../database.h"
+#include "../FilesDbShards.h"
 #include "../server_status.h"
 
 namespace 
@@ -58,8 +59,7 @@ namespace
 				Server->wait(10000);
 			}
 
-			IDatabase* files_db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
-			ServerFilesDao filesdao(files_db);
+			FilesDaos files_daos;
 			
 			std::auto_ptr<FileIndex> fileindex(create_lmdb_files_index());
 
@@ -77,7 +77,7 @@ namespace
 
 				if(!entries.empty())
 				{
-					ServerFilesDao::SStatFileEntry fentry = filesdao.getStatFileEntry(entries.begin()->second);
+					ServerFilesDao::SStatFileEntry fentry = files_daos.getEntryDao(entries.begin()->second).getStatFileEntry(entries.begin()->second);
 
 					if(fentry.exists)
 					{
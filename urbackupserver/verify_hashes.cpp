@@ -31,10 +31,27 @@
 #include "dao/ServerFilesDao.h"
 #include "FileIndex.h"
 #include "create_files_index.h"
+#include "FilesDbShards.h"
 #include "server_hash.h"
 #include "serverinterface/helper.h"
 #include "server.h"
 #include "../urbackupcommon/TreeHash.h"
+#include "../urbackupcommon/json.h"
+#include "../Interface/ThreadPool.h"
+#include "../Interface/Mutex.h"
+#include "../Interface/Condition.h"
+#include <algorithm>
+#include <deque>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+#if defined(_WIN32) || defined(__APPLE__) || defined(__FreeBSD__)
+#define stat64 stat
+#endif
 
 const _u32 c_read_blocksize=4096;
 const size_t draw_segments=30;
@@ -123,18 +140,45 @@ private:
 	_i64 curr_last;	
 };
 
-bool verify_file(db_single_result &res, _i64 &curr_verified, _i64 verify_size, bool& missing, const std::string& backuppath)
+class ParallelVerifyProgressCallback : public BackupServerPrepareHash::IHashProgressCallback
+{
+public:
+	ParallelVerifyProgressCallback(IMutex* mutex, _i64& curr_verified)
+		: mutex(mutex), curr_verified(curr_verified), curr_last(0)
+	{
+
+	}
+
+	virtual void hash_progress(int64 curr)
+	{
+		int64 add = curr - curr_last;
+		curr_last = curr;
+		IScopedLock lock(mutex);
+		curr_verified += add;
+	}
+
+private:
+	IMutex* mutex;
+	_i64& curr_verified;
+	_i64 curr_last;
+};
+
+bool verify_file(db_single_result &res, BackupServerPrepareHash::IHashProgressCallback* progress_callback, bool& missing, const std::string& backuppath, std::string& errmsg)
 {
 	std::string fp=res["fullpath"];
-	std::auto_ptr<IFsFile> f(Server->openFile(os_file_prefix(fp), MODE_READ));
+	std::auto_ptr<IFsFile> f(Server->openFile(os_file_prefix(fp), MODE_READ_SEQUENTIAL_BACKUP));
 	if( f.get()==NULL )
 	{
-		std::cout << std::endl;
-		Server->Log("Error opening file \""+fp+"\"", LL_ERROR);
+		errmsg = "Error opening file \""+fp+"\"";
 		missing = true;
 		return false;
 	}
 
+#ifdef __linux__
+	//Start reading the file asynchronously while the previous block is being hashed
+	posix_fadvise64(f->getOsHandle(), 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
 	bool in_backup_scripts = false;
 	if (!backuppath.empty())
 	{
@@ -160,21 +204,17 @@ bool verify_file(db_single_result &res, _i64 &curr_verified, _i64 verify_size, b
 
 	if(watoi64(res["filesize"])!=f->Size())
 	{
-		std::cout << std::endl;
-		Server->Log("Filesize of \""+fp+"\" is wrong", LL_ERROR);
+		errmsg = "Filesize of \""+fp+"\" is wrong";
 		return false;
 	}
 
-	std::string f_name=ExtractFileName(fp);
-	
-	VerifyProgressCallback progress_callback(f_name, curr_verified, verify_size);
 	FsExtentIterator extent_iterator(f.get(), 512*1024);
 
 	std::string calc_dig;
 	if (BackupServer::useTreeHashing() && !in_backup_scripts)
 	{
 		TreeHash treehash(NULL);
-		if (BackupServerPrepareHash::hash_sha(f.get(), &extent_iterator, true, treehash, &progress_callback))
+		if (BackupServerPrepareHash::hash_sha(f.get(), &extent_iterator, true, treehash, progress_callback))
 		{
 			calc_dig = treehash.finalize();
 		}
@@ -182,7 +222,7 @@ bool verify_file(db_single_result &res, _i64 &curr_verified, _i64 verify_size, b
 	else
 	{
 		HashSha512 shahash;
-		if (BackupServerPrepareHash::hash_sha(f.get(), &extent_iterator, !in_backup_scripts, shahash, &progress_callback))
+		if (BackupServerPrepareHash::hash_sha(f.get(), &extent_iterator, !in_backup_scripts, shahash, progress_callback))
 		{
 			calc_dig = shahash.finalize();
 		}
@@ -190,21 +230,292 @@ bool verify_file(db_single_result &res, _i64 &curr_verified, _i64 verify_size, b
 
 	if(calc_dig.empty())
 	{
-		std::cout << std::endl;
-		Server->Log("Could not read all bytes of file \""+fp+"\"", LL_ERROR);
+		errmsg = "Could not read all bytes of file \""+fp+"\"";
 		return false;
 	}
 
 	if(res["shahash"]!=calc_dig)
 	{
-		std::cout << std::endl;
-		Server->Log("Hash of \""+fp+"\" is wrong", LL_ERROR);
+		errmsg = "Hash of \""+fp+"\" is wrong";
 		return false;
 	}
 
 	return true;
 }
 
+namespace
+{
+	const size_t verify_batch_size = 10000;
+
+	struct SVerifyItem
+	{
+		db_single_result res;
+		std::string backuppath;
+		int64 dev;
+		int64 inode;
+
+		bool operator<(const SVerifyItem& other) const
+		{
+			if (dev != other.dev)
+				return dev < other.dev;
+			return inode < other.inode;
+		}
+	};
+
+	struct SVerifyResult
+	{
+		SVerifyResult(db_single_result res, bool missing, std::string errmsg)
+			: res(res), missing(missing), errmsg(errmsg)
+		{}
+
+		db_single_result res;
+		bool missing;
+		std::string errmsg;
+	};
+
+	/**
+	* Hashes files from a shared queue with multiple worker threads.
+	* Each worker uses its own hash context and reports progress into
+	* a shared byte counter. Failures are collected and printed by the
+	* thread waiting in waitForQueue, together with the progress bar.
+	*/
+	class ParallelVerify
+	{
+	public:
+		ParallelVerify(size_t n_threads)
+			: mutex(Server->createMutex()), work_cond(Server->createCondition()),
+			done_cond(Server->createCondition()), do_stop(false), working(0),
+			curr_verified(0), verified_files(0), failed_logged(0)
+		{
+			for (size_t i = 0; i < n_threads; ++i)
+			{
+				workers.push_back(new Worker(this));
+				tickets.push_back(Server->getThreadPool()->execute(workers[i], "verify hashes"));
+			}
+		}
+
+		~ParallelVerify()
+		{
+			{
+				IScopedLock lock(mutex);
+				do_stop = true;
+				work_cond->notify_all();
+			}
+
+			Server->getThreadPool()->waitFor(tickets);
+
+			for (size_t i = 0; i < workers.size(); ++i)
+			{
+				delete workers[i];
+			}
+
+			Server->destroy(mutex);
+			Server->destroy(work_cond);
+			Server->destroy(done_cond);
+		}
+
+		void addBatch(std::vector<SVerifyItem>& items)
+		{
+			IScopedLock lock(mutex);
+			queue.insert(queue.end(), items.begin(), items.end());
+			work_cond->notify_all();
+		}
+
+		void waitForQueue(size_t max_queue, _i64 verify_size)
+		{
+			IScopedLock lock(mutex);
+			while (queue.size() > max_queue
+				|| (max_queue == 0 && working > 0))
+			{
+				done_cond->wait(&lock, 1000);
+
+				logFailures(lock);
+
+				std::string curr_fn = last_fn;
+				_i64 verified = curr_verified;
+				lock.relock(NULL);
+				draw_progress(curr_fn, verified, verify_size);
+				lock.relock(mutex);
+			}
+
+			logFailures(lock);
+		}
+
+		std::vector<SVerifyResult> getFailed()
+		{
+			IScopedLock lock(mutex);
+			return failed;
+		}
+
+		_i64 getVerifiedBytes()
+		{
+			IScopedLock lock(mutex);
+			return curr_verified;
+		}
+
+		int64 getVerifiedFiles()
+		{
+			IScopedLock lock(mutex);
+			return verified_files;
+		}
+
+	private:
+		class Worker : public IThread
+		{
+		public:
+			Worker(ParallelVerify* parallel_verify)
+				: parallel_verify(parallel_verify)
+			{}
+
+			void operator()()
+			{
+				parallel_verify->workerRun();
+			}
+
+		private:
+			ParallelVerify* parallel_verify;
+		};
+
+		void logFailures(IScopedLock& lock)
+		{
+			std::vector<std::string> new_errors;
+			for (; failed_logged < failed.size(); ++failed_logged)
+			{
+				new_errors.push_back(failed[failed_logged].errmsg);
+			}
+
+			if (new_errors.empty())
+			{
+				return;
+			}
+
+			lock.relock(NULL);
+			//End the progress bar line
+			std::cout << std::endl;
+			for (size_t i = 0; i < new_errors.size(); ++i)
+			{
+				Server->Log(new_errors[i], LL_ERROR);
+			}
+			lock.relock(mutex);
+		}
+
+		void workerRun()
+		{
+			IScopedLock lock(mutex);
+			while (true)
+			{
+				while (queue.empty() && !do_stop)
+				{
+					work_cond->wait(&lock);
+				}
+
+				if (do_stop)
+				{
+					break;
+				}
+
+				SVerifyItem item = queue.front();
+				queue.pop_front();
+				++working;
+				last_fn = ExtractFileName(item.res["fullpath"]);
+
+				lock.relock(NULL);
+
+				ParallelVerifyProgressCallback progress_callback(mutex, curr_verified);
+				bool missing = false;
+				std::string errmsg;
+				bool ok = verify_file(item.res, &progress_callback, missing, item.backuppath, errmsg);
+
+				lock.relock(mutex);
+
+				--working;
+				++verified_files;
+				if (!ok)
+				{
+					failed.push_back(SVerifyResult(item.res, missing, errmsg));
+				}
+				done_cond->notify_all();
+			}
+		}
+
+		IMutex* mutex;
+		ICondition* work_cond;
+		ICondition* done_cond;
+		std::deque<SVerifyItem> queue;
+		std::vector<Worker*> workers;
+		std::vector<THREADPOOL_TICKET> tickets;
+		bool do_stop;
+		size_t working;
+		_i64 curr_verified;
+		int64 verified_files;
+		std::string last_fn;
+		std::vector<SVerifyResult> failed;
+		size_t failed_logged;
+	};
+
+#ifndef _WIN32
+	class StatWorker : public IThread
+	{
+	public:
+		StatWorker(std::vector<SVerifyItem>& items, size_t begin, size_t end)
+			: items(items), begin(begin), end(end)
+		{}
+
+		void operator()()
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				struct stat64 f_info;
+				if (stat64(os_file_prefix(items[i].res["fullpath"]).c_str(), &f_info) == 0)
+				{
+					items[i].dev = f_info.st_dev;
+					items[i].inode = f_info.st_ino;
+				}
+			}
+		}
+
+	private:
+		std::vector<SVerifyItem>& items;
+		size_t begin;
+		size_t end;
+	};
+#endif
+
+	void sort_by_location(std::vector<SVerifyItem>& items, size_t n_threads)
+	{
+#ifndef _WIN32
+		//Stat the files with multiple threads. Each thread gets its own range of items
+		size_t per_thread = (items.size() + n_threads - 1) / n_threads;
+		std::vector<StatWorker*> stat_workers;
+		std::vector<THREADPOOL_TICKET> stat_tickets;
+		for (size_t begin = 0; begin < items.size(); begin += per_thread)
+		{
+			stat_workers.push_back(new StatWorker(items, begin, (std::min)(items.size(), begin + per_thread)));
+			stat_tickets.push_back(Server->getThreadPool()->execute(stat_workers.back(), "verify stat"));
+		}
+
+		Server->getThreadPool()->waitFor(stat_tickets);
+
+		for (size_t i = 0; i < stat_workers.size(); ++i)
+		{
+			delete stat_workers[i];
+		}
+
+		std::sort(items.begin(), items.end());
+#endif
+	}
+
+	JSON::Object file_result_obj(db_single_result& res)
+	{
+		JSON::Object ret;
+		ret.set("id", watoi64(res["id"]));
+		ret.set("backupid", watoi(res["backupid"]));
+		ret.set("path", res["fullpath"]);
+		ret.set("filesize", watoi64(res["filesize"]));
+		return ret;
+	}
+}
+
 bool verify_hashes(std::string arg)
 {
 	IDatabase *db=Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER);
@@ -238,12 +549,19 @@ bool verify_hashes(std::string arg)
 	}
 
 	bool delete_failed = Server->getServerParameter("delete_verify_failed")=="true";
+	size_t verify_threads = (std::max)(1, watoi(Server->getServerParameter("verify_threads", "4")));
+	int sample_pc = (std::min)(100, (std::max)(1, watoi(Server->getServerParameter("verify_sample", "100"))));
+	int min_backupid = watoi(Server->getServerParameter("verify_min_backupid", "0"));
+	std::string report_fn = Server->getServerParameter("verify_report");
+	int64 starttime = Server->getTimeMS();
+	JSON::Array report_failed;
+	JSON::Array report_missing;
 
 	int cid=0;
 	int backupid=0;
 	std::string filter;
 
-	IDatabase *files_db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
+	std::vector<IDatabase*> files_dbs;
 
 	if(!clientname.empty())
 	{
@@ -263,10 +581,15 @@ bool verify_hashes(std::string arg)
 			}
 
 			filter="clientid="+convert(cid);
+			files_dbs.push_back(Server->getDatabase(Server->getThreadID(), FilesDbShards::getClientDatabaseId(cid)));
 		}
 		else
 		{
 			filter+="1=1";
+			for (size_t i = 0; i < FilesDbShards::getNumDatabases(); ++i)
+			{
+				files_dbs.push_back(Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(i)));
+			}
 		}
 		
 
@@ -329,93 +652,176 @@ bool verify_hashes(std::string arg)
 
 			if (!temp_create_query.empty())
 			{
-				files_db->Write("CREATE TEMPORARY TABLE backups (id INTEGER PRIMARY KEY)");
-
-				IQuery* q_insert = files_db->Prepare("INSERT INTO backups (id) VALUES (?)", false);
+				std::vector<int> backupids;
 				IQuery* q_backup_ids = db->Prepare(temp_create_query, false);
 				IDatabaseCursor* cur = q_backup_ids->Cursor();
 
 				db_single_result res;
 				while (cur->next(res))
 				{
-					q_insert->Bind(res["id"]);
-					q_insert->Write();
-					q_insert->Reset();
+					backupids.push_back(watoi(res["id"]));
 				}
 
 				db->destroyQuery(q_backup_ids);
-				files_db->destroyQuery(q_insert);
+
+				for (size_t i = 0; i < files_dbs.size(); ++i)
+				{
+					files_dbs[i]->Write("CREATE TEMPORARY TABLE backups (id INTEGER PRIMARY KEY)");
+
+					IQuery* q_insert = files_dbs[i]->Prepare("INSERT INTO backups (id) VALUES (?)", false);
+					for (size_t j = 0; j < backupids.size(); ++j)
+					{
+						q_insert->Bind(backupids[j]);
+						q_insert->Write();
+						q_insert->Reset();
+					}
+					files_dbs[i]->destroyQuery(q_insert);
+				}
 			}
 		}
 	}
 
+	if (files_dbs.empty())
+	{
+		for (size_t i = 0; i < FilesDbShards::getNumDatabases(); ++i)
+		{
+			files_dbs.push_back(Server->getDatabase(Server->getThreadID(), FilesDbShards::getDatabaseId(i)));
+		}
+	}
 	
-	std::cout << "Calculating filesize..." << std::endl;
-	IQuery *q_num_files = files_db->Prepare("SELECT SUM(filesize) AS c FROM files WHERE filesize>0 AND "+filter);
-	db_results res=q_num_files->Read();
-	if(res.empty())
+	if (filter.empty())
 	{
-		Server->Log("Error during filesize calculation.", LL_ERROR);
-		return false;
+		filter = "1=1";
+	}
+
+	if (min_backupid > 0)
+	{
+		filter += " AND backupid > " + convert(min_backupid);
 	}
 
-	_i64 verify_size=watoi64(res[0]["c"]);
+	std::cout << "Calculating filesize..." << std::endl;
+	_i64 verify_size=0;
+	for (size_t i = 0; i < files_dbs.size(); ++i)
+	{
+		IQuery *q_num_files = files_dbs[i]->Prepare("SELECT SUM(filesize) AS c FROM files WHERE filesize>0 AND "+filter);
+		db_results res=q_num_files->Read();
+		if(res.empty())
+		{
+			Server->Log("Error during filesize calculation.", LL_ERROR);
+			return false;
+		}
+
+		verify_size+=watoi64(res[0]["c"]);
+	}
 	_i64 curr_verified=0;
 
-	std::cout << "To be verified: " << PrettyPrintBytes(verify_size) << " of files" << std::endl;
+	if (sample_pc < 100)
+	{
+		verify_size = (verify_size*sample_pc) / 100;
+		std::cout << "Verifying a random sample of " << sample_pc << "% of files" << std::endl;
+	}
 
-	_i64 crowid=0;
+	std::cout << "To be verified: " << PrettyPrintBytes(verify_size) << " of files using " << verify_threads << " threads" << std::endl;
 
-	IQuery *q_get_files = files_db->Prepare("SELECT id, fullpath, shahash, filesize, backupid FROM files WHERE "+filter, false);
 	IQuery* q_get_backuppath = db->Prepare("SELECT path FROM backups WHERE id=?", false);
 
 	bool is_okay=true;
 
-	IDatabaseCursor* cursor = q_get_files->Cursor();
-
 	std::vector<int64> todelete;
 	std::vector<int64> missing_files;
 	std::map<int, std::string> backuppaths;
 
+	std::auto_ptr<ParallelVerify> parallel_verify(new ParallelVerify(verify_threads));
+	std::vector<SVerifyItem> batch;
+	int64 sampled_out = 0;
+
 	db_single_result res_single;
-	while(cursor->next(res_single))
+	for (size_t db_idx = 0; db_idx < files_dbs.size(); ++db_idx)
 	{
-		int backupid = watoi(res_single["backupid"]);
-		std::string backuppath;
-		std::map<int, std::string>::iterator it_backuppath = backuppaths.find(backupid);
-		if (it_backuppath == backuppaths.end())
-		{
-			q_get_backuppath->Bind(backupid);
-			db_results res_backuppath = q_get_backuppath->Read();
-			q_get_backuppath->Reset();
-			if (!res_backuppath.empty())
-			{
-				backuppath = res_backuppath[0]["path"];
-				backuppaths.insert(std::make_pair(backupid, backuppath));
-			}
-		}
-		else
-		{
-			backuppath = it_backuppath->second;
-		}
+		IDatabase* files_db = files_dbs[db_idx];
+		IQuery *q_get_files = files_db->Prepare("SELECT id, fullpath, shahash, filesize, backupid FROM files WHERE "+filter, false);
+		IDatabaseCursor* cursor = q_get_files->Cursor();
 
-		bool is_missing=false;
-		if(! verify_file( res_single, curr_verified, verify_size, is_missing, backuppath) )
+		bool has_next = true;
+		while(has_next)
 		{
-			if(!is_missing)
+			has_next = cursor->next(res_single);
+
+			if (has_next)
 			{
-				v_failure << "Verification of \"" << (res_single["fullpath"]) << "\" failed\r\n";
-				is_okay=false;
+				if (sample_pc < 100
+					&& Server->getRandomNumber() % 10000 >= static_cast<unsigned int>(sample_pc * 100))
+				{
+					++sampled_out;
+					continue;
+				}
 
-				if(delete_failed)
+				int backupid = watoi(res_single["backupid"]);
+				std::string backuppath;
+				std::map<int, std::string>::iterator it_backuppath = backuppaths.find(backupid);
+				if (it_backuppath == backuppaths.end())
 				{
-					todelete.push_back(watoi64(res_single["id"]));
+					q_get_backuppath->Bind(backupid);
+					db_results res_backuppath = q_get_backuppath->Read();
+					q_get_backuppath->Reset();
+					if (!res_backuppath.empty())
+					{
+						backuppath = res_backuppath[0]["path"];
+						backuppaths.insert(std::make_pair(backupid, backuppath));
+					}
 				}
+				else
+				{
+					backuppath = it_backuppath->second;
+				}
+
+				SVerifyItem item;
+				item.res = res_single;
+				item.backuppath = backuppath;
+				item.dev = 0;
+				item.inode = 0;
+				batch.push_back(item);
 			}
-			else
+
+			if (batch.size() >= verify_batch_size
+				|| (!has_next && !batch.empty()) )
+			{
+				sort_by_location(batch, verify_threads);
+
+				//Read and sort the next batch while the workers are busy with this one
+				parallel_verify->waitForQueue(verify_threads, verify_size);
+				parallel_verify->addBatch(batch);
+				batch.clear();
+			}
+		}
+
+		files_db->destroyQuery(q_get_files);
+	}
+
+	parallel_verify->waitForQueue(0, verify_size);
+
+	std::vector<SVerifyResult> failed = parallel_verify->getFailed();
+	curr_verified = parallel_verify->getVerifiedBytes();
+	int64 verified_files = parallel_verify->getVerifiedFiles();
+	parallel_verify.reset();
+
+	for (size_t i = 0; i < failed.size(); ++i)
+	{
+		if(!failed[i].missing)
+		{
+			v_failure << "Verification of \"" << (failed[i].res["fullpath"]) << "\" failed\r\n";
+			is_okay=false;
+
+			if(delete_failed)
 			{
-				missing_files.push_back(watoi64(res_single["id"]));
-			}			
+				todelete.push_back(watoi64(failed[i].res["id"]));
+			}
+
+			report_failed.add(file_result_obj(failed[i].res));
+		}
+		else
+		{
+			missing_files.push_back(watoi64(failed[i].res["id"]));
 		}
 	}
 
@@ -427,17 +833,16 @@ bool verify_hashes(std::string arg)
 		Server->deleteFile(v_output_fn);
 	}
 
-	files_db->destroyQuery(q_get_files);
 	db->destroyQuery(q_get_backuppath);
 
-	IQuery* q_get_file = files_db->Prepare("SELECT id, fullpath, shahash, filesize, backupid FROM files WHERE id=?");
-
 	if (missing_files.size() > 0)
 	{
 		std::cout << missing_files.size() << " could not be opened during verification. Checking now if they have been deleted from the database..." << std::endl;
 
 		for (size_t i = 0; i < missing_files.size(); ++i)
 		{
+			IDatabase* files_db = Server->getDatabase(Server->getThreadID(), FilesDbShards::getEntryDatabaseId(missing_files[i]));
+			IQuery* q_get_file = files_db->Prepare("SELECT id, fullpath, shahash, filesize, backupid FROM files WHERE id=?");
 			q_get_file->Bind(missing_files[i]);
 			db_results res = q_get_file->Read();
 			q_get_file->Reset();
@@ -445,12 +850,26 @@ bool verify_hashes(std::string arg)
 			if (!res.empty())
 			{
 				bool is_missing = false;
+				std::string errmsg;
 				db_single_result& res_single = res[0];
-				if (!verify_file(res_single, curr_verified, verify_size, is_missing, backuppaths[watoi(res_single["backupid"])]))
+				VerifyProgressCallback progress_callback(ExtractFileName(res_single["fullpath"]), curr_verified, verify_size);
+				if (!verify_file(res_single, &progress_callback, is_missing, backuppaths[watoi(res_single["backupid"])], errmsg))
 				{
+					std::cout << std::endl;
+					Server->Log(errmsg, LL_ERROR);
+
 					v_failure << "Verification of file \"" << (res_single["fullpath"]) << "\" failed (during rechecking previously missing files)\r\n";
 					is_okay = false;
 
+					if (is_missing)
+					{
+						report_missing.add(file_result_obj(res_single));
+					}
+					else
+					{
+						report_failed.add(file_result_obj(res_single));
+					}
+
 					if (delete_failed)
 					{
 						todelete.push_back(watoi64(res_single["id"]));
@@ -460,6 +879,33 @@ bool verify_hashes(std::string arg)
 		}
 	}
 
+	if (!report_fn.empty())
+	{
+		JSON::Object report;
+		report.set("ok", is_okay);
+		report.set("filter", filter);
+		report.set("threads", static_cast<int>(verify_threads));
+		report.set("sample_pc", sample_pc);
+		report.set("verified_files", verified_files);
+		report.set("sampled_out_files", sampled_out);
+		report.set("verified_bytes", curr_verified);
+		report.set("duration_ms", Server->getTimeMS() - starttime);
+		report.set("failed", report_failed);
+		report.set("missing", report_missing);
+
+		std::string report_data = report.stringify(false);
+		std::auto_ptr<IFile> report_f(Server->openFile(report_fn, MODE_WRITE));
+		if (report_f.get() == NULL
+			|| report_f->Write(report_data) != report_data.size())
+		{
+			Server->Log("Error writing verification report to \"" + report_fn + "\". " + os_last_error_str(), LL_ERROR);
+		}
+		else
+		{
+			Server->Log("Wrote verification report to \"" + report_fn + "\"", LL_INFO);
+		}
+	}
+
 	if(delete_failed)
 	{
 		std::cout << "Deleting " << todelete.size() << " file entries with failed verification from database..." << std::endl;
@@ -471,8 +917,7 @@ bool verify_hashes(std::string arg)
 		}
 		else
 		{
-			files_db = Server->getDatabase(Server->getThreadID(), URBACKUPDB_SERVER_FILES);
-			ServerFilesDao backupdao(files_db);
+			FilesDaos files_daos;
 			std::auto_ptr<FileIndex> fileindex(create_lmdb_files_index());
 
 			if(fileindex.get()==NULL)
@@ -484,7 +929,7 @@ bool verify_hashes(std::string arg)
 
 				for(size_t i=0;i<todelete.size();++i)
 				{
-					BackupServerHash::deleteFileSQL(backupdao, *fileindex, todelete[i]);
+					BackupServerHash::deleteFileSQL(files_daos.getEntryDao(todelete[i]), *fileindex, todelete[i]);
 				}
 
 				std::cout << "done." << std::endl;
@@ -494,4 +939,4 @@ bool verify_hashes(std::string arg)
 	
 
 	return is_okay;
-}
\ No newline at end of file
+}
\ No newline at end of file